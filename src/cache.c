@@ -0,0 +1,520 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <pthread.h>
+// Result cache of idempotent commands.
+// The key is the exact bytes of argv, input, output options, the selected environment variables,
+// the working directory and the attributes the command runs under (limits, scheduling),
+// hashed with FNV-1a for the bucket, and compared as a whole, so a hash collision never returns a wrong result.
+// Commands run in a container bypass the cache, as their executable and files are not the host's,
+// and so do the ones asking for perf counters or cgroup accounting, which only a real run can give.
+// An entry is valid until its TTL expires, or the executable changes (inode, size or mtime).
+// Identical requests in flight are coalesced, the followers wait for the leader's result.
+#define CTH_CACHE_BUCKETS 256
+struct cth_cache_entry {
+	uint64_t hash;
+	char *key;
+	size_t key_len;
+	// Still running in the leader.
+	bool pending;
+	uint64_t created_ms;
+	// The executable the result came from.
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	// The cached result.
+	int exit_code;
+	char *stdout_ret;
+	char *stderr_ret;
+	// Length of stdout_ret/stderr_ret, the output may contain NUL bytes.
+	size_t stdout_len;
+	size_t stderr_len;
+	uint64_t stdout_total;
+	uint64_t stderr_total;
+	uint64_t time_used_ms;
+	bool has_digest;
+	struct cth_digest digest[3];
+	struct cth_cache_entry *next;
+};
+struct cth_cache {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t ttl_ms;
+	char **env_keys;
+	size_t env_count;
+	struct cth_cache_entry *buckets[CTH_CACHE_BUCKETS];
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t coalesced;
+};
+// Growable byte buffer for the key.
+struct cth_key {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool failed;
+};
+static void cth_key_put(struct cth_key *key, const void *data, size_t len)
+{
+	/*
+	 * Append data to the key, key->failed is set on allocation failure.
+	 */
+	if (key->failed) {
+		return;
+	}
+	if (key->len + len > key->size) {
+		size_t size = key->size > 0 ? key->size : 256;
+		while (key->len + len > size) {
+			size *= 2;
+		}
+		char *buf = realloc(key->buf, size);
+		if (buf == NULL) {
+			key->failed = true;
+			return;
+		}
+		key->buf = buf;
+		key->size = size;
+	}
+	memcpy(key->buf + key->len, data, len);
+	key->len += len;
+}
+static void cth_key_put_str(struct cth_key *key, const char *str)
+{
+	/*
+	 * Append a length-prefixed string, NULL is different from "".
+	 */
+	uint64_t len = str != NULL ? strlen(str) : UINT64_MAX;
+	cth_key_put(key, &len, sizeof(len));
+	if (str != NULL) {
+		cth_key_put(key, str, (size_t)len);
+	}
+}
+static void cth_key_build(struct cth_key *key, const struct cth_cache *cache, char **argv, const char *input, bool get_output, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Serialize everything that affects the result into key.
+	 */
+	for (size_t i = 0; argv[i] != NULL; i++) {
+		cth_key_put_str(key, argv[i]);
+	}
+	cth_key_put_str(key, NULL);
+	cth_key_put_str(key, input);
+	int capture_mode = get_output ? attr->capture_mode : -1;
+	cth_key_put(key, &capture_mode, sizeof(capture_mode));
+	if (capture_mode == CTH_CAPTURE_TAIL) {
+		cth_key_put(key, &attr->tail_bytes, sizeof(attr->tail_bytes));
+		cth_key_put(key, &attr->tail_lines, sizeof(attr->tail_lines));
+	}
+	cth_key_put(key, &attr->max_output, sizeof(attr->max_output));
+	cth_key_put(key, &attr->hash, sizeof(attr->hash));
+	// The executable found by execvp() depends on PATH.
+	if (strchr(argv[0], '/') == NULL) {
+		cth_key_put_str(key, getenv("PATH"));
+	}
+	for (size_t i = 0; i < cache->env_count; i++) {
+		cth_key_put_str(key, getenv(cache->env_keys[i]));
+	}
+	// The environment overlay.
+	if (attr->env != NULL) {
+		cth_key_put(key, &attr->env->clear, sizeof(attr->env->clear));
+		for (size_t i = 0; i < attr->env->count; i++) {
+			cth_key_put_str(key, attr->env->keys[i]);
+			cth_key_put_str(key, attr->env->values[i]);
+		}
+	}
+	// Relative paths in argv and the files the command reads depend on the working directory.
+	char cwd[PATH_MAX];
+	cth_key_put_str(key, getcwd(cwd, sizeof(cwd)));
+	// The limits and the scheduling of the child, a command may behave differently under them.
+	// The cgroup limits are not here, commands in a cgroup bypass the cache.
+	cth_key_put(key, &attr->timeout_ms, sizeof(attr->timeout_ms));
+	size_t affinity_size = attr->cpu_affinity == NULL ? 0 : attr->cpu_affinity_size > 0 ? attr->cpu_affinity_size : sizeof(cpu_set_t);
+	cth_key_put(key, &affinity_size, sizeof(affinity_size));
+	if (affinity_size > 0) {
+		cth_key_put(key, attr->cpu_affinity, affinity_size);
+	}
+	cth_key_put(key, &attr->numa_policy, sizeof(attr->numa_policy));
+	cth_key_put(key, &attr->numa_nodes, sizeof(attr->numa_nodes));
+	cth_key_put(key, &attr->nice, sizeof(attr->nice));
+	cth_key_put(key, &attr->ioprio_class, sizeof(attr->ioprio_class));
+	cth_key_put(key, &attr->ioprio_level, sizeof(attr->ioprio_level));
+	cth_key_put(key, &attr->sched_policy, sizeof(attr->sched_policy));
+	cth_key_put(key, &attr->sched_priority, sizeof(attr->sched_priority));
+	cth_key_put(key, &attr->rlimit_count, sizeof(attr->rlimit_count));
+	for (size_t i = 0; i < attr->rlimit_count; i++) {
+		cth_key_put(key, &attr->rlimits[i].resource, sizeof(attr->rlimits[i].resource));
+		cth_key_put(key, &attr->rlimits[i].limit, sizeof(attr->rlimits[i].limit));
+	}
+}
+static uint64_t cth_fnv1a(const char *buf, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+static int cth_cache_stat_exe(const char *file, struct stat *st)
+{
+	/*
+	 * Find the executable like execvp() does, and stat() it.
+	 * Returns 0 on success, -1 if not found.
+	 */
+	if (strchr(file, '/') != NULL) {
+		return stat(file, st);
+	}
+	const char *path = getenv("PATH");
+	if (path == NULL) {
+		path = "/bin:/usr/bin";
+	}
+	char full[PATH_MAX];
+	while (true) {
+		const char *end = strchr(path, ':');
+		size_t dir_len = end != NULL ? (size_t)(end - path) : strlen(path);
+		// An empty entry means the current directory.
+		int n = dir_len > 0 ? snprintf(full, sizeof(full), "%.*s/%s", (int)dir_len, path, file) : snprintf(full, sizeof(full), "%s", file);
+		if (n > 0 && (size_t)n < sizeof(full) && stat(full, st) == 0 && S_ISREG(st->st_mode) && access(full, X_OK) == 0) {
+			return 0;
+		}
+		if (end == NULL) {
+			return -1;
+		}
+		path = end + 1;
+	}
+}
+static bool cth_cache_valid(const struct cth_cache *cache, const struct cth_cache_entry *entry, const struct stat *st)
+{
+	/*
+	 * Check the TTL and the executable of a finished entry.
+	 */
+	if (cache->ttl_ms > 0 && cth_now_ms() - entry->created_ms >= cache->ttl_ms) {
+		return false;
+	}
+	return st->st_dev == entry->dev && st->st_ino == entry->ino && st->st_size == entry->size && st->st_mtim.tv_sec == entry->mtime.tv_sec && st->st_mtim.tv_nsec == entry->mtime.tv_nsec;
+}
+static void cth_cache_free_entry(struct cth_cache_entry *entry)
+{
+	free(entry->key);
+	free(entry->stdout_ret);
+	free(entry->stderr_ret);
+	free(entry);
+}
+static void cth_cache_unlink(struct cth_cache *cache, struct cth_cache_entry *entry)
+{
+	/*
+	 * Remove entry from its bucket, with cache->lock held.
+	 */
+	struct cth_cache_entry **p = &cache->buckets[entry->hash % CTH_CACHE_BUCKETS];
+	while (*p != NULL && *p != entry) {
+		p = &(*p)->next;
+	}
+	if (*p != NULL) {
+		*p = entry->next;
+	}
+}
+static struct cth_cache_entry *cth_cache_find(const struct cth_cache *cache, uint64_t hash, const struct cth_key *key)
+{
+	/*
+	 * Find the entry of key, with cache->lock held.
+	 */
+	for (struct cth_cache_entry *entry = cache->buckets[hash % CTH_CACHE_BUCKETS]; entry != NULL; entry = entry->next) {
+		if (entry->hash == hash && entry->key_len == key->len && memcmp(entry->key, key->buf, key->len) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+static char *cth_cache_dup(const char *buf, size_t len)
+{
+	/*
+	 * Copy len bytes of buf with a trailing NUL, like the captured output.
+	 * Returns NULL on failure.
+	 */
+	char *dup = malloc(len + 1);
+	if (dup == NULL) {
+		return NULL;
+	}
+	memcpy(dup, buf, len);
+	dup[len] = 0;
+	return dup;
+}
+static struct cth_result *cth_cache_result(const struct cth_cache_entry *entry)
+{
+	/*
+	 * Make a new result from a finished entry, with cache->lock held.
+	 * Returns NULL on failure.
+	 */
+	struct cth_result *res = cth_new();
+	if (res == NULL) {
+		return NULL;
+	}
+	res->exited = true;
+	res->exit_code = entry->exit_code;
+	res->stdout_total = entry->stdout_total;
+	res->stderr_total = entry->stderr_total;
+	res->stdout_len = entry->stdout_len;
+	res->stderr_len = entry->stderr_len;
+	res->time_used_ms = entry->time_used_ms;
+	res->time_used = entry->time_used_ms * 1000;
+	res->cached = true;
+	if (entry->has_digest && (res->digest = malloc(sizeof(entry->digest))) != NULL) {
+		memcpy(res->digest, entry->digest, sizeof(entry->digest));
+	}
+	if (entry->stdout_ret != NULL) {
+		res->stdout_ret = cth_cache_dup(entry->stdout_ret, entry->stdout_len);
+	}
+	if (entry->stderr_ret != NULL) {
+		res->stderr_ret = cth_cache_dup(entry->stderr_ret, entry->stderr_len);
+	}
+	if ((entry->stdout_ret != NULL && res->stdout_ret == NULL) || (entry->stderr_ret != NULL && res->stderr_ret == NULL)) {
+		cth_free_result(&res);
+		return NULL;
+	}
+	return res;
+}
+static void cth_cache_fill(struct cth_cache_entry *entry, const struct cth_result *res, const struct stat *st)
+{
+	/*
+	 * Store the result of the leader into entry.
+	 */
+	entry->created_ms = cth_now_ms();
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->exit_code = res->exit_code;
+	entry->stdout_len = res->stdout_ret != NULL ? (size_t)res->stdout_len : 0;
+	entry->stderr_len = res->stderr_ret != NULL ? (size_t)res->stderr_len : 0;
+	entry->stdout_ret = res->stdout_ret != NULL ? cth_cache_dup(res->stdout_ret, entry->stdout_len) : NULL;
+	entry->stderr_ret = res->stderr_ret != NULL ? cth_cache_dup(res->stderr_ret, entry->stderr_len) : NULL;
+	entry->stdout_total = res->stdout_total;
+	entry->stderr_total = res->stderr_total;
+	entry->time_used_ms = res->time_used_ms;
+	entry->has_digest = res->digest != NULL;
+	if (entry->has_digest) {
+		memcpy(entry->digest, res->digest, sizeof(entry->digest));
+	}
+}
+struct cth_result *cth_cache_exec(struct cth_cache *cache, char **argv, char *input, bool get_output, const struct cth_exec_attr *attr, struct cth_result *(*exec)(char **, char *, bool, const struct cth_exec_attr *))
+{
+	/*
+	 * Run the command through the cache, exec is the real blocking exec function.
+	 * Only normally exited results are cached, timeouts and signals are not.
+	 * A hit does not fork at all.
+	 * Commands run in a container, or with perf_stat or cgroup_stat wanted, bypass the cache.
+	 */
+	if (attr->container != NULL) {
+		// The executable is looked up in the container, the host PATH and inodes say nothing about it.
+		return exec(argv, input, get_output, attr);
+	}
+	if (attr->perf_events != 0 || attr->cgroup_path != NULL || attr->cgroup_parent != NULL) {
+		// A hit has no counters or cgroup accounting of its own.
+		return exec(argv, input, get_output, attr);
+	}
+	struct cth_key key = { NULL, 0, 0, false };
+	cth_key_build(&key, cache, argv, input, get_output, attr);
+	struct stat st;
+	if (key.failed || cth_cache_stat_exe(argv[0], &st) < 0) {
+		// Not cacheable, let exec() report the error.
+		free(key.buf);
+		return exec(argv, input, get_output, attr);
+	}
+	uint64_t hash = cth_fnv1a(key.buf, key.len);
+	pthread_mutex_lock(&cache->lock);
+	struct cth_cache_entry *entry;
+	bool waited = false;
+	while ((entry = cth_cache_find(cache, hash, &key)) != NULL) {
+		if (entry->pending) {
+			// The same command is running in another thread, wait for it.
+			waited = true;
+			pthread_cond_wait(&cache->cond, &cache->lock);
+			continue;
+		}
+		if (cth_cache_valid(cache, entry, &st)) {
+			struct cth_result *res = cth_cache_result(entry);
+			if (waited) {
+				cache->coalesced++;
+			} else {
+				cache->hits++;
+			}
+			pthread_mutex_unlock(&cache->lock);
+			free(key.buf);
+			return res;
+		}
+		// Expired, or the executable changed.
+		cth_cache_unlink(cache, entry);
+		cth_cache_free_entry(entry);
+	}
+	// Miss, we are the leader.
+	cache->misses++;
+	entry = calloc(1, sizeof(struct cth_cache_entry));
+	if (entry == NULL) {
+		pthread_mutex_unlock(&cache->lock);
+		free(key.buf);
+		return exec(argv, input, get_output, attr);
+	}
+	entry->hash = hash;
+	entry->key = key.buf;
+	entry->key_len = key.len;
+	entry->pending = true;
+	entry->next = cache->buckets[hash % CTH_CACHE_BUCKETS];
+	cache->buckets[hash % CTH_CACHE_BUCKETS] = entry;
+	pthread_mutex_unlock(&cache->lock);
+	struct cth_result *res = exec(argv, input, get_output, attr);
+	pthread_mutex_lock(&cache->lock);
+	if (res != NULL && res->exited && !res->timed_out && res->term_signal == 0) {
+		cth_cache_fill(entry, res, &st);
+		entry->pending = false;
+	} else {
+		// The followers will try by themselves.
+		cth_cache_unlink(cache, entry);
+		cth_cache_free_entry(entry);
+	}
+	pthread_cond_broadcast(&cache->cond);
+	pthread_mutex_unlock(&cache->lock);
+	return res;
+}
+// API function.
+struct cth_cache *cth_new_cache(uint64_t ttl_ms)
+{
+	/*
+	 * Allocate a new result cache, set it to attr->cache to use it.
+	 * ttl_ms: Lifetime of the entries, 0 means until the executable changes.
+	 * Returns NULL on failure.
+	 * The caller is responsible for freeing it using cth_free_cache().
+	 */
+	struct cth_cache *cache = calloc(1, sizeof(struct cth_cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+	cache->ttl_ms = ttl_ms;
+	return cache;
+}
+// API function.
+int cth_cache_add_env(struct cth_cache *cache, const char *key)
+{
+	/*
+	 * Make the value of environment variable key a part of the cache key.
+	 * Call it before the cache is used.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (cache == NULL || key == NULL) {
+		return -1;
+	}
+	char *dup = strdup(key);
+	if (dup == NULL) {
+		return -1;
+	}
+	pthread_mutex_lock(&cache->lock);
+	char **keys = realloc(cache->env_keys, sizeof(char *) * (cache->env_count + 1));
+	if (keys == NULL) {
+		pthread_mutex_unlock(&cache->lock);
+		free(dup);
+		return -1;
+	}
+	keys[cache->env_count++] = dup;
+	cache->env_keys = keys;
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+// API function.
+void cth_cache_invalidate(struct cth_cache *cache)
+{
+	/*
+	 * Drop all the finished entries, the running ones are kept for their followers.
+	 */
+	if (cache == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&cache->lock);
+	for (size_t i = 0; i < CTH_CACHE_BUCKETS; i++) {
+		struct cth_cache_entry **p = &cache->buckets[i];
+		while (*p != NULL) {
+			struct cth_cache_entry *entry = *p;
+			if (entry->pending) {
+				p = &entry->next;
+				continue;
+			}
+			*p = entry->next;
+			cth_cache_free_entry(entry);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+// API function.
+void cth_cache_stats(struct cth_cache *cache, uint64_t *hits, uint64_t *misses, uint64_t *coalesced)
+{
+	/*
+	 * Get the counters of the cache, any of the pointers can be NULL.
+	 */
+	pthread_mutex_lock(&cache->lock);
+	if (hits != NULL) {
+		*hits = cache->hits;
+	}
+	if (misses != NULL) {
+		*misses = cache->misses;
+	}
+	if (coalesced != NULL) {
+		*coalesced = cache->coalesced;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+// API function.
+void cth_free_cache(struct cth_cache **cache)
+{
+	/*
+	 * Free the cache and all its entries, it must not be in use.
+	 * *cache: Pointer to the cache, can be NULL.
+	 * After calling this function, *cache will be set to NULL.
+	 */
+	if (*cache == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < CTH_CACHE_BUCKETS; i++) {
+		struct cth_cache_entry *entry = (*cache)->buckets[i];
+		while (entry != NULL) {
+			struct cth_cache_entry *next = entry->next;
+			cth_cache_free_entry(entry);
+			entry = next;
+		}
+	}
+	for (size_t i = 0; i < (*cache)->env_count; i++) {
+		free((*cache)->env_keys[i]);
+	}
+	free((*cache)->env_keys);
+	pthread_mutex_destroy(&(*cache)->lock);
+	pthread_cond_destroy(&(*cache)->cond);
+	free(*cache);
+	*cache = NULL;
+}
@@ -27,8 +27,11 @@
  *
  *
  */
-#include "include/catsh.h"
-static struct cth_result *cth_new(void)
+#include "include/catsh_internal.h"
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+struct cth_result *cth_new(void)
 {
 	/*
 	 * Allocate and initialize a new cth_result structure.
@@ -52,6 +55,21 @@ static struct cth_result *cth_new(void)
 	res->stderr_fd = -1;
 	res->time_fd = -1;
 	res->time_used_ms = 0;
+	res->stdout_total = 0;
+	res->stderr_total = 0;
+	res->stdout_len = 0;
+	res->stderr_len = 0;
+	res->cgroup_stat = NULL;
+	res->perf_stat = NULL;
+	res->cgroup_path = NULL;
+	res->timed_out = false;
+	res->term_signal = 0;
+	res->limit_hit = CTH_LIMIT_NONE;
+	res->status_slot = NULL;
+	res->cached = false;
+	res->output_in_fd = false;
+	res->digest = NULL;
+	res->feeder = NULL;
 	memset(res->reserved, 0, sizeof(res->reserved));
 	return res;
 }
@@ -99,6 +117,128 @@ void cth_free_argv(char ***argv)
 	free(*argv);
 	*argv = NULL;
 }
+// Feeder of the input producer of a non-blocking command.
+// The runner is a forked process, so the producer can not be called there, a thread of the
+// calling process pulls it into a pipe instead, and the runner reads the pipe as a fd input.
+#define CTH_FEEDER_RUNNING 0
+#define CTH_FEEDER_DONE 1
+#define CTH_FEEDER_ORPHAN 2
+struct cth_feeder {
+	pthread_t thread;
+	ssize_t (*produce)(void *ctx, void *buf, size_t cap);
+	void *ctx;
+	// Non-blocking write end of the pipe read by the runner.
+	int fd;
+	// Readable when the feeder should stop.
+	int stop_fd;
+	// CTH_FEEDER_*, who frees the feeder.
+	uint32_t state;
+};
+static void *cth_feeder_main(void *arg)
+{
+	/*
+	 * Pull the producer whenever the pipe is writable, until EOF, the runner closing the pipe, or a stop.
+	 * The pipe is closed before return, so the command gets EOF.
+	 */
+	struct cth_feeder *f = arg;
+	long pipe_size = fcntl(f->fd, F_GETPIPE_SZ);
+	size_t cap = pipe_size > 0 ? (size_t)pipe_size : 65536;
+	char *buf = malloc(cap);
+	const char *pending = NULL;
+	size_t pending_len = 0;
+	while (buf != NULL) {
+		struct pollfd pfd[2] = { { f->fd, POLLOUT, 0 }, { f->stop_fd, POLLIN, 0 } };
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfd[1].revents != 0 || (pfd[0].revents & (POLLERR | POLLHUP))) {
+			break;
+		}
+		if (pending_len == 0) {
+			ssize_t n = f->produce(f->ctx, buf, cap);
+			if (n <= 0) {
+				break;
+			}
+			pending = buf;
+			pending_len = (size_t)n;
+		}
+		ssize_t written = write(f->fd, pending, pending_len);
+		if (written > 0) {
+			pending += written;
+			pending_len -= (size_t)written;
+		} else if (written < 0 && errno != EAGAIN && errno != EINTR) {
+			// EPIPE, the command does not want more input.
+			break;
+		}
+	}
+	free(buf);
+	close(f->fd);
+	if (__atomic_exchange_n(&f->state, CTH_FEEDER_DONE, __ATOMIC_ACQ_REL) == CTH_FEEDER_ORPHAN) {
+		close(f->stop_fd);
+		free(f);
+	}
+	return NULL;
+}
+static struct cth_feeder *cth_feeder_start(const struct cth_input *input, int fd)
+{
+	/*
+	 * Start pulling input->produce into fd, the write end of a pipe, it's owned by the feeder from now on.
+	 * Returns the feeder, NULL on failure.
+	 */
+	struct cth_feeder *f = malloc(sizeof(struct cth_feeder));
+	if (f == NULL) {
+		close(fd);
+		return NULL;
+	}
+	f->produce = input->produce;
+	f->ctx = input->ctx;
+	f->fd = fd;
+	f->state = CTH_FEEDER_RUNNING;
+	f->stop_fd = eventfd(0, EFD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	// Ignore SIGPIPE, handle EPIPE error instead.
+	signal(SIGPIPE, SIG_IGN);
+	if (f->stop_fd < 0 || pthread_create(&f->thread, NULL, cth_feeder_main, f) != 0) {
+		if (f->stop_fd >= 0) {
+			close(f->stop_fd);
+		}
+		close(fd);
+		free(f);
+		return NULL;
+	}
+	return f;
+}
+static void cth_feeder_stop(struct cth_feeder *f)
+{
+	uint64_t one = 1;
+	write(f->stop_fd, &one, sizeof(one));
+}
+static void cth_feeder_join(struct cth_feeder *f)
+{
+	/*
+	 * Stop the feeder and wait for it, the producer is not called after this.
+	 * A producer call in progress is waited for.
+	 */
+	cth_feeder_stop(f);
+	pthread_join(f->thread, NULL);
+	close(f->stop_fd);
+	free(f);
+}
+static void cth_feeder_release(struct cth_feeder *f)
+{
+	/*
+	 * Stop the feeder without waiting for it, it frees itself when it's done.
+	 */
+	cth_feeder_stop(f);
+	pthread_detach(f->thread);
+	if (__atomic_exchange_n(&f->state, CTH_FEEDER_ORPHAN, __ATOMIC_ACQ_REL) == CTH_FEEDER_DONE) {
+		close(f->stop_fd);
+		free(f);
+	}
+}
 void cth_free_result(struct cth_result **res)
 {
 	/*
@@ -109,8 +249,30 @@ void cth_free_result(struct cth_result **res)
 	if (*res == NULL) {
 		return;
 	}
+	// Do not leave a running non-blocking command behind, if we know its cgroup.
+	if (!(*res)->exited && (*res)->cgroup_path != NULL) {
+		cth_cgroup_kill_path((*res)->cgroup_path);
+	}
+	// The runner frees the status slot if the command is still running.
+	if ((*res)->status_slot != NULL) {
+		cth_slot_release((*res)->status_slot);
+	}
+	// The feeder frees itself when the producer is done.
+	if ((*res)->feeder != NULL) {
+		cth_feeder_release((*res)->feeder);
+	}
+	if ((*res)->stdout_fd >= 0) {
+		close((*res)->stdout_fd);
+	}
+	if ((*res)->stderr_fd >= 0) {
+		close((*res)->stderr_fd);
+	}
 	free((*res)->stdout_ret);
 	free((*res)->stderr_ret);
+	free((*res)->cgroup_stat);
+	free((*res)->perf_stat);
+	free((*res)->cgroup_path);
+	free((*res)->digest);
 	free(*res);
 	*res = NULL;
 }
@@ -121,68 +283,202 @@ void *cth_init_argv(void)
 	 */
 	return NULL;
 }
-static struct cth_result *cth_exec_block_without_stdio(char **argv)
+void cth_child_exec(char **argv, const struct cth_exec_attr *attr, char **envp)
+{
+	/*
+	 * Apply attr in the child process, and exec the command.
+	 * envp: From cth_env_prepare() in the parent, nothing is allocated after fork().
+	 * The child may come from a raw clone3(), so everything here must be async-signal-safe, see cth_cgroup_fork().
+	 * Only returns on failure.
+	 */
+	if (cth_apply_sched(attr) < 0 || cth_apply_rlimits(attr) < 0 || cth_container_enter(attr) < 0) {
+		return;
+	}
+	if (attr != NULL && cth_jobserver_owned(attr->jobserver)) {
+		// Pass our jobserver in MAKEFLAGS, the envp is on the stack as we are after fork().
+		size_t count = 0;
+		while (envp[count] != NULL) {
+			count++;
+		}
+		char *js_envp[count + 2];
+		cth_jobserver_child(attr->jobserver, envp, js_envp);
+		execvpe(argv[0], argv, js_envp);
+		return;
+	}
+	execvpe(argv[0], argv, envp);
+}
+uint64_t cth_now_ms(void)
+{
+	/*
+	 * Monotonic clock in milliseconds.
+	 */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+uint64_t cth_deadline(const struct cth_exec_attr *attr)
+{
+	/*
+	 * Get the deadline of timeout_ms, 0 for no deadline.
+	 */
+	if (attr == NULL || attr->timeout_ms == 0) {
+		return 0;
+	}
+	return cth_now_ms() + attr->timeout_ms;
+}
+pid_t cth_waitpid(pid_t pid, int *status, struct rusage *ru, uint64_t deadline_ms)
+{
+	/*
+	 * wait4() with a deadline, deadline_ms is 0 to wait forever.
+	 * Sleeps on a pidfd if possible, otherwise polls with WNOHANG.
+	 * Returns pid on success, 0 on timeout, -1 on failure.
+	 */
+	if (deadline_ms == 0) {
+		pid_t ret;
+		while ((ret = wait4(pid, status, 0, ru)) < 0 && errno == EINTR) {
+		}
+		return ret;
+	}
+	int pidfd = cth_get_runtime()->has_pidfd ? (int)syscall(SYS_pidfd_open, pid, 0) : -1;
+	pid_t ret = 0;
+	while (true) {
+		ret = wait4(pid, status, WNOHANG, ru);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret != 0) {
+			break;
+		}
+		uint64_t now = cth_now_ms();
+		if (now >= deadline_ms) {
+			break;
+		}
+		if (pidfd >= 0) {
+			// The pidfd is readable when the child exits.
+			struct pollfd pfd = { pidfd, POLLIN, 0 };
+			poll(&pfd, 1, (int)(deadline_ms - now));
+		} else {
+			usleep((useconds_t)(deadline_ms - now < 10 ? deadline_ms - now : 10) * 1000);
+		}
+	}
+	if (pidfd >= 0) {
+		close(pidfd);
+	}
+	return ret;
+}
+void cth_set_status(struct cth_result *res, int status, const struct rusage *ru, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Set exit_code, term_signal and limit_hit from the wait status.
+	 */
+	res->exited = true;
+	if (WIFEXITED(status)) {
+		res->exit_code = WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		res->exit_code = 128 + WTERMSIG(status);
+		res->term_signal = WTERMSIG(status);
+	} else {
+		res->exit_code = -1;
+	}
+	// SIGKILL of timeout is not caused by a limit.
+	res->limit_hit = res->timed_out ? CTH_LIMIT_NONE : cth_limit_hit(attr, status, ru);
+}
+void cth_kill_job(pid_t pid, const struct cth_cgroup *cg)
+{
+	/*
+	 * Kill the command for timeout.
+	 * With a cgroup, the whole process tree is killed, otherwise only the child.
+	 */
+	kill(pid, SIGKILL);
+	cth_cgroup_kill(cg);
+}
+static struct cth_result *cth_exec_block_without_stdio(char **argv, const struct cth_exec_attr *attr)
 {
 	/*
 	 * Just exec the command in blocking mode, without redirecting stdin/stdout/stderr.
 	 * This is the simplest case.
 	 */
-	pid_t pid = fork();
+	int devnull_fd = cth_get_runtime()->devnull_fd;
+	struct cth_cgroup cg;
+	if (cth_cgroup_open(attr, &cg) < 0) {
+		return NULL;
+	}
+	uint64_t deadline_ms = cth_deadline(attr);
+	uint64_t spawn_start = cth_metrics_clock();
+	uint64_t trace_start = cth_trace_clock();
+	uint64_t record_start = cth_record_clock();
+	struct cth_perf perf;
+	cth_perf_init(&perf);
+	char **env_owned = NULL;
+	char **envp = cth_env_prepare(attr, &env_owned);
+	pid_t pid = envp != NULL ? cth_perf_fork(attr, &cg, &perf) : -1;
 	struct timeval start_time, end_time;
 	gettimeofday(&start_time, NULL);
 	// Just error handling.
 	if (pid < 0) {
+		cth_metrics_spawned(argv[0], spawn_start, false);
+		cth_cgroup_close(&cg);
+		free(env_owned);
 		return NULL;
 	}
 	// Child process, exec the command.
 	if (pid == 0) {
-		int fd = open("/dev/null", O_RDWR);
+		// The shared /dev/null fd is O_CLOEXEC, so only the dup2()ed ones are left after exec.
+		int fd = devnull_fd;
 		if (fd < 0) {
-			exit(CTH_EXIT_FAILURE);
+			_exit(CTH_EXIT_FAILURE);
 		}
 		dup2(fd, STDIN_FILENO);
 		dup2(fd, STDOUT_FILENO);
 		dup2(fd, STDERR_FILENO);
-		if (fd > 2) {
-			close(fd);
-		}
-		execvp(argv[0], argv);
-		exit(CTH_EXIT_FAILURE);
+		cth_child_exec(argv, attr, envp);
+		_exit(CTH_EXIT_FAILURE);
 	}
 	// Parent process, wait for child to exit.
-	struct cth_result *res = malloc(sizeof(struct cth_result));
+	free(env_owned);
+	struct cth_metrics_series *metrics = cth_metrics_spawned(argv[0], spawn_start, true);
+	uint64_t spawned_us = cth_trace_clock();
+	cth_trace_span(CTH_TRACE_SPAWN, argv[0], pid, trace_start, spawned_us, 0);
+	struct cth_result *res = cth_new();
 	if (res == NULL) {
+		cth_cgroup_close(&cg);
+		cth_perf_close(&perf);
+		cth_metrics_finished(metrics, NULL, false);
 		return NULL;
 	}
 	res->pid = pid;
-	res->ppid = -1;
-	res->exited = false;
-	res->exit_code = -1;
-	res->stdout_ret = NULL;
-	res->stderr_ret = NULL;
 	int status = 0;
-	// Wait for child process, handle EINTR.
-	while (waitpid(pid, &status, 0) < 0) {
-		if (errno == EINTR) {
-			continue;
-		}
+	struct rusage ru;
+	memset(&ru, 0, sizeof(ru));
+	// Wait for child process, kill it on timeout.
+	pid_t ret = cth_waitpid(pid, &status, &ru, deadline_ms);
+	if (ret == 0) {
+		cth_kill_job(pid, &cg);
+		res->timed_out = true;
+		ret = cth_waitpid(pid, &status, &ru, 0);
+	}
+	if (ret < 0) {
+		cth_cgroup_close(&cg);
+		cth_perf_close(&perf);
 		free(res);
+		cth_metrics_finished(metrics, NULL, false);
 		return NULL;
 	}
+	uint64_t reaped_us = cth_trace_clock();
+	cth_trace_span(CTH_TRACE_RUNNING, argv[0], pid, spawned_us, reaped_us, 0);
 	gettimeofday(&end_time, NULL);
+	res->cgroup_stat = cth_cgroup_read_stat(&cg);
+	cth_cgroup_close(&cg);
+	res->perf_stat = cth_perf_collect(&perf, NULL);
 	// Calculate time used in microseconds.
 	res->time_used = (end_time.tv_sec - start_time.tv_sec) * 1000000 + (end_time.tv_usec - start_time.tv_usec);
 	// Calculate time used in ms.
 	res->time_used_ms = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_usec - start_time.tv_usec) / 1000;
 	// Get exit code.
-	res->exited = true;
-	if (WIFEXITED(status)) {
-		res->exit_code = WEXITSTATUS(status);
-	} else if (WIFSIGNALED(status)) {
-		res->exit_code = 128 + WTERMSIG(status);
-	} else {
-		res->exit_code = -1;
-	}
+	cth_set_status(res, status, &ru, attr);
+	cth_trace_span(CTH_TRACE_REAPED, argv[0], pid, reaped_us, reaped_us, res->exit_code);
+	cth_metrics_finished(metrics, res, false);
+	cth_record_finished(argv, record_start, res, 0, 0);
 	return res;
 }
 static size_t pipe_buf_size(int fd)
@@ -194,17 +490,13 @@ static size_t pipe_buf_size(int fd)
 	 * As this is a internal function, we can do this.
 	 */
 	// Try to set the pipe buffer size to a large value.
-	// Get max allowed size from /proc/sys/fs/pipe-max-size.
-	FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
-	if (f) {
-		char line[32];
-		if (fgets(line, sizeof(line), f)) {
-			size_t max_size = strtoul(line, NULL, 10);
-			if (max_size > 0) {
-				fcntl(fd, F_SETPIPE_SZ, max_size);
-			}
+	// The max allowed size from /proc/sys/fs/pipe-max-size is cached in the runtime context.
+	size_t max_size = cth_get_runtime()->pipe_max_size;
+	if (max_size > 0) {
+		int size = fcntl(fd, F_SETPIPE_SZ, max_size);
+		if (size > 0) {
+			return (size_t)size;
 		}
-		fclose(f);
 	}
 	// Get the pipe buffer size using fcntl.
 	int size = fcntl(fd, F_GETPIPE_SZ);
@@ -213,161 +505,1033 @@ static size_t pipe_buf_size(int fd)
 	}
 	return (size_t)size;
 }
-static struct cth_result *cth_exec_block(char **argv, char *input, bool get_output);
-static struct cth_result *cth_exec_nonblock(char **argv, char *input, bool get_output)
-{
-	char memfd_name[32];
-	// Never mind, memfd does not really need a unique name, and we will not search it by name as well.
-	// NOLINTBEGIN
-	srand((unsigned int)time(NULL));
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_stdout_%d", rand());
-	int stdout_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_stderr_%d", rand());
-	int stderr_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_stat_%d", rand());
-	int stat_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_pid_%d", rand());
-	int pid_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_time_%d", rand());
-	int time_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	// NOLINTEND
-	if (stdout_fd < 0 || stderr_fd < 0 || stat_fd < 0 || pid_fd < 0 || time_fd < 0) {
+static size_t cth_write_all(int fd, const char *buf, size_t len)
+{
+	/*
+	 * Write len bytes from buf to fd, handle EINTR and EAGAIN.
+	 * Returns the number of bytes written, less than len on error.
+	 */
+	size_t total_written = 0;
+	while (total_written < len) {
+		ssize_t n = write(fd, buf + total_written, len - total_written);
+		if (n > 0) {
+			total_written += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			// write buffer full, wait for it to be available.
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+		} else {
+			// error, give up writing.
+			break;
+		}
+	}
+	return total_written;
+}
+char *cth_read_fd(int fd, size_t *len)
+{
+	/*
+	 * Read the first *len bytes of fd into a new buffer, with a trailing NUL.
+	 * Stops early at EOF, the file offset is not changed.
+	 * *len is set to the bytes read.
+	 * Returns the buffer on success, NULL on failure.
+	 */
+	char *buf = malloc(*len + 1);
+	if (buf == NULL) {
+		return NULL;
+	}
+	size_t total_read = 0;
+	while (total_read < *len) {
+		ssize_t n = pread(fd, buf + total_read, *len - total_read, (off_t)total_read);
+		if (n > 0) {
+			total_read += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			break;
+		}
+	}
+	buf[total_read] = 0;
+	*len = total_read;
+	return buf;
+}
+static void cth_close_pipe(int fds[2])
+{
+	/*
+	 * Close both ends of a pipe, if opened.
+	 */
+	for (int i = 0; i < 2; i++) {
+		if (fds[i] >= 0) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+// Fixed size ring buffer for CTH_CAPTURE_TAIL, or the spill target with spill_dir.
+struct cth_ring {
+	char *buf;
+	size_t size;
+	// Next position to write.
+	size_t head;
+	// Total bytes pushed, including the dropped ones.
+	uint64_t total;
+	// For spill_dir, the data goes into fd instead of buf, a memfd first, then a file in spill_dir past spill_threshold.
+	// spill_dir is set to NULL after spilling.
+	int fd;
+	uint64_t written;
+	uint64_t max_output;
+	uint64_t spill_threshold;
+	const char *spill_dir;
+	// Hash everything pushed, NULL for no hashing.
+	struct cth_hasher *hasher;
+};
+static int cth_ring_init(struct cth_ring *ring, size_t size)
+{
+	/*
+	 * Allocate the ring buffer.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	ring->buf = malloc(size);
+	ring->size = size;
+	ring->head = 0;
+	ring->total = 0;
+	if (ring->buf == NULL) {
+		return -1;
+	}
+	return 0;
+}
+static void cth_ring_push(struct cth_ring *ring, const char *data, size_t len)
+{
+	/*
+	 * Append data to the ring buffer, the oldest bytes are dropped if it's full.
+	 */
+	ring->total += len;
+	if (len >= ring->size) {
+		memcpy(ring->buf, data + len - ring->size, ring->size);
+		ring->head = 0;
+		return;
+	}
+	size_t first = ring->size - ring->head;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(ring->buf + ring->head, data, first);
+	memcpy(ring->buf, data + first, len - first);
+	ring->head = (ring->head + len) % ring->size;
+}
+static void cth_ring_free(struct cth_ring *ring)
+{
+	/*
+	 * Free the ring buffer, and close the spill target.
+	 */
+	free(ring->buf);
+	ring->buf = NULL;
+	if (ring->fd >= 0) {
+		close(ring->fd);
+		ring->fd = -1;
+	}
+}
+static char *cth_ring_dup(const struct cth_ring *ring, size_t lines, size_t *len)
+{
+	/*
+	 * Copy the content of the ring buffer into a new buffer, oldest byte first, with a trailing NUL.
+	 * lines: If > 0, only keep the last lines lines.
+	 * len: Set to the length of the returned data.
+	 * Returns the buffer on success, NULL on failure.
+	 */
+	size_t used = ring->total < ring->size ? (size_t)ring->total : ring->size;
+	size_t start = ring->total < ring->size ? 0 : ring->head;
+	char *buf = malloc(used + 1);
+	if (buf == NULL) {
+		return NULL;
+	}
+	size_t first = ring->size - start;
+	if (first > used) {
+		first = used;
+	}
+	memcpy(buf, ring->buf + start, first);
+	memcpy(buf + first, ring->buf, used - first);
+	if (lines > 0 && used > 0) {
+		// Walk backwards, every '\n' before position i starts a new line at i.
+		// The trailing '\n' belongs to the last line.
+		size_t seen = 0;
+		for (size_t i = used - 1; i > 0; i--) {
+			if (buf[i - 1] == '\n' && ++seen == lines) {
+				memmove(buf, buf + i, used - i);
+				used -= i;
+				break;
+			}
+		}
+	}
+	buf[used] = 0;
+	*len = used;
+	return buf;
+}
+static int cth_spill_file(const char *dir)
+{
+	/*
+	 * Create an unlinked file in dir.
+	 * Returns the fd, or -1 on failure.
+	 */
+	int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL)) {
+		return fd;
+	}
+	// No O_TMPFILE support in the filesystem.
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/cth-spill-XXXXXX", dir) >= (int)sizeof(path)) {
+		return -1;
+	}
+	fd = mkostemp(path, O_CLOEXEC);
+	if (fd >= 0) {
+		unlink(path);
+	}
+	return fd;
+}
+static void cth_spill(struct cth_ring *ring)
+{
+	/*
+	 * Move the data in the memfd into a spill file, and write there from now on.
+	 * On failure, it just keeps going in the memfd.
+	 */
+	int fd = cth_spill_file(ring->spill_dir);
+	ring->spill_dir = NULL;
+	if (fd < 0) {
+		return;
+	}
+	off_t offset = 0;
+	while ((uint64_t)offset < ring->written) {
+		ssize_t n = sendfile(fd, ring->fd, &offset, ring->written - (uint64_t)offset);
+		// EOF before ring->written should not happen, but would loop forever.
+		if (n == 0 || (n < 0 && errno != EINTR)) {
+			close(fd);
+			return;
+		}
+	}
+	close(ring->fd);
+	ring->fd = fd;
+}
+static int cth_spill_drain(int fd, struct cth_ring *ring, char *chunk, size_t chunk_size)
+{
+	/*
+	 * Move the data from fd into ring->fd, with splice() if possible.
+	 * The data past max_output is counted and dropped.
+	 * Returns fd, or -1 if fd reached EOF or failed and has been closed.
+	 */
+	if (ring->spill_dir != NULL && ring->written >= ring->spill_threshold) {
+		cth_spill(ring);
+	}
+	uint64_t room = ring->max_output - ring->written;
+	size_t len = room < chunk_size ? (size_t)room : chunk_size;
+	ssize_t n;
+	if (len > 0) {
+		loff_t offset = (loff_t)ring->written;
+		// With a hasher, the data has to pass through chunk.
+		n = ring->hasher != NULL ? -1 : splice(fd, NULL, ring->fd, &offset, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ring->hasher != NULL || (n < 0 && errno == EINVAL)) {
+			// The target does not support splice(), copy it.
+			n = read(fd, chunk, len);
+			for (ssize_t done = 0; n > 0 && done < n;) {
+				ssize_t ret = pwrite(ring->fd, chunk + done, (size_t)(n - done), (off_t)ring->written + done);
+				if (ret < 0 && errno != EINTR) {
+					break;
+				}
+				done += ret > 0 ? ret : 0;
+			}
+		}
+		if (n > 0) {
+			ring->written += (uint64_t)n;
+		}
+	} else {
+		// Past max_output, drop it.
+		n = read(fd, chunk, chunk_size);
+	}
+	if (n > 0) {
+		ring->total += (uint64_t)n;
+		if (ring->hasher != NULL) {
+			cth_hasher_update(ring->hasher, chunk, (size_t)n);
+		}
+		return fd;
+	}
+	if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return fd;
+	}
+	close(fd);
+	return -1;
+}
+static int cth_drain(int fd, struct cth_ring *ring, char *chunk, size_t chunk_size)
+{
+	/*
+	 * Read once from fd into the ring buffer, or its spill target.
+	 * Returns fd, or -1 if fd reached EOF or failed and has been closed.
+	 */
+	if (ring->fd >= 0) {
+		return cth_spill_drain(fd, ring, chunk, chunk_size);
+	}
+	ssize_t n = read(fd, chunk, chunk_size);
+	if (n > 0) {
+		cth_ring_push(ring, chunk, (size_t)n);
+		if (ring->hasher != NULL) {
+			cth_hasher_update(ring->hasher, chunk, (size_t)n);
+		}
+		return fd;
+	}
+	if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return fd;
+	}
+	close(fd);
+	return -1;
+}
+// What cth_pump() did with stdin, for tracing.
+struct cth_pump_stdin {
+	// cth_trace_clock() when stdin of the child was closed.
+	uint64_t end_us;
+	uint64_t bytes;
+};
+static bool cth_pump(const struct cth_input *input, int stdin_fd, int stdout_fd, int stderr_fd, struct cth_ring *stdout_ring, struct cth_ring *stderr_ring, struct cth_hasher *stdin_hasher, void (*progress)(float, int), int progress_line_num, uint64_t deadline_ms, struct cth_pump_stdin *stdin_stats)
+{
+	/*
+	 * Copy input to stdin_fd, and drain stdout_fd/stderr_fd into the ring buffers, until all of them are closed.
+	 * stdin_fd: The write end of the stdin pipe, should be non-blocking.
+	 * stdout_fd/stderr_fd: The read end of the output pipes, or -1 if output is not captured by pipe.
+	 * stdin_hasher: Hash the bytes written to stdin_fd, can be NULL.
+	 * deadline_ms: Give up at this time of cth_now_ms(), 0 for no deadline.
+	 * stdin_stats: Filled with the bytes written to stdin_fd, and when it's closed.
+	 * input->produce is called only when stdin_fd is writable, with up to a pipe size of room,
+	 * so at most one chunk of its output is held here.
+	 * All the given pipe fds are closed before return, input->fd is not.
+	 * Returns true if the deadline is reached.
+	 */
+	bool timed_out = false;
+	// Prgoress callback setup
+	float progress_total = 0.0f;
+	// Data waiting to be written to stdin_fd.
+	const char *pending = NULL;
+	size_t pending_len = 0;
+	char *buf = NULL;
+	size_t pipe_size = 0;
+	if (input->fd >= 0 || input->produce != NULL) {
+		// Get the size of input->fd, if possible.
+		struct stat st;
+		if (input->fd >= 0 && fstat(input->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			progress_total = (float)st.st_size;
+		}
+		pipe_size = pipe_buf_size(stdin_fd);
+		if (pipe_size == 0) {
+			pipe_size = 65536; // Fallback to 64KB if we cannot get pipe size.
+		}
+		buf = malloc(pipe_size);
+		if (buf == NULL) {
+			close(stdin_fd);
+			stdin_fd = -1;
+		}
+	} else if (input->len > 0) {
+		// Write from the buffer directly, no need to copy it.
+		pipe_buf_size(stdin_fd);
+		progress_total = (float)input->len;
+		pending = input->buf;
+		pending_len = input->len;
+	} else {
+		// Empty input.
+		close(stdin_fd);
+		stdin_fd = -1;
+	}
+	char chunk[65536];
+	uint64_t total_written = 0;
+	stdin_stats->end_us = stdin_fd < 0 ? cth_trace_clock() : 0;
+	while (stdin_fd >= 0 || stdout_fd >= 0 || stderr_fd >= 0) {
+		struct pollfd pfd[3];
+		nfds_t nfds = 0;
+		int in_idx = -1;
+		int out_idx = -1;
+		int err_idx = -1;
+		if (stdin_fd >= 0) {
+			// Wait for input if nothing is pending, otherwise wait for the pipe to be writable.
+			// The producer is pulled only when the pipe is writable.
+			bool to_pipe = pending_len > 0 || input->produce != NULL;
+			pfd[nfds].fd = to_pipe ? stdin_fd : input->fd;
+			pfd[nfds].events = to_pipe ? POLLOUT : POLLIN;
+			in_idx = (int)nfds++;
+		}
 		if (stdout_fd >= 0) {
-			close(stdout_fd);
+			pfd[nfds].fd = stdout_fd;
+			pfd[nfds].events = POLLIN;
+			out_idx = (int)nfds++;
 		}
 		if (stderr_fd >= 0) {
+			pfd[nfds].fd = stderr_fd;
+			pfd[nfds].events = POLLIN;
+			err_idx = (int)nfds++;
+		}
+		int timeout = -1;
+		if (deadline_ms > 0) {
+			uint64_t now = cth_now_ms();
+			if (now >= deadline_ms) {
+				timed_out = true;
+				break;
+			}
+			timeout = deadline_ms - now > INT_MAX ? INT_MAX : (int)(deadline_ms - now);
+		}
+		int ready = poll(pfd, nfds, timeout);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (ready == 0) {
+			continue;
+		}
+		if (in_idx >= 0 && pfd[in_idx].revents) {
+			if (pending_len == 0) {
+				ssize_t n = input->produce != NULL ? input->produce(input->ctx, buf, pipe_size) : read(input->fd, buf, pipe_size);
+				if (n > 0) {
+					pending = buf;
+					pending_len = (size_t)n;
+				} else if (n == 0 || input->produce != NULL || (errno != EINTR && errno != EAGAIN)) {
+					// EOF, close stdin of the child, a failing producer ends the input too.
+					close(stdin_fd);
+					stdin_fd = -1;
+				}
+			}
+			// Try to write directly, the pipe is writable in most cases.
+			if (stdin_fd >= 0 && pending_len > 0) {
+				ssize_t written = write(stdin_fd, pending, pending_len);
+				if (written > 0) {
+					if (stdin_hasher != NULL) {
+						cth_hasher_update(stdin_hasher, pending, (size_t)written);
+					}
+					pending += written;
+					pending_len -= (size_t)written;
+					total_written += (uint64_t)written;
+					if (progress != NULL && progress_total > 0.0f) {
+						progress((float)total_written / progress_total, progress_line_num);
+					}
+					// All the buffer is written.
+					if (pending_len == 0 && input->fd < 0 && input->produce == NULL) {
+						close(stdin_fd);
+						stdin_fd = -1;
+					}
+				} else if (written < 0 && errno != EAGAIN && errno != EINTR) {
+					// For EPIPE, the child does not want more input.
+					close(stdin_fd);
+					stdin_fd = -1;
+				}
+			}
+			if (stdin_fd < 0) {
+				stdin_stats->end_us = cth_trace_clock();
+			}
+		}
+		if (out_idx >= 0 && pfd[out_idx].revents) {
+			stdout_fd = cth_drain(stdout_fd, stdout_ring, chunk, sizeof(chunk));
+		}
+		if (err_idx >= 0 && pfd[err_idx].revents) {
+			stderr_fd = cth_drain(stderr_fd, stderr_ring, chunk, sizeof(chunk));
+		}
+	}
+	if (stdin_fd >= 0) {
+		close(stdin_fd);
+		stdin_stats->end_us = cth_trace_clock();
+	}
+	if (stdout_fd >= 0) {
+		close(stdout_fd);
+	}
+	if (stderr_fd >= 0) {
+		close(stderr_fd);
+	}
+	free(buf);
+	stdin_stats->bytes = total_written;
+	return timed_out;
+}
+struct cth_result *cth_exec_block_with_input(char **argv, const struct cth_input *input, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr, int stdout_sink, int stderr_sink, struct cth_cgroup *cg)
+{
+	/*
+	 * Exec the command in blocking mode, with stdin input and optional stdout/stderr capture.
+	 * argv: The command and its arguments, NULL-terminated array of strings.
+	 * input: The fd or buffer to read input from, a fd should be readable.
+	 * get_output: If true, capture stdout and stderr output.
+	 * progress: A callback function to report progress, can be NULL.
+	 * attr: Extra attributes, can be NULL.
+	 * stdout_sink/stderr_sink: If >= 0, leave the captured output in these memfds,
+	 *                          instead of stdout_ret/stderr_ret. Used by non-blocking mode.
+	 * cg: The cgroup opened by the caller, NULL to open it from attr here.
+	 */
+	struct timeval start_time, end_time;
+	gettimeofday(&start_time, NULL);
+	uint64_t deadline_ms = cth_deadline(attr);
+	struct cth_cgroup local_cg = { -1, NULL, false };
+	const struct cth_runtime *rt = cth_get_runtime();
+	bool tail = get_output && attr != NULL && attr->capture_mode == CTH_CAPTURE_TAIL;
+	bool to_fd = get_output && attr != NULL && attr->capture_mode == CTH_CAPTURE_FD;
+	uint64_t max_output = attr != NULL && attr->max_output > 0 ? attr->max_output : CTH_MAX_OUTPUT_SIZE;
+	// With spill_dir, the output is pumped through pipes, unless the sinks are given by non-blocking mode.
+	// To be hashed, it's always pumped, into the sinks if given.
+	unsigned int hash = attr != NULL ? attr->hash : 0;
+	bool piped = get_output && !tail && attr != NULL && ((attr->spill_dir != NULL && stdout_sink < 0) || hash != 0);
+	// Hashers of stdin, stdout and stderr.
+	struct cth_hasher hashers[3];
+	for (int i = 0; i < 3 && hash != 0; i++) {
+		cth_hasher_init(&hashers[i], hash);
+	}
+	// Create pipes for stdin.
+	int stdin_pipe[2] = { -1, -1 };
+	// Pipes for stdout and stderr, only for CTH_CAPTURE_TAIL, spill_dir and hash.
+	int stdout_pipe[2] = { -1, -1 };
+	int stderr_pipe[2] = { -1, -1 };
+	struct cth_ring stdout_ring = { NULL, 0, 0, 0, -1, 0, 0, 0, NULL, NULL };
+	struct cth_ring stderr_ring = { NULL, 0, 0, 0, -1, 0, 0, 0, NULL, NULL };
+	// Memfd for stdout and stderr, for CTH_CAPTURE_FULL and CTH_CAPTURE_FD.
+	int stdout_fd = -1;
+	int stderr_fd = -1;
+	if (tail) {
+		size_t ring_size = attr->tail_bytes > 0 ? attr->tail_bytes : CTH_TAIL_DEFAULT_SIZE;
+		stdout_ring.hasher = hash != 0 ? &hashers[STDOUT_FILENO] : NULL;
+		stderr_ring.hasher = hash != 0 ? &hashers[STDERR_FILENO] : NULL;
+		if (cth_ring_init(&stdout_ring, ring_size) < 0 || cth_ring_init(&stderr_ring, ring_size) < 0 || pipe2(stdout_pipe, O_CLOEXEC) < 0 || pipe2(stderr_pipe, O_CLOEXEC) < 0) {
+			cth_close_pipe(stdout_pipe);
+			cth_close_pipe(stderr_pipe);
+			free(stdout_ring.buf);
+			free(stderr_ring.buf);
+			return NULL;
+		}
+	} else if (piped) {
+		struct cth_ring *rings[2] = { &stdout_ring, &stderr_ring };
+		int sinks[2] = { stdout_sink, stderr_sink };
+		for (int i = 0; i < 2; i++) {
+			// The sinks belong to the caller, write into a dup of them.
+			rings[i]->fd = sinks[i] >= 0 ? fcntl(sinks[i], F_DUPFD_CLOEXEC, 0) : memfd_create(i == 0 ? "cth_stdout" : "cth_stderr", MFD_CLOEXEC);
+			rings[i]->max_output = max_output;
+			rings[i]->spill_threshold = attr->spill_threshold > 0 ? attr->spill_threshold : CTH_SPILL_DEFAULT_THRESHOLD;
+			rings[i]->spill_dir = sinks[i] >= 0 ? NULL : attr->spill_dir;
+			rings[i]->hasher = hash != 0 ? &hashers[i + 1] : NULL;
+		}
+		if (stdout_ring.fd < 0 || stderr_ring.fd < 0 || pipe2(stdout_pipe, O_CLOEXEC) < 0 || pipe2(stderr_pipe, O_CLOEXEC) < 0) {
+			cth_close_pipe(stdout_pipe);
+			cth_close_pipe(stderr_pipe);
+			cth_ring_free(&stdout_ring);
+			cth_ring_free(&stderr_ring);
+			return NULL;
+		}
+	} else if (get_output) {
+		// The memfds will be dup2()ed to stdout/stderr of the child.
+		stdout_fd = stdout_sink >= 0 ? stdout_sink : memfd_create("cth_stdout", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		stderr_fd = stderr_sink >= 0 ? stderr_sink : memfd_create("cth_stderr", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (stdout_fd < 0 || stderr_fd < 0) {
+			if (stdout_fd >= 0 && stdout_fd != stdout_sink) {
+				close(stdout_fd);
+			}
+			if (stderr_fd >= 0 && stderr_fd != stderr_sink) {
+				close(stderr_fd);
+			}
+			return NULL;
+		}
+		// Without a cap, the memfds just grow.
+		if (max_output != CTH_OUTPUT_UNLIMITED) {
+			ftruncate(stdout_fd, (off_t)max_output);
+			ftruncate(stderr_fd, (off_t)max_output);
+			fcntl(stdout_fd, F_ADD_SEALS, F_SEAL_GROW);
+			fcntl(stderr_fd, F_ADD_SEALS, F_SEAL_GROW);
+		}
+	}
+	// O_CLOEXEC, so the write end does not leak into commands started by other threads and keep their stdin open.
+	if (pipe2(stdin_pipe, O_CLOEXEC) < 0) {
+		cth_close_pipe(stdout_pipe);
+		cth_close_pipe(stderr_pipe);
+		cth_ring_free(&stdout_ring);
+		cth_ring_free(&stderr_ring);
+		if (stdout_fd >= 0 && stdout_fd != stdout_sink) {
+			close(stdout_fd);
+		}
+		if (stderr_fd >= 0 && stderr_fd != stderr_sink) {
 			close(stderr_fd);
 		}
-		if (stat_fd >= 0) {
-			close(stat_fd);
+		return NULL;
+	}
+	// Set write end of stdin pipe to non-blocking.
+	int flags = fcntl(stdin_pipe[1], F_GETFL, 0);
+	if (flags != -1) {
+		fcntl(stdin_pipe[1], F_SETFL, flags | O_NONBLOCK);
+	}
+	pid_t pid = -1;
+	uint64_t spawn_start = cth_metrics_clock();
+	uint64_t trace_start = cth_trace_clock();
+	uint64_t record_start = cth_record_clock();
+	struct cth_perf perf;
+	cth_perf_init(&perf);
+	// Prepared before fork(), the child must not allocate, other threads may hold the malloc locks.
+	char **env_owned = NULL;
+	char **envp = cth_env_prepare(attr, &env_owned);
+	if (envp != NULL && (cg != NULL || cth_cgroup_open(attr, &local_cg) == 0)) {
+		pid = cth_perf_fork(attr, cg != NULL ? cg : &local_cg, &perf);
+	}
+	if (cg == NULL) {
+		cg = &local_cg;
+	}
+	// Error handling.
+	if (pid < 0) {
+		cth_metrics_spawned(argv[0], spawn_start, false);
+		cth_cgroup_close(&local_cg);
+		cth_close_pipe(stdin_pipe);
+		cth_close_pipe(stdout_pipe);
+		cth_close_pipe(stderr_pipe);
+		cth_ring_free(&stdout_ring);
+		cth_ring_free(&stderr_ring);
+		if (stdout_fd >= 0 && stdout_fd != stdout_sink) {
+			close(stdout_fd);
+		}
+		if (stderr_fd >= 0 && stderr_fd != stderr_sink) {
+			close(stderr_fd);
+		}
+		free(env_owned);
+		return NULL;
+	}
+	if (pid == 0) {
+		// Child process.
+		close(stdin_pipe[1]);
+		dup2(stdin_pipe[0], STDIN_FILENO);
+		close(stdin_pipe[0]);
+		if (tail || piped) {
+			// The pipes are O_CLOEXEC, so only the dup2()ed ones are left after exec.
+			dup2(stdout_pipe[1], STDOUT_FILENO);
+			dup2(stderr_pipe[1], STDERR_FILENO);
+		} else if (get_output) {
+			dup2(stdout_fd, STDOUT_FILENO);
+			dup2(stderr_fd, STDERR_FILENO);
+		} else if (rt->devnull_fd >= 0) {
+			dup2(rt->devnull_fd, STDOUT_FILENO);
+			dup2(rt->devnull_fd, STDERR_FILENO);
+		}
+		cth_child_exec(argv, attr, envp);
+		close(STDIN_FILENO);
+		close(STDOUT_FILENO);
+		close(STDERR_FILENO);
+		_exit(CTH_EXIT_FAILURE);
+	}
+	// Parent process.
+	free(env_owned);
+	struct cth_metrics_series *metrics = cth_metrics_spawned(argv[0], spawn_start, true);
+	uint64_t spawned_us = cth_trace_clock();
+	cth_trace_span(CTH_TRACE_SPAWN, argv[0], pid, trace_start, spawned_us, 0);
+	close(stdin_pipe[0]);
+	if (stdout_pipe[1] >= 0) {
+		close(stdout_pipe[1]);
+	}
+	if (stderr_pipe[1] >= 0) {
+		close(stderr_pipe[1]);
+	}
+	struct cth_result *res = cth_new();
+	if (res == NULL) {
+		// Free pipes, the child will get EOF or EPIPE.
+		close(stdin_pipe[1]);
+		if (stdout_pipe[0] >= 0) {
+			close(stdout_pipe[0]);
 		}
-		if (time_fd >= 0) {
-			close(time_fd);
+		if (stderr_pipe[0] >= 0) {
+			close(stderr_pipe[0]);
 		}
-		if (pid_fd >= 0) {
-			close(pid_fd);
+		cth_ring_free(&stdout_ring);
+		cth_ring_free(&stderr_ring);
+		if (stdout_fd >= 0 && stdout_fd != stdout_sink) {
+			close(stdout_fd);
 		}
+		if (stderr_fd >= 0 && stderr_fd != stderr_sink) {
+			close(stderr_fd);
+		}
+		cth_cgroup_close(&local_cg);
+		cth_perf_close(&perf);
+		cth_metrics_finished(metrics, NULL, get_output);
 		return NULL;
 	}
-	pid_t pid = fork();
+	res->pid = pid;
+	signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE, handle EPIPE error instead.
+	// Write input to stdin pipe, and drain the output pipes if any.
+	// This closes all the pipes.
+	struct cth_pump_stdin stdin_stats;
+	res->timed_out = cth_pump(input, stdin_pipe[1], stdout_pipe[0], stderr_pipe[0], &stdout_ring, &stderr_ring, hash != 0 ? &hashers[STDIN_FILENO] : NULL, progress, progress_line_num, deadline_ms, &stdin_stats);
+	bool has_input = input->fd >= 0 || input->len > 0 || input->produce != NULL;
+	if (has_input) {
+		cth_trace_span(CTH_TRACE_STDIN, argv[0], pid, spawned_us, stdin_stats.end_us, (int64_t)stdin_stats.bytes);
+	}
+	if (progress != NULL) {
+		progress(1.0f, progress_line_num);
+	}
+	// Parent process, wait for child to exit, kill it on timeout.
+	int status = 0;
+	struct rusage ru;
+	memset(&ru, 0, sizeof(ru));
+	if (!res->timed_out && cth_waitpid(pid, &status, &ru, deadline_ms) == 0) {
+		res->timed_out = true;
+	}
+	if (res->timed_out) {
+		cth_kill_job(pid, cg);
+		cth_waitpid(pid, &status, &ru, 0);
+	}
+	uint64_t reaped_us = cth_trace_clock();
+	cth_trace_span(CTH_TRACE_RUNNING, argv[0], pid, spawned_us, reaped_us, 0);
+	gettimeofday(&end_time, NULL);
+	res->cgroup_stat = cth_cgroup_read_stat(cg);
+	cth_cgroup_close(&local_cg);
+	res->perf_stat = cth_perf_collect(&perf, NULL);
+	// Calculate time used in microseconds.
+	res->time_used = (end_time.tv_sec - start_time.tv_sec) * 1000000 + (end_time.tv_usec - start_time.tv_usec);
+	// Calculate time used in milliseconds.
+	res->time_used_ms = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_usec - start_time.tv_usec) / 1000;
+	cth_set_status(res, status, &ru, attr);
+	cth_trace_span(CTH_TRACE_REAPED, argv[0], pid, reaped_us, reaped_us, res->exit_code);
+	if (hash != 0 && (res->digest = malloc(3 * sizeof(struct cth_digest))) != NULL) {
+		for (int i = 0; i < 3; i++) {
+			cth_hasher_final(&hashers[i], &res->digest[i]);
+		}
+	}
+	if (tail) {
+		// Linearize the ring buffers.
+		size_t stdout_len = 0;
+		size_t stderr_len = 0;
+		res->stdout_total = stdout_ring.total;
+		res->stderr_total = stderr_ring.total;
+		res->stdout_ret = cth_ring_dup(&stdout_ring, attr->tail_lines, &stdout_len);
+		res->stderr_ret = cth_ring_dup(&stderr_ring, attr->tail_lines, &stderr_len);
+		res->stdout_len = stdout_len;
+		res->stderr_len = stderr_len;
+		free(stdout_ring.buf);
+		free(stderr_ring.buf);
+		if (stdout_sink >= 0 && res->stdout_ret != NULL) {
+			cth_write_all(stdout_sink, res->stdout_ret, stdout_len);
+			free(res->stdout_ret);
+			res->stdout_ret = NULL;
+			res->stdout_len = 0;
+		}
+		if (stderr_sink >= 0 && res->stderr_ret != NULL) {
+			cth_write_all(stderr_sink, res->stderr_ret, stderr_len);
+			free(res->stderr_ret);
+			res->stderr_ret = NULL;
+			res->stderr_len = 0;
+		}
+	} else if (piped) {
+		res->stdout_total = stdout_ring.total;
+		res->stderr_total = stderr_ring.total;
+		if (stdout_sink >= 0) {
+			// Non-blocking mode reads the sinks.
+			cth_ring_free(&stdout_ring);
+			cth_ring_free(&stderr_ring);
+		} else if (to_fd) {
+			lseek(stdout_ring.fd, 0, SEEK_SET);
+			lseek(stderr_ring.fd, 0, SEEK_SET);
+			res->stdout_fd = stdout_ring.fd;
+			res->stderr_fd = stderr_ring.fd;
+			res->output_in_fd = true;
+			stdout_ring.fd = -1;
+			stderr_ring.fd = -1;
+		} else {
+			size_t stdout_len = (size_t)stdout_ring.written;
+			size_t stderr_len = (size_t)stderr_ring.written;
+			res->stdout_ret = cth_read_fd(stdout_ring.fd, &stdout_len);
+			res->stderr_ret = cth_read_fd(stderr_ring.fd, &stderr_len);
+			res->stdout_len = stdout_len;
+			res->stderr_len = stderr_len;
+			cth_ring_free(&stdout_ring);
+			cth_ring_free(&stderr_ring);
+		}
+	} else if (get_output) {
+		// The child shares the file offset with us, so the offset is the size of output.
+		off_t stdout_len = lseek(stdout_fd, 0, SEEK_CUR);
+		off_t stderr_len = lseek(stderr_fd, 0, SEEK_CUR);
+		if (stdout_len < 0) {
+			stdout_len = 0;
+		}
+		if (stderr_len < 0) {
+			stderr_len = 0;
+		}
+		// Shrink the memfds to the real size, F_SEAL_GROW does not forbid this.
+		ftruncate(stdout_fd, stdout_len);
+		ftruncate(stderr_fd, stderr_len);
+		res->stdout_total = (uint64_t)stdout_len;
+		res->stderr_total = (uint64_t)stderr_len;
+		if (to_fd && stdout_sink < 0) {
+			// Hand the memfds over to the result.
+			lseek(stdout_fd, 0, SEEK_SET);
+			lseek(stderr_fd, 0, SEEK_SET);
+			res->stdout_fd = stdout_fd;
+			res->stderr_fd = stderr_fd;
+			res->output_in_fd = true;
+		} else {
+			if (stdout_sink < 0) {
+				size_t len = (size_t)stdout_len;
+				res->stdout_ret = cth_read_fd(stdout_fd, &len);
+				res->stdout_len = len;
+				close(stdout_fd);
+			}
+			if (stderr_sink < 0) {
+				size_t len = (size_t)stderr_len;
+				res->stderr_ret = cth_read_fd(stderr_fd, &len);
+				res->stderr_len = len;
+				close(stderr_fd);
+			}
+		}
+	}
+	if (get_output) {
+		cth_trace_span(CTH_TRACE_DRAIN, argv[0], pid, reaped_us, cth_trace_clock(), (int64_t)(res->stdout_total + res->stderr_total));
+	}
+	cth_metrics_finished(metrics, res, get_output);
+	cth_record_finished(argv, record_start, res, stdin_stats.bytes, (get_output ? CTH_RECORD_OUTPUT : 0) | (has_input ? CTH_RECORD_INPUT : 0));
+	if (progress != NULL) {
+		progress(-1.0, progress_line_num);
+	}
+	return res;
+}
+static struct cth_result *cth_exec_block(char **argv, char *input, bool get_output, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Exec the command in blocking mode, with optional stdin input and stdout/stderr capture.
+	 * argv: The command and its arguments, NULL-terminated array of strings.
+	 * input: The input to be passed to the command's stdin, can be NULL.
+	 * get_output: If true, capture stdout and stderr output.
+	 * attr: Extra attributes, can be NULL.
+	 * Returns a cth_result structure on success, NULL on failure.
+	 * The caller is responsible for freeing the result using cth_free_result().
+	 */
+	int token = -1;
+	if (attr != NULL && attr->jobserver != NULL && (token = cth_jobserver_acquire(attr->jobserver)) < 0) {
+		return NULL;
+	}
+	struct cth_result *res = NULL;
+	if (input == NULL && !get_output && (attr == NULL || attr->hash == 0)) {
+		// For the simplest case, just exec without stdio redirection
+		res = cth_exec_block_without_stdio(argv, attr);
+	} else {
+		// The input is written to the stdin pipe from memory directly.
+		struct cth_input in = { -1, input, input != NULL ? strlen(input) : 0, NULL, NULL };
+		res = cth_exec_block_with_input(argv, &in, get_output, NULL, 0, attr, -1, -1, NULL);
+	}
+	if (token >= 0) {
+		cth_jobserver_release(attr->jobserver, token);
+	}
+	return res;
+}
+static struct cth_result *cth_exec_nonblock_with_input(char **argv, const struct cth_input *input, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Exec the command in non-blocking mode.
+	 * A double-forked runner runs cth_exec_block_with_input(), and reports the status through a slot of the status slab.
+	 * The output goes into memfds, they are only created if get_output is true.
+	 * input->buf is inherited by the child with fork(), so it's not copied.
+	 * The cgroup is opened here, so that the caller knows it before the command starts.
+	 */
+	struct cth_cgroup cg;
+	if (cth_cgroup_open(attr, &cg) < 0) {
+		return NULL;
+	}
+	int stdout_fd = -1;
+	int stderr_fd = -1;
+	if (get_output && attr != NULL && attr->spill_dir != NULL && attr->capture_mode != CTH_CAPTURE_TAIL) {
+		// The command writes into the spill files directly unless hashed, they can not be sealed, so max_output is not enforced.
+		stdout_fd = cth_spill_file(attr->spill_dir);
+		stderr_fd = cth_spill_file(attr->spill_dir);
+	} else if (get_output) {
+		stdout_fd = memfd_create("cth_stdout", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		stderr_fd = memfd_create("cth_stderr", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	}
+	struct cth_slot *slot = cth_slot_alloc();
+	// The token is taken before the spawn, and given back by the runner after the command is reaped.
+	int token = -1;
+	if (attr != NULL && attr->jobserver != NULL && slot != NULL) {
+		token = cth_jobserver_acquire(attr->jobserver);
+	}
+	if (slot == NULL || (get_output && (stdout_fd < 0 || stderr_fd < 0)) || (attr != NULL && attr->jobserver != NULL && token < 0)) {
+		if (token >= 0) {
+			cth_jobserver_release(attr->jobserver, token);
+		}
+		if (stdout_fd >= 0) {
+			close(stdout_fd);
+		}
+		if (stderr_fd >= 0) {
+			close(stderr_fd);
+		}
+		if (slot != NULL) {
+			cth_slot_release(slot);
+		}
+		cth_cgroup_close(&cg);
+		return NULL;
+	}
+	// A producer is pulled by a feeder thread in this process, before the fork so that a failure is known here.
+	// The runner reads it from a pipe.
+	int feed[2] = { -1, -1 };
+	struct cth_feeder *feeder = NULL;
+	struct cth_input feed_input = { -1, NULL, 0, NULL, NULL };
+	if (input->produce != NULL && pipe2(feed, O_CLOEXEC) == 0) {
+		feed_input.fd = feed[0];
+		feeder = cth_feeder_start(input, feed[1]);
+		if (feeder == NULL) {
+			close(feed[0]);
+		}
+	}
+	pid_t pid = input->produce != NULL && feeder == NULL ? -1 : fork();
 	if (pid < 0) {
+		if (feeder != NULL) {
+			close(feed[0]);
+			cth_feeder_join(feeder);
+		}
+		if (token >= 0) {
+			cth_jobserver_release(attr->jobserver, token);
+		}
+		if (stdout_fd >= 0) {
+			close(stdout_fd);
+		}
+		if (stderr_fd >= 0) {
+			close(stderr_fd);
+		}
+		cth_slot_release(slot);
+		cth_cgroup_close(&cg);
 		return NULL;
 	}
 	if (pid > 0) {
 		waitpid(pid, NULL, 0);
-		struct cth_result *res = cth_new();
-		res->stat_fd = stat_fd;
-		res->stdout_fd = stdout_fd;
-		res->stderr_fd = stderr_fd;
-		res->time_fd = time_fd;
-		// Wait pid_fd, and get pid.
-		char pid_buf[32];
-		while (true) {
-			lseek(pid_fd, 0, SEEK_SET);
-			ssize_t n = read(pid_fd, pid_buf, sizeof(pid_buf) - 1);
-			if (n > 0) {
-				pid_buf[n] = 0;
-				char *endptr;
-				res->pid = (pid_t)strtoul(pid_buf, &endptr, 10);
-				if (endptr == pid_buf || *endptr != 0) {
-					// Invalid pid, treat as error.
-					close(pid_fd);
-					close(stat_fd);
-					close(stdout_fd);
-					close(stderr_fd);
-					free(res);
-					return NULL;
-				}
-				break;
-			} else if ((n < 0 && errno == EINTR) || n == 0) {
-				continue;
-			} else if (n < 0) {
-				// error, give up.
-				close(pid_fd);
-				close(stat_fd);
+		if (feeder != NULL) {
+			close(feed[0]);
+		}
+		// The runner owns the cgroup from now on, it removes the cgroup after the command exits.
+		if (cg.fd >= 0) {
+			close(cg.fd);
+		}
+		// Wait for the runner to report its pid.
+		cth_slot_wait(slot, CTH_SLOT_STARTING);
+		struct cth_result *res = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == CTH_SLOT_ERROR ? NULL : cth_new();
+		if (res == NULL) {
+			if (feeder != NULL) {
+				cth_feeder_join(feeder);
+			}
+			free(cg.path);
+			if (stdout_fd >= 0) {
 				close(stdout_fd);
+			}
+			if (stderr_fd >= 0) {
 				close(stderr_fd);
-				free(res);
-				return NULL;
 			}
+			cth_slot_release(slot);
+			return NULL;
 		}
-		close(pid_fd);
+		res->pid = slot->pid;
+		res->cgroup_path = cg.path;
+		res->stdout_fd = stdout_fd;
+		res->stderr_fd = stderr_fd;
+		res->output_in_fd = get_output && attr != NULL && attr->capture_mode == CTH_CAPTURE_FD;
+		res->status_slot = slot;
+		res->feeder = feeder;
 		return res;
 	}
+	if (feeder != NULL) {
+		// The runner only reads the pipe, the write end is the feeder's.
+		close(feed[1]);
+		input = &feed_input;
+	}
 	pid_t exec_pid = fork();
 	if (exec_pid < 0) {
-		write(pid_fd, "CTH_ERROR", 9);
+		if (token >= 0) {
+			cth_jobserver_release(attr->jobserver, token);
+		}
+		cth_cgroup_close(&cg);
+		cth_slot_publish(slot, CTH_SLOT_ERROR);
 		_exit(CTH_EXIT_FAILURE);
 	}
 	if (exec_pid > 0) {
+		// Set the pid here, so that the owner knows it after waitpid() and can check if the runner is alive.
+		__atomic_store_n(&slot->pid, exec_pid, __ATOMIC_RELEASE);
 		_exit(CTH_EXIT_SUCCESS);
 	}
-	char pid_str[32];
-	snprintf(pid_str, sizeof(pid_str), "%d", getpid());
-	write(pid_fd, pid_str, strlen(pid_str));
-	struct cth_result *exec_res = cth_exec_block(argv, input, get_output);
+	cth_slot_publish(slot, CTH_SLOT_RUNNING);
+	// The output goes into stdout_fd/stderr_fd directly, cth_wait() will read it from there.
+	struct cth_result *exec_res = cth_exec_block_with_input(argv, input, get_output, progress, progress_line_num, attr, stdout_fd, stderr_fd, cg.fd >= 0 ? &cg : NULL);
+	cth_cgroup_close(&cg);
+	if (token >= 0) {
+		cth_jobserver_release(attr->jobserver, token);
+	}
 	if (exec_res == NULL) {
-		write(stat_fd, "CTH_ERROR", 9);
+		cth_slot_publish(slot, CTH_SLOT_ERROR);
 		_exit(CTH_EXIT_FAILURE);
 	}
-	if (get_output) {
-		if (exec_res->stdout_ret) {
-			lseek(stdout_fd, 0, SEEK_SET);
-			// Buffered write to stdout_fd, as the output can be large.
-			size_t total_written = 0;
-			size_t to_write = strlen(exec_res->stdout_ret);
-			while (total_written < to_write) {
-				ssize_t n = write(stdout_fd, exec_res->stdout_ret + total_written, to_write - total_written);
-				if (n > 0) {
-					total_written += n;
-				} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-					// write buffer full, wait for it to be available.
-					struct pollfd pfd;
-					pfd.fd = stdout_fd;
-					pfd.events = POLLOUT;
-					poll(&pfd, 1, -1);
-				} else {
-					// error, give up writing.
-					break;
-				}
-			}
+	slot->exit_code = exec_res->exit_code;
+	slot->term_signal = exec_res->term_signal;
+	slot->limit_hit = exec_res->limit_hit;
+	slot->timed_out = exec_res->timed_out;
+	slot->time_used_ms = exec_res->time_used_ms;
+	slot->stdout_total = exec_res->stdout_total;
+	slot->stderr_total = exec_res->stderr_total;
+	if (exec_res->cgroup_stat != NULL) {
+		slot->cgroup_stat = *exec_res->cgroup_stat;
+		slot->has_cgroup_stat = true;
+	}
+	if (exec_res->digest != NULL) {
+		memcpy(slot->digest, exec_res->digest, sizeof(slot->digest));
+		slot->has_digest = true;
+	}
+	if (exec_res->perf_stat != NULL) {
+		slot->perf_stat = *exec_res->perf_stat;
+		slot->has_perf_stat = true;
+	}
+	cth_slot_publish(slot, CTH_SLOT_DONE);
+	_exit(CTH_EXIT_SUCCESS);
+}
+static struct cth_result *cth_exec_nonblock(char **argv, char *input, bool get_output, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Exec the command in non-blocking mode, with optional stdin input.
+	 */
+	struct cth_input in = { -1, input, input != NULL ? strlen(input) : 0, NULL, NULL };
+	return cth_exec_nonblock_with_input(argv, &in, get_output, NULL, 0, attr);
+}
+// API function.
+struct cth_exec_attr *cth_new_attr(void)
+{
+	/*
+	 * Allocate a new cth_exec_attr structure with default values.
+	 * Returns a pointer to the new structure, or NULL on failure.
+	 * The caller is responsible for freeing it using cth_free_attr().
+	 */
+	struct cth_exec_attr *attr = malloc(sizeof(struct cth_exec_attr));
+	if (attr == NULL) {
+		return NULL;
+	}
+	memset(attr, 0, sizeof(struct cth_exec_attr));
+	attr->capture_mode = CTH_CAPTURE_FULL;
+	attr->tail_bytes = 0;
+	attr->tail_lines = 0;
+	return attr;
+}
+// API function.
+void cth_free_attr(struct cth_exec_attr **attr)
+{
+	/*
+	 * Free the cth_exec_attr structure.
+	 * *attr: Pointer to the cth_exec_attr structure, can be NULL.
+	 * After calling this function, *attr will be set to NULL.
+	 */
+	if (*attr == NULL) {
+		return;
+	}
+	free(*attr);
+	*attr = NULL;
+}
+// API function.
+struct cth_result *cth_exec_with_attr(char **argv, char *input, bool block, bool get_output, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Same as cth_exec(), with extra attributes.
+	 * attr: Extra attributes, can be NULL to use the defaults.
+	 */
+	if (argv == NULL || argv[0] == NULL) {
+		return NULL;
+	}
+	if (block) {
+		// The cache keeps output on the heap, so CTH_CAPTURE_FD bypasses it.
+		if (attr != NULL && attr->cache != NULL && !(get_output && attr->capture_mode == CTH_CAPTURE_FD)) {
+			return cth_cache_exec(attr->cache, argv, input, get_output, attr, cth_exec_block);
 		}
-		if (exec_res->stderr_ret) {
-			lseek(stderr_fd, 0, SEEK_SET);
-			// Buffered write to stderr_fd, as the output can be large.
-			size_t total_written = 0;
-			size_t to_write = strlen(exec_res->stderr_ret);
-			while (total_written < to_write) {
-				ssize_t n = write(stderr_fd, exec_res->stderr_ret + total_written, to_write - total_written);
-				if (n > 0) {
-					total_written += n;
-				} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-					// write buffer full, wait for it to be available.
-					struct pollfd pfd;
-					pfd.fd = stderr_fd;
-					pfd.events = POLLOUT;
-					poll(&pfd, 1, -1);
-				} else {
-					// error, give up writing.
-					break;
-				}
-			}
-			// Read from stderr_fd to make sure the data is consumed by parent process, to avoid child process being blocked on write.
-			char buf[1024];
-			lseek(stderr_fd, 0, SEEK_SET);
-			int tt = read(stderr_fd, buf, sizeof(buf));
-			buf[tt] = 0;
-		}
-	}
-	char time_used_ms[128];
-	snprintf(time_used_ms, sizeof(time_used_ms), "%llu", (unsigned long long)exec_res->time_used_ms);
-	lseek(time_fd, 0, SEEK_SET);
-	write(time_fd, time_used_ms, strlen(time_used_ms));
-	char stat_str[32];
-	snprintf(stat_str, sizeof(stat_str), "%d", exec_res->exit_code);
-	lseek(stat_fd, 0, SEEK_SET);
-	write(stat_fd, stat_str, strlen(stat_str));
-	_exit(CTH_EXIT_SUCCESS);
+		return cth_exec_block(argv, input, get_output, attr);
+	}
+	return cth_exec_nonblock(argv, input, get_output, attr);
 }
 // API function.
 struct cth_result *cth_exec(char **argv, char *input, bool block, bool get_output)
@@ -377,19 +1541,12 @@ struct cth_result *cth_exec(char **argv, char *input, bool block, bool get_outpu
 	 * argv: The command and its arguments, NULL-terminated array of strings.
 	 * input: The input to be passed to the command's stdin, can be NULL.
 	 * block: If true, wait for the command to finish and return the result.
-	 *        If false, return immediately (not implemented yet).
+	 *        If false, return immediately, and use cth_wait() to get the result.
 	 * get_output: If true, capture stdout and stderr output.
 	 * Returns a cth_result structure on success, NULL on failure.
 	 * The caller is responsible for freeing the result using cth_free_result().
 	 */
-	if (argv == NULL || argv[0] == NULL) {
-		return NULL;
-	}
-	// For now, only blocking mode is implemented.
-	if (block) {
-		return cth_exec_block(argv, input, get_output);
-	}
-	return cth_exec_nonblock(argv, input, get_output);
+	return cth_exec_with_attr(argv, input, block, get_output, NULL);
 }
 // API function.
 int cth_exec_command(char **argv)
@@ -409,109 +1566,166 @@ int cth_exec_command(char **argv)
 }
 int cth_wait(struct cth_result **res)
 {
+	/*
+	 * Check if a non-blocking command exited, without blocking.
+	 * Returns the exit code if it exited, -1 if it's still running.
+	 * Checking the status is only a memory load of the status slot.
+	 */
 	if (res == NULL || *res == NULL) {
 		return -1;
 	}
 	struct cth_result *r = *res;
-	// Get r->stat_fd, read exit code from it.
-	if (r->stat_fd >= 0) {
-		char stat_buf[32];
-		lseek(r->stat_fd, 0, SEEK_SET);
-		ssize_t n = read(r->stat_fd, stat_buf, sizeof(stat_buf) - 1);
-		if (n > 0) {
-			stat_buf[n] = 0;
-			char *endptr;
-			int exit_code = (int)strtol(stat_buf, &endptr, 10);
-			if (endptr != stat_buf && *endptr == 0) {
-				r->exit_code = exit_code;
-				r->exited = true;
-				close(r->stat_fd);
-				// read time used from r->time_fd.
-				if (r->time_fd >= 0) {
-					char time_buf[128];
-					lseek(r->time_fd, 0, SEEK_SET);
-					ssize_t tn = read(r->time_fd, time_buf, sizeof(time_buf) - 1);
-					if (tn > 0) {
-						time_buf[tn] = 0;
-						char *endptr;
-						long long time_used_ms = strtoll(time_buf, &endptr, 10);
-						if (endptr != time_buf && *endptr == 0) {
-							r->time_used_ms = (uint64_t)time_used_ms;
-							r->time_used = r->time_used_ms * 1000; // convert ms to us.
-						}
-					}
-					close(r->time_fd);
-				}
-				// read stdout and stderr from their fds if needed.
-				if (r->stdout_fd >= 0) {
-					lseek(r->stdout_fd, 0, SEEK_SET);
-					char *stdout_buf = NULL;
-					size_t stdout_size = 0;
-					size_t BUF_CHUNK = 4096;
-					while (true) {
-						if (stdout_size + BUF_CHUNK > CTH_MAX_OUTPUT_SIZE) {
-							// Limit stdout buffer to CTH_MAX_OUTPUT_SIZE.
-							break;
-						}
-						stdout_buf = realloc(stdout_buf, stdout_size + BUF_CHUNK);
-						ssize_t n = read(r->stdout_fd, stdout_buf + stdout_size, BUF_CHUNK);
-						if (n > 0) {
-							stdout_size += n;
-						} else if (n < 0 && errno == EINTR) {
-							continue;
-						} else {
-							break;
-						}
-					}
-					if (stdout_buf) {
-						stdout_buf = realloc(stdout_buf, stdout_size + 1);
-						stdout_buf[stdout_size] = 0;
-						r->stdout_ret = stdout_buf;
-					} else {
-						r->stdout_ret = NULL;
-					}
-					close(r->stdout_fd);
-					r->stdout_fd = -1;
-				}
-				if (r->stderr_fd >= 0) {
-					lseek(r->stderr_fd, 0, SEEK_SET);
-					char *stderr_buf = NULL;
-					size_t stderr_size = 0;
-					size_t BUF_CHUNK = 4096;
-					while (true) {
-						if (stderr_size + BUF_CHUNK > CTH_MAX_OUTPUT_SIZE) {
-							// Limit stderr buffer to CTH_MAX_OUTPUT_SIZE.
-							break;
-						}
-						stderr_buf = realloc(stderr_buf, stderr_size + BUF_CHUNK);
-						ssize_t n = read(r->stderr_fd, stderr_buf + stderr_size, BUF_CHUNK);
-						if (n > 0) {
-							stderr_size += n;
-						} else if (n < 0 && errno == EINTR) {
-							continue;
-						} else {
-							break;
-						}
-					}
-					if (stderr_buf) {
-						stderr_buf = realloc(stderr_buf, stderr_size + 1);
-						stderr_buf[stderr_size] = 0;
-						r->stderr_ret = stderr_buf;
-					} else {
-						r->stderr_ret = NULL;
-					}
-					close(r->stderr_fd);
-					r->stderr_fd = -1;
-				}
-			} else {
-				r->exit_code = -1;
+	struct cth_slot *slot = r->status_slot;
+	if (slot == NULL) {
+		return r->exit_code;
+	}
+	uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+	if (state != CTH_SLOT_DONE && state != CTH_SLOT_ERROR) {
+		return -1;
+	}
+	r->exited = true;
+	if (state == CTH_SLOT_DONE) {
+		r->exit_code = slot->exit_code;
+		r->term_signal = slot->term_signal;
+		r->limit_hit = slot->limit_hit;
+		r->timed_out = slot->timed_out;
+		r->time_used_ms = slot->time_used_ms;
+		r->time_used = r->time_used_ms * 1000; // convert ms to us.
+		r->stdout_total = slot->stdout_total;
+		r->stderr_total = slot->stderr_total;
+		if (slot->has_cgroup_stat) {
+			r->cgroup_stat = malloc(sizeof(struct cth_cgroup_stat));
+			if (r->cgroup_stat != NULL) {
+				*r->cgroup_stat = slot->cgroup_stat;
 			}
-		} else {
-			r->exit_code = -1;
 		}
+		if (slot->has_digest) {
+			r->digest = malloc(sizeof(slot->digest));
+			if (r->digest != NULL) {
+				memcpy(r->digest, slot->digest, sizeof(slot->digest));
+			}
+		}
+		if (slot->has_perf_stat) {
+			r->perf_stat = malloc(sizeof(struct cth_perf_stat));
+			if (r->perf_stat != NULL) {
+				*r->perf_stat = slot->perf_stat;
+			}
+		}
+	} else {
+		// The runner failed to run the command.
+		r->exit_code = -1;
+	}
+	cth_slot_release(slot);
+	r->status_slot = NULL;
+	if (r->feeder != NULL) {
+		// The runner is gone, so the feeder stops at the next write, the producer is not called after this.
+		cth_feeder_join(r->feeder);
+		r->feeder = NULL;
+	}
+	if (r->output_in_fd) {
+		// Leave the output in the fds, just rewind them.
+		lseek(r->stdout_fd, 0, SEEK_SET);
+		lseek(r->stderr_fd, 0, SEEK_SET);
+		return r->exit_code;
+	}
+	// read stdout and stderr from their fds if needed.
+	// The size of the memfds is exactly the size of captured output.
+	struct stat st;
+	if (r->stdout_fd >= 0) {
+		if (state == CTH_SLOT_DONE && fstat(r->stdout_fd, &st) == 0) {
+			size_t len = (size_t)st.st_size;
+			r->stdout_ret = cth_read_fd(r->stdout_fd, &len);
+			r->stdout_len = len;
+		}
+		close(r->stdout_fd);
+		r->stdout_fd = -1;
+	}
+	if (r->stderr_fd >= 0) {
+		if (state == CTH_SLOT_DONE && fstat(r->stderr_fd, &st) == 0) {
+			size_t len = (size_t)st.st_size;
+			r->stderr_ret = cth_read_fd(r->stderr_fd, &len);
+			r->stderr_len = len;
+		}
+		close(r->stderr_fd);
+		r->stderr_fd = -1;
 	}
 	return r->exit_code;
 }
+// API function.
+int cth_wait_any(struct cth_result **res, size_t count, int timeout_ms)
+{
+	/*
+	 * Wait until one of the non-blocking commands in res exits, and cth_wait() it.
+	 * res: Array of count results, NULL entries and the ones already waited are skipped.
+	 * timeout_ms: 0 to return immediately, negative to wait forever.
+	 * Returns the index of the exited command, or -1 on timeout or if nothing is running.
+	 * Sleeps on a futex woken up by every command exit, instead of polling.
+	 */
+	uint64_t deadline_ms = timeout_ms > 0 ? cth_now_ms() + (uint64_t)timeout_ms : 0;
+	while (true) {
+		// Read the generation first, so that no exit after the scan is missed.
+		uint32_t generation = cth_slab_generation();
+		bool running = false;
+		for (size_t i = 0; i < count; i++) {
+			if (res[i] == NULL || res[i]->status_slot == NULL) {
+				continue;
+			}
+			running = true;
+			uint32_t state = __atomic_load_n(&((struct cth_slot *)res[i]->status_slot)->state, __ATOMIC_ACQUIRE);
+			if (state == CTH_SLOT_DONE || state == CTH_SLOT_ERROR) {
+				cth_wait(&res[i]);
+				return (int)i;
+			}
+		}
+		if (!running || timeout_ms == 0) {
+			return -1;
+		}
+		// A runner killed before publishing its state never wakes us up, so check them now and then.
+		int wait_ms = CTH_SLOT_CHECK_MS;
+		if (timeout_ms > 0) {
+			uint64_t now = cth_now_ms();
+			if (now >= deadline_ms) {
+				return -1;
+			}
+			if (deadline_ms - now < (uint64_t)wait_ms) {
+				wait_ms = (int)(deadline_ms - now);
+			}
+		}
+		cth_slab_wait(generation, wait_ms);
+		if (cth_slab_generation() == generation) {
+			for (size_t i = 0; i < count; i++) {
+				if (res[i] != NULL && res[i]->status_slot != NULL) {
+					cth_slot_check(res[i]->status_slot);
+				}
+			}
+		}
+	}
+}
+// API function.
+void *cth_map_output(const struct cth_result *res, bool stderr_stream, size_t *len)
+{
+	/*
+	 * Map the output kept with CTH_CAPTURE_FD read-only.
+	 * stderr_stream: Map stderr instead of stdout.
+	 * len: Set to the size of the mapping.
+	 * Returns the mapping, to be released with munmap(), or NULL if there is no output.
+	 */
+	*len = 0;
+	if (res == NULL || !res->output_in_fd) {
+		return NULL;
+	}
+	int fd = stderr_stream ? res->stderr_fd : res->stdout_fd;
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		return NULL;
+	}
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	*len = (size_t)st.st_size;
+	return map;
+}
 int cth_fork_rexec_self(char *const argv[])
 {
 	/*
@@ -519,7 +1733,17 @@ int cth_fork_rexec_self(char *const argv[])
 	 * argv: The arguments to pass to the new executable, NULL-terminated array of strings.
 	 * Returns the exit code of the new process on success, -1 on failure.
 	 * Note: This function will block, and use current terminal for stdio.
+	 * After cth_zygote_start(), the zygote forks the new process instead.
 	 */
+	int status = 0;
+	int zygote_ret = cth_zygote_exec(argv, &status);
+	if (zygote_ret > 0) {
+		return WEXITSTATUS(status);
+	}
+	if (zygote_ret < 0) {
+		// The zygote got the request, running it again here might run it twice.
+		return -1;
+	}
 	pid_t pid = fork();
 	if (pid == -1) {
 		return -1;
@@ -539,414 +1763,71 @@ int cth_fork_rexec_self(char *const argv[])
 		free(new_argv);
 		_exit(CTH_EXIT_FAILURE);
 	}
-	int status = 0;
 	waitpid(pid, &status, 0);
 	return WEXITSTATUS(status);
 }
-static struct cth_result *cth_exec_block_with_file_input(char **argv, int input_fd, bool get_output, void (*progress)(float, int), int progress_line_num)
+// API function.
+struct cth_result *cth_exec_with_file_input_attr(char **argv, int fd, bool block, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr)
 {
 	/*
-	 * Exec the command in blocking mode, with file descriptor input and optional stdout/stderr capture.
-	 * argv: The command and its arguments, NULL-terminated array of strings.
-	 * fd: The file descriptor to read input from, should be readable.
-	 * get_output: If true, capture stdout and stderr output.
-	 * progress: A callback function to report progress, can be NULL.
+	 * Same as cth_exec_with_file_input(), with extra attributes.
+	 * attr: Extra attributes, can be NULL to use the defaults.
 	 */
-	struct timeval start_time, end_time;
-	gettimeofday(&start_time, NULL);
-	if (input_fd < 0) {
-		return NULL;
-	}
-	// Create pipes for stdin.
-	int stdin_pipe[2] = { -1, -1 };
-	// Create memfd for stdout and stderr.
-	// No O_CLOEXEC, as we will write to them in child process.
-	int stdout_fd = open("/dev/null", O_RDWR);
-	int stderr_fd = open("/dev/null", O_RDWR);
-	if (get_output) {
-		close(stdout_fd);
-		close(stderr_fd);
-		stdout_fd = memfd_create("cth_stdout", MFD_ALLOW_SEALING);
-		stderr_fd = memfd_create("cth_stderr", MFD_ALLOW_SEALING);
-		ftruncate(stdout_fd, CTH_MAX_OUTPUT_SIZE);
-		ftruncate(stderr_fd, CTH_MAX_OUTPUT_SIZE);
-		fcntl(stdout_fd, F_ADD_SEALS, F_SEAL_GROW);
-		fcntl(stderr_fd, F_ADD_SEALS, F_SEAL_GROW);
-	}
-	if (pipe(stdin_pipe) < 0) {
-		return NULL;
-	}
-	// Set write end of stdin pipe to non-blocking.
-	int flags = fcntl(stdin_pipe[1], F_GETFL, 0);
-	if (flags != -1) {
-		fcntl(stdin_pipe[1], F_SETFL, flags | O_NONBLOCK);
-	}
-	pid_t pid = fork();
-	// Error handling.
-	if (pid < 0) {
-		if (stdin_pipe[0] != -1) {
-			close(stdin_pipe[0]);
-			close(stdin_pipe[1]);
-		}
-		close(stdout_fd);
-		close(stderr_fd);
+	if (argv == NULL || argv[0] == NULL) {
 		return NULL;
 	}
-	if (pid == 0) {
-		// Child process.
-		close(stdin_pipe[1]);
-		dup2(stdin_pipe[0], STDIN_FILENO);
-		close(stdin_pipe[0]);
-		if (get_output) {
-			dup2(stdout_fd, STDOUT_FILENO);
-			dup2(stderr_fd, STDERR_FILENO);
-			close(stdout_fd);
-			close(stderr_fd);
-		} else {
-			int fd = open("/dev/null", O_WRONLY);
-			if (fd >= 0) {
-				dup2(fd, STDOUT_FILENO);
-				dup2(fd, STDERR_FILENO);
-				if (fd > 2) {
-					close(fd);
-				}
-			}
-		}
-		execvp(argv[0], argv);
-		close(STDIN_FILENO);
-		close(STDOUT_FILENO);
-		close(STDERR_FILENO);
-		_exit(CTH_EXIT_FAILURE);
-	}
-	// Parent process.
-	close(stdin_pipe[0]);
-	struct cth_result *res = cth_new();
-	res->pid = pid;
-	if (res == NULL) {
-		// Free pipes
-		close(stdin_pipe[0]);
-		close(stdin_pipe[1]);
-		close(stdout_fd);
-		close(stderr_fd);
+	if (fd < 0) {
 		return NULL;
 	}
-	// Prgoress callback setup
-	float progress_total = 0.0f;
-	// Get the size of input_fd, if possible.
-	struct stat st;
-	if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode)) {
-		progress_total = (float)st.st_size;
-	}
-	// Write input to stdin pipe, handle EAGAIN and EINTR.
-	size_t pipe_size = pipe_buf_size(stdin_pipe[1]);
-	if (pipe_size == 0) {
-		pipe_size = 65536; // Fallback to 64KB if we cannot get pipe size.
-	}
-	if (input_fd >= 0) {
-		signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE, handle EPIPE error instead.
-		char buf[pipe_size];
-		ssize_t n;
-		while ((n = read(input_fd, buf, sizeof(buf))) > 0) {
-			ssize_t total_written = 0;
-			while (total_written < n) {
-				errno = 0;
-				ssize_t written = write(stdin_pipe[1], buf + total_written, n - total_written);
-				// For EPIPE, break.
-				if (errno == EPIPE) {
-					break;
-				}
-				if (written < 0) {
-					if (errno == EAGAIN || errno == EINTR) {
-						continue;
-					} else {
-						break;
-					}
-				}
-				total_written += written;
-				if (progress != NULL && progress_total > 0.0f) {
-					progress((float)total_written / progress_total, progress_line_num);
-				}
-			}
-		}
-	}
-	if (progress != NULL) {
-		progress(1.0f, progress_line_num);
-	}
-	close(stdin_pipe[1]);
-	close(stdin_pipe[0]);
-	// Parent process, wait for child to exit.
-	int status = 0;
-	// Wait for child process, handle EINTR
-	while (waitpid(pid, &status, 0) < 0) {
-		if (errno == EINTR) {
-			continue;
+	struct cth_input in = { fd, NULL, 0, NULL, NULL };
+	if (block) {
+		int token = -1;
+		if (attr != NULL && attr->jobserver != NULL && (token = cth_jobserver_acquire(attr->jobserver)) < 0) {
+			return NULL;
 		}
-		break;
-	}
-	gettimeofday(&end_time, NULL);
-	// Calculate time used in microseconds.
-	res->time_used = (end_time.tv_sec - start_time.tv_sec) * 1000000 + (end_time.tv_usec - start_time.tv_usec);
-	// Calculate time used in milliseconds.
-	res->time_used_ms = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_usec - start_time.tv_usec) / 1000;
-	res->exited = true;
-	if (WIFEXITED(status)) {
-		res->exit_code = WEXITSTATUS(status);
-	} else if (WIFSIGNALED(status)) {
-		res->exit_code = 128 + WTERMSIG(status);
-	} else {
-		res->exit_code = -1;
-	}
-	// Read stdout and stderr from memfd if get_output is true.
-	if (get_output) {
-		lseek(stdout_fd, 0, SEEK_SET);
-		lseek(stderr_fd, 0, SEEK_SET);
-		// Read stdout
-		char *stdout_buf = NULL;
-		size_t stdout_size = 0;
-		size_t BUF_CHUNK = 4096;
-		while (true) {
-			if (stdout_size + BUF_CHUNK > CTH_MAX_OUTPUT_SIZE) {
-				// Limit stdout buffer to CTH_MAX_OUTPUT_SIZE.
-				break;
-			}
-			char buf[BUF_CHUNK];
-			ssize_t n = read(stdout_fd, buf, sizeof(buf));
-			if (n <= 0) {
-				break;
-			}
-			if (stdout_buf == NULL) {
-				stdout_buf = strdup(buf);
-			} else {
-				size_t old_len = strlen(stdout_buf);
-				stdout_buf = realloc(stdout_buf, old_len + n + 1);
-				memcpy(stdout_buf + old_len, buf, n);
-				stdout_buf[old_len + n] = 0;
-			}
-			stdout_size += n;
-		}
-		res->stdout_ret = stdout_buf;
-		// Read stderr
-		char *stderr_buf = NULL;
-		size_t stderr_size = 0;
-		while (true) {
-			if (stderr_size + BUF_CHUNK > CTH_MAX_OUTPUT_SIZE) {
-				// Limit stderr buffer to CTH_MAX_OUTPUT_SIZE.
-				break;
-			}
-			char buf[BUF_CHUNK];
-			ssize_t n = read(stderr_fd, buf, sizeof(buf));
-			if (n <= 0) {
-				break;
-			}
-			if (stderr_buf == NULL) {
-				stderr_buf = strdup(buf);
-			} else {
-				size_t old_len = strlen(stderr_buf);
-				stderr_buf = realloc(stderr_buf, old_len + n + 1);
-				memcpy(stderr_buf + old_len, buf, n);
-				stderr_buf[old_len + n] = 0;
-			}
-			stderr_size += n;
+		struct cth_result *res = cth_exec_block_with_input(argv, &in, get_output, progress, progress_line_num, attr, -1, -1, NULL);
+		if (token >= 0) {
+			cth_jobserver_release(attr->jobserver, token);
 		}
-		res->stderr_ret = stderr_buf;
-	}
-	if (progress != NULL) {
-		progress(-1.0, progress_line_num);
+		return res;
 	}
-	return res;
+	return cth_exec_nonblock_with_input(argv, &in, get_output, progress, progress_line_num, attr);
 }
-static struct cth_result *cth_exec_block(char **argv, char *input, bool get_output)
+// API function.
+struct cth_result *cth_exec_with_producer(char **argv, ssize_t (*produce)(void *ctx, void *buf, size_t cap), void *ctx, bool block, bool get_output, const struct cth_exec_attr *attr)
 {
 	/*
-	 * Exec the command in blocking mode, with optional stdin input and stdout/stderr capture.
+	 * Exec the command with the input generated on the fly by a callback, without buffering all of it.
 	 * argv: The command and its arguments, NULL-terminated array of strings.
-	 * input: The input to be passed to the command's stdin, can be NULL.
+	 * produce: Called whenever stdin of the command is writable, to fill up to cap bytes of buf.
+	 *          Returns the number of bytes filled, 0 at EOF, or -1 on failure, which ends the input as EOF.
+	 *          cap is the size of the pipe, so at most one pipe size of input is held in memory.
+	 *          Not called any more once the command closes its stdin.
+	 * ctx: Passed to produce.
+	 * block: If true, wait for the command to finish and return the result, produce is called by this thread.
+	 *        If false, return immediately, produce is called by a thread of this process until EOF,
+	 *        and ctx must stay valid until cth_wait() reports the exit, or cth_free_result() stops the input.
 	 * get_output: If true, capture stdout and stderr output.
+	 * attr: Extra attributes, can be NULL. The result cache is not used, as the input is not known in advance.
 	 * Returns a cth_result structure on success, NULL on failure.
 	 * The caller is responsible for freeing the result using cth_free_result().
 	 */
-	struct timeval start_time, end_time;
-	gettimeofday(&start_time, NULL);
-	// For the simplest case, just exec without stdio redirection
-	if (input == NULL && !get_output) {
-		return cth_exec_block_without_stdio(argv);
-	}
-	// Open input as file, and use cth_exec_block_with_file_input.
-	int input_fd = -1;
-	if (input != NULL) {
-		input_fd = memfd_create("cth_input", MFD_CLOEXEC);
-		if (input_fd < 0) {
-			return NULL;
-		}
-		write(input_fd, input, strlen(input));
-		lseek(input_fd, 0, SEEK_SET);
-	} else {
-		// Get an empty memfd for input.
-		input_fd = memfd_create("cth_input_empty", MFD_CLOEXEC);
-		if (input_fd < 0) {
-			return NULL;
-		}
-	}
-	struct cth_result *res = cth_exec_block_with_file_input(argv, input_fd, get_output, NULL, 0);
-	if (input_fd >= 0) {
-		close(input_fd);
-	}
-	return res;
-}
-static struct cth_result *cth_exec_nonblock_with_file_input(char **argv, int input_fd, bool get_output, void (*progress)(float, int), int progress_line_num)
-{
-	char memfd_name[32];
-	// Never mind, memfd does not really need a unique name, and we will not search it by name as well.
-	// NOLINTBEGIN
-	srand((unsigned int)time(NULL));
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_stdout_%d", rand());
-	int stdout_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_stderr_%d", rand());
-	int stderr_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_stat_%d", rand());
-	int stat_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_pid_%d", rand());
-	int pid_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	snprintf(memfd_name, sizeof(memfd_name), "cth_memfd_time_%d", rand());
-	int time_fd = memfd_create(memfd_name, MFD_CLOEXEC);
-	// NOLINTEND
-	if (stdout_fd < 0 || stderr_fd < 0 || stat_fd < 0 || pid_fd < 0 || time_fd < 0) {
-		if (stdout_fd >= 0) {
-			close(stdout_fd);
-		}
-		if (stderr_fd >= 0) {
-			close(stderr_fd);
-		}
-		if (stat_fd >= 0) {
-			close(stat_fd);
-		}
-		if (time_fd >= 0) {
-			close(time_fd);
-		}
-		if (pid_fd >= 0) {
-			close(pid_fd);
-		}
-		return NULL;
-	}
-	pid_t pid = fork();
-	if (pid < 0) {
+	if (argv == NULL || argv[0] == NULL || produce == NULL) {
 		return NULL;
 	}
-	if (pid > 0) {
-		waitpid(pid, NULL, 0);
-		struct cth_result *res = cth_new();
-		res->stat_fd = stat_fd;
-		res->stdout_fd = stdout_fd;
-		res->stderr_fd = stderr_fd;
-		res->time_fd = time_fd;
-		// Wait pid_fd, and get pid.
-		char pid_buf[32];
-		while (true) {
-			lseek(pid_fd, 0, SEEK_SET);
-			ssize_t n = read(pid_fd, pid_buf, sizeof(pid_buf) - 1);
-			if (n > 0) {
-				pid_buf[n] = 0;
-				char *endptr;
-				res->pid = (pid_t)strtoul(pid_buf, &endptr, 10);
-				if (endptr == pid_buf || *endptr != 0) {
-					// Invalid pid, treat as error.
-					close(pid_fd);
-					close(stat_fd);
-					close(stdout_fd);
-					close(stderr_fd);
-					free(res);
-					return NULL;
-				}
-				break;
-			} else if ((n < 0 && errno == EINTR) || n == 0) {
-				continue;
-			} else if (n < 0) {
-				// error, give up.
-				close(pid_fd);
-				close(stat_fd);
-				close(stdout_fd);
-				close(stderr_fd);
-				free(res);
-				return NULL;
-			}
+	struct cth_input in = { -1, NULL, 0, produce, ctx };
+	if (block) {
+		int token = -1;
+		if (attr != NULL && attr->jobserver != NULL && (token = cth_jobserver_acquire(attr->jobserver)) < 0) {
+			return NULL;
+		}
+		struct cth_result *res = cth_exec_block_with_input(argv, &in, get_output, NULL, 0, attr, -1, -1, NULL);
+		if (token >= 0) {
+			cth_jobserver_release(attr->jobserver, token);
 		}
-		close(pid_fd);
 		return res;
 	}
-	pid_t exec_pid = fork();
-	if (exec_pid < 0) {
-		write(pid_fd, "CTH_ERROR", 9);
-		_exit(CTH_EXIT_FAILURE);
-	}
-	if (exec_pid > 0) {
-		_exit(CTH_EXIT_SUCCESS);
-	}
-	char pid_str[32];
-	snprintf(pid_str, sizeof(pid_str), "%d", getpid());
-	write(pid_fd, pid_str, strlen(pid_str));
-	struct cth_result *exec_res = cth_exec_block_with_file_input(argv, input_fd, get_output, progress, progress_line_num);
-	if (exec_res == NULL) {
-		write(stat_fd, "CTH_ERROR", 9);
-		_exit(CTH_EXIT_FAILURE);
-	}
-	if (get_output) {
-		if (exec_res->stdout_ret) {
-			lseek(stdout_fd, 0, SEEK_SET);
-			// Buffered write to stdout_fd, as the output can be large.
-			size_t total_written = 0;
-			size_t to_write = strlen(exec_res->stdout_ret);
-			while (total_written < to_write) {
-				ssize_t n = write(stdout_fd, exec_res->stdout_ret + total_written, to_write - total_written);
-				if (n > 0) {
-					total_written += n;
-				} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-					// write buffer full, wait for it to be available.
-					struct pollfd pfd;
-					pfd.fd = stdout_fd;
-					pfd.events = POLLOUT;
-					poll(&pfd, 1, -1);
-				} else {
-					// error, give up writing.
-					break;
-				}
-			}
-		}
-		if (exec_res->stderr_ret) {
-			lseek(stderr_fd, 0, SEEK_SET);
-			// Buffered write to stderr_fd, as the output can be large.
-			size_t total_written = 0;
-			size_t to_write = strlen(exec_res->stderr_ret);
-			while (total_written < to_write) {
-				ssize_t n = write(stderr_fd, exec_res->stderr_ret + total_written, to_write - total_written);
-				if (n > 0) {
-					total_written += n;
-				} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-					// write buffer full, wait for it to be available.
-					struct pollfd pfd;
-					pfd.fd = stderr_fd;
-					pfd.events = POLLOUT;
-					poll(&pfd, 1, -1);
-				} else {
-					// error, give up writing.
-					break;
-				}
-			}
-			// Read from stderr_fd to make sure the data is consumed by parent process, to avoid child process being blocked on write.
-			char buf[1024];
-			lseek(stderr_fd, 0, SEEK_SET);
-			int tt = read(stderr_fd, buf, sizeof(buf));
-			buf[tt] = 0;
-		}
-	}
-	char time_used_ms[128];
-	snprintf(time_used_ms, sizeof(time_used_ms), "%llu", (unsigned long long)exec_res->time_used_ms);
-	lseek(time_fd, 0, SEEK_SET);
-	write(time_fd, time_used_ms, strlen(time_used_ms));
-	char stat_str[32];
-	snprintf(stat_str, sizeof(stat_str), "%d", exec_res->exit_code);
-	lseek(stat_fd, 0, SEEK_SET);
-	write(stat_fd, stat_str, strlen(stat_str));
-	_exit(CTH_EXIT_SUCCESS);
+	return cth_exec_nonblock_with_input(argv, &in, get_output, NULL, 0, attr);
 }
 // API function.
 struct cth_result *cth_exec_with_file_input(char **argv, int fd, bool block, bool get_output, void (*progress)(float, int), int progress_line_num)
@@ -956,7 +1837,7 @@ struct cth_result *cth_exec_with_file_input(char **argv, int fd, bool block, boo
 	 * argv: The command and its arguments, NULL-terminated array of strings.
 	 * fd: The file descriptor to use as stdin, should be valid and open for reading.
 	 * block: If true, wait for the command to finish and return the result.
-	 *        If false, return immediately (not implemented yet).
+	 *        If false, return immediately, and use cth_wait() to get the result.
 	 * get_output: If true, capture stdout and stderr output.
 	 * progress: A callback function to report progress, can be NULL.
 	 *           The function will be called with a float value between 0.0 and 1.0,
@@ -966,14 +1847,7 @@ struct cth_result *cth_exec_with_file_input(char **argv, int fd, bool block, boo
 	 * Returns a cth_result structure on success, NULL on failure.
 	 * The caller is responsible for freeing the result using cth_free_result().
 	 */
-	if (argv == NULL || argv[0] == NULL) {
-		return NULL;
-	}
-	// For now, only blocking mode is implemented.
-	if (block) {
-		return cth_exec_block_with_file_input(argv, fd, get_output, progress, progress_line_num);
-	}
-	return cth_exec_nonblock_with_file_input(argv, fd, get_output, progress, progress_line_num);
+	return cth_exec_with_file_input_attr(argv, fd, block, get_output, progress, progress_line_num, NULL);
 }
 void cth_show_progress(float progress, int line_num)
 {
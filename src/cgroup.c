@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// cgroup v2 placement and accounting.
+// The child is created directly inside the cgroup with clone3(CLONE_INTO_CGROUP) if possible,
+// so every process it forks is accounted and can be killed with cgroup.kill.
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+// struct clone_args of clone3(), CLONE_ARGS_SIZE_VER2.
+struct cth_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+	uint64_t cgroup;
+};
+// For unique names of fresh cgroups.
+static unsigned long cth_cgroup_counter = 0;
+static int cth_cgroup_write(int dirfd, const char *file, const char *value)
+{
+	/*
+	 * Write value to a cgroup interface file.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	ssize_t len = (ssize_t)strlen(value);
+	ssize_t n = write(fd, value, (size_t)len);
+	close(fd);
+	return n == len ? 0 : -1;
+}
+static ssize_t cth_cgroup_read(int dirfd, const char *file, char *buf, size_t size)
+{
+	/*
+	 * Read a cgroup interface file into buf, with a trailing NUL.
+	 * Returns the length on success, -1 on failure.
+	 */
+	int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	size_t total = 0;
+	while (total < size - 1) {
+		ssize_t n = read(fd, buf + total, size - 1 - total);
+		if (n > 0) {
+			total += (size_t)n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			break;
+		}
+	}
+	close(fd);
+	buf[total] = 0;
+	return (ssize_t)total;
+}
+static uint64_t cth_cgroup_key(const char *buf, const char *key)
+{
+	/*
+	 * Sum up all the values of key in a flat keyed or nested keyed file.
+	 * cpu.stat is "key value" per line, io.stat is "dev key=value key=value ..." per line.
+	 */
+	uint64_t sum = 0;
+	size_t key_len = strlen(key);
+	for (const char *p = buf; (p = strstr(p, key)) != NULL; p += key_len) {
+		// Make sure it's the whole key.
+		if (p != buf && p[-1] != ' ' && p[-1] != '\n') {
+			continue;
+		}
+		const char *value = p + key_len;
+		if (*value != ' ' && *value != '=') {
+			continue;
+		}
+		sum += strtoull(value + 1, NULL, 10);
+	}
+	return sum;
+}
+int cth_cgroup_open(const struct cth_exec_attr *attr, struct cth_cgroup *cg)
+{
+	/*
+	 * Open or create the cgroup requested by attr, and apply the limits.
+	 * cg->fd is -1 if attr does not ask for a cgroup.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	cg->fd = -1;
+	cg->path = NULL;
+	cg->owned = false;
+	if (attr == NULL || (attr->cgroup_path == NULL && attr->cgroup_parent == NULL)) {
+		return 0;
+	}
+	if (attr->cgroup_path != NULL) {
+		cg->path = strdup(attr->cgroup_path);
+		if (cg->path == NULL) {
+			return -1;
+		}
+	} else {
+		unsigned long n = __atomic_fetch_add(&cth_cgroup_counter, 1, __ATOMIC_RELAXED);
+		if (asprintf(&cg->path, "%s/catsh-%d-%lu", attr->cgroup_parent, getpid(), n) < 0) {
+			cg->path = NULL;
+			return -1;
+		}
+		if (mkdir(cg->path, 0755) < 0) {
+			free(cg->path);
+			cg->path = NULL;
+			return -1;
+		}
+		cg->owned = true;
+	}
+	cg->fd = open(cg->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	char value[64];
+	int ret = cg->fd < 0 ? -1 : 0;
+	if (ret == 0 && attr->memory_max > 0) {
+		snprintf(value, sizeof(value), "%llu", (unsigned long long)attr->memory_max);
+		ret = cth_cgroup_write(cg->fd, "memory.max", value);
+	}
+	if (ret == 0 && attr->cpu_max_us > 0) {
+		snprintf(value, sizeof(value), "%llu %llu", (unsigned long long)attr->cpu_max_us, (unsigned long long)(attr->cpu_period_us > 0 ? attr->cpu_period_us : 100000));
+		ret = cth_cgroup_write(cg->fd, "cpu.max", value);
+	}
+	if (ret == 0 && attr->pids_max > 0) {
+		snprintf(value, sizeof(value), "%llu", (unsigned long long)attr->pids_max);
+		ret = cth_cgroup_write(cg->fd, "pids.max", value);
+	}
+	if (ret < 0) {
+		// The limits cannot be applied, do not run the command without them.
+		cth_cgroup_close(cg);
+		return -1;
+	}
+	return 0;
+}
+pid_t cth_cgroup_fork(const struct cth_cgroup *cg)
+{
+	/*
+	 * fork() into the cgroup.
+	 * With clone3(CLONE_INTO_CGROUP), the child is never visible outside of the cgroup.
+	 * Otherwise, the child moves itself into the cgroup before returning.
+	 * The raw clone3() skips the fork handling of glibc: no atfork handlers, the malloc and stdio locks
+	 * are not reset, and the cached TID is stale. So the child must stay async-signal-safe until exec,
+	 * no malloc() or stdio, everything it needs is prepared by the parent, see cth_env_prepare().
+	 * Returns the same as fork().
+	 */
+	if (cg == NULL || cg->fd < 0) {
+		return fork();
+	}
+	if (cth_get_runtime()->has_clone3) {
+		struct cth_clone_args args;
+		memset(&args, 0, sizeof(args));
+		args.flags = CLONE_INTO_CGROUP;
+		args.exit_signal = SIGCHLD;
+		args.cgroup = (uint64_t)cg->fd;
+		long pid = syscall(SYS_clone3, &args, sizeof(args));
+		if (pid >= 0) {
+			return (pid_t)pid;
+		}
+		// Fallback to fork() for old kernels.
+	}
+	pid_t pid = fork();
+	if (pid == 0 && cth_cgroup_write(cg->fd, "cgroup.procs", "0") < 0) {
+		_exit(CTH_EXIT_FAILURE);
+	}
+	return pid;
+}
+static int cth_cgroup_kill_fd(int dirfd)
+{
+	/*
+	 * Kill every process in the cgroup.
+	 * Use cgroup.kill if available (5.14+), otherwise SIGKILL every pid in cgroup.procs.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (cth_cgroup_write(dirfd, "cgroup.kill", "1") == 0) {
+		return 0;
+	}
+	char buf[4096];
+	ssize_t len = cth_cgroup_read(dirfd, "cgroup.procs", buf, sizeof(buf));
+	if (len < 0) {
+		return -1;
+	}
+	for (char *p = buf; *p != 0;) {
+		char *endptr;
+		long pid = strtol(p, &endptr, 10);
+		if (endptr == p) {
+			break;
+		}
+		if (pid > 0) {
+			kill((pid_t)pid, SIGKILL);
+		}
+		p = endptr;
+	}
+	return 0;
+}
+int cth_cgroup_kill(const struct cth_cgroup *cg)
+{
+	/*
+	 * Kill the whole cgroup.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (cg == NULL || cg->fd < 0) {
+		return -1;
+	}
+	return cth_cgroup_kill_fd(cg->fd);
+}
+int cth_cgroup_kill_path(const char *path)
+{
+	/*
+	 * Kill the whole cgroup at path.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	int ret = cth_cgroup_kill_fd(fd);
+	close(fd);
+	return ret;
+}
+struct cth_cgroup_stat *cth_cgroup_read_stat(const struct cth_cgroup *cg)
+{
+	/*
+	 * Read the accounting of the cgroup.
+	 * Missing files (e.g. memory.peak before 5.19, or disabled controllers) are reported as 0.
+	 * Returns a new cth_cgroup_stat, NULL on failure.
+	 */
+	if (cg == NULL || cg->fd < 0) {
+		return NULL;
+	}
+	struct cth_cgroup_stat *stat = malloc(sizeof(struct cth_cgroup_stat));
+	if (stat == NULL) {
+		return NULL;
+	}
+	memset(stat, 0, sizeof(struct cth_cgroup_stat));
+	char buf[4096];
+	if (cth_cgroup_read(cg->fd, "cpu.stat", buf, sizeof(buf)) > 0) {
+		stat->cpu_usage_usec = cth_cgroup_key(buf, "usage_usec");
+		stat->cpu_user_usec = cth_cgroup_key(buf, "user_usec");
+		stat->cpu_system_usec = cth_cgroup_key(buf, "system_usec");
+	}
+	if (cth_cgroup_read(cg->fd, "memory.peak", buf, sizeof(buf)) > 0) {
+		stat->memory_peak = strtoull(buf, NULL, 10);
+	}
+	if (cth_cgroup_read(cg->fd, "io.stat", buf, sizeof(buf)) > 0) {
+		stat->io_rbytes = cth_cgroup_key(buf, "rbytes");
+		stat->io_wbytes = cth_cgroup_key(buf, "wbytes");
+		stat->io_rios = cth_cgroup_key(buf, "rios");
+		stat->io_wios = cth_cgroup_key(buf, "wios");
+	}
+	return stat;
+}
+void cth_cgroup_close(struct cth_cgroup *cg)
+{
+	/*
+	 * Close the cgroup, a cgroup created by us is removed,
+	 * after killing the processes left in it, e.g. daemonized ones.
+	 */
+	if (cg->owned && cg->path != NULL) {
+		for (int i = 0; i < 1000 && rmdir(cg->path) < 0 && errno == EBUSY; i++) {
+			if (i == 0 && cg->fd >= 0) {
+				cth_cgroup_kill_fd(cg->fd);
+			}
+			usleep(1000);
+		}
+	}
+	if (cg->fd >= 0) {
+		close(cg->fd);
+	}
+	free(cg->path);
+	cg->fd = -1;
+	cg->path = NULL;
+	cg->owned = false;
+}
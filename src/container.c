@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <pthread.h>
+// Running commands inside containers.
+// The child enters the namespaces with setns() and chroot()s into the root dirfd before exec,
+// so a command in a container costs one spawn, instead of a nsenter/chroot process chain.
+// The pid namespace only applies to the children of the caller, so the parent switches
+// pid_for_children of its thread around the fork instead.
+static const char *cth_ns_names[CTH_NS_COUNT] = { "user", "cgroup", "ipc", "uts", "net", "pid", "mnt" };
+static const int cth_ns_types[CTH_NS_COUNT] = { CLONE_NEWUSER, CLONE_NEWCGROUP, CLONE_NEWIPC, CLONE_NEWUTS, CLONE_NEWNET, CLONE_NEWPID, CLONE_NEWNS };
+// Cache of the containers opened by cth_container_open(), the entries are never freed before cth_container_forget().
+struct cth_container_entry {
+	struct cth_container container;
+	pid_t pid;
+	// Tells if the process is gone, even if its pid is reused.
+	int pidfd;
+	struct cth_container_entry *next;
+};
+static struct cth_container_entry *cth_containers = NULL;
+static pthread_mutex_t cth_containers_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool cth_same_file(const char *path1, const char *path2)
+{
+	struct stat st1;
+	struct stat st2;
+	return stat(path1, &st1) == 0 && stat(path2, &st2) == 0 && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino;
+}
+static void cth_container_clear(struct cth_container *container)
+{
+	for (int i = 0; i < CTH_NS_COUNT; i++) {
+		if (container->ns_fd[i] >= 0) {
+			close(container->ns_fd[i]);
+		}
+		container->ns_fd[i] = -1;
+	}
+	if (container->root_fd >= 0) {
+		close(container->root_fd);
+	}
+	container->root_fd = -1;
+}
+static int cth_container_fill(struct cth_container *container, pid_t pid)
+{
+	/*
+	 * Open the namespaces and the root of the process, the ones same as ours are left -1,
+	 * as setns() to the user namespace we are already in fails.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	char path[64];
+	char self[64];
+	for (int i = 0; i < CTH_NS_COUNT; i++) {
+		container->ns_fd[i] = -1;
+		sprintf(path, "/proc/%d/ns/%s", pid, cth_ns_names[i]);
+		sprintf(self, "/proc/self/ns/%s", cth_ns_names[i]);
+		if (access(path, F_OK) != 0) {
+			// Not supported by the kernel.
+			continue;
+		}
+		if (!cth_same_file(path, self) && (container->ns_fd[i] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+			cth_container_clear(container);
+			return -1;
+		}
+	}
+	container->root_fd = -1;
+	sprintf(path, "/proc/%d/root", pid);
+	if (!cth_same_file(path, "/proc/self/root") && (container->root_fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		cth_container_clear(container);
+		return -1;
+	}
+	return 0;
+}
+static bool cth_pidfd_alive(int pidfd)
+{
+	/*
+	 * The pidfd is readable after the process exits.
+	 */
+	struct pollfd pfd = { pidfd, POLLIN, 0 };
+	return poll(&pfd, 1, 0) == 0;
+}
+// API function.
+const struct cth_container *cth_container_open(pid_t pid)
+{
+	/*
+	 * Get the namespaces and the root of a process in a container, e.g. its init, for attr->container.
+	 * The fds are cached, opening the same process again is only a lookup,
+	 * and they are reopened if the process has exited since then.
+	 * Returns NULL on failure.
+	 * The result is owned by the cache, and valid until cth_container_forget(pid).
+	 */
+	if (pid <= 0) {
+		return NULL;
+	}
+	pthread_mutex_lock(&cth_containers_lock);
+	struct cth_container_entry *entry = cth_containers;
+	while (entry != NULL && entry->pid != pid) {
+		entry = entry->next;
+	}
+	if (entry != NULL && entry->pidfd >= 0 && cth_pidfd_alive(entry->pidfd)) {
+		pthread_mutex_unlock(&cth_containers_lock);
+		return &entry->container;
+	}
+	if (entry == NULL) {
+		entry = calloc(1, sizeof(struct cth_container_entry));
+		if (entry == NULL) {
+			pthread_mutex_unlock(&cth_containers_lock);
+			return NULL;
+		}
+		entry->pid = pid;
+		entry->pidfd = -1;
+		entry->container.root_fd = -1;
+		for (int i = 0; i < CTH_NS_COUNT; i++) {
+			entry->container.ns_fd[i] = -1;
+		}
+		entry->next = cth_containers;
+		cth_containers = entry;
+	} else {
+		// Stale, the pid may belong to another process now.
+		cth_container_clear(&entry->container);
+		if (entry->pidfd >= 0) {
+			close(entry->pidfd);
+		}
+	}
+	// Without pidfd, the entry is never trusted, and reopened every time.
+	entry->pidfd = cth_get_runtime()->has_pidfd ? (int)syscall(SYS_pidfd_open, pid, 0) : -1;
+	if (cth_container_fill(&entry->container, pid) < 0) {
+		// Never return the empty entry as a hit, it would run the commands on the host.
+		if (entry->pidfd >= 0) {
+			close(entry->pidfd);
+			entry->pidfd = -1;
+		}
+		pthread_mutex_unlock(&cth_containers_lock);
+		return NULL;
+	}
+	pthread_mutex_unlock(&cth_containers_lock);
+	return &entry->container;
+}
+// API function.
+void cth_container_forget(pid_t pid)
+{
+	/*
+	 * Close the cached fds of cth_container_open(pid), 0 for all the containers.
+	 * The pointers returned for them are invalid after this.
+	 */
+	pthread_mutex_lock(&cth_containers_lock);
+	struct cth_container_entry **prev = &cth_containers;
+	while (*prev != NULL) {
+		struct cth_container_entry *entry = *prev;
+		if (pid != 0 && entry->pid != pid) {
+			prev = &entry->next;
+			continue;
+		}
+		*prev = entry->next;
+		cth_container_clear(&entry->container);
+		if (entry->pidfd >= 0) {
+			close(entry->pidfd);
+		}
+		free(entry);
+	}
+	pthread_mutex_unlock(&cth_containers_lock);
+}
+pid_t cth_container_fork(const struct cth_exec_attr *attr, const struct cth_cgroup *cg)
+{
+	/*
+	 * fork() into the cgroup, and into the pid namespace of attr->container.
+	 * setns() of a pid namespace only changes pid_for_children of the calling thread,
+	 * so it's switched for this fork only, and switched back.
+	 * Returns the same as fork().
+	 */
+	int pid_ns = attr != NULL && attr->container != NULL ? attr->container->ns_fd[CTH_NS_PID] : -1;
+	if (pid_ns < 0) {
+		return cth_cgroup_fork(cg);
+	}
+	int saved = open("/proc/thread-self/ns/pid_for_children", O_RDONLY | O_CLOEXEC);
+	if (saved < 0) {
+		return -1;
+	}
+	if (setns(pid_ns, CLONE_NEWPID) < 0) {
+		close(saved);
+		return -1;
+	}
+	pid_t pid = cth_cgroup_fork(cg);
+	if (pid != 0) {
+		setns(saved, CLONE_NEWPID);
+		close(saved);
+	}
+	return pid;
+}
+int cth_container_enter(const struct cth_exec_attr *attr)
+{
+	/*
+	 * Enter the namespaces and the root of attr->container in the child.
+	 * The user namespace goes first, so that we have the capabilities for the namespaces it owns,
+	 * and the mount namespace last, as it also changes the root and cwd.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (attr == NULL || attr->container == NULL) {
+		return 0;
+	}
+	const struct cth_container *container = attr->container;
+	for (int i = 0; i < CTH_NS_COUNT; i++) {
+		// The pid namespace was handled by cth_container_fork().
+		if (i == CTH_NS_PID || container->ns_fd[i] < 0) {
+			continue;
+		}
+		if (setns(container->ns_fd[i], cth_ns_types[i]) < 0) {
+			return -1;
+		}
+	}
+	if (container->root_fd >= 0) {
+		if (fchdir(container->root_fd) < 0 || chroot(".") < 0 || chdir("/") < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
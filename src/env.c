@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+extern char **environ;
+static ssize_t cth_env_find(const struct cth_env *env, const char *key, size_t key_len)
+{
+	/*
+	 * Find key in the overlay entries.
+	 * Returns the index, or -1 if not found.
+	 */
+	for (size_t i = 0; i < env->count; i++) {
+		if (strncmp(env->keys[i], key, key_len) == 0 && env->keys[i][key_len] == 0) {
+			return (ssize_t)i;
+		}
+	}
+	return -1;
+}
+static int cth_env_put(struct cth_env *env, const char *key, const char *value)
+{
+	/*
+	 * Add or replace an overlay entry, value == NULL means unset.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (key == NULL || key[0] == 0 || strchr(key, '=') != NULL) {
+		return -1;
+	}
+	char *entry = NULL;
+	if (value != NULL) {
+		size_t key_len = strlen(key);
+		size_t value_len = strlen(value);
+		entry = malloc(key_len + value_len + 2);
+		if (entry == NULL) {
+			return -1;
+		}
+		memcpy(entry, key, key_len);
+		entry[key_len] = '=';
+		memcpy(entry + key_len + 1, value, value_len + 1);
+	}
+	ssize_t i = cth_env_find(env, key, strlen(key));
+	if (i >= 0) {
+		free(env->values[i]);
+		env->values[i] = entry;
+	} else {
+		char **new_keys = realloc(env->keys, sizeof(char *) * (env->count + 1));
+		if (new_keys == NULL) {
+			free(entry);
+			return -1;
+		}
+		env->keys = new_keys;
+		char **new_values = realloc(env->values, sizeof(char *) * (env->count + 1));
+		if (new_values == NULL) {
+			free(entry);
+			return -1;
+		}
+		env->values = new_values;
+		env->keys[env->count] = strdup(key);
+		if (env->keys[env->count] == NULL) {
+			free(entry);
+			return -1;
+		}
+		env->values[env->count] = entry;
+		env->count++;
+	}
+	// The compiled envp is outdated now.
+	free(env->envp);
+	env->envp = NULL;
+	return 0;
+}
+// API function.
+struct cth_env *cth_new_env(void)
+{
+	/*
+	 * Allocate an empty environment overlay, it inherits environ as is.
+	 * Returns the overlay on success, NULL on failure.
+	 * The caller is responsible for freeing it using cth_free_env().
+	 */
+	struct cth_env *env = malloc(sizeof(struct cth_env));
+	if (env == NULL) {
+		return NULL;
+	}
+	env->clear = false;
+	env->keys = NULL;
+	env->values = NULL;
+	env->count = 0;
+	env->envp = NULL;
+	return env;
+}
+// API function.
+int cth_env_set(struct cth_env *env, const char *key, const char *value)
+{
+	/*
+	 * Set key=value in the child, without touching environ of the current process.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (env == NULL || value == NULL) {
+		return -1;
+	}
+	return cth_env_put(env, key, value);
+}
+// API function.
+int cth_env_unset(struct cth_env *env, const char *key)
+{
+	/*
+	 * Remove key from the environment of the child.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (env == NULL) {
+		return -1;
+	}
+	return cth_env_put(env, key, NULL);
+}
+// API function.
+void cth_env_clear(struct cth_env *env)
+{
+	/*
+	 * Do not inherit environ, the child only gets the variables set by cth_env_set().
+	 */
+	if (env == NULL) {
+		return;
+	}
+	env->clear = true;
+	free(env->envp);
+	env->envp = NULL;
+}
+static char **cth_env_merge(const struct cth_env *env)
+{
+	/*
+	 * Merge the overlay with the current environ into a new envp.
+	 * Returns the envp, NULL on failure.
+	 */
+	size_t base = 0;
+	if (!env->clear && environ != NULL) {
+		while (environ[base] != NULL) {
+			base++;
+		}
+	}
+	char **envp = malloc(sizeof(char *) * (base + env->count + 1));
+	if (envp == NULL) {
+		return NULL;
+	}
+	size_t n = 0;
+	// Inherited variables, unless overridden or unset by the overlay.
+	for (size_t i = 0; i < base; i++) {
+		const char *eq = strchr(environ[i], '=');
+		size_t key_len = eq != NULL ? (size_t)(eq - environ[i]) : strlen(environ[i]);
+		if (env->count == 0 || cth_env_find(env, environ[i], key_len) < 0) {
+			envp[n++] = environ[i];
+		}
+	}
+	// Variables set by the overlay.
+	for (size_t i = 0; i < env->count; i++) {
+		if (env->values[i] != NULL) {
+			envp[n++] = env->values[i];
+		}
+	}
+	envp[n] = NULL;
+	return envp;
+}
+// API function.
+int cth_env_compile(struct cth_env *env)
+{
+	/*
+	 * Merge the overlay with the current environ into a prebuilt envp.
+	 * The envp is reused by every exec with this overlay until it's changed again,
+	 * so compile it once before using the same overlay for many commands or from many threads.
+	 * If not compiled, every exec merges it again before its fork().
+	 * Note: environ is copied by pointer, so compile it again after setenv() in the current process.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (env == NULL) {
+		return -1;
+	}
+	char **envp = cth_env_merge(env);
+	if (envp == NULL) {
+		return -1;
+	}
+	free(env->envp);
+	env->envp = envp;
+	return 0;
+}
+char **cth_env_prepare(const struct cth_exec_attr *attr, char ***owned)
+{
+	/*
+	 * Get the envp of a child before fork(), so that the child only reads it, and does not allocate.
+	 * An overlay not compiled yet is merged into a new envp for this exec only, without changing the overlay,
+	 * it's set in *owned, for the caller to free after fork(), *owned is NULL otherwise.
+	 * Returns the envp, NULL on failure.
+	 */
+	*owned = NULL;
+	if (attr == NULL || attr->env == NULL) {
+		// environ is NULL after clearenv(), the child gets an empty environment then.
+		static char *empty[] = { NULL };
+		return environ != NULL ? environ : empty;
+	}
+	if (attr->env->envp != NULL) {
+		return attr->env->envp;
+	}
+	*owned = cth_env_merge(attr->env);
+	return *owned;
+}
+// API function.
+void cth_free_env(struct cth_env **env)
+{
+	/*
+	 * Free the overlay and the compiled envp.
+	 * After calling this function, *env will be set to NULL.
+	 */
+	if (*env == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < (*env)->count; i++) {
+		free((*env)->keys[i]);
+		free((*env)->values[i]);
+	}
+	free((*env)->keys);
+	free((*env)->values);
+	free((*env)->envp);
+	free(*env);
+	*env = NULL;
+}
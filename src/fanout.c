@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// Fan-out of one input stream to many commands.
+// The input is spliced into a source pipe, and each round of it is duplicated with tee() into a
+// middle pipe per command, then spliced from there into the stdin pipe of the command.
+// tee() always copies from the head of the source pipe, so a command that takes only a part of a round
+// would need an offset it can not have. The middle pipes are empty at the start of each round, and have
+// at least as many slots as the source pipe, so tee() always copies the whole round.
+// The next round starts when every command took the last one, so the slowest one sets the pace.
+// The data is never copied into user space.
+// Size of the source pipe, the middle pipes get the same size.
+#define CTH_FANOUT_PIPE_SIZE (1024 * 1024)
+struct cth_fanout_child {
+	pid_t pid;
+	// Middle pipe.
+	int mid[2];
+	// Write end of the stdin pipe of the command, -1 after closed.
+	int in;
+	// Bytes of the current round still in mid.
+	size_t pending;
+	int stdout_fd;
+	int stderr_fd;
+	struct cth_cgroup cg;
+	struct cth_perf perf;
+	struct cth_metrics_series *metrics;
+	uint64_t start_ms;
+	// For tracing.
+	const char *argv0;
+	uint64_t spawned_us;
+	uint64_t fed;
+	// For recording.
+	char **argv;
+	uint64_t record_us;
+};
+static void cth_fanout_close(struct cth_fanout_child *c)
+{
+	/*
+	 * Stop feeding the command, it gets EOF on stdin.
+	 */
+	if (c->in >= 0) {
+		close(c->in);
+		c->in = -1;
+		cth_trace_span(CTH_TRACE_STDIN, c->argv0, c->pid, c->spawned_us, cth_trace_clock(), (int64_t)c->fed);
+	}
+	c->pending = 0;
+}
+static size_t cth_fanout_size_pipes(int src[2], struct cth_fanout_child *children, size_t n)
+{
+	/*
+	 * Give the source pipe and the middle pipes the same size, as large as we are allowed to.
+	 * Returns the size.
+	 */
+	long size = fcntl(src[1], F_SETPIPE_SZ, CTH_FANOUT_PIPE_SIZE);
+	if (size < 0) {
+		size = fcntl(src[1], F_GETPIPE_SZ);
+	}
+	for (size_t i = 0; i < n; i++) {
+		long got = fcntl(children[i].mid[1], F_SETPIPE_SZ, size);
+		if (got < size) {
+			// Over the per-user limit, shrink the source pipe to match, shrinking an empty pipe works.
+			got = fcntl(children[i].mid[1], F_GETPIPE_SZ);
+			size = fcntl(src[1], F_SETPIPE_SZ, got);
+		}
+	}
+	// The middle pipes set before a shrink are larger, which is fine.
+	return (size_t)size;
+}
+static pid_t cth_fanout_spawn(char **argv, struct cth_fanout_child *c, bool get_output, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Start one command, with the read end of a new pipe as stdin.
+	 * Returns the pid, or -1 on failure.
+	 */
+	int stdin_pipe[2] = { -1, -1 };
+	if (pipe2(stdin_pipe, O_CLOEXEC) < 0) {
+		return -1;
+	}
+	if (get_output) {
+		c->stdout_fd = memfd_create("cth_stdout", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		c->stderr_fd = memfd_create("cth_stderr", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		uint64_t max_output = attr != NULL && attr->max_output > 0 ? attr->max_output : CTH_MAX_OUTPUT_SIZE;
+		if (c->stdout_fd >= 0 && c->stderr_fd >= 0 && max_output != CTH_OUTPUT_UNLIMITED) {
+			ftruncate(c->stdout_fd, (off_t)max_output);
+			ftruncate(c->stderr_fd, (off_t)max_output);
+			fcntl(c->stdout_fd, F_ADD_SEALS, F_SEAL_GROW);
+			fcntl(c->stderr_fd, F_ADD_SEALS, F_SEAL_GROW);
+		}
+	}
+	uint64_t spawn_start = cth_metrics_clock();
+	uint64_t trace_start = cth_trace_clock();
+	c->record_us = cth_record_clock();
+	pid_t pid = -1;
+	char **env_owned = NULL;
+	char **envp = cth_env_prepare(attr, &env_owned);
+	if (envp != NULL && (!get_output || (c->stdout_fd >= 0 && c->stderr_fd >= 0)) && cth_cgroup_open(attr, &c->cg) == 0) {
+		pid = cth_perf_fork(attr, &c->cg, &c->perf);
+	}
+	if (pid == 0) {
+		int devnull_fd = cth_get_runtime()->devnull_fd;
+		dup2(stdin_pipe[0], STDIN_FILENO);
+		dup2(get_output ? c->stdout_fd : devnull_fd, STDOUT_FILENO);
+		dup2(get_output ? c->stderr_fd : devnull_fd, STDERR_FILENO);
+		cth_child_exec(argv, attr, envp);
+		_exit(CTH_EXIT_FAILURE);
+	}
+	free(env_owned);
+	close(stdin_pipe[0]);
+	if (pid < 0) {
+		cth_metrics_spawned(argv[0], spawn_start, false);
+		close(stdin_pipe[1]);
+		return -1;
+	}
+	c->metrics = cth_metrics_spawned(argv[0], spawn_start, true);
+	c->start_ms = cth_now_ms();
+	c->argv0 = argv[0];
+	c->argv = argv;
+	c->spawned_us = cth_trace_clock();
+	cth_trace_span(CTH_TRACE_SPAWN, argv[0], pid, trace_start, c->spawned_us, 0);
+	c->in = stdin_pipe[1];
+	fcntl(c->in, F_SETFL, O_NONBLOCK);
+	return pid;
+}
+static bool cth_fanout_round(int input_fd, int src[2], struct cth_fanout_child *children, size_t n, size_t size)
+{
+	/*
+	 * Move the next round of input into the source pipe, and duplicate it into the middle pipes.
+	 * Returns false at EOF of the input.
+	 */
+	ssize_t len = splice(input_fd, NULL, src[1], NULL, size, SPLICE_F_MOVE);
+	while (len < 0 && errno == EINTR) {
+		len = splice(input_fd, NULL, src[1], NULL, size, SPLICE_F_MOVE);
+	}
+	if (len < 0 && errno == EINVAL) {
+		// input_fd does not support splice(), copy the round in, the pipe is large enough to take it at once.
+		char buf[65536];
+		len = read(input_fd, buf, sizeof(buf));
+		if (len > 0 && write(src[1], buf, (size_t)len) != len) {
+			len = -1;
+		}
+	}
+	if (len <= 0) {
+		return false;
+	}
+	// The last command that still reads gets the round moved instead of copied.
+	size_t last = n;
+	for (size_t i = 0; i < n; i++) {
+		if (children[i].in >= 0) {
+			last = i;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		struct cth_fanout_child *c = &children[i];
+		if (c->in < 0) {
+			continue;
+		}
+		ssize_t done = i == last ? splice(src[0], NULL, c->mid[1], NULL, (size_t)len, SPLICE_F_MOVE) : tee(src[0], c->mid[1], (size_t)len, 0);
+		if (done != len) {
+			// Can not happen, as the middle pipe is empty and as large as the source pipe.
+			cth_fanout_close(c);
+			continue;
+		}
+		c->pending = (size_t)len;
+	}
+	if (last == n) {
+		// Nobody reads any more, drop the round.
+		char drop[4096];
+		for (ssize_t left = len; left > 0;) {
+			ssize_t ret = read(src[0], drop, (size_t)left < sizeof(drop) ? (size_t)left : sizeof(drop));
+			if (ret <= 0) {
+				break;
+			}
+			left -= ret;
+		}
+	}
+	return true;
+}
+static bool cth_fanout_pump(int input_fd, int src[2], struct cth_fanout_child *children, size_t n, size_t size, uint64_t deadline_ms)
+{
+	/*
+	 * Feed the input to all the commands, until EOF or until none of them reads any more.
+	 * All the stdin pipes are closed before return.
+	 * Returns true if the deadline is reached.
+	 */
+	bool eof = false;
+	struct pollfd *pfd = malloc(n * sizeof(struct pollfd));
+	size_t *idx = malloc(n * sizeof(size_t));
+	bool timed_out = false;
+	while (pfd != NULL && idx != NULL) {
+		nfds_t nfds = 0;
+		size_t reading = 0;
+		for (size_t i = 0; i < n; i++) {
+			struct cth_fanout_child *c = &children[i];
+			if (c->in < 0) {
+				continue;
+			}
+			reading++;
+			if (c->pending > 0) {
+				pfd[nfds].fd = c->in;
+				pfd[nfds].events = POLLOUT;
+				idx[nfds++] = i;
+			} else if (eof) {
+				cth_fanout_close(c);
+			}
+		}
+		if (reading == 0 || (eof && nfds == 0)) {
+			break;
+		}
+		int timeout = -1;
+		if (deadline_ms > 0) {
+			uint64_t now = cth_now_ms();
+			if (now >= deadline_ms) {
+				timed_out = true;
+				break;
+			}
+			timeout = deadline_ms - now > INT_MAX ? INT_MAX : (int)(deadline_ms - now);
+		}
+		if (nfds == 0) {
+			// Everyone took the last round, wait for more input, a regular file is always readable.
+			struct pollfd in_pfd = { input_fd, POLLIN, 0 };
+			if (timeout >= 0 && poll(&in_pfd, 1, timeout) == 0) {
+				continue;
+			}
+			eof = !cth_fanout_round(input_fd, src, children, n, size);
+			continue;
+		}
+		if (poll(pfd, nfds, timeout) < 0 && errno != EINTR) {
+			break;
+		}
+		for (nfds_t j = 0; j < nfds; j++) {
+			if (pfd[j].revents == 0) {
+				continue;
+			}
+			struct cth_fanout_child *c = &children[idx[j]];
+			ssize_t moved = splice(c->mid[0], NULL, c->in, NULL, c->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (moved > 0) {
+				c->pending -= (size_t)moved;
+				c->fed += (uint64_t)moved;
+			} else if (moved < 0 && errno != EAGAIN && errno != EINTR) {
+				// EPIPE, the command does not want more input, the others go on without it.
+				cth_fanout_close(c);
+			}
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		cth_fanout_close(&children[i]);
+	}
+	free(pfd);
+	free(idx);
+	return timed_out;
+}
+static struct cth_result *cth_fanout_reap(struct cth_fanout_child *c, bool get_output, const struct cth_exec_attr *attr, uint64_t deadline_ms, bool timed_out)
+{
+	/*
+	 * Wait for one command, and build its result.
+	 * Returns NULL on failure.
+	 */
+	int status = 0;
+	struct rusage ru;
+	memset(&ru, 0, sizeof(ru));
+	if (!timed_out && cth_waitpid(c->pid, &status, &ru, deadline_ms) == 0) {
+		timed_out = true;
+	}
+	if (timed_out) {
+		cth_kill_job(c->pid, &c->cg);
+		cth_waitpid(c->pid, &status, &ru, 0);
+	}
+	uint64_t reaped_us = cth_trace_clock();
+	cth_trace_span(CTH_TRACE_RUNNING, c->argv0, c->pid, c->spawned_us, reaped_us, 0);
+	struct cth_result *res = cth_new();
+	if (res == NULL) {
+		cth_metrics_finished(c->metrics, NULL, get_output);
+		return NULL;
+	}
+	res->pid = c->pid;
+	res->timed_out = timed_out;
+	res->time_used_ms = cth_now_ms() - c->start_ms;
+	res->time_used = (useconds_t)(res->time_used_ms * 1000);
+	res->cgroup_stat = cth_cgroup_read_stat(&c->cg);
+	res->perf_stat = cth_perf_collect(&c->perf, NULL);
+	cth_set_status(res, status, &ru, attr);
+	cth_trace_span(CTH_TRACE_REAPED, c->argv0, c->pid, reaped_us, reaped_us, res->exit_code);
+	if (get_output) {
+		// The child shares the file offset with us, so the offset is the size of output.
+		off_t stdout_len = lseek(c->stdout_fd, 0, SEEK_CUR);
+		off_t stderr_len = lseek(c->stderr_fd, 0, SEEK_CUR);
+		res->stdout_total = stdout_len > 0 ? (uint64_t)stdout_len : 0;
+		res->stderr_total = stderr_len > 0 ? (uint64_t)stderr_len : 0;
+		size_t stdout_read = (size_t)res->stdout_total;
+		size_t stderr_read = (size_t)res->stderr_total;
+		res->stdout_ret = cth_read_fd(c->stdout_fd, &stdout_read);
+		res->stderr_ret = cth_read_fd(c->stderr_fd, &stderr_read);
+		res->stdout_len = stdout_read;
+		res->stderr_len = stderr_read;
+		cth_trace_span(CTH_TRACE_DRAIN, c->argv0, c->pid, reaped_us, cth_trace_clock(), (int64_t)(res->stdout_total + res->stderr_total));
+	}
+	cth_metrics_finished(c->metrics, res, get_output);
+	cth_record_finished(c->argv, c->record_us, res, c->fed, (get_output ? CTH_RECORD_OUTPUT : 0) | CTH_RECORD_INPUT);
+	return res;
+}
+// API function.
+int cth_exec_fanout(char **const argv_list[], size_t n, int input_fd, bool get_output, const struct cth_exec_attr *attr, struct cth_result *res[])
+{
+	/*
+	 * Exec n commands in blocking mode, and feed the same input to all of them, without copying it in user space.
+	 * argv_list: n commands, each a NULL-terminated array of strings.
+	 * input_fd: Read until EOF, a file or a pipe, anything splice(2) can read from.
+	 * get_output: If true, capture stdout and stderr output of each command.
+	 * attr: Extra attributes for all the commands, can be NULL. capture_mode, hash, cache and jobserver are not used.
+	 * res: Array of n, filled with the results, in the order of argv_list, NULL for a command that failed to start.
+	 *      The caller is responsible for freeing them using cth_free_result().
+	 * A command that exits or closes stdin early just stops getting input, the others go on.
+	 * timeout_ms covers the whole fan-out, all the commands are killed when it's reached.
+	 * Returns 0 on success, -1 if nothing could be started.
+	 */
+	if (argv_list == NULL || n == 0 || input_fd < 0 || res == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		res[i] = NULL;
+		if (argv_list[i] == NULL || argv_list[i][0] == NULL) {
+			return -1;
+		}
+	}
+	int src[2] = { -1, -1 };
+	struct cth_fanout_child *children = calloc(n, sizeof(struct cth_fanout_child));
+	if (children == NULL || pipe2(src, O_CLOEXEC) < 0) {
+		free(children);
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		children[i].pid = -1;
+		children[i].mid[0] = -1;
+		children[i].mid[1] = -1;
+		children[i].in = -1;
+		children[i].stdout_fd = -1;
+		children[i].stderr_fd = -1;
+		children[i].cg.fd = -1;
+		cth_perf_init(&children[i].perf);
+	}
+	uint64_t deadline_ms = cth_deadline(attr);
+	signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE, handle EPIPE error instead.
+	size_t started = 0;
+	for (size_t i = 0; i < n; i++) {
+		struct cth_fanout_child *c = &children[i];
+		if (pipe2(c->mid, O_CLOEXEC) < 0) {
+			c->mid[0] = -1;
+			c->mid[1] = -1;
+			continue;
+		}
+		c->pid = cth_fanout_spawn(argv_list[i], c, get_output, attr);
+		started += c->pid > 0;
+	}
+	if (started > 0) {
+		size_t size = cth_fanout_size_pipes(src, children, n);
+		bool timed_out = cth_fanout_pump(input_fd, src, children, n, size, deadline_ms);
+		for (size_t i = 0; i < n; i++) {
+			if (children[i].pid > 0) {
+				res[i] = cth_fanout_reap(&children[i], get_output, attr, deadline_ms, timed_out);
+			}
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		struct cth_fanout_child *c = &children[i];
+		int fds[4] = { c->mid[0], c->mid[1], c->stdout_fd, c->stderr_fd };
+		for (int j = 0; j < 4; j++) {
+			if (fds[j] >= 0) {
+				close(fds[j]);
+			}
+		}
+		cth_cgroup_close(&c->cg);
+		cth_perf_close(&c->perf);
+	}
+	close(src[0]);
+	close(src[1]);
+	free(children);
+	return started > 0 ? 0 : -1;
+}
@@ -0,0 +1,598 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <pthread.h>
+// Dependency graph executor.
+// Ready nodes are run by a pool of worker threads, each with its own deque of ready nodes:
+// the owner pushes and pops at the bottom, so a dependent runs right after its dependency on the same worker,
+// and idle workers steal the oldest nodes from the top of the other deques.
+struct cth_graph_node {
+	char **argv;
+	const struct cth_exec_attr *attr;
+	char *input;
+	// All the dependencies, and the ones whose stdout is piped into stdin, in order.
+	int *deps;
+	size_t dep_count;
+	int *pipes;
+	size_t pipe_count;
+	int *dependents;
+	size_t dependent_count;
+	// Run state.
+	int pending_deps;
+	bool dep_failed;
+	int state;
+	struct cth_result *res;
+	uint64_t start_ms;
+	uint64_t end_ms;
+};
+struct cth_graph_deque {
+	pthread_mutex_t lock;
+	int *items;
+	// items[top] is the oldest, items[bottom - 1] is the newest, never wraps as each node is pushed once per run.
+	size_t top;
+	size_t bottom;
+};
+struct cth_graph {
+	struct cth_graph_node *nodes;
+	size_t count;
+	// Run state.
+	struct cth_graph_deque *deques;
+	size_t worker_count;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int ready;
+	int remaining;
+	int policy;
+	bool cancel;
+	uint64_t start_ms;
+};
+struct cth_graph_worker {
+	struct cth_graph *graph;
+	size_t id;
+};
+static int cth_graph_append(int **array, size_t *count, int value)
+{
+	/*
+	 * Append value to a growable int array.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int *new_array = realloc(*array, sizeof(int) * (*count + 1));
+	if (new_array == NULL) {
+		return -1;
+	}
+	new_array[(*count)++] = value;
+	*array = new_array;
+	return 0;
+}
+static void cth_graph_push(struct cth_graph *graph, size_t worker, int node)
+{
+	/*
+	 * Push a ready node to the bottom of a worker's deque, and wake up an idle worker.
+	 */
+	struct cth_graph_deque *deque = &graph->deques[worker];
+	pthread_mutex_lock(&deque->lock);
+	deque->items[deque->bottom++] = node;
+	pthread_mutex_unlock(&deque->lock);
+	pthread_mutex_lock(&graph->lock);
+	graph->ready++;
+	pthread_cond_signal(&graph->cond);
+	pthread_mutex_unlock(&graph->lock);
+}
+static int cth_graph_take(struct cth_graph *graph, size_t worker)
+{
+	/*
+	 * Pop the newest node of our own deque, or steal the oldest node of another worker.
+	 * Returns the node, or -1 if there's nothing to do.
+	 */
+	for (size_t i = 0; i < graph->worker_count; i++) {
+		size_t victim = (worker + i) % graph->worker_count;
+		struct cth_graph_deque *deque = &graph->deques[victim];
+		int node = -1;
+		pthread_mutex_lock(&deque->lock);
+		if (deque->top < deque->bottom) {
+			node = i == 0 ? deque->items[--deque->bottom] : deque->items[deque->top++];
+		}
+		pthread_mutex_unlock(&deque->lock);
+		if (node >= 0) {
+			pthread_mutex_lock(&graph->lock);
+			graph->ready--;
+			pthread_mutex_unlock(&graph->lock);
+			return node;
+		}
+	}
+	return -1;
+}
+static char *cth_graph_input(const struct cth_graph *graph, const struct cth_graph_node *node, struct cth_input *in)
+{
+	/*
+	 * Concatenate the stdout of the piped dependencies into in.
+	 * The output may contain NUL bytes, so it's measured by stdout_len, not strlen(),
+	 * and not stdout_total either, which also counts the bytes not kept by a tail or max_output.
+	 * Returns the buffer to free, or NULL on failure.
+	 */
+	size_t len = 0;
+	for (size_t i = 0; i < node->pipe_count; i++) {
+		const struct cth_result *res = graph->nodes[node->pipes[i]].res;
+		len += res != NULL && res->stdout_ret != NULL ? (size_t)res->stdout_len : 0;
+	}
+	char *buf = malloc(len + 1);
+	if (buf == NULL) {
+		return NULL;
+	}
+	len = 0;
+	for (size_t i = 0; i < node->pipe_count; i++) {
+		const struct cth_result *res = graph->nodes[node->pipes[i]].res;
+		if (res != NULL && res->stdout_ret != NULL) {
+			memcpy(buf + len, res->stdout_ret, (size_t)res->stdout_len);
+			len += (size_t)res->stdout_len;
+		}
+	}
+	buf[len] = 0;
+	in->fd = -1;
+	in->buf = buf;
+	in->len = len;
+	in->produce = NULL;
+	in->ctx = NULL;
+	return buf;
+}
+static struct cth_result *cth_graph_exec(const struct cth_graph *graph, const struct cth_graph_node *node)
+{
+	/*
+	 * Run the command of node, with the piped output as stdin if any.
+	 * The piped input goes to cth_exec_block_with_input() by length, like a shard chunk,
+	 * so it does not go through the result cache.
+	 */
+	if (node->pipe_count == 0) {
+		return cth_exec_with_attr(node->argv, node->input, true, true, node->attr);
+	}
+	struct cth_input in;
+	char *buf = cth_graph_input(graph, node, &in);
+	if (buf == NULL) {
+		return NULL;
+	}
+	int token = -1;
+	struct cth_result *res = NULL;
+	if (node->attr == NULL || node->attr->jobserver == NULL || (token = cth_jobserver_acquire(node->attr->jobserver)) >= 0) {
+		res = cth_exec_block_with_input(node->argv, &in, true, NULL, 0, node->attr, -1, -1, NULL);
+	}
+	if (token >= 0) {
+		cth_jobserver_release(node->attr->jobserver, token);
+	}
+	free(buf);
+	return res;
+}
+static void cth_graph_run_node(struct cth_graph *graph, size_t worker, int id)
+{
+	/*
+	 * Run a ready node, or skip it, then release its dependents.
+	 */
+	struct cth_graph_node *node = &graph->nodes[id];
+	node->start_ms = cth_now_ms() - graph->start_ms;
+	if (__atomic_load_n(&node->dep_failed, __ATOMIC_ACQUIRE) || __atomic_load_n(&graph->cancel, __ATOMIC_ACQUIRE)) {
+		node->state = CTH_GRAPH_SKIPPED;
+	} else {
+		node->res = cth_graph_exec(graph, node);
+		node->state = CTH_EXEC_SUCCEED(node->res) ? CTH_GRAPH_SUCCEEDED : CTH_GRAPH_FAILED;
+		if (node->state == CTH_GRAPH_FAILED && graph->policy == CTH_GRAPH_FAIL_FAST) {
+			__atomic_store_n(&graph->cancel, true, __ATOMIC_RELEASE);
+		}
+	}
+	node->end_ms = cth_now_ms() - graph->start_ms;
+	for (size_t i = 0; i < node->dependent_count; i++) {
+		struct cth_graph_node *dependent = &graph->nodes[node->dependents[i]];
+		if (node->state != CTH_GRAPH_SUCCEEDED) {
+			__atomic_store_n(&dependent->dep_failed, true, __ATOMIC_RELEASE);
+		}
+		if (__atomic_sub_fetch(&dependent->pending_deps, 1, __ATOMIC_ACQ_REL) == 0) {
+			cth_graph_push(graph, worker, node->dependents[i]);
+		}
+	}
+	pthread_mutex_lock(&graph->lock);
+	if (--graph->remaining == 0) {
+		pthread_cond_broadcast(&graph->cond);
+	}
+	pthread_mutex_unlock(&graph->lock);
+}
+static void *cth_graph_worker(void *arg)
+{
+	struct cth_graph_worker *self = arg;
+	struct cth_graph *graph = self->graph;
+	while (true) {
+		int id = cth_graph_take(graph, self->id);
+		if (id >= 0) {
+			cth_graph_run_node(graph, self->id, id);
+			continue;
+		}
+		pthread_mutex_lock(&graph->lock);
+		while (graph->remaining > 0 && graph->ready == 0) {
+			pthread_cond_wait(&graph->cond, &graph->lock);
+		}
+		bool done = graph->remaining == 0;
+		pthread_mutex_unlock(&graph->lock);
+		if (done) {
+			return NULL;
+		}
+	}
+}
+static bool cth_graph_acyclic(const struct cth_graph *graph)
+{
+	/*
+	 * Kahn's algorithm, check that all the nodes can be ordered.
+	 */
+	int *pending = malloc(sizeof(int) * (graph->count + 1));
+	int *queue = malloc(sizeof(int) * (graph->count + 1));
+	if (pending == NULL || queue == NULL) {
+		free(pending);
+		free(queue);
+		return false;
+	}
+	size_t head = 0;
+	size_t tail = 0;
+	for (size_t i = 0; i < graph->count; i++) {
+		pending[i] = (int)graph->nodes[i].dep_count;
+		if (pending[i] == 0) {
+			queue[tail++] = (int)i;
+		}
+	}
+	while (head < tail) {
+		const struct cth_graph_node *node = &graph->nodes[queue[head++]];
+		for (size_t i = 0; i < node->dependent_count; i++) {
+			if (--pending[node->dependents[i]] == 0) {
+				queue[tail++] = node->dependents[i];
+			}
+		}
+	}
+	free(pending);
+	free(queue);
+	return tail == graph->count;
+}
+// API function.
+struct cth_graph *cth_new_graph(void)
+{
+	/*
+	 * Allocate an empty command graph.
+	 * Returns NULL on failure.
+	 * The caller is responsible for freeing it using cth_free_graph().
+	 */
+	struct cth_graph *graph = calloc(1, sizeof(struct cth_graph));
+	if (graph == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&graph->lock, NULL);
+	pthread_cond_init(&graph->cond, NULL);
+	return graph;
+}
+// API function.
+int cth_graph_add(struct cth_graph *graph, char **argv, char *input, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Add a command to the graph, argv and input are copied, attr is not and must outlive the graph.
+	 * input: stdin of the command, can be NULL, ignored if any dependency is piped into it.
+	 * Returns the node id, or -1 on failure.
+	 */
+	if (graph == NULL || argv == NULL || argv[0] == NULL) {
+		return -1;
+	}
+	struct cth_graph_node *nodes = realloc(graph->nodes, sizeof(struct cth_graph_node) * (graph->count + 1));
+	if (nodes == NULL) {
+		return -1;
+	}
+	graph->nodes = nodes;
+	struct cth_graph_node *node = &nodes[graph->count];
+	memset(node, 0, sizeof(struct cth_graph_node));
+	for (size_t i = 0; argv[i] != NULL; i++) {
+		if (cth_add_arg(&node->argv, argv[i]) < 0) {
+			cth_free_argv(&node->argv);
+			return -1;
+		}
+	}
+	if (input != NULL) {
+		node->input = strdup(input);
+		if (node->input == NULL) {
+			cth_free_argv(&node->argv);
+			return -1;
+		}
+	}
+	node->attr = attr;
+	node->state = CTH_GRAPH_PENDING;
+	return (int)graph->count++;
+}
+// API function.
+int cth_graph_depend(struct cth_graph *graph, int node, int dep)
+{
+	/*
+	 * node runs after dep succeeded.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (graph == NULL || node < 0 || dep < 0 || (size_t)node >= graph->count || (size_t)dep >= graph->count || node == dep) {
+		return -1;
+	}
+	if (cth_graph_append(&graph->nodes[node].deps, &graph->nodes[node].dep_count, dep) < 0) {
+		return -1;
+	}
+	if (cth_graph_append(&graph->nodes[dep].dependents, &graph->nodes[dep].dependent_count, node) < 0) {
+		graph->nodes[node].dep_count--;
+		return -1;
+	}
+	return 0;
+}
+// API function.
+int cth_graph_pipe(struct cth_graph *graph, int node, int from)
+{
+	/*
+	 * node runs after from succeeded, with the stdout of from as its stdin.
+	 * If there are more than one, their outputs are concatenated in the order they are added.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (cth_graph_depend(graph, node, from) < 0) {
+		return -1;
+	}
+	return cth_graph_append(&graph->nodes[node].pipes, &graph->nodes[node].pipe_count, from);
+}
+// API function.
+int cth_graph_run(struct cth_graph *graph, int slots, int policy)
+{
+	/*
+	 * Run the graph, at most slots commands at the same time.
+	 * slots: 0 for the number of online CPUs, at most 1024.
+	 * policy: CTH_GRAPH_FAIL_FAST to skip everything not started after a failure,
+	 *         CTH_GRAPH_KEEP_GOING to skip only the nodes depending on a failed one.
+	 * Returns 0 if all nodes succeeded, the number of failed and skipped nodes otherwise,
+	 * or -1 if the graph has a cycle or on failure.
+	 * The graph can be run again, the previous results are freed.
+	 */
+	if (graph == NULL || !cth_graph_acyclic(graph)) {
+		return -1;
+	}
+	if (graph->count == 0) {
+		return 0;
+	}
+	size_t workers = slots > 0 ? (size_t)slots : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers == 0) {
+		workers = 1;
+	}
+	if (workers > 1024) {
+		workers = 1024;
+	}
+	if (workers > graph->count) {
+		workers = graph->count;
+	}
+	graph->deques = calloc(workers, sizeof(struct cth_graph_deque));
+	pthread_t *threads = calloc(workers, sizeof(pthread_t));
+	struct cth_graph_worker *args = calloc(workers, sizeof(struct cth_graph_worker));
+	if (graph->deques == NULL || threads == NULL || args == NULL) {
+		free(graph->deques);
+		graph->deques = NULL;
+		free(threads);
+		free(args);
+		return -1;
+	}
+	graph->worker_count = workers;
+	for (size_t i = 0; i < workers; i++) {
+		pthread_mutex_init(&graph->deques[i].lock, NULL);
+		graph->deques[i].items = malloc(sizeof(int) * graph->count);
+	}
+	// Reset the run state, and spread the roots over the workers.
+	graph->ready = 0;
+	graph->remaining = (int)graph->count;
+	graph->policy = policy;
+	graph->cancel = false;
+	graph->start_ms = cth_now_ms();
+	size_t next = 0;
+	for (size_t i = 0; i < graph->count; i++) {
+		struct cth_graph_node *node = &graph->nodes[i];
+		cth_free_result(&node->res);
+		node->pending_deps = (int)node->dep_count;
+		node->dep_failed = false;
+		node->state = CTH_GRAPH_PENDING;
+		node->start_ms = 0;
+		node->end_ms = 0;
+	}
+	bool failed = false;
+	for (size_t i = 0; i < workers; i++) {
+		failed = failed || graph->deques[i].items == NULL;
+	}
+	// Pushed backwards, as the owner pops the newest first, so the roots start in the order they were added.
+	for (size_t i = graph->count; i > 0 && !failed; i--) {
+		if (graph->nodes[i - 1].dep_count == 0) {
+			struct cth_graph_deque *deque = &graph->deques[next++ % workers];
+			deque->items[deque->bottom++] = (int)(i - 1);
+			graph->ready++;
+		}
+	}
+	size_t started = 0;
+	for (; started < workers && !failed; started++) {
+		args[started].graph = graph;
+		args[started].id = started;
+		if (pthread_create(&threads[started], NULL, cth_graph_worker, &args[started]) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		failed = true;
+	}
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (size_t i = 0; i < workers; i++) {
+		pthread_mutex_destroy(&graph->deques[i].lock);
+		free(graph->deques[i].items);
+	}
+	free(graph->deques);
+	graph->deques = NULL;
+	free(threads);
+	free(args);
+	if (failed) {
+		return -1;
+	}
+	int not_succeeded = 0;
+	for (size_t i = 0; i < graph->count; i++) {
+		not_succeeded += graph->nodes[i].state != CTH_GRAPH_SUCCEEDED;
+	}
+	return not_succeeded;
+}
+// API function.
+int cth_graph_state(const struct cth_graph *graph, int node)
+{
+	/*
+	 * Get the CTH_GRAPH_* state of a node, -1 for invalid node.
+	 */
+	if (graph == NULL || node < 0 || (size_t)node >= graph->count) {
+		return -1;
+	}
+	return graph->nodes[node].state;
+}
+// API function.
+const struct cth_result *cth_graph_result(const struct cth_graph *graph, int node)
+{
+	/*
+	 * Get the result of a node after cth_graph_run(), owned by the graph.
+	 * Returns NULL if the node did not run.
+	 */
+	if (graph == NULL || node < 0 || (size_t)node >= graph->count) {
+		return NULL;
+	}
+	return graph->nodes[node].res;
+}
+// API function.
+int cth_graph_timing(const struct cth_graph *graph, int node, uint64_t *start_ms, uint64_t *end_ms)
+{
+	/*
+	 * Get when the node started and finished, in milliseconds since cth_graph_run() started.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (graph == NULL || node < 0 || (size_t)node >= graph->count) {
+		return -1;
+	}
+	*start_ms = graph->nodes[node].start_ms;
+	*end_ms = graph->nodes[node].end_ms;
+	return 0;
+}
+// API function.
+uint64_t cth_graph_critical_path(const struct cth_graph *graph, int *path, size_t *path_len)
+{
+	/*
+	 * Find the chain of dependencies with the longest total run time of the last run.
+	 * path: Filled with the node ids from the first to the last, should have room for all the nodes, can be NULL.
+	 * path_len: Set to the number of nodes in path, can be NULL.
+	 * Returns the total run time of the path in milliseconds.
+	 */
+	if (path_len != NULL) {
+		*path_len = 0;
+	}
+	if (graph == NULL || graph->count == 0 || !cth_graph_acyclic(graph)) {
+		return 0;
+	}
+	// Longest path ending at each node, in topological order.
+	uint64_t *length = calloc(graph->count, sizeof(uint64_t));
+	int *prev = malloc(sizeof(int) * graph->count);
+	int *pending = malloc(sizeof(int) * graph->count);
+	int *queue = malloc(sizeof(int) * graph->count);
+	if (length == NULL || prev == NULL || pending == NULL || queue == NULL) {
+		free(length);
+		free(prev);
+		free(pending);
+		free(queue);
+		return 0;
+	}
+	size_t head = 0;
+	size_t tail = 0;
+	for (size_t i = 0; i < graph->count; i++) {
+		prev[i] = -1;
+		pending[i] = (int)graph->nodes[i].dep_count;
+		if (pending[i] == 0) {
+			queue[tail++] = (int)i;
+		}
+	}
+	int last = queue[0];
+	while (head < tail) {
+		int id = queue[head++];
+		const struct cth_graph_node *node = &graph->nodes[id];
+		length[id] += node->end_ms - node->start_ms;
+		if (length[id] > length[last]) {
+			last = id;
+		}
+		for (size_t i = 0; i < node->dependent_count; i++) {
+			int dependent = node->dependents[i];
+			if (prev[dependent] < 0 || length[id] > length[dependent]) {
+				length[dependent] = length[id];
+				prev[dependent] = id;
+			}
+			if (--pending[dependent] == 0) {
+				queue[tail++] = dependent;
+			}
+		}
+	}
+	uint64_t total = length[last];
+	if (path != NULL && path_len != NULL) {
+		size_t n = 0;
+		for (int id = last; id >= 0; id = prev[id]) {
+			path[n++] = id;
+		}
+		// Reverse it, from the first to the last.
+		for (size_t i = 0; i < n / 2; i++) {
+			int tmp = path[i];
+			path[i] = path[n - 1 - i];
+			path[n - 1 - i] = tmp;
+		}
+		*path_len = n;
+	}
+	free(length);
+	free(prev);
+	free(pending);
+	free(queue);
+	return total;
+}
+// API function.
+void cth_free_graph(struct cth_graph **graph)
+{
+	/*
+	 * Free the graph, its nodes and their results.
+	 * *graph: Pointer to the graph, can be NULL.
+	 * After calling this function, *graph will be set to NULL.
+	 */
+	if (*graph == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < (*graph)->count; i++) {
+		struct cth_graph_node *node = &(*graph)->nodes[i];
+		cth_free_argv(&node->argv);
+		free(node->input);
+		free(node->deps);
+		free(node->pipes);
+		free(node->dependents);
+		cth_free_result(&node->res);
+	}
+	free((*graph)->nodes);
+	pthread_mutex_destroy(&(*graph)->lock);
+	pthread_cond_destroy(&(*graph)->cond);
+	free(*graph);
+	*graph = NULL;
+}
@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+// Incremental CRC32C, xxHash64 and SHA-256 over the streams of a command.
+// They are fed with the chunks as they pass through the pumps, so the output is never walked twice.
+// CRC32C uses the crc32 instructions of SSE4.2 or ARMv8 if available.
+#define CTH_XXH_P1 11400714785074694791ULL
+#define CTH_XXH_P2 14029467366897019727ULL
+#define CTH_XXH_P3 1609587929392839161ULL
+#define CTH_XXH_P4 9650029242287828579ULL
+#define CTH_XXH_P5 2870177450012600261ULL
+static uint32_t cth_crc32c_table[256];
+static pthread_once_t cth_crc32c_once = PTHREAD_ONCE_INIT;
+static const uint32_t cth_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+static uint64_t cth_load64(const uint8_t *p)
+{
+	/*
+	 * Unaligned little-endian load.
+	 */
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+static uint32_t cth_load32(const uint8_t *p)
+{
+	/*
+	 * Unaligned little-endian load.
+	 */
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+static uint64_t cth_rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+static uint32_t cth_rotr32(uint32_t x, int r)
+{
+	return (x >> r) | (x << (32 - r));
+}
+static void cth_crc32c_init_table(void)
+{
+	/*
+	 * Table for the reflected Castagnoli polynomial.
+	 */
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ (0x82f63b78 & (0U - (crc & 1)));
+		}
+		cth_crc32c_table[i] = crc;
+	}
+}
+static uint32_t cth_crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	/*
+	 * Bytewise table lookup, for CPUs without crc32 instructions.
+	 */
+	pthread_once(&cth_crc32c_once, cth_crc32c_init_table);
+	for (size_t i = 0; i < len; i++) {
+		crc = cth_crc32c_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t cth_crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	/*
+	 * 8 bytes per crc32 instruction, the tail one byte at a time.
+	 */
+	uint64_t c = crc;
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+	}
+	crc = (uint32_t)c;
+	for (; len > 0; p++, len--) {
+		crc = _mm_crc32_u8(crc, *p);
+	}
+	return crc;
+}
+#elif defined(__aarch64__)
+__attribute__((target("arch=armv8-a+crc"))) static uint32_t cth_crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	/*
+	 * 8 bytes per crc32cx instruction, the tail one byte at a time.
+	 */
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32cd(crc, v);
+	}
+	for (; len > 0; p++, len--) {
+		crc = __crc32cb(crc, *p);
+	}
+	return crc;
+}
+#endif
+static bool cth_crc32c_has_hw(void)
+{
+	/*
+	 * Check if the CPU has the crc32 instructions.
+	 */
+#if defined(__x86_64__)
+	return __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__) && defined(HWCAP_CRC32)
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+	return false;
+#endif
+}
+static void cth_xxh64_consume(struct cth_hasher *h, const uint8_t *p)
+{
+	/*
+	 * Feed one 32 bytes stripe into the four accumulators.
+	 */
+	for (int i = 0; i < 4; i++) {
+		h->xxh_v[i] += cth_load64(p + i * 8) * CTH_XXH_P2;
+		h->xxh_v[i] = cth_rotl64(h->xxh_v[i], 31) * CTH_XXH_P1;
+	}
+}
+static uint64_t cth_xxh64_merge(uint64_t acc, uint64_t v)
+{
+	v *= CTH_XXH_P2;
+	v = cth_rotl64(v, 31) * CTH_XXH_P1;
+	acc ^= v;
+	return acc * CTH_XXH_P1 + CTH_XXH_P4;
+}
+static void cth_xxh64_update(struct cth_hasher *h, const uint8_t *p, size_t len)
+{
+	/*
+	 * Consume full stripes, keep the rest for the next call.
+	 */
+	if (h->xxh_buf_len > 0) {
+		size_t take = 32 - h->xxh_buf_len < len ? 32 - h->xxh_buf_len : len;
+		memcpy(h->xxh_buf + h->xxh_buf_len, p, take);
+		h->xxh_buf_len += take;
+		p += take;
+		len -= take;
+		if (h->xxh_buf_len < 32) {
+			return;
+		}
+		cth_xxh64_consume(h, h->xxh_buf);
+		h->xxh_buf_len = 0;
+	}
+	for (; len >= 32; p += 32, len -= 32) {
+		cth_xxh64_consume(h, p);
+	}
+	memcpy(h->xxh_buf, p, len);
+	h->xxh_buf_len = len;
+}
+static uint64_t cth_xxh64_final(const struct cth_hasher *h)
+{
+	/*
+	 * Fold the accumulators and the buffered tail, with seed 0.
+	 */
+	uint64_t acc;
+	if (h->len >= 32) {
+		acc = cth_rotl64(h->xxh_v[0], 1) + cth_rotl64(h->xxh_v[1], 7) + cth_rotl64(h->xxh_v[2], 12) + cth_rotl64(h->xxh_v[3], 18);
+		for (int i = 0; i < 4; i++) {
+			acc = cth_xxh64_merge(acc, h->xxh_v[i]);
+		}
+	} else {
+		acc = CTH_XXH_P5;
+	}
+	acc += h->len;
+	const uint8_t *p = h->xxh_buf;
+	size_t len = h->xxh_buf_len;
+	for (; len >= 8; p += 8, len -= 8) {
+		uint64_t k = cth_rotl64(cth_load64(p) * CTH_XXH_P2, 31) * CTH_XXH_P1;
+		acc ^= k;
+		acc = cth_rotl64(acc, 27) * CTH_XXH_P1 + CTH_XXH_P4;
+	}
+	if (len >= 4) {
+		acc ^= (uint64_t)cth_load32(p) * CTH_XXH_P1;
+		acc = cth_rotl64(acc, 23) * CTH_XXH_P2 + CTH_XXH_P3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len > 0; p++, len--) {
+		acc ^= *p * CTH_XXH_P5;
+		acc = cth_rotl64(acc, 11) * CTH_XXH_P1;
+	}
+	acc ^= acc >> 33;
+	acc *= CTH_XXH_P2;
+	acc ^= acc >> 29;
+	acc *= CTH_XXH_P3;
+	acc ^= acc >> 32;
+	return acc;
+}
+static void cth_sha256_block(uint32_t state[8], const uint8_t *p)
+{
+	/*
+	 * Compress one 64 bytes block into state.
+	 */
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++) {
+		w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = cth_rotr32(w[i - 15], 7) ^ cth_rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = cth_rotr32(w[i - 2], 17) ^ cth_rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (cth_rotr32(e, 6) ^ cth_rotr32(e, 11) ^ cth_rotr32(e, 25)) + ((e & f) ^ (~e & g)) + cth_sha256_k[i] + w[i];
+		uint32_t t2 = (cth_rotr32(a, 2) ^ cth_rotr32(a, 13) ^ cth_rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+static void cth_sha256_update(struct cth_hasher *h, const uint8_t *p, size_t len)
+{
+	/*
+	 * Compress full blocks, keep the rest for the next call.
+	 */
+	if (h->sha_buf_len > 0) {
+		size_t take = 64 - h->sha_buf_len < len ? 64 - h->sha_buf_len : len;
+		memcpy(h->sha_buf + h->sha_buf_len, p, take);
+		h->sha_buf_len += take;
+		p += take;
+		len -= take;
+		if (h->sha_buf_len < 64) {
+			return;
+		}
+		cth_sha256_block(h->sha_state, h->sha_buf);
+		h->sha_buf_len = 0;
+	}
+	for (; len >= 64; p += 64, len -= 64) {
+		cth_sha256_block(h->sha_state, p);
+	}
+	memcpy(h->sha_buf, p, len);
+	h->sha_buf_len = len;
+}
+static void cth_sha256_final(struct cth_hasher *h, uint8_t out[32])
+{
+	/*
+	 * Pad with 0x80, zeros and the bit length, and write the big-endian state.
+	 */
+	uint64_t bits = h->len * 8;
+	h->sha_buf[h->sha_buf_len++] = 0x80;
+	if (h->sha_buf_len > 56) {
+		memset(h->sha_buf + h->sha_buf_len, 0, 64 - h->sha_buf_len);
+		cth_sha256_block(h->sha_state, h->sha_buf);
+		h->sha_buf_len = 0;
+	}
+	memset(h->sha_buf + h->sha_buf_len, 0, 56 - h->sha_buf_len);
+	for (int i = 0; i < 8; i++) {
+		h->sha_buf[56 + i] = (uint8_t)(bits >> (56 - i * 8));
+	}
+	cth_sha256_block(h->sha_state, h->sha_buf);
+	for (int i = 0; i < 8; i++) {
+		out[i * 4] = (uint8_t)(h->sha_state[i] >> 24);
+		out[i * 4 + 1] = (uint8_t)(h->sha_state[i] >> 16);
+		out[i * 4 + 2] = (uint8_t)(h->sha_state[i] >> 8);
+		out[i * 4 + 3] = (uint8_t)h->sha_state[i];
+	}
+}
+void cth_hasher_init(struct cth_hasher *h, unsigned int algos)
+{
+	/*
+	 * Start hashing with the CTH_HASH_* algorithms in algos, 0 hashes nothing.
+	 */
+	static const uint32_t sha_init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memset(h, 0, sizeof(*h));
+	h->algos = algos;
+	h->crc32c = 0xffffffff;
+	h->crc32c_hw = (algos & CTH_HASH_CRC32C) != 0 && cth_crc32c_has_hw();
+	h->xxh_v[0] = CTH_XXH_P1 + CTH_XXH_P2;
+	h->xxh_v[1] = CTH_XXH_P2;
+	h->xxh_v[2] = 0;
+	h->xxh_v[3] = 0 - CTH_XXH_P1;
+	memcpy(h->sha_state, sha_init, sizeof(sha_init));
+}
+void cth_hasher_update(struct cth_hasher *h, const void *buf, size_t len)
+{
+	/*
+	 * Feed the next len bytes of the stream.
+	 */
+	if (h->algos == 0 || len == 0) {
+		return;
+	}
+	const uint8_t *p = buf;
+	if (h->algos & CTH_HASH_CRC32C) {
+#if defined(__x86_64__) || defined(__aarch64__)
+		h->crc32c = h->crc32c_hw ? cth_crc32c_hw(h->crc32c, p, len) : cth_crc32c_sw(h->crc32c, p, len);
+#else
+		h->crc32c = cth_crc32c_sw(h->crc32c, p, len);
+#endif
+	}
+	h->len += len;
+	if (h->algos & CTH_HASH_XXH64) {
+		cth_xxh64_update(h, p, len);
+	}
+	if (h->algos & CTH_HASH_SHA256) {
+		cth_sha256_update(h, p, len);
+	}
+}
+void cth_hasher_final(struct cth_hasher *h, struct cth_digest *digest)
+{
+	/*
+	 * Finish the stream into digest, the algorithms not enabled are left 0.
+	 */
+	memset(digest, 0, sizeof(*digest));
+	digest->algos = h->algos;
+	digest->len = h->len;
+	if (h->algos & CTH_HASH_CRC32C) {
+		digest->crc32c = ~h->crc32c;
+	}
+	if (h->algos & CTH_HASH_XXH64) {
+		digest->xxh64 = cth_xxh64_final(h);
+	}
+	if (h->algos & CTH_HASH_SHA256) {
+		cth_sha256_final(h, digest->sha256);
+	}
+}
+// API function.
+void cth_hash(unsigned int algos, const void *buf, size_t len, struct cth_digest *digest)
+{
+	/*
+	 * Hash a buffer with the same algorithms as attr->hash, e.g. to check a digest of the result.
+	 * algos: CTH_HASH_* flags.
+	 * digest: Filled with the digests, the algorithms not in algos are 0.
+	 */
+	struct cth_hasher h;
+	cth_hasher_init(&h, algos);
+	cth_hasher_update(&h, buf, len);
+	cth_hasher_final(&h, digest);
+}
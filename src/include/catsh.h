@@ -30,7 +30,9 @@
 #ifndef __linux__
 #error "This code is intended to be compiled on Linux systems only."
 #endif
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -48,8 +50,10 @@
 #include <sys/stat.h>
 #include <stdint.h>
 #include <time.h>
+#include <sched.h>
+#include <sys/resource.h>
 // Bool!!!
-#if __STDC_VERSION__ < 202000L
+#if !defined(__cplusplus) && __STDC_VERSION__ < 202000L
 #ifndef bool
 #define bool _Bool
 #define true ((_Bool)1u)
@@ -60,6 +64,10 @@
 #ifdef __ANDROID__
 #define memfd_create(...) syscall(SYS_memfd_create, __VA_ARGS__)
 #endif
+// For C++, see catsh.hpp for the wrapper.
+#ifdef __cplusplus
+extern "C" {
+#endif
 #define cth_debug(x) \
 	do {         \
 		x    \
@@ -77,8 +85,95 @@
 #define CTH_VERSION_MINOR 9
 #define CTH_VERSION_PATCH 3
 #define CTH_VERSION_STRING "0.9.3"
-// 128 MiB, for output capturing, should be enough for most cases. Can be changed in the future if needed.
+// 128 MiB, the default cap of output capturing, see max_output of struct cth_exec_attr.
 #define CTH_MAX_OUTPUT_SIZE (1024 * 1024 * 128)
+// No cap of output capturing.
+#define CTH_OUTPUT_UNLIMITED UINT64_MAX
+// Default spill_threshold of struct cth_exec_attr, 64 MiB.
+#define CTH_SPILL_DEFAULT_THRESHOLD (1024 * 1024 * 64)
+// Default chunk size of cth_exec_sharded(), 1 MiB.
+#define CTH_SHARD_DEFAULT_SIZE (1024 * 1024)
+// Flags of cth_run(), fail with ENOTSUP instead of running sh for command lines out of the subset.
+#define CTH_RUN_NO_SHELL 1
+// Default ring size of cth_trace_enable(), in events of 64 bytes.
+#define CTH_TRACE_DEFAULT_EVENTS 65536
+// Flags of struct cth_record.
+// The output was captured.
+#define CTH_RECORD_OUTPUT 1
+// The command had an input, stdin_bytes is what it accepted.
+#define CTH_RECORD_INPUT 2
+// The command was killed because of timeout_ms.
+#define CTH_RECORD_TIMED_OUT 4
+// A command logged by cth_record_start(), see cth_record_next().
+struct cth_record {
+	// Wall clock time of the spawn, in microseconds since the epoch.
+	uint64_t start_us;
+	// From the spawn to the output collected.
+	uint64_t wall_us;
+	uint64_t stdin_bytes;
+	// Total bytes written by the command, 0 if the output was not captured.
+	uint64_t stdout_bytes;
+	uint64_t stderr_bytes;
+	int exit_code;
+	// CTH_RECORD_* flags.
+	unsigned int flags;
+	// NULL-terminated.
+	char **argv;
+};
+// cgroup v2 accounting of the whole process tree of a command.
+struct cth_cgroup_stat {
+	// From cpu.stat.
+	uint64_t cpu_usage_usec;
+	uint64_t cpu_user_usec;
+	uint64_t cpu_system_usec;
+	// From memory.peak, 0 if not supported.
+	uint64_t memory_peak;
+	// From io.stat, summed up over all devices, 0 if the io controller is not enabled.
+	uint64_t io_rbytes;
+	uint64_t io_wbytes;
+	uint64_t io_rios;
+	uint64_t io_wios;
+};
+// Checksum algorithms for attr->hash and cth_hash().
+#define CTH_HASH_CRC32C 1
+#define CTH_HASH_XXH64 2
+#define CTH_HASH_SHA256 4
+// Flags of cth_metrics_enable(), label the metrics by argv[0].
+#define CTH_METRICS_BY_ARGV0 1
+// Counters of attr->perf_events.
+#define CTH_PERF_CYCLES 1
+#define CTH_PERF_INSTRUCTIONS 2
+#define CTH_PERF_CACHE_MISSES 4
+#define CTH_PERF_BRANCH_MISSES 8
+#define CTH_PERF_TASK_CLOCK 16
+#define CTH_PERF_HARDWARE (CTH_PERF_CYCLES | CTH_PERF_INSTRUCTIONS | CTH_PERF_CACHE_MISSES | CTH_PERF_BRANCH_MISSES)
+#define CTH_PERF_ALL (CTH_PERF_HARDWARE | CTH_PERF_TASK_CLOCK)
+// perf_event_open(2) counters of a command, of all its threads and children, from its exec.
+struct cth_perf_stat {
+	// The CTH_PERF_* counters that could be opened, the others are 0.
+	unsigned int events;
+	// Only user space was counted, perf_event_paranoid forbids counting the kernel.
+	bool user_only;
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t cache_misses;
+	uint64_t branch_misses;
+	// CPU time, in nanoseconds.
+	uint64_t task_clock_ns;
+	// Time the hardware counters were enabled, and actually counting. If the PMU was multiplexed,
+	// running is less than enabled, and the hardware counts are scaled up to estimates.
+	uint64_t time_enabled_ns;
+	uint64_t time_running_ns;
+};
+struct cth_digest {
+	// The CTH_HASH_* algorithms computed, the others are 0.
+	unsigned int algos;
+	// Bytes hashed.
+	uint64_t len;
+	uint32_t crc32c;
+	uint64_t xxh64;
+	uint8_t sha256[32];
+};
 struct __attribute__((packed, aligned(1))) cth_result {
 	uint32_t cth_version;
 	size_t struct_size;
@@ -93,14 +188,195 @@ struct __attribute__((packed, aligned(1))) cth_result {
 	useconds_t time_used;
 	// New sections for non-blocking exec.
 	// Just overuse memfd magic!
+	// Deprecated, always -1, the status is in the shared status slab now.
 	int stat_fd;
+	// Output memfds of a running non-blocking command, -1 if output is not captured.
 	int stdout_fd;
 	int stderr_fd;
+	// Deprecated, always -1.
 	int time_fd;
 	// Time used in milliseconds.
 	uint64_t time_used_ms;
+	// Total bytes the command wrote to stdout/stderr.
+	// With CTH_CAPTURE_TAIL, this also counts the bytes dropped from the ring buffer.
+	uint64_t stdout_total;
+	uint64_t stderr_total;
+	// cgroup v2 accounting, NULL if the command is not placed into a cgroup.
+	struct cth_cgroup_stat *cgroup_stat;
+	// The cgroup of a non-blocking command, it's killed by cth_free_result() if still running.
+	char *cgroup_path;
+	// The command was killed because of timeout_ms.
+	bool timed_out;
+	// The signal that killed the command, 0 if it exited normally.
+	int term_signal;
+	// The RLIMIT_* resource that killed the command, CTH_LIMIT_NONE if none.
+	// SIGXCPU/SIGXFSZ and a SIGKILL at the hard CPU limit are certain, a crash is only RLIMIT_AS
+	// if the peak RSS reached half of the limit, and RLIMIT_STACK is never reported.
+	int limit_hit;
+	// Internal, the status slot of a running non-blocking command, NULL after cth_wait() succeeds.
+	void *status_slot;
+	// The result comes from the result cache, no process was run.
+	bool cached;
+	// With CTH_CAPTURE_FD, the output is left in stdout_fd/stderr_fd instead of stdout_ret/stderr_ret.
+	bool output_in_fd;
+	// With attr->hash, the digests of stdin, stdout and stderr, indexed by the fd number, NULL otherwise.
+	struct cth_digest *digest;
+	// Internal, the thread pulling the input producer of a non-blocking command, NULL after cth_wait() succeeds.
+	void *feeder;
+	// With attr->perf_events, the counters, NULL if none could be opened.
+	struct cth_perf_stat *perf_stat;
+	// Length of stdout_ret/stderr_ret, the output may contain NUL bytes.
+	// Less than stdout_total/stderr_total if only the tail is kept, or the output is cut at max_output.
+	uint64_t stdout_len;
+	uint64_t stderr_len;
 	// Reserved space for future expansion, should be zeroed.
-	uint8_t reserved[256 - sizeof(int) - sizeof(int) - sizeof(int) - sizeof(int) - sizeof(uint64_t)];
+	uint8_t reserved[256 - sizeof(int) - sizeof(int) - sizeof(int) - sizeof(int) - sizeof(uint64_t) - sizeof(uint64_t) - sizeof(uint64_t) - sizeof(struct cth_cgroup_stat *) - sizeof(char *) - sizeof(bool) - sizeof(int) - sizeof(int) - sizeof(void *) - sizeof(bool) - sizeof(bool) - sizeof(struct cth_digest *) - sizeof(void *) - sizeof(struct cth_perf_stat *) - sizeof(uint64_t) - sizeof(uint64_t)];
+};
+// Value of limit_hit if no limit is hit.
+#define CTH_LIMIT_NONE (-1)
+// Resource limit for the child, see struct cth_exec_attr.
+struct cth_rlimit {
+	// RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, RLIMIT_NPROC, RLIMIT_FSIZE, etc.
+	int resource;
+	struct rlimit limit;
+};
+// Output capture modes for struct cth_exec_attr.
+// Keep everything, up to max_output.
+#define CTH_CAPTURE_FULL 0
+// Keep only the tail of each stream in a fixed ring buffer.
+#define CTH_CAPTURE_TAIL 1
+// Keep everything, up to max_output, but in result->stdout_fd/stderr_fd instead of the heap, see cth_map_output().
+#define CTH_CAPTURE_FD 2
+// Ring buffer size for CTH_CAPTURE_TAIL if only tail_lines is set.
+#define CTH_TAIL_DEFAULT_SIZE (1024 * 64)
+// NUMA memory policies for struct cth_exec_attr, same values as MPOL_* of set_mempolicy(2),
+// except that 0 keeps the inherited policy.
+#define CTH_MPOL_INHERIT 0
+#define CTH_MPOL_PREFERRED 1
+#define CTH_MPOL_BIND 2
+#define CTH_MPOL_INTERLEAVE 3
+#define CTH_MPOL_LOCAL 4
+// I/O priority classes for struct cth_exec_attr, same values as IOPRIO_CLASS_* of ioprio_set(2),
+// except that 0 keeps the inherited priority.
+#define CTH_IOPRIO_INHERIT 0
+#define CTH_IOPRIO_RT 1
+#define CTH_IOPRIO_BE 2
+#define CTH_IOPRIO_IDLE 3
+// Command graph, see cth_new_graph().
+struct cth_graph;
+// Failure policies of cth_graph_run().
+#define CTH_GRAPH_FAIL_FAST 0
+#define CTH_GRAPH_KEEP_GOING 1
+// Node states of cth_graph_state().
+#define CTH_GRAPH_PENDING 0
+#define CTH_GRAPH_SUCCEEDED 1
+#define CTH_GRAPH_FAILED 2
+#define CTH_GRAPH_SKIPPED 3
+// Namespaces of a container, in the order they are entered.
+#define CTH_NS_USER 0
+#define CTH_NS_CGROUP 1
+#define CTH_NS_IPC 2
+#define CTH_NS_UTS 3
+#define CTH_NS_NET 4
+#define CTH_NS_PID 5
+#define CTH_NS_MNT 6
+#define CTH_NS_COUNT 7
+// A container to run commands in, see cth_container_open().
+// The fds can also be set by hand, e.g. only root_fd for a chroot container.
+struct cth_container {
+	// nsfs fds indexed by CTH_NS_*, -1 to stay in our namespace.
+	int ns_fd[CTH_NS_COUNT];
+	// Directory to chroot() into, -1 for no chroot.
+	int root_fd;
+};
+// GNU make jobserver, see cth_jobserver_from_env() and cth_new_jobserver().
+struct cth_jobserver;
+// Result cache of idempotent commands, see cth_new_cache().
+struct cth_cache;
+// Environment overlay for the child, see cth_new_env().
+struct cth_env {
+	// Start from an empty environment instead of environ.
+	bool clear;
+	// Overlay entries, values[i] is "KEY=VALUE", or NULL to unset keys[i].
+	char **keys;
+	char **values;
+	size_t count;
+	// Compiled envp, NULL if not compiled yet.
+	char **envp;
+};
+// Extra attributes for cth_exec_with_attr() and cth_exec_with_file_input_attr().
+// Always allocate it with cth_new_attr(), new members might be added in the future.
+struct cth_exec_attr {
+	// CTH_CAPTURE_FULL, CTH_CAPTURE_TAIL or CTH_CAPTURE_FD, only used if get_output is true.
+	int capture_mode;
+	// CTH_CAPTURE_TAIL: size of the ring buffer per stream, in bytes.
+	size_t tail_bytes;
+	// CTH_CAPTURE_TAIL: keep only the last tail_lines lines, 0 means no line limit.
+	size_t tail_lines;
+	// Environment overlay for the child, NULL to inherit environ.
+	struct cth_env *env;
+	// Place the child into this existing cgroup v2 directory, NULL for none.
+	// The cgroup is killed as a whole on timeout, so it should be dedicated to the command.
+	const char *cgroup_path;
+	// Or, create a fresh cgroup v2 under this directory for each exec, removed after the command exits.
+	// The controllers used by the limits below must be enabled in its cgroup.subtree_control.
+	const char *cgroup_parent;
+	// Limits written to the cgroup, 0 to leave them unchanged.
+	uint64_t memory_max;
+	// cpu.max, cpu_max_us of CPU time per cpu_period_us (100000 if 0).
+	uint64_t cpu_max_us;
+	uint64_t cpu_period_us;
+	uint64_t pids_max;
+	// Kill the command after timeout_ms milliseconds, 0 for no timeout.
+	// With a cgroup, all the processes in it are killed.
+	uint64_t timeout_ms;
+	// The following are applied in the child before exec, the exec fails if any of them cannot be applied.
+	// CPU affinity, NULL to inherit. cpu_affinity_size is the size for CPU_*_S() macros, 0 for sizeof(cpu_set_t).
+	cpu_set_t *cpu_affinity;
+	size_t cpu_affinity_size;
+	// NUMA memory policy, CTH_MPOL_*, numa_nodes is the bitmask of nodes 0-63.
+	int numa_policy;
+	uint64_t numa_nodes;
+	// Added to the inherited nice value, 0 for unchanged, negative values need CAP_SYS_NICE.
+	int nice;
+	// I/O priority, CTH_IOPRIO_*, and the level 0-7 (0 is the highest) for RT and BE.
+	int ioprio_class;
+	int ioprio_level;
+	// Scheduling policy, e.g. SCHED_BATCH or SCHED_IDLE, SCHED_OTHER (0) keeps the inherited one.
+	// sched_priority is only used by SCHED_FIFO and SCHED_RR.
+	int sched_policy;
+	int sched_priority;
+	// Resource limits set with setrlimit(), rlimits can be NULL if rlimit_count is 0.
+	// Limits only hit by failing syscalls (e.g. RLIMIT_NOFILE, RLIMIT_NPROC) cannot be reported in limit_hit.
+	const struct cth_rlimit *rlimits;
+	size_t rlimit_count;
+	// Serve blocking cth_exec_with_attr() calls from this cache, NULL for no cache.
+	// Only for deterministic commands, the result is reused without running the command.
+	// The key covers the working directory and the limits/scheduling attributes.
+	// Commands in a container, in a cgroup, or with perf_events are not cached, as a hit has no perf_stat or cgroup_stat.
+	struct cth_cache *cache;
+	// Take a jobserver token before each spawn, and give it back after the command is reaped, NULL for no limit.
+	// With our own jobserver, the children also get it in MAKEFLAGS.
+	struct cth_jobserver *jobserver;
+	// Cap of captured output per stream for CTH_CAPTURE_FULL and CTH_CAPTURE_FD, 0 for CTH_MAX_OUTPUT_SIZE,
+	// or CTH_OUTPUT_UNLIMITED. Without spill_dir, the output is in memfds, the command gets a write error past the cap.
+	uint64_t max_output;
+	// If set, blocking mode captures through pipes, into memfds up to spill_threshold (0 for CTH_SPILL_DEFAULT_THRESHOLD),
+	// then moves it into an unlinked file in this directory, the data past max_output is counted and dropped.
+	// Non-blocking mode writes into the file from the start, max_output is not enforced then.
+	const char *spill_dir;
+	uint64_t spill_threshold;
+	// Enter the namespaces and the root of this container before exec, NULL to run on the host.
+	// Needs the privileges of setns(2) and chroot(2).
+	const struct cth_container *container;
+	// CTH_HASH_* flags, hash the streams while they are pumped, into result->digest, 0 for no hashing.
+	// stdin covers the bytes the command accepted, stdout/stderr all the bytes it wrote, as in stdout_total.
+	// With get_output, the output is drained through pipes then, so it's hashed on the way.
+	unsigned int hash;
+	// CTH_PERF_* flags, count the command with perf_event_open(2) into result->perf_stat, 0 for none.
+	// Counted from the exec, over all the threads and children of the command, and summed up over the commands of cth_run().
+	// Counters the kernel refuses (perf_event_paranoid, no PMU in most VMs) are left out, the command runs anyway.
+	unsigned int perf_events;
 };
 #define CTH_VERSION ((CTH_VERSION_MAJOR << 16) | (CTH_VERSION_MINOR << 8) | (CTH_VERSION_PATCH))
 #define CTH_ABI_COMPATIBLE(res) ((res) != NULL && (res)->cth_version <= CTH_VERSION && (res)->struct_size == sizeof(struct cth_result))
@@ -111,10 +387,106 @@ struct cth_result *cth_exec(char **argv, char *input, bool block, bool get_outpu
 int cth_fork_rexec_self(char *const argv[]);
 int cth_exec_command(char **argv);
 int cth_wait(struct cth_result **res);
+int cth_wait_any(struct cth_result **res, size_t count, int timeout_ms);
 void *cth_init_argv(void);
 struct cth_result *cth_exec_with_file_input(char **argv, int fd, bool block, bool get_output, void (*progress)(float, int), int progress_line_num);
+// Index of the lines (or any delimiter separated records) in a buffer, see cth_lines_index().
+struct cth_lines {
+	// The indexed buffer, not owned by the index.
+	const char *buf;
+	size_t len;
+	// Number of lines, the last line does not need a trailing delimiter.
+	size_t count;
+	// Internal, positions of the delimiters.
+	size_t *delims;
+	size_t ndelims;
+	char delim;
+};
+// Field iterator, see cth_fields_init().
+struct cth_fields {
+	const char *pos;
+	const char *end;
+	char delim;
+	bool done;
+};
+// Process-wide runtime context, see cth_get_runtime().
+// Cached system limits, kernel features and shared fds, read-only after initialization.
+struct cth_runtime {
+	// From /proc/sys/fs/pipe-max-size, 0 if unknown.
+	size_t pipe_max_size;
+	long arg_max;
+	long page_size;
+	// RLIMIT_NOFILE.
+	rlim_t nofile_cur;
+	rlim_t nofile_max;
+	// Kernel features.
+	bool has_pidfd;
+	bool has_clone3;
+	bool has_io_uring;
+	bool has_close_range;
+	// /dev/null, opened with O_CLOEXEC, -1 on failure.
+	int devnull_fd;
+};
+struct cth_env *cth_new_env(void);
+int cth_env_set(struct cth_env *env, const char *key, const char *value);
+int cth_env_unset(struct cth_env *env, const char *key);
+void cth_env_clear(struct cth_env *env);
+int cth_env_compile(struct cth_env *env);
+void cth_free_env(struct cth_env **env);
+struct cth_cache *cth_new_cache(uint64_t ttl_ms);
+int cth_cache_add_env(struct cth_cache *cache, const char *key);
+void cth_cache_invalidate(struct cth_cache *cache);
+void cth_cache_stats(struct cth_cache *cache, uint64_t *hits, uint64_t *misses, uint64_t *coalesced);
+void cth_free_cache(struct cth_cache **cache);
+struct cth_jobserver *cth_jobserver_from_env(void);
+struct cth_jobserver *cth_new_jobserver(unsigned int jobs);
+void cth_free_jobserver(struct cth_jobserver **js);
+void *cth_map_output(const struct cth_result *res, bool stderr_stream, size_t *len);
+void cth_hash(unsigned int algos, const void *buf, size_t len, struct cth_digest *digest);
+int cth_exec_fanout(char **const argv_list[], size_t n, int input_fd, bool get_output, const struct cth_exec_attr *attr, struct cth_result *res[]);
+struct cth_result *cth_exec_sharded(char **argv, int fd, size_t workers, size_t chunk_size, char delim, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr);
+struct cth_result *cth_run(const char *cmdline, char *input, bool get_output, int flags, const struct cth_exec_attr *attr);
+int cth_metrics_enable(int flags);
+int cth_metrics_dump(int fd);
+int cth_trace_enable(size_t events);
+int cth_trace_dump(int fd);
+int cth_record_start(const char *path);
+void cth_record_stop(void);
+int cth_record_next(int fd, struct cth_record *rec);
+void cth_free_record(struct cth_record *rec);
+int cth_zygote_serve(int *argc, char ***argv);
+int cth_zygote_start(void);
+void cth_zygote_stop(void);
+const struct cth_container *cth_container_open(pid_t pid);
+void cth_container_forget(pid_t pid);
+struct cth_graph *cth_new_graph(void);
+int cth_graph_add(struct cth_graph *graph, char **argv, char *input, const struct cth_exec_attr *attr);
+int cth_graph_depend(struct cth_graph *graph, int node, int dep);
+int cth_graph_pipe(struct cth_graph *graph, int node, int from);
+int cth_graph_run(struct cth_graph *graph, int slots, int policy);
+int cth_graph_state(const struct cth_graph *graph, int node);
+const struct cth_result *cth_graph_result(const struct cth_graph *graph, int node);
+int cth_graph_timing(const struct cth_graph *graph, int node, uint64_t *start_ms, uint64_t *end_ms);
+uint64_t cth_graph_critical_path(const struct cth_graph *graph, int *path, size_t *path_len);
+void cth_free_graph(struct cth_graph **graph);
+int cth_init(void);
+const struct cth_runtime *cth_get_runtime(void);
+struct cth_lines *cth_lines_index(const char *buf, size_t len);
+struct cth_lines *cth_lines_index_delim(const char *buf, size_t len, char delim);
+const char *cth_line(const struct cth_lines *lines, size_t i, size_t *len);
+void cth_free_lines(struct cth_lines **lines);
+void cth_fields_init(struct cth_fields *fields, const char *line, size_t len, char delim);
+bool cth_fields_next(struct cth_fields *fields, const char **field, size_t *len);
+struct cth_exec_attr *cth_new_attr(void);
+void cth_free_attr(struct cth_exec_attr **attr);
+struct cth_result *cth_exec_with_attr(char **argv, char *input, bool block, bool get_output, const struct cth_exec_attr *attr);
+struct cth_result *cth_exec_with_producer(char **argv, ssize_t (*produce)(void *ctx, void *buf, size_t cap), void *ctx, bool block, bool get_output, const struct cth_exec_attr *attr);
+struct cth_result *cth_exec_with_file_input_attr(char **argv, int fd, bool block, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr);
 void cth_show_progress(float progress, int line_num);
 #define CTH_EXEC_SUCCEED(res) ((res) != NULL && (res)->exited && ((res)->exit_code == 0))
 #define CTH_EXEC_FAILED(res) ((res) != NULL && (res)->exited && ((res)->exit_code != 0))
 #define CTH_EXEC_RUNNING(res) ((res) != NULL && !(res)->exited)
-#define CTH_EXEC_CANNOT_RUN(res) ((res) == NULL)
\ No newline at end of file
+#define CTH_EXEC_CANNOT_RUN(res) ((res) == NULL)
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+// C++20 header-only wrapper of catsh.
+// cth::result owns a struct cth_result, cth::command builds and runs a command,
+// and cth::executor drives co_await-able non-blocking execution.
+#ifndef CATSH_HPP
+#define CATSH_HPP
+#include "catsh.h"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/eventfd.h>
+namespace cth
+{
+// Move-only owner of a struct cth_result, freed with cth_free_result().
+class result
+{
+      public:
+	result() noexcept = default;
+	explicit result(struct cth_result *res) noexcept : res_(res)
+	{
+	}
+	result(const result &) = delete;
+	result &operator=(const result &) = delete;
+	result(result &&other) noexcept : res_(std::exchange(other.res_, nullptr))
+	{
+	}
+	result &operator=(result &&other) noexcept
+	{
+		if (this != &other) {
+			cth_free_result(&res_);
+			res_ = std::exchange(other.res_, nullptr);
+		}
+		return *this;
+	}
+	~result()
+	{
+		cth_free_result(&res_);
+	}
+	// False if the command cannot be run.
+	explicit operator bool() const noexcept
+	{
+		return res_ != nullptr;
+	}
+	struct cth_result *get() const noexcept
+	{
+		return res_;
+	}
+	// Give up the ownership, the caller should free it with cth_free_result().
+	struct cth_result *release() noexcept
+	{
+		return std::exchange(res_, nullptr);
+	}
+	// For a non-blocking command, check if it exited without blocking, see cth_wait().
+	bool ready() noexcept
+	{
+		return res_ != nullptr && (res_->exited || cth_wait(&res_) >= 0 || res_->exited);
+	}
+	bool exited() const noexcept
+	{
+		return res_ != nullptr && res_->exited;
+	}
+	bool succeeded() const noexcept
+	{
+		return CTH_EXEC_SUCCEED(res_);
+	}
+	int exit_code() const noexcept
+	{
+		return res_ != nullptr ? res_->exit_code : -1;
+	}
+	pid_t pid() const noexcept
+	{
+		return res_ != nullptr ? res_->pid : -1;
+	}
+	bool timed_out() const noexcept
+	{
+		return res_ != nullptr && res_->timed_out;
+	}
+	int term_signal() const noexcept
+	{
+		return res_ != nullptr ? res_->term_signal : 0;
+	}
+	int limit_hit() const noexcept
+	{
+		return res_ != nullptr ? res_->limit_hit : CTH_LIMIT_NONE;
+	}
+	std::chrono::microseconds time_used() const noexcept
+	{
+		return std::chrono::microseconds(res_ != nullptr ? res_->time_used : 0);
+	}
+	const struct cth_cgroup_stat *cgroup_stat() const noexcept
+	{
+		return res_ != nullptr ? res_->cgroup_stat : nullptr;
+	}
+	// Views of the captured output, valid as long as this result, no copy is made.
+	std::string_view out() const noexcept
+	{
+		return res_ != nullptr ? view(res_->stdout_ret, res_->stdout_len) : std::string_view();
+	}
+	std::string_view err() const noexcept
+	{
+		return res_ != nullptr ? view(res_->stderr_ret, res_->stderr_len) : std::string_view();
+	}
+	std::span<const std::byte> out_bytes() const noexcept
+	{
+		return std::as_bytes(std::span<const char>(out()));
+	}
+	std::span<const std::byte> err_bytes() const noexcept
+	{
+		return std::as_bytes(std::span<const char>(err()));
+	}
+
+      private:
+	// The output may contain NUL bytes, so the view has the captured length, not strlen().
+	static std::string_view view(const char *str, std::uint64_t len) noexcept
+	{
+		return str != nullptr ? std::string_view(str, static_cast<std::size_t>(len)) : std::string_view();
+	}
+	struct cth_result *res_ = nullptr;
+};
+class executor;
+class exec_awaitable;
+// Builder of a command, the argv, input and attributes are kept in it, so it can be run many times.
+class command
+{
+      public:
+	command(std::initializer_list<std::string_view> argv) : attr_(cth_new_attr(), attr_deleter{})
+	{
+		for (auto arg : argv) {
+			args_.emplace_back(arg);
+		}
+	}
+	explicit command(std::vector<std::string> argv) : args_(std::move(argv)), attr_(cth_new_attr(), attr_deleter{})
+	{
+	}
+	command(command &&) noexcept = default;
+	command &operator=(command &&) noexcept = default;
+	command &arg(std::string_view arg)
+	{
+		args_.emplace_back(arg);
+		return *this;
+	}
+	// Input for stdin, it's passed as a C string, so it should not contain '\0'.
+	command &input(std::string_view input)
+	{
+		input_ = input;
+		has_input_ = true;
+		return *this;
+	}
+	// Capture stdout and stderr, true by default.
+	command &capture(bool enable = true) noexcept
+	{
+		capture_ = enable;
+		return *this;
+	}
+	// Keep only the tail of the output, see CTH_CAPTURE_TAIL.
+	command &tail(std::size_t bytes, std::size_t lines = 0) noexcept
+	{
+		if (attr_) {
+			attr_->capture_mode = CTH_CAPTURE_TAIL;
+			attr_->tail_bytes = bytes;
+			attr_->tail_lines = lines;
+		}
+		return *this;
+	}
+	command &env(const std::string &key, const std::string &value)
+	{
+		if (get_env() != nullptr) {
+			cth_env_set(env_.get(), key.c_str(), value.c_str());
+		}
+		return *this;
+	}
+	command &unset_env(const std::string &key)
+	{
+		if (get_env() != nullptr) {
+			cth_env_unset(env_.get(), key.c_str());
+		}
+		return *this;
+	}
+	command &clear_env()
+	{
+		if (get_env() != nullptr) {
+			cth_env_clear(env_.get());
+		}
+		return *this;
+	}
+	command &timeout(std::chrono::milliseconds timeout) noexcept
+	{
+		if (attr_) {
+			attr_->timeout_ms = static_cast<uint64_t>(timeout.count());
+		}
+		return *this;
+	}
+	command &cgroup_parent(std::string path)
+	{
+		cgroup_parent_ = std::move(path);
+		if (attr_) {
+			attr_->cgroup_parent = cgroup_parent_.c_str();
+		}
+		return *this;
+	}
+	command &nice(int value) noexcept
+	{
+		if (attr_) {
+			attr_->nice = value;
+		}
+		return *this;
+	}
+	// Raw attributes for everything else, pointers stored in it must outlive the command.
+	struct cth_exec_attr *attr() noexcept
+	{
+		return attr_.get();
+	}
+	// Run in blocking mode.
+	result run()
+	{
+		return exec(true);
+	}
+	// Run in non-blocking mode, wait for it with result::ready() or co_await.
+	result spawn()
+	{
+		return exec(false);
+	}
+	// co_await cmd.async(ex) to run in non-blocking mode, and resume on the executor thread after it exits.
+	exec_awaitable async(executor &ex);
+
+      private:
+	struct attr_deleter {
+		void operator()(struct cth_exec_attr *attr) const noexcept
+		{
+			cth_free_attr(&attr);
+		}
+	};
+	struct env_deleter {
+		void operator()(struct cth_env *env) const noexcept
+		{
+			cth_free_env(&env);
+		}
+	};
+	struct cth_env *get_env()
+	{
+		if (!env_) {
+			env_.reset(cth_new_env());
+			if (attr_) {
+				attr_->env = env_.get();
+			}
+		}
+		return env_.get();
+	}
+	result exec(bool block)
+	{
+		if (!attr_ || args_.empty()) {
+			return result();
+		}
+		// The C API does not modify argv or input, the casts are only for the signatures.
+		std::vector<char *> argv;
+		argv.reserve(args_.size() + 1);
+		for (auto &arg : args_) {
+			argv.push_back(const_cast<char *>(arg.c_str()));
+		}
+		argv.push_back(nullptr);
+		if (env_) {
+			// Compile it here once, instead of in every child.
+			cth_env_compile(env_.get());
+		}
+		char *input = has_input_ ? const_cast<char *>(input_.c_str()) : nullptr;
+		return result(cth_exec_with_attr(argv.data(), input, block, capture_, attr_.get()));
+	}
+	std::vector<std::string> args_;
+	std::string input_;
+	bool has_input_ = false;
+	bool capture_ = true;
+	std::string cgroup_parent_;
+	std::unique_ptr<struct cth_exec_attr, attr_deleter> attr_;
+	std::unique_ptr<struct cth_env, env_deleter> env_;
+};
+// A single thread waiting for non-blocking commands, and resuming the coroutines waiting for them.
+// It sleeps on pidfds of the commands, or checks them every millisecond if pidfd is not supported.
+class executor
+{
+      public:
+	executor() : wake_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), thread_([this] { loop(); })
+	{
+	}
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+	~executor()
+	{
+		stop_.store(true);
+		wake();
+		thread_.join();
+		if (wake_fd_ >= 0) {
+			close(wake_fd_);
+		}
+	}
+	// Resume h on the executor thread after res exits, res must be alive until then.
+	void submit(result &res, std::coroutine_handle<> h)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			incoming_.push_back(waiter{ &res, -1, h });
+		}
+		wake();
+	}
+
+      private:
+	struct waiter {
+		result *res;
+		int pidfd;
+		std::coroutine_handle<> h;
+	};
+	void wake() noexcept
+	{
+		uint64_t one = 1;
+		if (wake_fd_ >= 0) {
+			(void)!write(wake_fd_, &one, sizeof(one));
+		}
+	}
+	void loop()
+	{
+		std::vector<waiter> waiting;
+		std::vector<struct pollfd> pfds;
+		while (!stop_.load() || !waiting.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				for (auto &w : incoming_) {
+					w.pidfd = cth_get_runtime()->has_pidfd ? static_cast<int>(syscall(SYS_pidfd_open, w.res->pid(), 0)) : -1;
+					waiting.push_back(w);
+				}
+				incoming_.clear();
+			}
+			// Resume the finished ones, a resumed coroutine might submit new commands.
+			for (std::size_t i = 0; i < waiting.size();) {
+				if (waiting[i].res->ready()) {
+					waiter w = waiting[i];
+					waiting[i] = waiting.back();
+					waiting.pop_back();
+					if (w.pidfd >= 0) {
+						close(w.pidfd);
+					}
+					w.h.resume();
+				} else {
+					i++;
+				}
+			}
+			pfds.clear();
+			pfds.push_back(pollfd{ wake_fd_, POLLIN, 0 });
+			bool tick = false;
+			for (auto &w : waiting) {
+				if (w.pidfd >= 0) {
+					pfds.push_back(pollfd{ w.pidfd, POLLIN, 0 });
+				} else {
+					tick = true;
+				}
+			}
+			if (stop_.load() && waiting.empty()) {
+				break;
+			}
+			poll(pfds.data(), pfds.size(), tick ? 1 : -1);
+			uint64_t count;
+			(void)!read(wake_fd_, &count, sizeof(count));
+		}
+	}
+	int wake_fd_;
+	std::mutex mutex_;
+	std::vector<waiter> incoming_;
+	std::atomic<bool> stop_{ false };
+	std::thread thread_;
+};
+// Awaitable of command::async(), co_await gives the cth::result.
+class exec_awaitable
+{
+      public:
+	exec_awaitable(executor &ex, command &cmd) : ex_(ex), cmd_(cmd)
+	{
+	}
+	bool await_ready()
+	{
+		res_ = cmd_.spawn();
+		return !res_ || res_.ready();
+	}
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		ex_.submit(res_, h);
+	}
+	result await_resume() noexcept
+	{
+		return std::move(res_);
+	}
+
+      private:
+	executor &ex_;
+	command &cmd_;
+	result res_;
+};
+inline exec_awaitable command::async(executor &ex)
+{
+	return exec_awaitable(ex, *this);
+}
+} // namespace cth
+#endif
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+// Internal header, shared by the source files of catsh, not installed.
+#ifndef CATSH_INTERNAL_H
+#define CATSH_INTERNAL_H
+#include "catsh.h"
+// Syscall numbers are the same on all architectures for these new syscalls.
+#ifndef SYS_io_uring_setup
+#define SYS_io_uring_setup 425
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+// Allocate a new result with default values, see catsh.c.
+struct cth_result *cth_new(void);
+// Exec helpers shared with the other exec paths, see catsh.c.
+struct cth_cgroup;
+void cth_child_exec(char **argv, const struct cth_exec_attr *attr, char **envp);
+// Environment of the child, see env.c.
+char **cth_env_prepare(const struct cth_exec_attr *attr, char ***owned);
+uint64_t cth_now_ms(void);
+uint64_t cth_deadline(const struct cth_exec_attr *attr);
+pid_t cth_waitpid(pid_t pid, int *status, struct rusage *ru, uint64_t deadline_ms);
+void cth_set_status(struct cth_result *res, int status, const struct rusage *ru, const struct cth_exec_attr *attr);
+void cth_kill_job(pid_t pid, const struct cth_cgroup *cg);
+char *cth_read_fd(int fd, size_t *len);
+// Where the stdin data of the child comes from, a fd, a buffer in memory, or a producer callback.
+struct cth_input {
+	// Readable fd, or -1 to use buf or produce.
+	int fd;
+	const char *buf;
+	size_t len;
+	// Called for more input when stdin of the child is writable, if not NULL.
+	ssize_t (*produce)(void *ctx, void *buf, size_t cap);
+	void *ctx;
+};
+struct cth_result *cth_exec_block_with_input(char **argv, const struct cth_input *input, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr, int stdout_sink, int stderr_sink, struct cth_cgroup *cg);
+// cgroup v2 the command is placed into, see cgroup.c.
+struct cth_cgroup {
+	// Directory fd of the cgroup, -1 if no cgroup is used.
+	int fd;
+	char *path;
+	// Created by us, and removed after the command exits.
+	bool owned;
+};
+int cth_cgroup_open(const struct cth_exec_attr *attr, struct cth_cgroup *cg);
+pid_t cth_cgroup_fork(const struct cth_cgroup *cg);
+int cth_cgroup_kill(const struct cth_cgroup *cg);
+int cth_cgroup_kill_path(const char *path);
+struct cth_cgroup_stat *cth_cgroup_read_stat(const struct cth_cgroup *cg);
+void cth_cgroup_close(struct cth_cgroup *cg);
+// Scheduling attributes of the child, see sched.c.
+int cth_apply_sched(const struct cth_exec_attr *attr);
+// Status slot of a non-blocking command, in memory shared with the runner process, see slab.c.
+#define CTH_SLOT_FREE 0
+#define CTH_SLOT_STARTING 1
+#define CTH_SLOT_RUNNING 2
+#define CTH_SLOT_DONE 3
+#define CTH_SLOT_ERROR 4
+// The result was freed before the command exits, the runner frees the slot.
+#define CTH_SLOT_ORPHAN 5
+// How long to sleep on a slot before checking if the runner is still alive.
+#define CTH_SLOT_CHECK_MS 100
+struct cth_slot {
+	// CTH_SLOT_*, also the futex word.
+	uint32_t state;
+	pid_t pid;
+	int exit_code;
+	int term_signal;
+	int limit_hit;
+	bool timed_out;
+	bool has_cgroup_stat;
+	uint64_t time_used_ms;
+	uint64_t stdout_total;
+	uint64_t stderr_total;
+	struct cth_cgroup_stat cgroup_stat;
+	bool has_digest;
+	struct cth_digest digest[3];
+	bool has_perf_stat;
+	struct cth_perf_stat perf_stat;
+} __attribute__((aligned(64)));
+struct cth_slot *cth_slot_alloc(void);
+void cth_slot_publish(struct cth_slot *slot, uint32_t state);
+void cth_slot_wait(struct cth_slot *slot, uint32_t state);
+bool cth_slot_check(struct cth_slot *slot);
+void cth_slot_release(struct cth_slot *slot);
+uint32_t cth_slab_generation(void);
+void cth_slab_wait(uint32_t generation, int timeout_ms);
+// Resource limits of the child, see limit.c.
+int cth_apply_rlimits(const struct cth_exec_attr *attr);
+int cth_limit_hit(const struct cth_exec_attr *attr, int status, const struct rusage *ru);
+// GNU make jobserver, see jobserver.c.
+// The implicit token every process owns, the others are the bytes read from the jobserver.
+#define CTH_JOB_IMPLICIT 256
+int cth_jobserver_acquire(struct cth_jobserver *js);
+void cth_jobserver_release(struct cth_jobserver *js, int token);
+size_t cth_jobserver_child(const struct cth_jobserver *js, char *const *envp, char **out);
+bool cth_jobserver_owned(const struct cth_jobserver *js);
+// Container entry, see container.c.
+pid_t cth_container_fork(const struct cth_exec_attr *attr, const struct cth_cgroup *cg);
+int cth_container_enter(const struct cth_exec_attr *attr);
+// Zygote of cth_fork_rexec_self(), see zygote.c.
+int cth_zygote_exec(char *const argv[], int *status);
+// Execution tracing, see trace.c.
+// Phases of an execution, in the order they happen.
+#define CTH_TRACE_SPAWN 0
+#define CTH_TRACE_STDIN 1
+#define CTH_TRACE_RUNNING 2
+#define CTH_TRACE_DRAIN 3
+#define CTH_TRACE_REAPED 4
+uint64_t cth_trace_clock(void);
+void cth_trace_span(int phase, const char *argv0, pid_t pid, uint64_t start_us, uint64_t end_us, int64_t value);
+// Performance counters of a command, see perf.c.
+#define CTH_PERF_COUNT 5
+struct cth_perf {
+	// Counter fds indexed by the bit number of CTH_PERF_*, -1 if not opened.
+	int fd[CTH_PERF_COUNT];
+	bool user_only;
+};
+void cth_perf_init(struct cth_perf *perf);
+pid_t cth_perf_fork(const struct cth_exec_attr *attr, const struct cth_cgroup *cg, struct cth_perf *perf);
+struct cth_perf_stat *cth_perf_collect(struct cth_perf *perf, struct cth_perf_stat *stat);
+void cth_perf_close(struct cth_perf *perf);
+// Workload capture, see record.c.
+uint64_t cth_record_clock(void);
+void cth_record_finished(char *const argv[], uint64_t start_us, const struct cth_result *res, uint64_t stdin_bytes, unsigned int flags);
+// Incremental stream hashing, see hash.c.
+struct cth_hasher {
+	unsigned int algos;
+	uint64_t len;
+	uint32_t crc32c;
+	bool crc32c_hw;
+	uint64_t xxh_v[4];
+	uint8_t xxh_buf[32];
+	size_t xxh_buf_len;
+	uint32_t sha_state[8];
+	uint8_t sha_buf[64];
+	size_t sha_buf_len;
+};
+void cth_hasher_init(struct cth_hasher *h, unsigned int algos);
+void cth_hasher_update(struct cth_hasher *h, const void *buf, size_t len);
+void cth_hasher_final(struct cth_hasher *h, struct cth_digest *digest);
+// Execution metrics, see metrics.c.
+struct cth_metrics_series;
+uint64_t cth_metrics_clock(void);
+struct cth_metrics_series *cth_metrics_spawned(const char *argv0, uint64_t start_us, bool ok);
+void cth_metrics_finished(struct cth_metrics_series *s, const struct cth_result *res, bool get_output);
+// Result cache, see cache.c.
+struct cth_result *cth_cache_exec(struct cth_cache *cache, char **argv, char *input, bool get_output, const struct cth_exec_attr *attr, struct cth_result *(*exec)(char **, char *, bool, const struct cth_exec_attr *));
+#endif
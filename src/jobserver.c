@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <sys/eventfd.h>
+// GNU make jobserver.
+// A jobserver is a pipe or a named fifo holding one byte per free job slot, every process also owns one implicit slot.
+// A token is read before each spawn and written back after the command is reaped,
+// so that catsh shares the -jN of make, or acts as the jobserver of its own children.
+// Our own jobserver is a pipe, the only form all versions of make understand, the children inherit it.
+struct cth_jobserver {
+	// Our own non-blocking open file description of the pipe or fifo, so that a waiter never blocks in read()
+	// when another process took the token first.
+	int read_fd;
+	int write_fd;
+	// The pipe of our own jobserver, O_CLOEXEC, only inherited by the commands we run.
+	int pipe_fds[2];
+	// Readable after the implicit token is given back, it wakes up the waiters polling read_fd.
+	int event_fd;
+	// Created by cth_new_jobserver().
+	bool owned;
+	// 1 if the implicit token is free, shared with the non-blocking runners as the structure is MAP_SHARED.
+	uint32_t implicit;
+	// The fifo of make >= 4.4.
+	char path[PATH_MAX];
+	// The MAKEFLAGS entry for the children of our own jobserver.
+	char makeflags[64];
+};
+static struct cth_jobserver *cth_jobserver_alloc(void)
+{
+	struct cth_jobserver *js = mmap(NULL, sizeof(struct cth_jobserver), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (js == MAP_FAILED) {
+		return NULL;
+	}
+	js->read_fd = -1;
+	js->write_fd = -1;
+	js->pipe_fds[0] = -1;
+	js->pipe_fds[1] = -1;
+	js->implicit = 1;
+	js->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (js->event_fd < 0) {
+		munmap(js, sizeof(struct cth_jobserver));
+		return NULL;
+	}
+	return js;
+}
+static bool cth_fd_valid(int fd)
+{
+	return fd >= 0 && fcntl(fd, F_GETFD) >= 0;
+}
+static int cth_reopen_nonblock(int fd)
+{
+	/*
+	 * Open a new open file description of a pipe, as O_NONBLOCK of the one shared with make (or our children)
+	 * would also affect them.
+	 */
+	char path[64];
+	sprintf(path, "/proc/self/fd/%d", fd);
+	return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+// API function.
+struct cth_jobserver *cth_jobserver_from_env(void)
+{
+	/*
+	 * Join the jobserver of make from MAKEFLAGS, both --jobserver-auth=fifo:PATH and the R,W pipe fds.
+	 * Returns NULL if there is no usable jobserver, e.g. the command is not marked recursive with + in the Makefile,
+	 * so make closed the pipe fds.
+	 * The caller is responsible for freeing it using cth_free_jobserver().
+	 */
+	const char *flags = getenv("MAKEFLAGS");
+	if (flags == NULL) {
+		return NULL;
+	}
+	// The last one wins, as make appends it to the inherited flags.
+	const char *auth = NULL;
+	for (const char *p = flags; (p = strstr(p, "--jobserver-")) != NULL; p++) {
+		if (strncmp(p, "--jobserver-auth=", 17) == 0) {
+			auth = p + 17;
+		} else if (strncmp(p, "--jobserver-fds=", 16) == 0) {
+			// Before make 4.2.
+			auth = p + 16;
+		}
+	}
+	if (auth == NULL) {
+		return NULL;
+	}
+	struct cth_jobserver *js = cth_jobserver_alloc();
+	if (js == NULL) {
+		return NULL;
+	}
+	if (strncmp(auth, "fifo:", 5) == 0) {
+		size_t len = strcspn(auth + 5, " ");
+		if (len == 0 || len >= sizeof(js->path)) {
+			cth_free_jobserver(&js);
+			return NULL;
+		}
+		memcpy(js->path, auth + 5, len);
+		js->read_fd = open(js->path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		js->write_fd = js->read_fd;
+	} else {
+		int read_fd = -1;
+		if (sscanf(auth, "%d,%d", &read_fd, &js->write_fd) != 2 || !cth_fd_valid(read_fd)) {
+			js->write_fd = -1;
+		} else {
+			js->read_fd = cth_reopen_nonblock(read_fd);
+		}
+	}
+	if (!cth_fd_valid(js->read_fd) || !cth_fd_valid(js->write_fd)) {
+		cth_free_jobserver(&js);
+		return NULL;
+	}
+	return js;
+}
+// API function.
+struct cth_jobserver *cth_new_jobserver(unsigned int jobs)
+{
+	/*
+	 * Create a jobserver of jobs slots, for our own commands and their children.
+	 * The children get it as MAKEFLAGS=" -jN --jobserver-auth=R,W" with the pipe fds,
+	 * so make and other jobserver-aware tools run by us share the slots.
+	 * Returns NULL on failure.
+	 * The caller is responsible for freeing it using cth_free_jobserver().
+	 */
+	if (jobs == 0) {
+		return NULL;
+	}
+	struct cth_jobserver *js = cth_jobserver_alloc();
+	if (js == NULL) {
+		return NULL;
+	}
+	js->owned = true;
+	if (pipe2(js->pipe_fds, O_CLOEXEC) < 0 || (js->read_fd = cth_reopen_nonblock(js->pipe_fds[0])) < 0) {
+		cth_free_jobserver(&js);
+		return NULL;
+	}
+	js->write_fd = js->pipe_fds[1];
+	snprintf(js->makeflags, sizeof(js->makeflags), "MAKEFLAGS= -j%u --jobserver-auth=%d,%d", jobs, js->pipe_fds[0], js->pipe_fds[1]);
+	// One slot is the implicit token.
+	for (unsigned int i = 1; i < jobs; i++) {
+		if (write(js->write_fd, "+", 1) != 1) {
+			cth_free_jobserver(&js);
+			return NULL;
+		}
+	}
+	return js;
+}
+int cth_jobserver_acquire(struct cth_jobserver *js)
+{
+	/*
+	 * Take a token, blocks until one is free.
+	 * Returns the token to give back to cth_jobserver_release(), or -1 on failure.
+	 */
+	while (true) {
+		uint32_t free_token = 1;
+		if (__atomic_compare_exchange_n(&js->implicit, &free_token, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			return CTH_JOB_IMPLICIT;
+		}
+		unsigned char token;
+		ssize_t ret = read(js->read_fd, &token, 1);
+		if (ret == 1) {
+			return token;
+		}
+		if (ret == 0 || (ret < 0 && errno != EINTR && errno != EAGAIN)) {
+			return -1;
+		}
+		// Sleep until a token is written back, or the implicit one is given back.
+		// The event is drained before checking the implicit token again, so a release is never missed.
+		struct pollfd pfd[2] = { { js->read_fd, POLLIN, 0 }, { js->event_fd, POLLIN, 0 } };
+		if (poll(pfd, 2, -1) > 0 && (pfd[1].revents & POLLIN)) {
+			uint64_t count;
+			read(js->event_fd, &count, sizeof(count));
+		}
+	}
+}
+void cth_jobserver_release(struct cth_jobserver *js, int token)
+{
+	/*
+	 * Give back a token of cth_jobserver_acquire(), -1 is ignored.
+	 */
+	if (token == CTH_JOB_IMPLICIT) {
+		__atomic_store_n(&js->implicit, 1, __ATOMIC_RELEASE);
+		uint64_t one = 1;
+		write(js->event_fd, &one, sizeof(one));
+		return;
+	}
+	if (token < 0) {
+		return;
+	}
+	// make checks the tokens it gets back, so write back the same byte.
+	unsigned char byte = (unsigned char)token;
+	while (write(js->write_fd, &byte, 1) < 0 && errno == EINTR) {
+	}
+}
+size_t cth_jobserver_child(const struct cth_jobserver *js, char *const *envp, char **out)
+{
+	/*
+	 * Pass our own jobserver to the command, called in the child after fork(), so no allocation.
+	 * The pipe is inherited, and envp is copied into out with MAKEFLAGS replaced.
+	 * out should have room for all entries of envp plus two.
+	 * Returns the number of entries in out.
+	 */
+	fcntl(js->pipe_fds[0], F_SETFD, 0);
+	fcntl(js->pipe_fds[1], F_SETFD, 0);
+	size_t n = 0;
+	for (size_t i = 0; envp != NULL && envp[i] != NULL; i++) {
+		if (strncmp(envp[i], "MAKEFLAGS=", 10) != 0) {
+			out[n++] = envp[i];
+		}
+	}
+	out[n++] = (char *)js->makeflags;
+	out[n] = NULL;
+	return n;
+}
+bool cth_jobserver_owned(const struct cth_jobserver *js)
+{
+	return js != NULL && js->owned;
+}
+// API function.
+void cth_free_jobserver(struct cth_jobserver **js)
+{
+	/*
+	 * Free the jobserver.
+	 * The pipe fds inherited from make are left open.
+	 * *js: Pointer to the jobserver, can be NULL.
+	 * After calling this function, *js will be set to NULL.
+	 */
+	if (*js == NULL) {
+		return;
+	}
+	if ((*js)->read_fd >= 0) {
+		close((*js)->read_fd);
+	}
+	for (int i = 0; i < 2; i++) {
+		if ((*js)->pipe_fds[i] >= 0) {
+			close((*js)->pipe_fds[i]);
+		}
+	}
+	close((*js)->event_fd);
+	munmap(*js, sizeof(struct cth_jobserver));
+	*js = NULL;
+}
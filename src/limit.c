@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// Resource limits applied in the child between fork and exec,
+// and the guess of which one killed the command.
+static const struct rlimit *cth_find_rlimit(const struct cth_exec_attr *attr, int resource)
+{
+	/*
+	 * Find the limit set for resource, the last one wins.
+	 * Returns NULL if not set.
+	 */
+	const struct rlimit *ret = NULL;
+	for (size_t i = 0; attr != NULL && i < attr->rlimit_count; i++) {
+		if (attr->rlimits[i].resource == resource) {
+			ret = &attr->rlimits[i].limit;
+		}
+	}
+	return ret;
+}
+int cth_apply_rlimits(const struct cth_exec_attr *attr)
+{
+	/*
+	 * Apply attr->rlimits to the calling process.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (attr == NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i < attr->rlimit_count; i++) {
+		if (setrlimit(attr->rlimits[i].resource, &attr->rlimits[i].limit) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+int cth_limit_hit(const struct cth_exec_attr *attr, int status, const struct rusage *ru)
+{
+	/*
+	 * Guess which limit killed the command from the wait status and rusage.
+	 * SIGXCPU and SIGXFSZ are only sent for RLIMIT_CPU and RLIMIT_FSIZE,
+	 * SIGKILL is RLIMIT_CPU if the CPU time reached the hard limit,
+	 * SIGSEGV/SIGBUS/SIGABRT are RLIMIT_AS only if the peak RSS reached half of it,
+	 * as the address space is always larger than the RSS, otherwise it's an ordinary crash.
+	 * Returns the RLIMIT_* resource, or CTH_LIMIT_NONE.
+	 */
+	if (attr == NULL || attr->rlimit_count == 0 || !WIFSIGNALED(status)) {
+		return CTH_LIMIT_NONE;
+	}
+	const struct rlimit *cpu = cth_find_rlimit(attr, RLIMIT_CPU);
+	switch (WTERMSIG(status)) {
+	case SIGXCPU:
+		return cpu != NULL ? RLIMIT_CPU : CTH_LIMIT_NONE;
+	case SIGXFSZ:
+		return cth_find_rlimit(attr, RLIMIT_FSIZE) != NULL ? RLIMIT_FSIZE : CTH_LIMIT_NONE;
+	case SIGKILL:
+		if (cpu != NULL && ru != NULL && cpu->rlim_max != RLIM_INFINITY && (rlim_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec + 1) >= cpu->rlim_max) {
+			return RLIMIT_CPU;
+		}
+		return CTH_LIMIT_NONE;
+	case SIGSEGV:
+	case SIGBUS:
+	case SIGABRT: {
+		const struct rlimit *as = cth_find_rlimit(attr, RLIMIT_AS);
+		// ru_maxrss is in KiB.
+		if (as != NULL && ru != NULL && as->rlim_cur != RLIM_INFINITY && (rlim_t)ru->ru_maxrss * 1024 * 2 >= as->rlim_cur) {
+			return RLIMIT_AS;
+		}
+		return CTH_LIMIT_NONE;
+	}
+	default:
+		return CTH_LIMIT_NONE;
+	}
+}
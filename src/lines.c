@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+// Line and field splitting over captured output.
+// The newline scan is the hot path for large outputs, so it's vectorized with AVX2/SSE2/NEON,
+// and falls back to memchr() on other platforms.
+static int cth_lines_reserve(struct cth_lines *lines, size_t *cap, size_t more)
+{
+	/*
+	 * Make sure there's room for more delimiter positions.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (lines->ndelims + more <= *cap) {
+		return 0;
+	}
+	size_t new_cap = *cap * 2;
+	if (new_cap < lines->ndelims + more) {
+		new_cap = lines->ndelims + more;
+	}
+	size_t *new_delims = realloc(lines->delims, new_cap * sizeof(size_t));
+	if (new_delims == NULL) {
+		return -1;
+	}
+	lines->delims = new_delims;
+	*cap = new_cap;
+	return 0;
+}
+static int cth_scan_scalar(struct cth_lines *lines, size_t *cap, size_t from)
+{
+	/*
+	 * Record the delimiters in buf[from, len) with memchr().
+	 * Returns 0 on success, -1 on failure.
+	 */
+	const char *p = lines->buf + from;
+	const char *end = lines->buf + lines->len;
+	while (p < end) {
+		const char *hit = memchr(p, lines->delim, (size_t)(end - p));
+		if (hit == NULL) {
+			break;
+		}
+		if (cth_lines_reserve(lines, cap, 1) < 0) {
+			return -1;
+		}
+		lines->delims[lines->ndelims++] = (size_t)(hit - lines->buf);
+		p = hit + 1;
+	}
+	return 0;
+}
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static int cth_scan_avx2(struct cth_lines *lines, size_t *cap)
+{
+	/*
+	 * Record the delimiters 32 bytes at a time, the tail is left to cth_scan_scalar().
+	 * Returns 0 on success, -1 on failure.
+	 */
+	const __m256i needle = _mm256_set1_epi8(lines->delim);
+	size_t i = 0;
+	for (; i + 32 <= lines->len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(lines->buf + i));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+		if (mask == 0) {
+			continue;
+		}
+		if (cth_lines_reserve(lines, cap, 32) < 0) {
+			return -1;
+		}
+		while (mask != 0) {
+			lines->delims[lines->ndelims++] = i + (size_t)__builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	return cth_scan_scalar(lines, cap, i);
+}
+#endif
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+static int cth_scan_sse2(struct cth_lines *lines, size_t *cap)
+{
+	/*
+	 * Record the delimiters 16 bytes at a time, the tail is left to cth_scan_scalar().
+	 * Returns 0 on success, -1 on failure.
+	 */
+	const __m128i needle = _mm_set1_epi8(lines->delim);
+	size_t i = 0;
+	for (; i + 16 <= lines->len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(lines->buf + i));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+		if (mask == 0) {
+			continue;
+		}
+		if (cth_lines_reserve(lines, cap, 16) < 0) {
+			return -1;
+		}
+		while (mask != 0) {
+			lines->delims[lines->ndelims++] = i + (size_t)__builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	return cth_scan_scalar(lines, cap, i);
+}
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+static int cth_scan_neon(struct cth_lines *lines, size_t *cap)
+{
+	/*
+	 * Record the delimiters 16 bytes at a time, the tail is left to cth_scan_scalar().
+	 * NEON has no movemask, so narrow the compare result to 4 bits per byte.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	const uint8x16_t needle = vdupq_n_u8((uint8_t)lines->delim);
+	size_t i = 0;
+	for (; i + 16 <= lines->len; i += 16) {
+		uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)(lines->buf + i)), needle);
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		if (mask == 0) {
+			continue;
+		}
+		if (cth_lines_reserve(lines, cap, 16) < 0) {
+			return -1;
+		}
+		while (mask != 0) {
+			unsigned int byte = (unsigned int)__builtin_ctzll(mask) >> 2;
+			lines->delims[lines->ndelims++] = i + byte;
+			mask &= ~(0xfULL << (byte * 4));
+		}
+	}
+	return cth_scan_scalar(lines, cap, i);
+}
+#endif
+static int cth_scan(struct cth_lines *lines, size_t *cap)
+{
+	/*
+	 * Pick the best scanner for this CPU.
+	 */
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return cth_scan_avx2(lines, cap);
+	}
+	return cth_scan_sse2(lines, cap);
+#elif defined(__i386__) && defined(__SSE2__)
+	return cth_scan_sse2(lines, cap);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	return cth_scan_neon(lines, cap);
+#else
+	return cth_scan_scalar(lines, cap, 0);
+#endif
+}
+// API function.
+struct cth_lines *cth_lines_index_delim(const char *buf, size_t len, char delim)
+{
+	/*
+	 * Build an index of the records in buf, separated by delim.
+	 * buf: The buffer to index, not copied, so it should outlive the index.
+	 * len: Length of buf, buf does not need to be NUL-terminated.
+	 * delim: The record delimiter, usually '\n'.
+	 * Returns the index on success, NULL on failure.
+	 * The caller is responsible for freeing it using cth_free_lines().
+	 */
+	if (buf == NULL && len > 0) {
+		return NULL;
+	}
+	struct cth_lines *lines = malloc(sizeof(struct cth_lines));
+	if (lines == NULL) {
+		return NULL;
+	}
+	lines->buf = buf;
+	lines->len = len;
+	lines->delim = delim;
+	lines->ndelims = 0;
+	// Guess one line per 64 bytes, it will grow if needed.
+	size_t cap = len / 64 + 16;
+	lines->delims = malloc(cap * sizeof(size_t));
+	if (lines->delims == NULL || cth_scan(lines, &cap) < 0) {
+		free(lines->delims);
+		free(lines);
+		return NULL;
+	}
+	// The last record does not need a trailing delimiter.
+	lines->count = lines->ndelims;
+	if (len > 0 && (lines->ndelims == 0 || lines->delims[lines->ndelims - 1] != len - 1)) {
+		lines->count++;
+	}
+	return lines;
+}
+// API function.
+struct cth_lines *cth_lines_index(const char *buf, size_t len)
+{
+	/*
+	 * Build an index of the lines in buf.
+	 * Same as cth_lines_index_delim(buf, len, '\n').
+	 */
+	return cth_lines_index_delim(buf, len, '\n');
+}
+// API function.
+const char *cth_line(const struct cth_lines *lines, size_t i, size_t *len)
+{
+	/*
+	 * Get the i-th line, without copying.
+	 * lines: The index from cth_lines_index().
+	 * i: Line number, starts from 0.
+	 * len: Set to the length of the line, without the delimiter.
+	 * Returns a pointer into the indexed buffer, NULL if i is out of range.
+	 * Note: the line is NOT NUL-terminated.
+	 */
+	if (lines == NULL || i >= lines->count) {
+		return NULL;
+	}
+	size_t start = i == 0 ? 0 : lines->delims[i - 1] + 1;
+	size_t end = i < lines->ndelims ? lines->delims[i] : lines->len;
+	*len = end - start;
+	return lines->buf + start;
+}
+// API function.
+void cth_free_lines(struct cth_lines **lines)
+{
+	/*
+	 * Free the index, the indexed buffer is not touched.
+	 * After calling this function, *lines will be set to NULL.
+	 */
+	if (*lines == NULL) {
+		return;
+	}
+	free((*lines)->delims);
+	free(*lines);
+	*lines = NULL;
+}
+// API function.
+void cth_fields_init(struct cth_fields *fields, const char *line, size_t len, char delim)
+{
+	/*
+	 * Start splitting a line into fields separated by delim, without copying.
+	 * Empty fields are kept, like cut(1), so "a,,b" has 3 fields.
+	 */
+	fields->pos = line;
+	fields->end = line + len;
+	fields->delim = delim;
+	fields->done = false;
+}
+// API function.
+bool cth_fields_next(struct cth_fields *fields, const char **field, size_t *len)
+{
+	/*
+	 * Get the next field.
+	 * field/len: Set to the field, it points into the line and is NOT NUL-terminated.
+	 * Returns true if a field is returned, false if there's no more field.
+	 */
+	if (fields->done) {
+		return false;
+	}
+	const char *hit = memchr(fields->pos, fields->delim, (size_t)(fields->end - fields->pos));
+	*field = fields->pos;
+	if (hit == NULL) {
+		*len = (size_t)(fields->end - fields->pos);
+		fields->done = true;
+		return true;
+	}
+	*len = (size_t)(hit - fields->pos);
+	fields->pos = hit + 1;
+	return true;
+}
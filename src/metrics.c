@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <stddef.h>
+// Process-wide execution metrics, exported in Prometheus text format.
+// The registry is MAP_SHARED anonymous memory like the status slab, so the runner processes
+// of non-blocking commands update it too. Every update is a relaxed atomic add, no locks.
+// Series are labeled by argv[0] with CTH_METRICS_BY_ARGV0, found in an open addressing table.
+// Histograms are log-linear, 4 buckets per power of 2, like HDR histograms with 2 bits of precision.
+#define CTH_METRICS_SERIES 128
+#define CTH_METRICS_LABEL_MAX 64
+#define CTH_METRICS_BUCKETS 252
+// State of a series slot.
+#define CTH_SERIES_FREE 0
+#define CTH_SERIES_INIT 1
+#define CTH_SERIES_READY 2
+struct cth_histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t buckets[CTH_METRICS_BUCKETS];
+};
+struct cth_metrics_series {
+	uint32_t state;
+	uint64_t hash;
+	char label[CTH_METRICS_LABEL_MAX];
+	uint64_t spawns;
+	uint64_t failures;
+	uint64_t timeouts;
+	int64_t in_flight;
+	// In microseconds.
+	struct cth_histogram spawn_latency;
+	struct cth_histogram wall_time;
+	// In bytes, stdout and stderr together.
+	struct cth_histogram output;
+};
+struct cth_metrics {
+	int flags;
+	// Slot 0 is the unlabeled series, and the overflow of a full table.
+	struct cth_metrics_series series[CTH_METRICS_SERIES];
+};
+static struct cth_metrics *cth_metrics_reg = NULL;
+static size_t cth_bucket_index(uint64_t v)
+{
+	/*
+	 * Bucket of v: exact below 4, then 4 sub-buckets per power of 2.
+	 */
+	if (v < 4) {
+		return (size_t)v;
+	}
+	int e = 63 - __builtin_clzll(v);
+	return (size_t)(4 * (e - 1)) + (size_t)((v >> (e - 2)) & 3);
+}
+static uint64_t cth_bucket_upper(size_t idx)
+{
+	/*
+	 * Inclusive upper bound of bucket idx.
+	 */
+	if (idx < 4) {
+		return idx;
+	}
+	int e = (int)(idx / 4) + 1;
+	uint64_t lower = (uint64_t)(4 + idx % 4) << (e - 2);
+	return lower + ((uint64_t)1 << (e - 2)) - 1;
+}
+static void cth_observe(struct cth_histogram *h, uint64_t v)
+{
+	__atomic_add_fetch(&h->buckets[cth_bucket_index(v)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum, v, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+}
+static struct cth_metrics_series *cth_metrics_find(struct cth_metrics *m, const char *argv0)
+{
+	/*
+	 * Find or insert the series of argv0, lock-free.
+	 * Returns the unlabeled series if labels are off, or the table is full.
+	 */
+	if (!(m->flags & CTH_METRICS_BY_ARGV0) || argv0 == NULL) {
+		return &m->series[0];
+	}
+	// FNV-1a, over the part of the name that fits into the label.
+	uint64_t hash = 14695981039346656037ULL;
+	size_t len = 0;
+	for (; argv0[len] != '\0' && len < CTH_METRICS_LABEL_MAX - 1; len++) {
+		hash = (hash ^ (uint8_t)argv0[len]) * 1099511628211ULL;
+	}
+	for (size_t i = 0; i < CTH_METRICS_SERIES - 1; i++) {
+		struct cth_metrics_series *s = &m->series[1 + (hash + i) % (CTH_METRICS_SERIES - 1)];
+		uint32_t state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+		if (state == CTH_SERIES_FREE) {
+			if (__atomic_compare_exchange_n(&s->state, &state, CTH_SERIES_INIT, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				memcpy(s->label, argv0, len);
+				s->label[len] = '\0';
+				s->hash = hash;
+				__atomic_store_n(&s->state, CTH_SERIES_READY, __ATOMIC_RELEASE);
+				return s;
+			}
+		}
+		// Another thread is filling it in, it's only a memcpy().
+		while (state == CTH_SERIES_INIT) {
+			sched_yield();
+			state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+		}
+		if (s->hash == hash && strncmp(s->label, argv0, len) == 0 && s->label[len] == '\0') {
+			return s;
+		}
+	}
+	return &m->series[0];
+}
+uint64_t cth_metrics_clock(void)
+{
+	/*
+	 * Monotonic clock in microseconds, 0 if metrics are off, so the hot path skips clock_gettime().
+	 */
+	if (__atomic_load_n(&cth_metrics_reg, __ATOMIC_ACQUIRE) == NULL) {
+		return 0;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+struct cth_metrics_series *cth_metrics_spawned(const char *argv0, uint64_t start_us, bool ok)
+{
+	/*
+	 * Count a spawn, start_us is cth_metrics_clock() before the fork.
+	 * ok: false if the fork failed, that counts as a failure.
+	 * Returns the series to pass to cth_metrics_finished(), NULL if metrics are off or the spawn failed.
+	 */
+	struct cth_metrics *m = __atomic_load_n(&cth_metrics_reg, __ATOMIC_ACQUIRE);
+	if (m == NULL || start_us == 0) {
+		return NULL;
+	}
+	struct cth_metrics_series *s = cth_metrics_find(m, argv0);
+	__atomic_add_fetch(&s->spawns, 1, __ATOMIC_RELAXED);
+	if (!ok) {
+		__atomic_add_fetch(&s->failures, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	__atomic_add_fetch(&s->in_flight, 1, __ATOMIC_RELAXED);
+	uint64_t now = cth_metrics_clock();
+	cth_observe(&s->spawn_latency, now > start_us ? now - start_us : 0);
+	return s;
+}
+void cth_metrics_finished(struct cth_metrics_series *s, const struct cth_result *res, bool get_output)
+{
+	/*
+	 * Count the end of a command spawned with cth_metrics_spawned().
+	 * res: NULL if we failed to wait for it, that counts as a failure.
+	 */
+	if (s == NULL) {
+		return;
+	}
+	__atomic_sub_fetch(&s->in_flight, 1, __ATOMIC_RELAXED);
+	if (res == NULL) {
+		__atomic_add_fetch(&s->failures, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (res->exit_code != 0 || res->term_signal != 0) {
+		__atomic_add_fetch(&s->failures, 1, __ATOMIC_RELAXED);
+	}
+	if (res->timed_out) {
+		__atomic_add_fetch(&s->timeouts, 1, __ATOMIC_RELAXED);
+	}
+	cth_observe(&s->wall_time, res->time_used);
+	if (get_output) {
+		cth_observe(&s->output, res->stdout_total + res->stderr_total);
+	}
+}
+// API function.
+int cth_metrics_enable(int flags)
+{
+	/*
+	 * Start collecting execution metrics, for all the commands spawned after this.
+	 * flags: CTH_METRICS_BY_ARGV0 to label the series by argv[0], up to 127 different names,
+	 *        the rest are counted in the unlabeled series.
+	 * Enable it before starting non-blocking commands, so that their runners share the registry.
+	 * Calling it again does nothing, the flags of the first call stay.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (__atomic_load_n(&cth_metrics_reg, __ATOMIC_ACQUIRE) != NULL) {
+		return 0;
+	}
+	struct cth_metrics *m = mmap(NULL, sizeof(struct cth_metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED) {
+		return -1;
+	}
+	m->flags = flags;
+	m->series[0].state = CTH_SERIES_READY;
+	struct cth_metrics *expected = NULL;
+	if (!__atomic_compare_exchange_n(&cth_metrics_reg, &expected, m, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// Lost the race, the registry is never unmapped, so drop ours.
+		munmap(m, sizeof(struct cth_metrics));
+	}
+	return 0;
+}
+static void cth_metrics_labels(FILE *out, const struct cth_metrics *m, const struct cth_metrics_series *s, const char *extra)
+{
+	/*
+	 * Write the label set of s, with an extra label if not NULL, escaped as the text format needs.
+	 */
+	bool labeled = (m->flags & CTH_METRICS_BY_ARGV0) != 0;
+	if (!labeled && extra == NULL) {
+		return;
+	}
+	fputc('{', out);
+	if (labeled) {
+		fputs("argv0=\"", out);
+		const char *label = s == &m->series[0] ? "_other" : s->label;
+		for (const char *p = label; *p != '\0'; p++) {
+			if (*p == '\\' || *p == '"') {
+				fputc('\\', out);
+				fputc(*p, out);
+			} else if (*p == '\n') {
+				fputs("\\n", out);
+			} else {
+				fputc(*p, out);
+			}
+		}
+		fputc('"', out);
+	}
+	if (extra != NULL) {
+		fprintf(out, "%s%s", labeled ? "," : "", extra);
+	}
+	fputc('}', out);
+}
+static void cth_metrics_histogram(FILE *out, const struct cth_metrics *m, const char *name, const char *help, size_t offset, double scale)
+{
+	/*
+	 * Write one histogram family, offset is the offset of the histogram in the series.
+	 * scale converts the stored unit into the exported one.
+	 * Only the buckets from the lowest to the highest non-empty one are written, then +Inf.
+	 */
+	fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	for (size_t i = 0; i < CTH_METRICS_SERIES; i++) {
+		const struct cth_metrics_series *s = &m->series[i];
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != CTH_SERIES_READY) {
+			continue;
+		}
+		const struct cth_histogram *h = (const struct cth_histogram *)((const char *)s + offset);
+		uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+		if (count == 0) {
+			continue;
+		}
+		size_t bottom = CTH_METRICS_BUCKETS;
+		size_t top = 0;
+		for (size_t b = 0; b < CTH_METRICS_BUCKETS; b++) {
+			if (__atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED) != 0) {
+				bottom = bottom < b ? bottom : b;
+				top = b;
+			}
+		}
+		uint64_t cumulative = 0;
+		char le[64];
+		for (size_t b = bottom; b <= top; b++) {
+			cumulative += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+			snprintf(le, sizeof(le), "le=\"%.9g\"", (double)cth_bucket_upper(b) * scale);
+			fprintf(out, "%s_bucket", name);
+			cth_metrics_labels(out, m, s, le);
+			fprintf(out, " %llu\n", (unsigned long long)cumulative);
+		}
+		// Updates racing with the dump may make count a bit larger than the buckets, keep +Inf consistent.
+		fprintf(out, "%s_bucket", name);
+		cth_metrics_labels(out, m, s, "le=\"+Inf\"");
+		fprintf(out, " %llu\n%s_sum", (unsigned long long)(count > cumulative ? count : cumulative), name);
+		cth_metrics_labels(out, m, s, NULL);
+		fprintf(out, " %.9g\n%s_count", (double)__atomic_load_n(&h->sum, __ATOMIC_RELAXED) * scale, name);
+		cth_metrics_labels(out, m, s, NULL);
+		fprintf(out, " %llu\n", (unsigned long long)(count > cumulative ? count : cumulative));
+	}
+}
+static void cth_metrics_counter(FILE *out, const struct cth_metrics *m, const char *name, const char *type, const char *help, size_t offset)
+{
+	/*
+	 * Write one counter or gauge family, offset is the offset of the value in the series.
+	 */
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	for (size_t i = 0; i < CTH_METRICS_SERIES; i++) {
+		const struct cth_metrics_series *s = &m->series[i];
+		if (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != CTH_SERIES_READY) {
+			continue;
+		}
+		// The unlabeled series is only written if it's used, or if it's the only one.
+		if (i == 0 && (m->flags & CTH_METRICS_BY_ARGV0) && __atomic_load_n(&s->spawns, __ATOMIC_RELAXED) == 0) {
+			continue;
+		}
+		int64_t value = __atomic_load_n((const int64_t *)((const char *)s + offset), __ATOMIC_RELAXED);
+		fprintf(out, "%s", name);
+		cth_metrics_labels(out, m, s, NULL);
+		fprintf(out, " %lld\n", (long long)value);
+	}
+}
+// API function.
+int cth_metrics_dump(int fd)
+{
+	/*
+	 * Write the metrics to fd in Prometheus text exposition format.
+	 * Times are in seconds and sizes in bytes, as Prometheus expects.
+	 * Returns 0 on success, -1 on failure or if metrics are not enabled.
+	 */
+	const struct cth_metrics *m = __atomic_load_n(&cth_metrics_reg, __ATOMIC_ACQUIRE);
+	if (m == NULL) {
+		return -1;
+	}
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&text, &len);
+	if (out == NULL) {
+		return -1;
+	}
+	cth_metrics_counter(out, m, "catsh_spawns_total", "counter", "Commands spawned.", offsetof(struct cth_metrics_series, spawns));
+	cth_metrics_counter(out, m, "catsh_failures_total", "counter", "Commands that failed to spawn, exited non-zero or were killed.", offsetof(struct cth_metrics_series, failures));
+	cth_metrics_counter(out, m, "catsh_timeouts_total", "counter", "Commands killed by timeout_ms.", offsetof(struct cth_metrics_series, timeouts));
+	cth_metrics_counter(out, m, "catsh_in_flight", "gauge", "Commands running now.", offsetof(struct cth_metrics_series, in_flight));
+	cth_metrics_histogram(out, m, "catsh_spawn_latency_seconds", "Time to fork the command.", offsetof(struct cth_metrics_series, spawn_latency), 1e-6);
+	cth_metrics_histogram(out, m, "catsh_wall_time_seconds", "Wall time of the command.", offsetof(struct cth_metrics_series, wall_time), 1e-6);
+	cth_metrics_histogram(out, m, "catsh_output_bytes", "Captured stdout and stderr, including the dropped part.", offsetof(struct cth_metrics_series, output), 1.0);
+	if (fclose(out) != 0) {
+		free(text);
+		return -1;
+	}
+	size_t written = 0;
+	while (written < len) {
+		ssize_t n = write(fd, text + written, len - written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		written += (size_t)n;
+	}
+	free(text);
+	return written == len ? 0 : -1;
+}
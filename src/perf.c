@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <linux/perf_event.h>
+// Hardware performance counters of a command, with perf_event_open(2).
+// The counters are opened by the parent on the forked child, which waits for them before going on
+// to exec, see cth_perf_fork(). They are enabled on exec, so the setup of the child is not counted,
+// and inherited, so the threads and the children of the command are counted too, their counts are
+// added up when they exit. The hardware counters are one group, so they are scheduled together
+// and their ratios (e.g. IPC) hold even if the PMU is multiplexed. task-clock is a software counter
+// on its own, it never fails to schedule.
+// Counters are read one by one, inherited counters can not be read with PERF_FORMAT_GROUP.
+struct cth_perf_event {
+	uint32_t type;
+	uint64_t config;
+};
+// Indexed by the bit number of CTH_PERF_*.
+static const struct cth_perf_event cth_perf_events[CTH_PERF_COUNT] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+void cth_perf_init(struct cth_perf *perf)
+{
+	/*
+	 * No counters opened.
+	 */
+	for (int i = 0; i < CTH_PERF_COUNT; i++) {
+		perf->fd[i] = -1;
+	}
+	perf->user_only = false;
+}
+static int cth_perf_open_one(const struct cth_perf_event *ev, pid_t pid, int group_fd, bool user_only)
+{
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(pe));
+	pe.size = sizeof(pe);
+	pe.type = ev->type;
+	pe.config = ev->config;
+	pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	pe.disabled = 1;
+	pe.enable_on_exec = 1;
+	pe.inherit = 1;
+	pe.exclude_kernel = user_only;
+	pe.exclude_hv = user_only;
+	return (int)syscall(SYS_perf_event_open, &pe, pid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+static void cth_perf_open(unsigned int events, pid_t pid, struct cth_perf *perf)
+{
+	/*
+	 * Open the CTH_PERF_* counters on pid, before it execs.
+	 * The counters the kernel refuses are skipped, this never fails the command:
+	 * with perf_event_paranoid 2, only user space can be counted without CAP_PERFMON, so the counters are
+	 * opened again excluding the kernel, and user_only is set. With 3 (some distros) or no PMU (e.g. most VMs),
+	 * the hardware counters are just missing.
+	 */
+	int leader = -1;
+	for (int i = 0; i < CTH_PERF_COUNT; i++) {
+		if ((events & (1U << i)) == 0) {
+			continue;
+		}
+		bool hw = cth_perf_events[i].type == PERF_TYPE_HARDWARE;
+		int group_fd = hw ? leader : -1;
+		int fd = cth_perf_open_one(&cth_perf_events[i], pid, group_fd, perf->user_only);
+		if (fd < 0 && (errno == EACCES || errno == EPERM) && !perf->user_only) {
+			// Count user space only from now on, the counters already open are reopened to match.
+			perf->user_only = true;
+			for (int j = 0; j < i; j++) {
+				if (perf->fd[j] >= 0) {
+					close(perf->fd[j]);
+					perf->fd[j] = -1;
+				}
+			}
+			leader = -1;
+			i = -1;
+			continue;
+		}
+		if (fd < 0) {
+			continue;
+		}
+		perf->fd[i] = fd;
+		if (hw && leader < 0) {
+			leader = fd;
+		}
+	}
+}
+pid_t cth_perf_fork(const struct cth_exec_attr *attr, const struct cth_cgroup *cg, struct cth_perf *perf)
+{
+	/*
+	 * cth_container_fork(), with the counters of attr->perf_events opened on the child.
+	 * perf: Where the counters go, NULL if the caller does not collect them.
+	 * The child waits for them on a gate pipe, so it does not exec before they are attached.
+	 * Returns the same as fork().
+	 */
+	int gate[2] = { -1, -1 };
+	if (perf == NULL || attr == NULL || attr->perf_events == 0 || pipe2(gate, O_CLOEXEC) < 0) {
+		return cth_container_fork(attr, cg);
+	}
+	pid_t pid = cth_container_fork(attr, cg);
+	if (pid == 0) {
+		// Wait for a byte, not for EOF, other children forked meanwhile may hold the write end until their exec.
+		close(gate[1]);
+		char c;
+		while (read(gate[0], &c, 1) < 0 && errno == EINTR) {
+		}
+		close(gate[0]);
+		return 0;
+	}
+	close(gate[0]);
+	if (pid > 0) {
+		cth_perf_open(attr->perf_events, pid, perf);
+	}
+	// The child goes on even if no counter could be opened.
+	while (write(gate[1], "", 1) < 0 && errno == EINTR) {
+	}
+	close(gate[1]);
+	return pid;
+}
+void cth_perf_close(struct cth_perf *perf)
+{
+	/*
+	 * Close the counters without reading them, e.g. on failure.
+	 */
+	for (int i = 0; i < CTH_PERF_COUNT; i++) {
+		if (perf->fd[i] >= 0) {
+			close(perf->fd[i]);
+			perf->fd[i] = -1;
+		}
+	}
+}
+struct cth_perf_stat *cth_perf_collect(struct cth_perf *perf, struct cth_perf_stat *stat)
+{
+	/*
+	 * Read the counters of a reaped command and close them.
+	 * stat: The counts are added to it, so the commands of a pipeline add up, NULL to allocate a new one.
+	 * Returns stat, or the new one, NULL if no counter was opened.
+	 */
+	bool hw_timed = false;
+	for (int i = 0; i < CTH_PERF_COUNT; i++) {
+		if (perf->fd[i] < 0) {
+			continue;
+		}
+		// value, time_enabled, time_running.
+		uint64_t values[3];
+		bool ok = read(perf->fd[i], values, sizeof(values)) == (ssize_t)sizeof(values);
+		close(perf->fd[i]);
+		perf->fd[i] = -1;
+		if (!ok) {
+			continue;
+		}
+		if (stat == NULL && (stat = calloc(1, sizeof(struct cth_perf_stat))) == NULL) {
+			continue;
+		}
+		stat->events |= 1U << i;
+		stat->user_only = stat->user_only || perf->user_only;
+		uint64_t value = values[0];
+		if (values[2] == 0) {
+			// Never scheduled.
+			value = 0;
+		} else if (values[2] < values[1]) {
+			// Multiplexed, scale it up to the whole time.
+			value = (uint64_t)((double)value * (double)values[1] / (double)values[2]);
+		}
+		switch (1U << i) {
+		case CTH_PERF_CYCLES:
+			stat->cycles += value;
+			break;
+		case CTH_PERF_INSTRUCTIONS:
+			stat->instructions += value;
+			break;
+		case CTH_PERF_CACHE_MISSES:
+			stat->cache_misses += value;
+			break;
+		case CTH_PERF_BRANCH_MISSES:
+			stat->branch_misses += value;
+			break;
+		default:
+			stat->task_clock_ns += value;
+			break;
+		}
+		// The times of the hardware group, all the hardware counters share them.
+		if (cth_perf_events[i].type == PERF_TYPE_HARDWARE && !hw_timed) {
+			stat->time_enabled_ns += values[1];
+			stat->time_running_ns += values[2];
+			hw_timed = true;
+		}
+	}
+	return stat;
+}
@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// Workload capture, for replaying a real workload in benchmarks, see tests/bench_replay.c.
+// Each command run while recording is appended to the log as one record, with a single write()
+// to an O_APPEND fd, so the runner processes of non-blocking commands, which inherit the fd,
+// append to the same log without tearing the records of each other.
+// The records are in the byte order of the host, the log is meant to be replayed on the same kind of machine.
+#define CTH_RECORD_MAGIC 0x52485443 // "CTHR"
+// Sanity cap of a record read back, a larger one means the log is corrupted.
+#define CTH_RECORD_MAX_SIZE (1024 * 1024 * 16)
+struct __attribute__((packed)) cth_record_header {
+	uint32_t magic;
+	// Size of the whole record, header included.
+	uint32_t size;
+	uint64_t start_us;
+	uint64_t wall_us;
+	uint64_t stdin_bytes;
+	uint64_t stdout_bytes;
+	uint64_t stderr_bytes;
+	int32_t exit_code;
+	uint16_t flags;
+	// Followed by argc NUL-terminated strings.
+	uint16_t argc;
+};
+static int cth_recorder = -1;
+uint64_t cth_record_clock(void)
+{
+	/*
+	 * Wall clock in microseconds, 0 if recording is off.
+	 * CLOCK_REALTIME, so that the records of several processes and sessions can be ordered in one log.
+	 */
+	if (__atomic_load_n(&cth_recorder, __ATOMIC_ACQUIRE) < 0) {
+		return 0;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+void cth_record_finished(char *const argv[], uint64_t start_us, const struct cth_result *res, uint64_t stdin_bytes, unsigned int flags)
+{
+	/*
+	 * Append a command that started at start_us of cth_record_clock() to the log, with its result.
+	 * start_us is 0 if recording was off when the command started, nothing is recorded then.
+	 * flags: CTH_RECORD_* known by the caller, CTH_RECORD_TIMED_OUT is taken from res.
+	 */
+	int fd = __atomic_load_n(&cth_recorder, __ATOMIC_ACQUIRE);
+	if (fd < 0 || start_us == 0 || res == NULL || argv == NULL) {
+		return;
+	}
+	uint64_t end_us = cth_record_clock();
+	size_t size = sizeof(struct cth_record_header);
+	size_t argc = 0;
+	for (; argv[argc] != NULL && argc < UINT16_MAX; argc++) {
+		size += strlen(argv[argc]) + 1;
+	}
+	if (size > CTH_RECORD_MAX_SIZE) {
+		return;
+	}
+	char *buf = malloc(size);
+	if (buf == NULL) {
+		return;
+	}
+	struct cth_record_header h = {
+		.magic = CTH_RECORD_MAGIC,
+		.size = (uint32_t)size,
+		.start_us = start_us,
+		.wall_us = end_us > start_us ? end_us - start_us : 0,
+		.stdin_bytes = stdin_bytes,
+		.stdout_bytes = res->stdout_total,
+		.stderr_bytes = res->stderr_total,
+		.exit_code = res->exit_code,
+		.flags = (uint16_t)(flags | (res->timed_out ? CTH_RECORD_TIMED_OUT : 0)),
+		.argc = (uint16_t)argc,
+	};
+	memcpy(buf, &h, sizeof(h));
+	char *pos = buf + sizeof(h);
+	for (size_t i = 0; i < argc; i++) {
+		size_t len = strlen(argv[i]) + 1;
+		memcpy(pos, argv[i], len);
+		pos += len;
+	}
+	// One write() per record, a short write is not retried, the reader stops at the torn record.
+	ssize_t n;
+	do {
+		n = write(fd, buf, size);
+	} while (n < 0 && errno == EINTR);
+	free(buf);
+}
+// API function.
+int cth_record_start(const char *path)
+{
+	/*
+	 * Start logging every command run after this to the file at path, appended to it if it exists.
+	 * A record holds the argv, the start time, the wall time from spawn to the output collected,
+	 * the input and output sizes and the exit code, read it back with cth_record_next().
+	 * Start it before starting non-blocking commands, so that their runners log them too.
+	 * The pipelines of cth_run() are not recorded, only its single commands, which run through cth_exec_with_attr().
+	 * Returns 0 on success, -1 on failure, or if recording is already started.
+	 */
+	if (path == NULL || __atomic_load_n(&cth_recorder, __ATOMIC_ACQUIRE) >= 0) {
+		errno = EBUSY;
+		return -1;
+	}
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	int expected = -1;
+	if (!__atomic_compare_exchange_n(&cth_recorder, &expected, fd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		close(fd);
+		errno = EBUSY;
+		return -1;
+	}
+	return 0;
+}
+// API function.
+void cth_record_stop(void)
+{
+	/*
+	 * Stop logging and close the log.
+	 * Commands still running are not logged, stop it after they are waited for.
+	 */
+	int fd = __atomic_exchange_n(&cth_recorder, -1, __ATOMIC_ACQ_REL);
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+static int cth_record_read(int fd, void *buf, size_t len)
+{
+	/*
+	 * Read exactly len bytes.
+	 * Returns 1 on success, 0 on EOF before any byte, -1 on failure or a short read.
+	 */
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = read(fd, (char *)buf + got, len - got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			return got == 0 ? 0 : -1;
+		}
+		got += (size_t)n;
+	}
+	return 1;
+}
+// API function.
+int cth_record_next(int fd, struct cth_record *rec)
+{
+	/*
+	 * Read the next record of a log written by cth_record_start().
+	 * rec->argv is allocated, free it with cth_free_record().
+	 * Returns 1 if a record is read, 0 at the end of the log, -1 on failure or a corrupted record (errno EBADMSG).
+	 */
+	if (rec == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(rec, 0, sizeof(*rec));
+	struct cth_record_header h;
+	errno = 0;
+	int ret = cth_record_read(fd, &h, sizeof(h));
+	if (ret <= 0) {
+		if (ret < 0 && errno == 0) {
+			errno = EBADMSG;
+		}
+		return ret;
+	}
+	if (h.magic != CTH_RECORD_MAGIC || h.size < sizeof(h) || h.size > CTH_RECORD_MAX_SIZE || h.argc == 0) {
+		errno = EBADMSG;
+		return -1;
+	}
+	size_t len = h.size - sizeof(h);
+	// The pointers and the strings in one block, the strings after the pointers.
+	char **argv = malloc((h.argc + 1) * sizeof(char *) + len);
+	if (argv == NULL) {
+		return -1;
+	}
+	char *strings = (char *)(argv + h.argc + 1);
+	errno = 0;
+	if (cth_record_read(fd, strings, len) != 1) {
+		free(argv);
+		if (errno == 0) {
+			errno = EBADMSG;
+		}
+		return -1;
+	}
+	// Each string must end within the record.
+	size_t pos = 0;
+	for (size_t i = 0; i < h.argc; i++) {
+		char *end = pos < len ? memchr(strings + pos, '\0', len - pos) : NULL;
+		if (end == NULL) {
+			free(argv);
+			errno = EBADMSG;
+			return -1;
+		}
+		argv[i] = strings + pos;
+		pos = (size_t)(end - strings) + 1;
+	}
+	argv[h.argc] = NULL;
+	rec->start_us = h.start_us;
+	rec->wall_us = h.wall_us;
+	rec->stdin_bytes = h.stdin_bytes;
+	rec->stdout_bytes = h.stdout_bytes;
+	rec->stderr_bytes = h.stderr_bytes;
+	rec->exit_code = h.exit_code;
+	rec->flags = h.flags;
+	rec->argv = argv;
+	return 1;
+}
+// API function.
+void cth_free_record(struct cth_record *rec)
+{
+	/*
+	 * Free the argv of a record read by cth_record_next().
+	 */
+	if (rec != NULL) {
+		free(rec->argv);
+		rec->argv = NULL;
+	}
+}
@@ -0,0 +1,744 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+// Shell-free command lines, see cth_run().
+// A safe subset of sh is parsed into a plan, the plan is cached by the command line,
+// and run with our own fork/pipe machinery, without a shell in between.
+// Anything out of the subset (expansions, globs, subshells, builtins...) runs with sh -c instead.
+// Plans cached per process, more command lines are parsed every time.
+#define CTH_RUN_CACHE_SIZE 64
+enum {
+	CTH_RUN_END,
+	CTH_RUN_WORD,
+	CTH_RUN_PIPE,
+	CTH_RUN_AND,
+	CTH_RUN_OR,
+	CTH_RUN_REDIR,
+	// Out of the subset, run with sh.
+	CTH_RUN_SHELL,
+};
+struct cth_run_token {
+	int type;
+	// CTH_RUN_WORD: the word with the quotes removed, owned by the token.
+	char *word;
+	// CTH_RUN_WORD: length of NAME if the word is NAME=value, 0 otherwise.
+	size_t name_len;
+	// CTH_RUN_REDIR: the fd to redirect, flags of open(2), and the fd to duplicate, -1 for a file.
+	int fd;
+	int flags;
+	int dup_fd;
+};
+struct cth_run_redir {
+	int fd;
+	// The file to open with flags, NULL to duplicate dup_fd.
+	char *path;
+	int flags;
+	int dup_fd;
+};
+struct cth_run_cmd {
+	// NULL-terminated.
+	char **argv;
+	// NAME=value, NULL-terminated, can be NULL.
+	char **assign;
+	// Applied in order, as sh does.
+	struct cth_run_redir *redirs;
+	size_t nredirs;
+};
+struct cth_run_pipeline {
+	// CTH_RUN_AND or CTH_RUN_OR with the previous pipeline, CTH_RUN_END for the first one.
+	int op;
+	struct cth_run_cmd *cmds;
+	size_t ncmds;
+};
+struct cth_plan {
+	char *cmdline;
+	// Out of the subset, run with sh -c cmdline.
+	bool shell;
+	struct cth_run_pipeline *pipelines;
+	size_t npipelines;
+};
+static pthread_mutex_t cth_run_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cth_plan *cth_run_cache[CTH_RUN_CACHE_SIZE];
+// Commands that only make sense inside a shell, and reserved words.
+static const char *const cth_run_builtins[] = {
+	"!", ".", ":", "[[", "{", "}", "alias", "bg", "break", "case", "cd", "command", "continue", "do", "done", "elif", "else", "esac", "eval", "exec", "exit", "export", "fg", "fi", "for", "function", "getopts", "hash", "if", "jobs", "local", "read", "readonly", "return", "select", "set", "shift", "source", "then", "time", "times", "trap", "type", "ulimit", "umask", "unalias", "unset", "until", "wait", "while", NULL,
+};
+static bool cth_run_delim(char c)
+{
+	/*
+	 * Characters that end an unquoted word.
+	 */
+	return c == '\0' || strchr(" \t\n|&;<>()", c) != NULL;
+}
+static bool cth_run_name(const char *s, size_t len)
+{
+	/*
+	 * Check if s is a valid variable name.
+	 */
+	if (len == 0 || !(s[0] == '_' || (s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z'))) {
+		return false;
+	}
+	for (size_t i = 1; i < len; i++) {
+		char c = s[i];
+		if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) {
+			return false;
+		}
+	}
+	return true;
+}
+static int cth_run_lex_word(const char **pos, struct cth_run_token *tok)
+{
+	/*
+	 * Lex a word, removing the quotes.
+	 * Returns CTH_RUN_WORD, CTH_RUN_SHELL if it needs expansions, or -1 on failure.
+	 */
+	const char *p = *pos;
+	// A word is never longer than its quoted form.
+	char *word = malloc(strlen(p) + 1);
+	if (word == NULL) {
+		return -1;
+	}
+	size_t len = 0;
+	bool quoted = false;
+	int ret = CTH_RUN_WORD;
+	tok->name_len = 0;
+	while (!cth_run_delim(*p)) {
+		if (*p == '\'') {
+			const char *end = strchr(p + 1, '\'');
+			if (end == NULL) {
+				ret = CTH_RUN_SHELL;
+				break;
+			}
+			memcpy(word + len, p + 1, (size_t)(end - p - 1));
+			len += (size_t)(end - p - 1);
+			p = end + 1;
+			quoted = true;
+		} else if (*p == '"') {
+			p++;
+			while (*p != '"' && *p != '\0' && *p != '$' && *p != '`') {
+				if (*p == '\\' && p[1] != '\0' && strchr("$`\"\\", p[1]) != NULL) {
+					p++;
+				} else if (*p == '\\' && p[1] == '\n') {
+					break;
+				}
+				word[len++] = *p++;
+			}
+			if (*p != '"') {
+				ret = CTH_RUN_SHELL;
+				break;
+			}
+			p++;
+			quoted = true;
+		} else if (*p == '\\') {
+			if (p[1] == '\0' || p[1] == '\n') {
+				ret = CTH_RUN_SHELL;
+				break;
+			}
+			word[len++] = p[1];
+			p += 2;
+			quoted = true;
+		} else if (strchr("$`*?[", *p) != NULL || (*p == '~' && (len == 0 || (tok->name_len > 0 && len == tok->name_len + 1))) || (*p == '#' && len == 0 && !quoted)) {
+			// Expansions, globs, tilde and comments.
+			ret = CTH_RUN_SHELL;
+			break;
+		} else {
+			if (*p == '=' && tok->name_len == 0 && !quoted && cth_run_name(word, len)) {
+				tok->name_len = len;
+			}
+			word[len++] = *p++;
+		}
+	}
+	if (ret != CTH_RUN_WORD) {
+		free(word);
+		return ret;
+	}
+	word[len] = '\0';
+	tok->word = word;
+	*pos = p;
+	return CTH_RUN_WORD;
+}
+static int cth_run_lex(const char **pos, struct cth_run_token *tok)
+{
+	/*
+	 * Get the next token of the command line.
+	 * Returns the type, also set in tok->type, or -1 on failure.
+	 */
+	const char *p = *pos;
+	while (*p == ' ' || *p == '\t') {
+		p++;
+	}
+	tok->word = NULL;
+	tok->type = CTH_RUN_SHELL;
+	if (*p == '\0') {
+		tok->type = CTH_RUN_END;
+	} else if (*p == '|') {
+		if (p[1] != '&') {
+			tok->type = p[1] == '|' ? CTH_RUN_OR : CTH_RUN_PIPE;
+			p += p[1] == '|' ? 2 : 1;
+		}
+	} else if (*p == '&') {
+		if (p[1] == '&') {
+			tok->type = CTH_RUN_AND;
+			p += 2;
+		}
+	} else if (*p == '<' || *p == '>' || (*p >= '0' && *p <= '9' && (p[1] == '<' || p[1] == '>'))) {
+		// [n]< [n]> [n]>> [n]>&m, only for stdin, stdout and stderr.
+		tok->fd = *p == '<' ? 0 : 1;
+		if (*p >= '0' && *p <= '9') {
+			tok->fd = *p++ - '0';
+		}
+		tok->dup_fd = -1;
+		if (*p == '<' && strchr("<&>", p[1]) == NULL) {
+			tok->flags = O_RDONLY;
+			tok->type = CTH_RUN_REDIR;
+			p++;
+		} else if (*p == '>' && p[1] == '>') {
+			tok->flags = O_WRONLY | O_CREAT | O_APPEND;
+			tok->type = CTH_RUN_REDIR;
+			p += 2;
+		} else if (*p == '>' && p[1] == '&') {
+			if (p[2] >= '0' && p[2] <= '2' && cth_run_delim(p[3])) {
+				tok->dup_fd = p[2] - '0';
+				tok->type = CTH_RUN_REDIR;
+				p += 3;
+			}
+		} else if (*p == '>' && p[1] != '|') {
+			tok->flags = O_WRONLY | O_CREAT | O_TRUNC;
+			tok->type = CTH_RUN_REDIR;
+			p++;
+		}
+		if (tok->fd > 2) {
+			tok->type = CTH_RUN_SHELL;
+		}
+	} else if (!cth_run_delim(*p)) {
+		tok->type = cth_run_lex_word(&p, tok);
+	}
+	*pos = p;
+	return tok->type;
+}
+static void cth_run_free_plan(struct cth_plan *plan)
+{
+	if (plan == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < plan->npipelines; i++) {
+		struct cth_run_pipeline *pl = &plan->pipelines[i];
+		for (size_t j = 0; j < pl->ncmds; j++) {
+			struct cth_run_cmd *cmd = &pl->cmds[j];
+			cth_free_argv(&cmd->argv);
+			cth_free_argv(&cmd->assign);
+			for (size_t k = 0; k < cmd->nredirs; k++) {
+				free(cmd->redirs[k].path);
+			}
+			free(cmd->redirs);
+		}
+		free(pl->cmds);
+	}
+	free(plan->pipelines);
+	free(plan->cmdline);
+	free(plan);
+}
+static int cth_run_parse_cmd(const char **pos, struct cth_run_cmd *cmd, struct cth_run_token *tok)
+{
+	/*
+	 * Parse a simple command: assignments, then words and redirections.
+	 * tok is left at the token after it.
+	 * Returns 0 on success, 1 if it's out of the subset, -1 on failure.
+	 */
+	while (true) {
+		int type = cth_run_lex(pos, tok);
+		if (type == CTH_RUN_WORD) {
+			char ***list = cmd->argv == NULL && tok->name_len > 0 ? &cmd->assign : &cmd->argv;
+			int ret = cth_add_arg(list, tok->word);
+			free(tok->word);
+			if (ret < 0) {
+				return -1;
+			}
+		} else if (type == CTH_RUN_REDIR) {
+			struct cth_run_redir redir = { tok->fd, NULL, tok->flags, tok->dup_fd };
+			if (redir.dup_fd < 0) {
+				// The file name.
+				if (cth_run_lex(pos, tok) != CTH_RUN_WORD) {
+					return tok->type < 0 ? -1 : 1;
+				}
+				redir.path = tok->word;
+			}
+			struct cth_run_redir *redirs = realloc(cmd->redirs, sizeof(struct cth_run_redir) * (cmd->nredirs + 1));
+			if (redirs == NULL) {
+				free(redir.path);
+				return -1;
+			}
+			redirs[cmd->nredirs++] = redir;
+			cmd->redirs = redirs;
+		} else {
+			break;
+		}
+	}
+	if (tok->type < 0) {
+		return -1;
+	}
+	// Assignments alone set shell variables, that's for sh.
+	if (tok->type == CTH_RUN_SHELL || cmd->argv == NULL) {
+		return 1;
+	}
+	for (size_t i = 0; cth_run_builtins[i] != NULL; i++) {
+		if (strcmp(cmd->argv[0], cth_run_builtins[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+static struct cth_plan *cth_run_parse(const char *cmdline)
+{
+	/*
+	 * Parse cmdline into a plan, plan->shell is set if it's out of the subset.
+	 * Returns NULL on failure.
+	 */
+	struct cth_plan *plan = calloc(1, sizeof(struct cth_plan));
+	if (plan == NULL) {
+		return NULL;
+	}
+	plan->cmdline = strdup(cmdline);
+	if (plan->cmdline == NULL) {
+		free(plan);
+		return NULL;
+	}
+	const char *pos = cmdline;
+	struct cth_run_token tok;
+	int op = CTH_RUN_END;
+	int ret = 0;
+	while (ret == 0) {
+		struct cth_run_pipeline *pipelines = realloc(plan->pipelines, sizeof(struct cth_run_pipeline) * (plan->npipelines + 1));
+		if (pipelines == NULL) {
+			ret = -1;
+			break;
+		}
+		plan->pipelines = pipelines;
+		struct cth_run_pipeline *pl = &pipelines[plan->npipelines++];
+		pl->op = op;
+		pl->cmds = NULL;
+		pl->ncmds = 0;
+		do {
+			struct cth_run_cmd *cmds = realloc(pl->cmds, sizeof(struct cth_run_cmd) * (pl->ncmds + 1));
+			if (cmds == NULL) {
+				ret = -1;
+				break;
+			}
+			pl->cmds = cmds;
+			struct cth_run_cmd *cmd = &cmds[pl->ncmds++];
+			memset(cmd, 0, sizeof(struct cth_run_cmd));
+			ret = cth_run_parse_cmd(&pos, cmd, &tok);
+		} while (ret == 0 && tok.type == CTH_RUN_PIPE);
+		if (ret != 0 || tok.type == CTH_RUN_END) {
+			break;
+		}
+		if (tok.type != CTH_RUN_AND && tok.type != CTH_RUN_OR) {
+			ret = 1;
+		}
+		op = tok.type;
+	}
+	if (ret < 0) {
+		cth_run_free_plan(plan);
+		return NULL;
+	}
+	plan->shell = ret > 0;
+	return plan;
+}
+static size_t cth_run_hash(const char *s)
+{
+	/*
+	 * FNV-1a of the command line, the index in the plan cache.
+	 */
+	uint64_t h = 14695981039346656037ULL;
+	for (; *s != '\0'; s++) {
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	}
+	return (size_t)(h % CTH_RUN_CACHE_SIZE);
+}
+static struct cth_plan *cth_run_plan(const char *cmdline, bool *cached)
+{
+	/*
+	 * Get the cached plan of cmdline, parse and cache it on a miss.
+	 * Cached plans are never changed or freed, so they are used without the lock.
+	 * *cached is false if the cache is full, the caller frees the plan then.
+	 * Returns NULL on failure.
+	 */
+	size_t start = cth_run_hash(cmdline);
+	pthread_mutex_lock(&cth_run_lock);
+	for (size_t i = 0; i < CTH_RUN_CACHE_SIZE; i++) {
+		struct cth_plan *plan = cth_run_cache[(start + i) % CTH_RUN_CACHE_SIZE];
+		if (plan == NULL) {
+			break;
+		}
+		if (strcmp(plan->cmdline, cmdline) == 0) {
+			pthread_mutex_unlock(&cth_run_lock);
+			*cached = true;
+			return plan;
+		}
+	}
+	pthread_mutex_unlock(&cth_run_lock);
+	struct cth_plan *plan = cth_run_parse(cmdline);
+	*cached = false;
+	if (plan == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&cth_run_lock);
+	for (size_t i = 0; i < CTH_RUN_CACHE_SIZE; i++) {
+		struct cth_plan **slot = &cth_run_cache[(start + i) % CTH_RUN_CACHE_SIZE];
+		if (*slot == NULL) {
+			*slot = plan;
+			*cached = true;
+			break;
+		}
+		if (strcmp((*slot)->cmdline, cmdline) == 0) {
+			// Parsed by another thread meanwhile.
+			cth_run_free_plan(plan);
+			plan = *slot;
+			*cached = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cth_run_lock);
+	return plan;
+}
+static struct cth_env *cth_run_env(const struct cth_run_cmd *cmd, const struct cth_env *base)
+{
+	/*
+	 * Build the environment of a command with assignments, on top of the overlay of attr.
+	 * Returns the compiled overlay, NULL on failure.
+	 */
+	struct cth_env *env = cth_new_env();
+	if (env == NULL) {
+		return NULL;
+	}
+	int ret = 0;
+	if (base != NULL) {
+		env->clear = base->clear;
+		for (size_t i = 0; i < base->count && ret == 0; i++) {
+			const char *eq = base->values[i] != NULL ? strchr(base->values[i], '=') : NULL;
+			ret = eq != NULL ? cth_env_set(env, base->keys[i], eq + 1) : cth_env_unset(env, base->keys[i]);
+		}
+	}
+	for (size_t i = 0; cmd->assign[i] != NULL && ret == 0; i++) {
+		const char *eq = strchr(cmd->assign[i], '=');
+		char *key = strndup(cmd->assign[i], (size_t)(eq - cmd->assign[i]));
+		ret = key != NULL ? cth_env_set(env, key, eq + 1) : -1;
+		free(key);
+	}
+	if (ret < 0 || cth_env_compile(env) < 0) {
+		cth_free_env(&env);
+	}
+	return env;
+}
+static void cth_run_child(const struct cth_run_cmd *cmd, const int fds[3], bool piped, const struct cth_exec_attr *attr, char **envp)
+{
+	/*
+	 * Set up stdio and the redirections in the child process, and exec the command.
+	 * Never returns.
+	 */
+	for (int i = 0; i < 3; i++) {
+		dup2(fds[i], i);
+	}
+	for (size_t i = 0; i < cmd->nredirs; i++) {
+		const struct cth_run_redir *r = &cmd->redirs[i];
+		if (r->path == NULL) {
+			dup2(r->dup_fd, r->fd);
+			continue;
+		}
+		// The fds of the parent are all O_CLOEXEC, they are gone after exec.
+		int fd = open(r->path, r->flags | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			// Like sh, but without stdio, as we are after fork().
+			write(STDERR_FILENO, "catsh: cannot open ", 19);
+			write(STDERR_FILENO, r->path, strlen(r->path));
+			write(STDERR_FILENO, "\n", 1);
+			_exit(1);
+		}
+		dup2(fd, r->fd);
+		close(fd);
+	}
+	if (piped) {
+		// The writer of a pipe is expected to die of SIGPIPE when the reader is gone, even if we ignore it.
+		signal(SIGPIPE, SIG_DFL);
+	}
+	cth_child_exec(cmd->argv, attr, envp);
+	_exit(CTH_EXIT_FAILURE);
+}
+static int cth_run_pipeline(const struct cth_run_pipeline *pl, const int base_fds[3], const struct cth_exec_attr *attr, const struct cth_cgroup *cg, uint64_t deadline_ms, struct cth_result *res)
+{
+	/*
+	 * Run a pipeline, and wait for all its commands.
+	 * The status of the last command goes into res, as in sh.
+	 * Returns 0 on success, -1 if a command could not be started.
+	 */
+	pid_t *pids = calloc(pl->ncmds, sizeof(pid_t));
+	struct cth_metrics_series **metrics = calloc(pl->ncmds, sizeof(struct cth_metrics_series *));
+	uint64_t *spawned_us = calloc(pl->ncmds, sizeof(uint64_t));
+	struct cth_perf *perf = calloc(pl->ncmds, sizeof(struct cth_perf));
+	if (pids == NULL || metrics == NULL || spawned_us == NULL || perf == NULL) {
+		free(pids);
+		free(metrics);
+		free(spawned_us);
+		free(perf);
+		return -1;
+	}
+	struct cth_exec_attr local_attr;
+	memset(&local_attr, 0, sizeof(local_attr));
+	if (attr != NULL) {
+		local_attr = *attr;
+	}
+	uint64_t start_ms = cth_now_ms();
+	int prev_read = -1;
+	size_t started = 0;
+	for (; started < pl->ncmds; started++) {
+		const struct cth_run_cmd *cmd = &pl->cmds[started];
+		int fds[3] = { prev_read >= 0 ? prev_read : base_fds[0], base_fds[1], base_fds[2] };
+		int next[2] = { -1, -1 };
+		if (started + 1 < pl->ncmds) {
+			if (pipe2(next, O_CLOEXEC) < 0) {
+				break;
+			}
+			fds[1] = next[1];
+		}
+		struct cth_env *env = NULL;
+		if (cmd->assign != NULL) {
+			env = cth_run_env(cmd, attr != NULL ? attr->env : NULL);
+			local_attr.env = env;
+		}
+		const struct cth_exec_attr *cmd_attr = attr != NULL || env != NULL ? &local_attr : NULL;
+		uint64_t spawn_start = cth_metrics_clock();
+		uint64_t trace_start = cth_trace_clock();
+		cth_perf_init(&perf[started]);
+		char **env_owned = NULL;
+		char **envp = cmd->assign == NULL || env != NULL ? cth_env_prepare(cmd_attr, &env_owned) : NULL;
+		pid_t pid = envp != NULL ? cth_perf_fork(cmd_attr, cg, &perf[started]) : -1;
+		if (pid == 0) {
+			cth_run_child(cmd, fds, pl->ncmds > 1, cmd_attr, envp);
+		}
+		free(env_owned);
+		cth_free_env(&env);
+		local_attr.env = attr != NULL ? attr->env : NULL;
+		if (prev_read >= 0) {
+			close(prev_read);
+		}
+		if (next[1] >= 0) {
+			close(next[1]);
+		}
+		prev_read = next[0];
+		if (pid < 0) {
+			cth_metrics_spawned(cmd->argv[0], spawn_start, false);
+			break;
+		}
+		metrics[started] = cth_metrics_spawned(cmd->argv[0], spawn_start, true);
+		spawned_us[started] = cth_trace_clock();
+		cth_trace_span(CTH_TRACE_SPAWN, cmd->argv[0], pid, trace_start, spawned_us[started], 0);
+		pids[started] = pid;
+	}
+	if (prev_read >= 0) {
+		close(prev_read);
+	}
+	bool failed = started < pl->ncmds;
+	for (size_t i = 0; i < started; i++) {
+		int status = 0;
+		struct rusage ru;
+		memset(&ru, 0, sizeof(ru));
+		pid_t ret = failed || res->timed_out ? 0 : cth_waitpid(pids[i], &status, &ru, deadline_ms);
+		if (ret == 0) {
+			// Timeout, or a later command failed to start, the rest of the pipeline goes down with it.
+			res->timed_out = !failed;
+			for (size_t j = i; j < started; j++) {
+				cth_kill_job(pids[j], cg);
+			}
+			cth_waitpid(pids[i], &status, &ru, 0);
+		}
+		uint64_t reaped_us = cth_trace_clock();
+		cth_trace_span(CTH_TRACE_RUNNING, pl->cmds[i].argv[0], pids[i], spawned_us[i], reaped_us, 0);
+		struct cth_result part;
+		memset(&part, 0, sizeof(part));
+		part.timed_out = res->timed_out;
+		part.time_used_ms = cth_now_ms() - start_ms;
+		part.time_used = (useconds_t)(part.time_used_ms * 1000);
+		cth_set_status(&part, status, &ru, attr);
+		cth_trace_span(CTH_TRACE_REAPED, pl->cmds[i].argv[0], pids[i], reaped_us, reaped_us, part.exit_code);
+		cth_metrics_finished(metrics[i], &part, false);
+		// The counters of all the commands add up, like the cgroup accounting of the run.
+		res->perf_stat = cth_perf_collect(&perf[i], res->perf_stat);
+		if (i + 1 == pl->ncmds) {
+			res->pid = pids[i];
+			res->exit_code = part.exit_code;
+			res->term_signal = part.term_signal;
+			res->limit_hit = part.limit_hit;
+		}
+	}
+	free(pids);
+	free(metrics);
+	free(spawned_us);
+	free(perf);
+	return failed ? -1 : 0;
+}
+static int cth_run_fds(char *input, bool get_output, const struct cth_exec_attr *attr, int fds[3])
+{
+	/*
+	 * Open stdin, stdout and stderr of the run.
+	 * stdin is a memfd with the input, or /dev/null, shared by all the commands that read it, as in sh.
+	 * stdout and stderr are memfds capped at max_output, or /dev/null, shared by all the commands.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int devnull_fd = cth_get_runtime()->devnull_fd;
+	fds[0] = devnull_fd;
+	fds[1] = devnull_fd;
+	fds[2] = devnull_fd;
+	if (input != NULL) {
+		fds[0] = memfd_create("cth_stdin", MFD_CLOEXEC);
+		size_t len = strlen(input);
+		if (fds[0] < 0 || write(fds[0], input, len) != (ssize_t)len || lseek(fds[0], 0, SEEK_SET) != 0) {
+			return -1;
+		}
+	}
+	if (get_output) {
+		fds[1] = memfd_create("cth_stdout", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		fds[2] = memfd_create("cth_stderr", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		uint64_t max_output = attr != NULL && attr->max_output > 0 ? attr->max_output : CTH_MAX_OUTPUT_SIZE;
+		if (fds[1] >= 0 && fds[2] >= 0 && max_output != CTH_OUTPUT_UNLIMITED) {
+			ftruncate(fds[1], (off_t)max_output);
+			ftruncate(fds[2], (off_t)max_output);
+			fcntl(fds[1], F_ADD_SEALS, F_SEAL_GROW);
+			fcntl(fds[2], F_ADD_SEALS, F_SEAL_GROW);
+		}
+	}
+	return fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0 ? 0 : -1;
+}
+static struct cth_result *cth_run_plan_exec(const struct cth_plan *plan, char *input, bool get_output, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Run the pipelines of the plan, in the order of && and ||.
+	 * Returns the result, NULL on failure.
+	 */
+	int fds[3] = { -1, -1, -1 };
+	struct cth_cgroup cg;
+	struct cth_result *res = NULL;
+	bool fds_ok = cth_run_fds(input, get_output, attr, fds) == 0;
+	int devnull_fd = cth_get_runtime()->devnull_fd;
+	if (fds_ok && cth_cgroup_open(attr, &cg) == 0) {
+		res = cth_new();
+		if (res != NULL) {
+			res->exited = true;
+			res->exit_code = 0;
+			uint64_t deadline_ms = cth_deadline(attr);
+			uint64_t start_ms = cth_now_ms();
+			for (size_t i = 0; i < plan->npipelines && !res->timed_out; i++) {
+				const struct cth_run_pipeline *pl = &plan->pipelines[i];
+				// The status is the one of the last pipeline that ran.
+				if ((pl->op == CTH_RUN_AND && res->exit_code != 0) || (pl->op == CTH_RUN_OR && res->exit_code == 0)) {
+					continue;
+				}
+				if (cth_run_pipeline(pl, fds, attr, &cg, deadline_ms, res) < 0) {
+					cth_free_result(&res);
+					break;
+				}
+			}
+			if (res != NULL) {
+				res->time_used_ms = cth_now_ms() - start_ms;
+				res->time_used = (useconds_t)(res->time_used_ms * 1000);
+				res->cgroup_stat = cth_cgroup_read_stat(&cg);
+			}
+		}
+		cth_cgroup_close(&cg);
+	}
+	if (res != NULL && get_output) {
+		// The commands share the file offsets with us, so the offsets are the sizes of the output.
+		off_t stdout_len = lseek(fds[1], 0, SEEK_CUR);
+		off_t stderr_len = lseek(fds[2], 0, SEEK_CUR);
+		res->stdout_total = stdout_len > 0 ? (uint64_t)stdout_len : 0;
+		res->stderr_total = stderr_len > 0 ? (uint64_t)stderr_len : 0;
+		size_t stdout_read = (size_t)res->stdout_total;
+		size_t stderr_read = (size_t)res->stderr_total;
+		res->stdout_ret = cth_read_fd(fds[1], &stdout_read);
+		res->stderr_ret = cth_read_fd(fds[2], &stderr_read);
+		res->stdout_len = stdout_read;
+		res->stderr_len = stderr_read;
+	}
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] >= 0 && fds[i] != devnull_fd) {
+			close(fds[i]);
+		}
+	}
+	return res;
+}
+// API function.
+struct cth_result *cth_run(const char *cmdline, char *input, bool get_output, int flags, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Run a command line without a shell, in blocking mode.
+	 * cmdline: A subset of sh: words with '' "" and \ quoting, NAME=value before a command,
+	 *          pipes |, redirections < > >> 2> 2>> 2>&1 >&2, and lists of && and ||.
+	 *          It's parsed once, the plan is cached and reused for the same cmdline.
+	 *          Anything else (variables, globs, ;, subshells, builtins like cd...) runs with sh -c cmdline.
+	 * input: The input of the commands that read stdin, can be NULL.
+	 * get_output: If true, capture stdout and stderr of all the commands.
+	 * flags: CTH_RUN_NO_SHELL to fail with ENOTSUP instead of running sh.
+	 * attr: Extra attributes, can be NULL. timeout_ms covers the whole command line.
+	 *       A single simple command goes through cth_exec_with_attr() with all of attr,
+	 *       otherwise output is always captured as CTH_CAPTURE_FULL, without hash and cache,
+	 *       and files of redirections are opened outside of attr->container.
+	 * Returns a cth_result with the exit code of the last pipeline that ran, as in sh,
+	 * or NULL on failure.
+	 * The caller is responsible for freeing the result using cth_free_result().
+	 */
+	if (cmdline == NULL) {
+		return NULL;
+	}
+	bool cached = false;
+	struct cth_plan *plan = cth_run_plan(cmdline, &cached);
+	if (plan == NULL) {
+		return NULL;
+	}
+	struct cth_result *res = NULL;
+	const struct cth_run_cmd *cmd = plan->shell ? NULL : &plan->pipelines[0].cmds[0];
+	if (plan->shell) {
+		if (flags & CTH_RUN_NO_SHELL) {
+			errno = ENOTSUP;
+		} else {
+			char *argv[] = { "sh", "-c", plan->cmdline, NULL };
+			res = cth_exec_with_attr(argv, input, true, get_output, attr);
+		}
+	} else if (plan->npipelines == 1 && plan->pipelines[0].ncmds == 1 && cmd->assign == NULL && cmd->nredirs == 0) {
+		res = cth_exec_with_attr(cmd->argv, input, true, get_output, attr);
+	} else {
+		res = cth_run_plan_exec(plan, input, get_output, attr);
+	}
+	if (!cached) {
+		cth_run_free_plan(plan);
+	}
+	return res;
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// Process-wide runtime context, initialized once by cth_init() or the first exec.
+static struct cth_runtime cth_runtime_ctx;
+// 0: not initialized, 1: initializing, 2: ready.
+static int cth_runtime_state = 0;
+static size_t cth_read_pipe_max_size(void)
+{
+	/*
+	 * Get max allowed pipe size from /proc/sys/fs/pipe-max-size.
+	 * Returns 0 on failure.
+	 */
+	size_t max_size = 0;
+	FILE *f = fopen("/proc/sys/fs/pipe-max-size", "re");
+	if (f) {
+		char line[32];
+		if (fgets(line, sizeof(line), f)) {
+			max_size = strtoul(line, NULL, 10);
+		}
+		fclose(f);
+	}
+	return max_size;
+}
+static bool cth_probe_syscall(long ret, int expected_errno)
+{
+	/*
+	 * A syscall is supported if it succeeded, or failed with the errno we expected for bad arguments.
+	 * ENOSYS means no kernel support, EPERM usually means seccomp or sysctl disabled it.
+	 */
+	if (ret >= 0) {
+		return true;
+	}
+	return errno == expected_errno;
+}
+static void cth_runtime_probe(struct cth_runtime *rt)
+{
+	/*
+	 * Cache system limits and kernel features, and open the shared fds.
+	 */
+	rt->pipe_max_size = cth_read_pipe_max_size();
+	rt->arg_max = sysconf(_SC_ARG_MAX);
+	rt->page_size = sysconf(_SC_PAGESIZE);
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rt->nofile_cur = rl.rlim_cur;
+		rt->nofile_max = rl.rlim_max;
+	} else {
+		rt->nofile_cur = 1024;
+		rt->nofile_max = 1024;
+	}
+	// pidfd_open() on ourselves.
+	long fd = syscall(SYS_pidfd_open, getpid(), 0);
+	rt->has_pidfd = fd >= 0;
+	if (fd >= 0) {
+		close((int)fd);
+	}
+	// clone3() with size 0 is always EINVAL if the syscall exists.
+	rt->has_clone3 = cth_probe_syscall(syscall(SYS_clone3, NULL, 0), EINVAL);
+	// io_uring_setup() with 0 entries is always EINVAL if the syscall exists.
+	// The params are copied in before the entries are checked, so they must be readable, or it's EFAULT.
+	// This is a zeroed struct io_uring_params (120 bytes), without depending on <linux/io_uring.h>.
+	uint64_t io_uring_params[15] = { 0 };
+	rt->has_io_uring = cth_probe_syscall(syscall(SYS_io_uring_setup, 0, io_uring_params), EINVAL);
+	// close_range() on an empty range closes nothing.
+	rt->has_close_range = cth_probe_syscall(syscall(SYS_close_range, ~0U, ~0U, 0), EINVAL);
+	// Shared fds, O_CLOEXEC, so they are only visible in children after dup2().
+	rt->devnull_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+// API function.
+const struct cth_runtime *cth_get_runtime(void)
+{
+	/*
+	 * Get the process-wide runtime context, initialize it if needed.
+	 * Thread safe, the context is read-only after initialization.
+	 */
+	if (__atomic_load_n(&cth_runtime_state, __ATOMIC_ACQUIRE) == 2) {
+		return &cth_runtime_ctx;
+	}
+	int expected = 0;
+	if (__atomic_compare_exchange_n(&cth_runtime_state, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		cth_runtime_probe(&cth_runtime_ctx);
+		__atomic_store_n(&cth_runtime_state, 2, __ATOMIC_RELEASE);
+	} else {
+		// Another thread is initializing, it does not take long.
+		while (__atomic_load_n(&cth_runtime_state, __ATOMIC_ACQUIRE) != 2) {
+			sched_yield();
+		}
+	}
+	return &cth_runtime_ctx;
+}
+// API function.
+int cth_init(void)
+{
+	/*
+	 * Initialize the runtime context.
+	 * This is optional, the first exec will do it as well,
+	 * but calling it early moves the cost out of the first command.
+	 * Note: the cached fds should not be closed by the caller, e.g. by a daemon closing all fds.
+	 * Returns 0 on success, -1 if the shared fds cannot be opened.
+	 */
+	const struct cth_runtime *rt = cth_get_runtime();
+	if (rt->devnull_fd < 0) {
+		return -1;
+	}
+	return 0;
+}
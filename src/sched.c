@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// Scheduling attributes applied in the child between fork and exec.
+// Only raw syscalls are used, so there's no dependency on libnuma.
+#define CTH_IOPRIO_WHO_PROCESS 1
+#define CTH_IOPRIO_CLASS_SHIFT 13
+int cth_apply_sched(const struct cth_exec_attr *attr)
+{
+	/*
+	 * Apply CPU affinity, NUMA memory policy, nice value, I/O priority and scheduling policy to the calling process.
+	 * Called in the child, so it must be async-signal-safe, no malloc() here.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (attr == NULL) {
+		return 0;
+	}
+	if (attr->cpu_affinity != NULL) {
+		size_t size = attr->cpu_affinity_size > 0 ? attr->cpu_affinity_size : sizeof(cpu_set_t);
+		if (sched_setaffinity(0, size, attr->cpu_affinity) < 0) {
+			return -1;
+		}
+	}
+	if (attr->numa_policy != CTH_MPOL_INHERIT) {
+		// MPOL_LOCAL takes no nodes, the others need at least one.
+		unsigned long nodes = (unsigned long)attr->numa_nodes;
+		if (syscall(SYS_set_mempolicy, attr->numa_policy, attr->numa_policy == CTH_MPOL_LOCAL ? NULL : &nodes, attr->numa_policy == CTH_MPOL_LOCAL ? 0 : sizeof(nodes) * 8 + 1) < 0) {
+			return -1;
+		}
+	}
+	if (attr->ioprio_class != CTH_IOPRIO_INHERIT) {
+		int ioprio = (attr->ioprio_class << CTH_IOPRIO_CLASS_SHIFT) | (attr->ioprio_class == CTH_IOPRIO_IDLE ? 0 : attr->ioprio_level);
+		if (syscall(SYS_ioprio_set, CTH_IOPRIO_WHO_PROCESS, 0, ioprio) < 0) {
+			return -1;
+		}
+	}
+	if (attr->nice != 0) {
+		// nice() can return -1 on success, so check errno.
+		errno = 0;
+		if (nice(attr->nice) == -1 && errno != 0) {
+			return -1;
+		}
+	}
+	if (attr->sched_policy != SCHED_OTHER) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = attr->sched_priority;
+		if (sched_setscheduler(0, attr->sched_policy, &param) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
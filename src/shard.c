@@ -0,0 +1,429 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <pthread.h>
+// Sharded input, like parallel --pipe.
+// The input is cut into record-aligned chunks, each chunk is the stdin of one instance of the command,
+// up to workers instances run at the same time, and the outputs are stitched back in input order.
+// A regular file is mapped and the chunks point into the mapping, other fds are read chunk by chunk.
+// Record boundaries are found with memchr(), which is vectorized in the libc.
+// Chunks in flight or waiting to be stitched, per worker.
+#define CTH_SHARD_WINDOW 2
+struct cth_shard_chunk {
+	bool ready;
+	// Owned copy of the input for fds that can not be mapped, NULL for the mapping.
+	char *buf;
+	size_t len;
+	struct cth_result *res;
+};
+struct cth_shard {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	// The input, either a mapping of the file or the fd.
+	const char *map;
+	size_t map_len;
+	size_t offset;
+	int fd;
+	char *carry;
+	size_t carry_len;
+	bool eof;
+	size_t chunk_size;
+	char delim;
+	// Chunks are numbered in input order, chunk i is in chunks[i % window].
+	struct cth_shard_chunk *chunks;
+	size_t window;
+	// Next chunk to start, and next chunk to stitch.
+	size_t next;
+	size_t stitched;
+	// No more chunks, or a chunk failed to start.
+	bool drained;
+	bool failed;
+	char **argv;
+	struct cth_exec_attr *attr;
+	bool get_output;
+};
+// Growable output buffer.
+struct cth_shard_out {
+	char *buf;
+	size_t len;
+	size_t cap;
+};
+static bool cth_shard_read(struct cth_shard *sh, char **out, size_t *out_len)
+{
+	/*
+	 * Read the next chunk from sh->fd, it ends at the first delimiter at or after chunk_size.
+	 * The bytes after it are kept for the next chunk.
+	 * Returns false at EOF or on failure.
+	 */
+	size_t cap = sh->chunk_size + sh->carry_len + 1;
+	char *buf = malloc(cap);
+	if (buf == NULL) {
+		return false;
+	}
+	size_t len = sh->carry_len;
+	if (sh->carry != NULL) {
+		memcpy(buf, sh->carry, sh->carry_len);
+		free(sh->carry);
+		sh->carry = NULL;
+		sh->carry_len = 0;
+	}
+	size_t from = sh->chunk_size - 1;
+	while (true) {
+		if (len > from) {
+			const char *hit = memchr(buf + from, sh->delim, len - from);
+			if (hit != NULL) {
+				size_t end = (size_t)(hit - buf) + 1;
+				if (end < len) {
+					sh->carry = malloc(len - end);
+					if (sh->carry == NULL) {
+						free(buf);
+						return false;
+					}
+					memcpy(sh->carry, buf + end, len - end);
+					sh->carry_len = len - end;
+				}
+				*out = buf;
+				*out_len = end;
+				return true;
+			}
+			from = len;
+		}
+		if (sh->eof) {
+			break;
+		}
+		if (len == cap) {
+			// A record longer than chunk_size.
+			char *new_buf = realloc(buf, cap * 2);
+			if (new_buf == NULL) {
+				free(buf);
+				return false;
+			}
+			buf = new_buf;
+			cap *= 2;
+		}
+		ssize_t n = read(sh->fd, buf + len, cap - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			sh->eof = true;
+		} else {
+			len += (size_t)n;
+		}
+	}
+	// The last chunk, without a trailing delimiter.
+	if (len == 0) {
+		free(buf);
+		return false;
+	}
+	*out = buf;
+	*out_len = len;
+	return true;
+}
+static bool cth_shard_next(struct cth_shard *sh, struct cth_shard_chunk *chunk)
+{
+	/*
+	 * Cut the next chunk of input, with sh->lock held.
+	 * Returns false if there is no more input.
+	 */
+	chunk->buf = NULL;
+	if (sh->map == NULL) {
+		return cth_shard_read(sh, &chunk->buf, &chunk->len);
+	}
+	if (sh->offset >= sh->map_len) {
+		return false;
+	}
+	size_t end = sh->offset + sh->chunk_size;
+	if (end >= sh->map_len) {
+		end = sh->map_len;
+	} else {
+		const char *hit = memchr(sh->map + end - 1, sh->delim, sh->map_len - (end - 1));
+		end = hit != NULL ? (size_t)(hit - sh->map) + 1 : sh->map_len;
+	}
+	chunk->len = end - sh->offset;
+	sh->offset = end;
+	return true;
+}
+static void *cth_shard_worker(void *arg)
+{
+	/*
+	 * Take the next chunk and run the command on it, until the input is drained.
+	 */
+	struct cth_shard *sh = arg;
+	pthread_mutex_lock(&sh->lock);
+	while (true) {
+		// Do not run too far ahead of the stitching, the results are kept until then.
+		while (!sh->drained && !sh->failed && sh->next >= sh->stitched + sh->window) {
+			pthread_cond_wait(&sh->cond, &sh->lock);
+		}
+		if (sh->drained || sh->failed) {
+			break;
+		}
+		size_t index = sh->next;
+		struct cth_shard_chunk *chunk = &sh->chunks[index % sh->window];
+		// Offset of the chunk in the mapping, read before cth_shard_next() moves it.
+		size_t offset = sh->offset;
+		if (!cth_shard_next(sh, chunk)) {
+			sh->drained = true;
+			pthread_cond_broadcast(&sh->cond);
+			break;
+		}
+		sh->next++;
+		pthread_mutex_unlock(&sh->lock);
+		struct cth_input in = { -1, chunk->buf != NULL ? chunk->buf : sh->map + offset, chunk->len, NULL, NULL };
+		int token = -1;
+		struct cth_result *res = NULL;
+		if (sh->attr->jobserver == NULL || (token = cth_jobserver_acquire(sh->attr->jobserver)) >= 0) {
+			res = cth_exec_block_with_input(sh->argv, &in, sh->get_output, NULL, 0, sh->attr, -1, -1, NULL);
+		}
+		if (token >= 0) {
+			cth_jobserver_release(sh->attr->jobserver, token);
+		}
+		pthread_mutex_lock(&sh->lock);
+		chunk->res = res;
+		chunk->ready = true;
+		if (res == NULL) {
+			sh->failed = true;
+		}
+		pthread_cond_broadcast(&sh->cond);
+	}
+	pthread_mutex_unlock(&sh->lock);
+	return NULL;
+}
+static bool cth_shard_append(struct cth_shard_out *out, const char *data, size_t len)
+{
+	/*
+	 * Append len bytes of data, keeping a trailing NUL.
+	 * Returns false on failure.
+	 */
+	if (out->len + len + 1 > out->cap) {
+		size_t cap = out->cap > 0 ? out->cap : 65536;
+		while (out->len + len + 1 > cap) {
+			cap *= 2;
+		}
+		char *buf = realloc(out->buf, cap);
+		if (buf == NULL) {
+			return false;
+		}
+		out->buf = buf;
+		out->cap = cap;
+	}
+	if (len > 0) {
+		memcpy(out->buf + out->len, data, len);
+	}
+	out->len += len;
+	out->buf[out->len] = '\0';
+	return true;
+}
+static bool cth_shard_stitch(struct cth_result *res, struct cth_shard_out *out, struct cth_shard_out *err, const struct cth_result *part)
+{
+	/*
+	 * Add the result of the next chunk to res.
+	 * The first failure of a chunk in input order is reported.
+	 * Returns false on failure.
+	 */
+	if (res->exit_code == 0 && part->exit_code != 0) {
+		res->exit_code = part->exit_code;
+		res->term_signal = part->term_signal;
+	}
+	if (res->limit_hit == CTH_LIMIT_NONE) {
+		res->limit_hit = part->limit_hit;
+	}
+	res->timed_out = res->timed_out || part->timed_out;
+	res->stdout_total += part->stdout_total;
+	res->stderr_total += part->stderr_total;
+	// The output may contain NUL bytes, and stdout_total also counts the bytes not kept, so append stdout_len.
+	bool ok = true;
+	if (part->stdout_ret != NULL) {
+		ok = cth_shard_append(out, part->stdout_ret, part->stdout_len);
+	}
+	if (ok && part->stderr_ret != NULL) {
+		ok = cth_shard_append(err, part->stderr_ret, part->stderr_len);
+	}
+	return ok;
+}
+static void cth_shard_free_chunk(struct cth_shard_chunk *chunk)
+{
+	free(chunk->buf);
+	chunk->buf = NULL;
+	cth_free_result(&chunk->res);
+	chunk->ready = false;
+}
+// API function.
+struct cth_result *cth_exec_sharded(char **argv, int fd, size_t workers, size_t chunk_size, char delim, bool get_output, void (*progress)(float, int), int progress_line_num, const struct cth_exec_attr *attr)
+{
+	/*
+	 * Split the input into record-aligned chunks, and run one instance of the command per chunk in parallel.
+	 * argv: The command and its arguments, NULL-terminated array of strings.
+	 * fd: The input, read from the current offset until EOF. A regular file is mapped, not read.
+	 * workers: Instances running at the same time, 0 for the number of online CPUs.
+	 * chunk_size: Bytes per chunk, 0 for CTH_SHARD_DEFAULT_SIZE. A chunk is extended to the next delimiter.
+	 * delim: The record delimiter, usually '\n'.
+	 * get_output: If true, capture stdout and stderr, stitched together in input order.
+	 *             stdout_total/stderr_total are the lengths, the output may contain NUL bytes.
+	 * progress: Called with the fraction of the input stitched so far, if the input size is known.
+	 * attr: Extra attributes for each instance, can be NULL. timeout_ms and max_output apply per chunk,
+	 *       capture_mode, hash, spill_dir and cache are not used.
+	 * Returns a cth_result on success, with the first non-zero exit code of the chunks in input order,
+	 * or NULL on failure, e.g. if an instance could not be started.
+	 * The caller is responsible for freeing the result using cth_free_result().
+	 */
+	if (argv == NULL || argv[0] == NULL || fd < 0) {
+		return NULL;
+	}
+	if (workers == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus > 0 ? (size_t)cpus : 1;
+	}
+	struct cth_exec_attr local_attr;
+	memset(&local_attr, 0, sizeof(local_attr));
+	if (attr != NULL) {
+		local_attr = *attr;
+	}
+	local_attr.capture_mode = CTH_CAPTURE_FULL;
+	local_attr.hash = 0;
+	local_attr.spill_dir = NULL;
+	local_attr.cache = NULL;
+	struct cth_shard sh;
+	memset(&sh, 0, sizeof(sh));
+	sh.fd = fd;
+	sh.chunk_size = chunk_size > 0 ? chunk_size : CTH_SHARD_DEFAULT_SIZE;
+	sh.delim = delim;
+	sh.window = workers * CTH_SHARD_WINDOW;
+	sh.argv = argv;
+	sh.attr = &local_attr;
+	sh.get_output = get_output;
+	// Map a regular file, the mapping starts at 0 as the offset of mmap() has to be page aligned.
+	struct stat st;
+	off_t start = lseek(fd, 0, SEEK_CUR);
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && start >= 0 && st.st_size > start) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (map != MAP_FAILED) {
+		madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+		sh.map = map;
+		sh.map_len = (size_t)st.st_size;
+		sh.offset = (size_t)start;
+	} else if (S_ISREG(st.st_mode) && start >= 0 && st.st_size <= start) {
+		// Nothing left to read.
+		sh.eof = true;
+	}
+	float progress_total = sh.map != NULL ? (float)(sh.map_len - sh.offset) : 0.0f;
+	sh.chunks = calloc(sh.window, sizeof(struct cth_shard_chunk));
+	pthread_t *threads = calloc(workers, sizeof(pthread_t));
+	struct cth_result *res = cth_new();
+	if (sh.chunks == NULL || threads == NULL || res == NULL) {
+		free(sh.chunks);
+		free(threads);
+		free(res);
+		if (sh.map != NULL) {
+			munmap(map, sh.map_len);
+		}
+		return NULL;
+	}
+	pthread_mutex_init(&sh.lock, NULL);
+	pthread_cond_init(&sh.cond, NULL);
+	uint64_t start_ms = cth_now_ms();
+	size_t started = 0;
+	for (; started < workers; started++) {
+		if (pthread_create(&threads[started], NULL, cth_shard_worker, &sh) != 0) {
+			break;
+		}
+	}
+	res->exited = true;
+	res->exit_code = 0;
+	struct cth_shard_out out = { NULL, 0, 0 };
+	struct cth_shard_out err = { NULL, 0, 0 };
+	uint64_t stitched_bytes = 0;
+	pthread_mutex_lock(&sh.lock);
+	if (started == 0) {
+		sh.failed = true;
+	}
+	while (!sh.failed) {
+		struct cth_shard_chunk *chunk = &sh.chunks[sh.stitched % sh.window];
+		while (!chunk->ready && !sh.failed && !(sh.drained && sh.stitched == sh.next)) {
+			pthread_cond_wait(&sh.cond, &sh.lock);
+		}
+		if (!chunk->ready || sh.failed) {
+			break;
+		}
+		pthread_mutex_unlock(&sh.lock);
+		bool ok = cth_shard_stitch(res, &out, &err, chunk->res);
+		stitched_bytes += chunk->len;
+		cth_shard_free_chunk(chunk);
+		if (progress != NULL && progress_total > 0.0f) {
+			progress((float)stitched_bytes / progress_total, progress_line_num);
+		}
+		pthread_mutex_lock(&sh.lock);
+		sh.stitched++;
+		if (!ok) {
+			sh.failed = true;
+		}
+		pthread_cond_broadcast(&sh.cond);
+	}
+	pthread_mutex_unlock(&sh.lock);
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	// Chunks left behind by a failure.
+	for (size_t i = 0; i < sh.window; i++) {
+		cth_shard_free_chunk(&sh.chunks[i]);
+	}
+	pthread_mutex_destroy(&sh.lock);
+	pthread_cond_destroy(&sh.cond);
+	free(sh.chunks);
+	free(sh.carry);
+	free(threads);
+	if (sh.map != NULL) {
+		munmap(map, sh.map_len);
+	}
+	if (sh.failed) {
+		free(out.buf);
+		free(err.buf);
+		cth_free_result(&res);
+		return NULL;
+	}
+	if (get_output) {
+		// Empty output is still an empty string, as with cth_exec().
+		cth_shard_append(&out, NULL, 0);
+		cth_shard_append(&err, NULL, 0);
+	}
+	res->stdout_ret = out.buf;
+	res->stderr_ret = err.buf;
+	res->stdout_len = out.len;
+	res->stderr_len = err.len;
+	res->time_used_ms = cth_now_ms() - start_ms;
+	res->time_used = (useconds_t)(res->time_used_ms * 1000);
+	if (progress != NULL) {
+		progress(-1.0, progress_line_num);
+	}
+	return res;
+}
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <linux/futex.h>
+// Shared status slab of non-blocking commands.
+// The slabs are MAP_SHARED anonymous memory, so the runner processes forked after a slab is mapped
+// write the status into it directly, and checking a command is only a memory load.
+// Slabs are never unmapped, their slots are reused.
+// Only the slots are shared, the chain of slabs is process-private memory,
+// as a pointer is meaningless to the other processes mapping the same slab.
+#define CTH_SLAB_SLOTS 1024
+struct cth_slab {
+	struct cth_slot slots[CTH_SLAB_SLOTS];
+	// Bumped and woken up on every command exit, only the one in the first slab is used.
+	uint32_t generation;
+};
+struct cth_slab_link {
+	struct cth_slab *slab;
+	struct cth_slab_link *next;
+};
+static struct cth_slab_link *cth_slabs = NULL;
+// Where to start searching for a free slot.
+static size_t cth_slot_hint = 0;
+static void cth_futex_wait(uint32_t *addr, uint32_t value, int timeout_ms)
+{
+	/*
+	 * Sleep while *addr == value, timeout_ms < 0 means no timeout.
+	 * Not FUTEX_PRIVATE_FLAG, as the waker is another process.
+	 */
+	struct timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+	syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+}
+static void cth_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+static struct cth_slab_link *cth_slab_new(void)
+{
+	/*
+	 * Map a new slab, all the slots are CTH_SLOT_FREE as the memory is zeroed.
+	 */
+	struct cth_slab_link *link = malloc(sizeof(struct cth_slab_link));
+	if (link == NULL) {
+		return NULL;
+	}
+	link->slab = mmap(NULL, sizeof(struct cth_slab), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (link->slab == MAP_FAILED) {
+		free(link);
+		return NULL;
+	}
+	link->next = NULL;
+	return link;
+}
+static void cth_slab_drop(struct cth_slab_link *link)
+{
+	/*
+	 * Undo cth_slab_new(), for the loser of a race to append a slab.
+	 */
+	munmap(link->slab, sizeof(struct cth_slab));
+	free(link);
+}
+static struct cth_slab_link *cth_slab_first(void)
+{
+	/*
+	 * Get the first slab, map it if needed.
+	 */
+	struct cth_slab_link *link = __atomic_load_n(&cth_slabs, __ATOMIC_ACQUIRE);
+	if (link != NULL) {
+		return link;
+	}
+	struct cth_slab_link *new_link = cth_slab_new();
+	if (new_link == NULL) {
+		return NULL;
+	}
+	if (!__atomic_compare_exchange_n(&cth_slabs, &link, new_link, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// Another thread did it first.
+		cth_slab_drop(new_link);
+		return link;
+	}
+	return new_link;
+}
+struct cth_slot *cth_slot_alloc(void)
+{
+	/*
+	 * Take a free slot, it's CTH_SLOT_STARTING after this.
+	 * The slot must be allocated before forking the runner, so that the runner shares it.
+	 * Returns NULL on failure.
+	 */
+	struct cth_slab_link *link = cth_slab_first();
+	size_t hint = __atomic_load_n(&cth_slot_hint, __ATOMIC_RELAXED);
+	while (link != NULL) {
+		struct cth_slab *slab = link->slab;
+		for (size_t i = 0; i < CTH_SLAB_SLOTS; i++) {
+			size_t n = (hint + i) % CTH_SLAB_SLOTS;
+			uint32_t expected = CTH_SLOT_FREE;
+			if (__atomic_load_n(&slab->slots[n].state, __ATOMIC_RELAXED) == CTH_SLOT_FREE && __atomic_compare_exchange_n(&slab->slots[n].state, &expected, CTH_SLOT_STARTING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&cth_slot_hint, n + 1, __ATOMIC_RELAXED);
+				struct cth_slot *slot = &slab->slots[n];
+				slot->pid = -1;
+				slot->exit_code = -1;
+				slot->term_signal = 0;
+				slot->limit_hit = CTH_LIMIT_NONE;
+				slot->timed_out = false;
+				slot->has_cgroup_stat = false;
+				slot->has_digest = false;
+				slot->has_perf_stat = false;
+				slot->time_used_ms = 0;
+				slot->stdout_total = 0;
+				slot->stderr_total = 0;
+				memset(&slot->cgroup_stat, 0, sizeof(slot->cgroup_stat));
+				return slot;
+			}
+		}
+		// This slab is full, go to the next one, or append a new one.
+		struct cth_slab_link *next = __atomic_load_n(&link->next, __ATOMIC_ACQUIRE);
+		if (next == NULL) {
+			struct cth_slab_link *new_link = cth_slab_new();
+			if (new_link == NULL) {
+				return NULL;
+			}
+			if (__atomic_compare_exchange_n(&link->next, &next, new_link, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				next = new_link;
+			} else {
+				cth_slab_drop(new_link);
+			}
+		}
+		link = next;
+	}
+	return NULL;
+}
+void cth_slot_publish(struct cth_slot *slot, uint32_t state)
+{
+	/*
+	 * Runner side, set the state after filling the other fields, and wake up the waiters.
+	 * If the result is already freed, the slot is freed here for the final states.
+	 */
+	if (state == CTH_SLOT_RUNNING) {
+		uint32_t expected = CTH_SLOT_STARTING;
+		__atomic_compare_exchange_n(&slot->state, &expected, CTH_SLOT_RUNNING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+		cth_futex_wake(&slot->state);
+		return;
+	}
+	uint32_t old = __atomic_exchange_n(&slot->state, state, __ATOMIC_ACQ_REL);
+	if (old == CTH_SLOT_ORPHAN) {
+		__atomic_store_n(&slot->state, CTH_SLOT_FREE, __ATOMIC_RELEASE);
+		return;
+	}
+	cth_futex_wake(&slot->state);
+	struct cth_slab_link *link = __atomic_load_n(&cth_slabs, __ATOMIC_ACQUIRE);
+	if (link != NULL) {
+		__atomic_add_fetch(&link->slab->generation, 1, __ATOMIC_ACQ_REL);
+		cth_futex_wake(&link->slab->generation);
+	}
+}
+static bool cth_runner_alive(pid_t pid)
+{
+	/*
+	 * The runner is not our child, so it can't be waited for.
+	 * Its pidfd is readable once it exits, even if nobody reaps it,
+	 * kill() is only the fallback, it can't tell a zombie from a running process.
+	 */
+	if (pid <= 0) {
+		return true;
+	}
+	int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd < 0) {
+		return errno != ESRCH && (kill(pid, 0) == 0 || errno != ESRCH);
+	}
+	struct pollfd pfd = { pidfd, POLLIN, 0 };
+	bool alive = poll(&pfd, 1, 0) == 0;
+	close(pidfd);
+	return alive;
+}
+bool cth_slot_check(struct cth_slot *slot)
+{
+	/*
+	 * Owner side, check if the runner died without publishing a final state, e.g. it was killed,
+	 * and publish CTH_SLOT_ERROR for it then.
+	 * Returns true if the slot is in a final state.
+	 */
+	uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+	if (state != CTH_SLOT_STARTING && state != CTH_SLOT_RUNNING) {
+		return true;
+	}
+	if (cth_runner_alive(__atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE))) {
+		return false;
+	}
+	// Lost the race if the runner published just before exiting, the state is final anyway.
+	__atomic_compare_exchange_n(&slot->state, &state, CTH_SLOT_ERROR, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	return true;
+}
+void cth_slot_wait(struct cth_slot *slot, uint32_t state)
+{
+	/*
+	 * Sleep until the state is not state any more.
+	 * The runner is checked every CTH_SLOT_CHECK_MS, if it's gone the state becomes CTH_SLOT_ERROR.
+	 */
+	uint32_t current;
+	while ((current = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE)) == state) {
+		cth_futex_wait(&slot->state, current, CTH_SLOT_CHECK_MS);
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == state) {
+			cth_slot_check(slot);
+		}
+	}
+}
+void cth_slot_release(struct cth_slot *slot)
+{
+	/*
+	 * Owner side, give up the slot.
+	 * If the runner is still running, it frees the slot when the command exits.
+	 */
+	while (true) {
+		uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+		if (state == CTH_SLOT_STARTING || state == CTH_SLOT_RUNNING) {
+			if (__atomic_compare_exchange_n(&slot->state, &state, CTH_SLOT_ORPHAN, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				return;
+			}
+			continue;
+		}
+		__atomic_store_n(&slot->state, CTH_SLOT_FREE, __ATOMIC_RELEASE);
+		return;
+	}
+}
+uint32_t cth_slab_generation(void)
+{
+	/*
+	 * Get the exit counter, to be used with cth_slab_wait().
+	 */
+	struct cth_slab_link *link = __atomic_load_n(&cth_slabs, __ATOMIC_ACQUIRE);
+	return link != NULL ? __atomic_load_n(&link->slab->generation, __ATOMIC_ACQUIRE) : 0;
+}
+void cth_slab_wait(uint32_t generation, int timeout_ms)
+{
+	/*
+	 * Sleep until a command exits after cth_slab_generation() returned generation, or timeout.
+	 */
+	struct cth_slab_link *link = __atomic_load_n(&cth_slabs, __ATOMIC_ACQUIRE);
+	if (link == NULL) {
+		if (timeout_ms > 0) {
+			usleep((useconds_t)timeout_ms * 1000);
+		}
+		return;
+	}
+	cth_futex_wait(&link->slab->generation, generation, timeout_ms);
+}
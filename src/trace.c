@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+// Execution timeline, exported as Chrome trace-event JSON, for chrome://tracing or Perfetto.
+// Each execution records its phases as complete events into a ring of fixed size events.
+// The ring is MAP_SHARED anonymous memory like the metrics registry, so the runner processes
+// of non-blocking commands record into it too. Writers take an index with an atomic add,
+// and publish the event with its sequence number, like a seqlock, so the dump skips torn events.
+// The oldest events are overwritten when the ring is full.
+struct cth_trace_event {
+	// Index + 1 of the event once written, 0 while it's being written.
+	uint64_t seq;
+	// Microseconds of CLOCK_MONOTONIC.
+	uint64_t start_us;
+	uint64_t dur_us;
+	// Bytes, or the exit code for CTH_TRACE_REAPED.
+	int64_t value;
+	int32_t pid;
+	uint8_t phase;
+	char argv0[27];
+};
+struct cth_trace {
+	size_t capacity;
+	// The process that enabled tracing, the pid of all the events in the JSON.
+	pid_t owner;
+	// Time of cth_trace_enable(), the zero of the timeline.
+	uint64_t base_us;
+	// Events recorded so far, the next index.
+	uint64_t next;
+	struct cth_trace_event events[];
+};
+static struct cth_trace *cth_tracer = NULL;
+// Names of CTH_TRACE_*.
+static const char *const cth_trace_phases[] = { "spawn", "stdin", "running", "drain", "reaped" };
+uint64_t cth_trace_clock(void)
+{
+	/*
+	 * Monotonic clock in microseconds, 0 if tracing is off, so the hot path skips clock_gettime().
+	 */
+	if (__atomic_load_n(&cth_tracer, __ATOMIC_ACQUIRE) == NULL) {
+		return 0;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+void cth_trace_span(int phase, const char *argv0, pid_t pid, uint64_t start_us, uint64_t end_us, int64_t value)
+{
+	/*
+	 * Record a phase of an execution, from start_us to end_us of cth_trace_clock().
+	 * start_us is 0 if tracing was off when the phase started, nothing is recorded then.
+	 * CTH_TRACE_REAPED is an instant, end_us is not used.
+	 */
+	struct cth_trace *t = __atomic_load_n(&cth_tracer, __ATOMIC_ACQUIRE);
+	if (t == NULL || start_us == 0) {
+		return;
+	}
+	uint64_t idx = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED);
+	struct cth_trace_event *e = &t->events[idx % t->capacity];
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	e->start_us = start_us;
+	e->dur_us = phase != CTH_TRACE_REAPED && end_us > start_us ? end_us - start_us : 0;
+	e->value = value;
+	e->pid = (int32_t)pid;
+	e->phase = (uint8_t)phase;
+	size_t len = 0;
+	if (argv0 != NULL) {
+		// The basename is enough to tell the commands apart on the timeline.
+		const char *slash = strrchr(argv0, '/');
+		argv0 = slash != NULL && slash[1] != '\0' ? slash + 1 : argv0;
+		for (; argv0[len] != '\0' && len < sizeof(e->argv0) - 1; len++) {
+			e->argv0[len] = argv0[len];
+		}
+	}
+	e->argv0[len] = '\0';
+	__atomic_store_n(&e->seq, idx + 1, __ATOMIC_RELEASE);
+}
+// API function.
+int cth_trace_enable(size_t events)
+{
+	/*
+	 * Start recording the timeline of all the commands spawned after this.
+	 * events: Size of the ring, 0 for CTH_TRACE_DEFAULT_EVENTS. Each event takes 64 bytes,
+	 *         an execution records up to 5 of them, the oldest are overwritten when it's full.
+	 * Enable it before starting non-blocking commands, so that their runners share the ring.
+	 * Calling it again does nothing, the ring of the first call stays.
+	 * Returns 0 on success, -1 on failure.
+	 */
+	if (__atomic_load_n(&cth_tracer, __ATOMIC_ACQUIRE) != NULL) {
+		return 0;
+	}
+	if (events == 0) {
+		events = CTH_TRACE_DEFAULT_EVENTS;
+	}
+	size_t size = sizeof(struct cth_trace) + events * sizeof(struct cth_trace_event);
+	struct cth_trace *t = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (t == MAP_FAILED) {
+		return -1;
+	}
+	t->capacity = events;
+	t->owner = getpid();
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t->base_us = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+	struct cth_trace *expected = NULL;
+	if (!__atomic_compare_exchange_n(&cth_tracer, &expected, t, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// Lost the race, the ring is never unmapped, so drop ours.
+		munmap(t, size);
+	}
+	return 0;
+}
+static void cth_trace_string(FILE *out, const char *s)
+{
+	/*
+	 * Write s as a JSON string.
+	 */
+	fputc('"', out);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', out);
+			fputc(*s, out);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		} else {
+			fputc(*s, out);
+		}
+	}
+	fputc('"', out);
+}
+static void cth_trace_write(FILE *out, const struct cth_trace *t, const struct cth_trace_event *e)
+{
+	/*
+	 * Write one event, the timestamps are relative to cth_trace_enable().
+	 * A spawn also names the track of the command, tracks are the pids of the commands.
+	 */
+	const char *name = e->phase <= CTH_TRACE_REAPED ? cth_trace_phases[e->phase] : "unknown";
+	uint64_t ts = e->start_us > t->base_us ? e->start_us - t->base_us : 0;
+	if (e->phase == CTH_TRACE_SPAWN) {
+		fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", (int)t->owner, (int)e->pid);
+		char label[sizeof(e->argv0) + 16];
+		snprintf(label, sizeof(label), "%s [%d]", e->argv0, (int)e->pid);
+		cth_trace_string(out, label);
+		fputs("}},\n", out);
+	}
+	fprintf(out, "{\"name\":\"%s\",\"cat\":\"catsh\",\"ph\":\"%s\",\"ts\":%llu,", name, e->phase == CTH_TRACE_REAPED ? "i\",\"s\":\"t" : "X", (unsigned long long)ts);
+	if (e->phase != CTH_TRACE_REAPED) {
+		fprintf(out, "\"dur\":%llu,", (unsigned long long)e->dur_us);
+	}
+	fprintf(out, "\"pid\":%d,\"tid\":%d,\"args\":{\"argv0\":", (int)t->owner, (int)e->pid);
+	cth_trace_string(out, e->argv0);
+	if (e->phase == CTH_TRACE_REAPED) {
+		fprintf(out, ",\"exit_code\":%lld", (long long)e->value);
+	} else if (e->phase == CTH_TRACE_STDIN || e->phase == CTH_TRACE_DRAIN) {
+		fprintf(out, ",\"bytes\":%lld", (long long)e->value);
+	}
+	fputs("}}", out);
+}
+// API function.
+int cth_trace_dump(int fd)
+{
+	/*
+	 * Write the recorded timeline to fd as Chrome trace-event JSON, oldest event first.
+	 * Open it in chrome://tracing or https://ui.perfetto.dev, each command is a track named "argv0 [pid]".
+	 * Phases: spawn (fork), stdin (feeding the input), running (spawned to reaped),
+	 * drain (collecting the captured output after the exit, with its size), and reaped (instant, with the exit code).
+	 * The number of events lost to the ring wrapping around is in otherData.dropped_events.
+	 * Returns 0 on success, -1 on failure or if tracing is not enabled.
+	 */
+	const struct cth_trace *t = __atomic_load_n(&cth_tracer, __ATOMIC_ACQUIRE);
+	if (t == NULL) {
+		return -1;
+	}
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&text, &len);
+	if (out == NULL) {
+		return -1;
+	}
+	uint64_t end = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+	uint64_t begin = end > t->capacity ? end - t->capacity : 0;
+	fputs("{\"traceEvents\":[\n", out);
+	bool first = true;
+	for (uint64_t idx = begin; idx < end; idx++) {
+		const struct cth_trace_event *slot = &t->events[idx % t->capacity];
+		// Copy it out, and keep it only if it was not being written meanwhile.
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		struct cth_trace_event e;
+		memcpy(&e, slot, sizeof(e));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq != idx + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+			continue;
+		}
+		e.argv0[sizeof(e.argv0) - 1] = '\0';
+		if (!first) {
+			fputs(",\n", out);
+		}
+		first = false;
+		cth_trace_write(out, t, &e);
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)begin);
+	if (fclose(out) != 0) {
+		free(text);
+		return -1;
+	}
+	size_t written = 0;
+	while (written < len) {
+		ssize_t n = write(fd, text + written, len - written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		written += (size_t)n;
+	}
+	free(text);
+	return written == len ? 0 : -1;
+}
@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "include/catsh_internal.h"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+// Zygote of cth_fork_rexec_self().
+// A re-exec of ourselves is started once and initialized, then waits in cth_zygote_serve(),
+// and forks a fresh child per request, so a subcommand costs a fork instead of a full exec and startup.
+// A request is the argv in one SOCK_SEQPACKET message, with stdin, stdout, stderr, cwd and a reply socket passed by SCM_RIGHTS.
+// The zygote sends the wait status back on the reply socket, so concurrent requests don't need to be ordered.
+#define CTH_ZYGOTE_ENV "CTH_ZYGOTE_FD"
+#define CTH_ZYGOTE_MAX_REQUEST 65536
+#define CTH_ZYGOTE_FDS 5
+static int cth_zygote_fd = -1;
+// The argv of the forked child, it lives as long as the child.
+static char **cth_zygote_child_argv = NULL;
+static char *cth_zygote_child_buf = NULL;
+static pid_t cth_zygote_pid = -1;
+// Held for writing by start and stop, and for reading while a request is sent.
+static pthread_rwlock_t cth_zygote_lock = PTHREAD_RWLOCK_INITIALIZER;
+struct cth_zygote_child {
+	pid_t pid;
+	int reply_fd;
+};
+static void cth_zygote_reap(struct cth_zygote_child *children, size_t *count)
+{
+	/*
+	 * Send the status of the exited children back.
+	 */
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (size_t i = 0; i < *count; i++) {
+			if (children[i].pid == pid) {
+				send(children[i].reply_fd, &status, sizeof(status), MSG_NOSIGNAL);
+				close(children[i].reply_fd);
+				children[i] = children[--(*count)];
+				break;
+			}
+		}
+	}
+}
+static int cth_zygote_recv(int fd, char *buf, int fds[CTH_ZYGOTE_FDS])
+{
+	/*
+	 * Receive a request.
+	 * Returns the size of the argv data, 0 on EOF, -1 on a bad request.
+	 */
+	char control[CMSG_SPACE(sizeof(int) * CTH_ZYGOTE_FDS)];
+	struct iovec iov = { buf, CTH_ZYGOTE_MAX_REQUEST };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ssize_t len;
+	while ((len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+	}
+	if (len <= 0) {
+		return len == 0 ? 0 : -1;
+	}
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * CTH_ZYGOTE_FDS)) {
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * CTH_ZYGOTE_FDS);
+	if ((msg.msg_flags & MSG_TRUNC) || buf[len - 1] != 0) {
+		for (int i = 0; i < CTH_ZYGOTE_FDS; i++) {
+			close(fds[i]);
+		}
+		return -1;
+	}
+	return (int)len;
+}
+static char **cth_zygote_argv(const char *buf, size_t len, int *argc)
+{
+	/*
+	 * Unpack the NUL-separated arguments, with /proc/self/exe as argv[0] like a real re-exec.
+	 * The last byte is the NUL ending the request, not an argument.
+	 */
+	len--;
+	int count = 1;
+	for (size_t i = 0; i < len; i++) {
+		count += buf[i] == 0;
+	}
+	char **argv = malloc(sizeof(char *) * (size_t)(count + 1));
+	if (argv == NULL) {
+		return NULL;
+	}
+	argv[0] = "/proc/self/exe";
+	*argc = 1;
+	for (size_t i = 0; i < len; i += strlen(buf + i) + 1) {
+		argv[(*argc)++] = (char *)buf + i;
+	}
+	argv[*argc] = NULL;
+	return argv;
+}
+// API function.
+int cth_zygote_serve(int *argc, char ***argv)
+{
+	/*
+	 * Call this in main() after the initialization, with the address of argc and argv.
+	 * Returns 0 at once in a normal run.
+	 * In the zygote started by cth_zygote_start(), this only returns in the forked child of a request, with 1,
+	 * and argc/argv set to the arguments of cth_fork_rexec_self(), as if we were re-executed with them.
+	 */
+	const char *env = getenv(CTH_ZYGOTE_ENV);
+	if (env == NULL) {
+		return 0;
+	}
+	int ctl = atoi(env);
+	unsetenv(CTH_ZYGOTE_ENV);
+	fcntl(ctl, F_SETFD, FD_CLOEXEC);
+	// Children are reaped through a signalfd.
+	signal(SIGCHLD, SIG_DFL);
+	sigset_t mask;
+	sigset_t old_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+	int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	char *buf = malloc(CTH_ZYGOTE_MAX_REQUEST);
+	if (sfd < 0 || buf == NULL || send(ctl, "R", 1, MSG_NOSIGNAL) != 1) {
+		_exit(CTH_EXIT_FAILURE);
+	}
+	struct cth_zygote_child *children = NULL;
+	size_t count = 0;
+	while (true) {
+		struct pollfd pfd[2] = { { ctl, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+		if (poll(pfd, 2, -1) < 0) {
+			continue;
+		}
+		if (pfd[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+			while (read(sfd, &info, sizeof(info)) > 0) {
+			}
+			cth_zygote_reap(children, &count);
+		}
+		if (!(pfd[0].revents & (POLLIN | POLLHUP))) {
+			continue;
+		}
+		int fds[CTH_ZYGOTE_FDS];
+		int len = cth_zygote_recv(ctl, buf, fds);
+		if (len == 0) {
+			// The parent is gone, the running children are left to finish alone.
+			_exit(CTH_EXIT_SUCCESS);
+		}
+		struct cth_zygote_child *new_children = len > 0 ? realloc(children, sizeof(struct cth_zygote_child) * (count + 1)) : NULL;
+		if (new_children == NULL) {
+			// A bad request, or out of memory, the client gets EOF on the reply socket.
+			if (len > 0) {
+				for (int i = 0; i < CTH_ZYGOTE_FDS; i++) {
+					close(fds[i]);
+				}
+			}
+			continue;
+		}
+		children = new_children;
+		pid_t pid = fork();
+		if (pid == 0) {
+			// The child returns to main() of the caller, as a fresh re-exec.
+			close(ctl);
+			close(sfd);
+			for (size_t i = 0; i < count; i++) {
+				close(children[i].reply_fd);
+			}
+			free(children);
+			sigprocmask(SIG_SETMASK, &old_mask, NULL);
+			dup2(fds[0], STDIN_FILENO);
+			dup2(fds[1], STDOUT_FILENO);
+			dup2(fds[2], STDERR_FILENO);
+			if (fchdir(fds[3]) < 0) {
+				_exit(CTH_EXIT_FAILURE);
+			}
+			for (int i = 0; i < CTH_ZYGOTE_FDS; i++) {
+				close(fds[i]);
+			}
+			cth_zygote_child_buf = buf;
+			cth_zygote_child_argv = cth_zygote_argv(buf, (size_t)len, argc);
+			if (cth_zygote_child_argv == NULL) {
+				_exit(CTH_EXIT_FAILURE);
+			}
+			*argv = cth_zygote_child_argv;
+			return 1;
+		}
+		for (int i = 0; i < CTH_ZYGOTE_FDS - 1; i++) {
+			close(fds[i]);
+		}
+		if (pid < 0) {
+			close(fds[CTH_ZYGOTE_FDS - 1]);
+			continue;
+		}
+		children[count].pid = pid;
+		children[count].reply_fd = fds[CTH_ZYGOTE_FDS - 1];
+		count++;
+	}
+}
+// API function.
+int cth_zygote_start(void)
+{
+	/*
+	 * Start the zygote, cth_fork_rexec_self() uses it from now on.
+	 * The executable must call cth_zygote_serve() in main(), otherwise this fails.
+	 * The children get the environment of this moment, but the current cwd and stdio of each call.
+	 * Returns 0 on success or if it's already running, -1 on failure.
+	 */
+	pthread_rwlock_wrlock(&cth_zygote_lock);
+	if (cth_zygote_fd >= 0) {
+		pthread_rwlock_unlock(&cth_zygote_lock);
+		return 0;
+	}
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		pthread_rwlock_unlock(&cth_zygote_lock);
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		// dup() clears O_CLOEXEC, so only this one is inherited.
+		int fd = dup(sv[1]);
+		char value[16];
+		sprintf(value, "%d", fd);
+		setenv(CTH_ZYGOTE_ENV, value, 1);
+		execl("/proc/self/exe", "/proc/self/exe", NULL);
+		_exit(CTH_EXIT_FAILURE);
+	}
+	close(sv[1]);
+	char ready = 0;
+	if (pid < 0 || recv(sv[0], &ready, 1, 0) != 1 || ready != 'R') {
+		// It exited without calling cth_zygote_serve().
+		close(sv[0]);
+		if (pid > 0) {
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
+		pthread_rwlock_unlock(&cth_zygote_lock);
+		return -1;
+	}
+	__atomic_store_n(&cth_zygote_fd, sv[0], __ATOMIC_RELAXED);
+	cth_zygote_pid = pid;
+	pthread_rwlock_unlock(&cth_zygote_lock);
+	return 0;
+}
+// API function.
+void cth_zygote_stop(void)
+{
+	/*
+	 * Stop the zygote, cth_fork_rexec_self() falls back to fork and exec.
+	 * The running children are not affected.
+	 */
+	pthread_rwlock_wrlock(&cth_zygote_lock);
+	if (cth_zygote_fd >= 0) {
+		// It exits on EOF.
+		close(cth_zygote_fd);
+		waitpid(cth_zygote_pid, NULL, 0);
+		__atomic_store_n(&cth_zygote_fd, -1, __ATOMIC_RELAXED);
+		cth_zygote_pid = -1;
+	}
+	pthread_rwlock_unlock(&cth_zygote_lock);
+}
+int cth_zygote_exec(char *const argv[], int *status)
+{
+	/*
+	 * Run argv in a child of the zygote, with our stdio and cwd, and wait for it.
+	 * Returns 1 if it ran, with its wait status in status,
+	 * 0 if the zygote is not running or the request was not sent, then the caller should fork and exec,
+	 * -1 if the request was sent but no status came back, as the command may have run, it must not be retried.
+	 */
+	if (__atomic_load_n(&cth_zygote_fd, __ATOMIC_RELAXED) < 0) {
+		return 0;
+	}
+	char *buf = malloc(CTH_ZYGOTE_MAX_REQUEST);
+	if (buf == NULL) {
+		return 0;
+	}
+	size_t len = 0;
+	for (size_t i = 0; argv[i] != NULL; i++) {
+		size_t arg_len = strlen(argv[i]) + 1;
+		if (len + arg_len + 1 > CTH_ZYGOTE_MAX_REQUEST) {
+			free(buf);
+			return 0;
+		}
+		memcpy(buf + len, argv[i], arg_len);
+		len += arg_len;
+	}
+	// End the request with an extra NUL, so that an empty argv is not an empty message, which would look like EOF.
+	buf[len++] = 0;
+	int reply[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply) < 0) {
+		free(buf);
+		return 0;
+	}
+	int cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	int fds[CTH_ZYGOTE_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, cwd_fd, reply[1] };
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov = { buf, len };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	pthread_rwlock_rdlock(&cth_zygote_lock);
+	ssize_t sent = cwd_fd >= 0 && cth_zygote_fd >= 0 ? sendmsg(cth_zygote_fd, &msg, MSG_NOSIGNAL) : -1;
+	pthread_rwlock_unlock(&cth_zygote_lock);
+	free(buf);
+	if (cwd_fd >= 0) {
+		close(cwd_fd);
+	}
+	close(reply[1]);
+	if (sent < 0) {
+		close(reply[0]);
+		return 0;
+	}
+	ssize_t ret;
+	while ((ret = recv(reply[0], status, sizeof(*status), 0)) < 0 && errno == EINTR) {
+	}
+	close(reply[0]);
+	return ret == sizeof(*status) ? 1 : -1;
+}
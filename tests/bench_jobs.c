@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#include <dirent.h>
+#include <sys/sysinfo.h>
+// Usage: ./bench_jobs [jobs...], defaults to 100 500 1000 2000, up to 20000.
+// Each job is a non-blocking dd reading one byte from a FIFO, so all the jobs of a level are running at the same time,
+// and they are released at once by writing one byte per job to the FIFO after all of them are launched.
+#define FIFO_PATH "/tmp/cth_bench_jobs_fifo"
+#define MAX_JOBS 20000
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static long count_fds(void)
+{
+	long count = 0;
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir == NULL) {
+		return -1;
+	}
+	while (readdir(dir) != NULL) {
+		count++;
+	}
+	closedir(dir);
+	// ".", ".." and the fd of dir itself.
+	return count - 3;
+}
+static long read_kb(const char *file, const char *key)
+{
+	// Read "key: N kB" from /proc/self/status or /proc/meminfo.
+	char line[256];
+	long value = -1;
+	size_t key_len = strlen(key);
+	FILE *fp = fopen(file, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, key, key_len) == 0 && line[key_len] == ':') {
+			value = strtol(line + key_len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(fp);
+	return value;
+}
+static long count_procs(void)
+{
+	struct sysinfo info;
+	if (sysinfo(&info) < 0) {
+		return -1;
+	}
+	return info.procs;
+}
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+static double percentile(const double *sorted, int n, double p)
+{
+	int i = (int)(p * (n - 1) + 0.5);
+	return sorted[i];
+}
+static void bench(int jobs)
+{
+	struct cth_result **res = calloc((size_t)jobs, sizeof(struct cth_result *));
+	double *latency = calloc((size_t)jobs, sizeof(double));
+	char *release = calloc((size_t)jobs, 1);
+	// Keep a writer open, so that the jobs never block in open() or see EOF.
+	unlink(FIFO_PATH);
+	int fifo = mkfifo(FIFO_PATH, 0600) == 0 ? open(FIFO_PATH, O_RDWR | O_CLOEXEC) : -1;
+	if (res == NULL || latency == NULL || release == NULL || fifo < 0) {
+		printf("%8d  failed to set up\n", jobs);
+		free(res);
+		free(latency);
+		free(release);
+		return;
+	}
+	long base_fds = count_fds();
+	long base_procs = count_procs();
+	long base_shmem = read_kb("/proc/meminfo", "Shmem");
+	long base_slab = read_kb("/proc/meminfo", "Slab");
+	long base_rss = read_kb("/proc/self/status", "VmRSS");
+	// Launch all the jobs.
+	int launched = 0;
+	double t1 = now();
+	for (; launched < jobs; launched++) {
+		res[launched] = cth_exec((char *[]){ "dd", "if=" FIFO_PATH, "of=/dev/null", "bs=1", "count=1", "status=none", NULL }, NULL, false, false);
+		if (res[launched] == NULL) {
+			break;
+		}
+	}
+	double t2 = now();
+	// All the jobs are running now, take the peak numbers.
+	long peak_fds = count_fds();
+	long peak_procs = count_procs();
+	long peak_shmem = read_kb("/proc/meminfo", "Shmem");
+	long peak_slab = read_kb("/proc/meminfo", "Slab");
+	long peak_rss = read_kb("/proc/self/status", "VmRSS");
+	// Release all the jobs at once, and poll them until they exit, like a simple event loop would do.
+	double t_release = now();
+	write(fifo, release, (size_t)launched);
+	int remaining = launched;
+	long sweeps = 0;
+	double sweep_time = 0;
+	while (remaining > 0) {
+		double s1 = now();
+		for (int i = 0; i < launched; i++) {
+			if (res[i] != NULL && !res[i]->exited && cth_wait(&res[i]) >= 0) {
+				latency[i] = now() - t_release;
+				remaining--;
+			}
+		}
+		sweep_time += now() - s1;
+		sweeps++;
+		if (remaining > 0) {
+			usleep(1000);
+		}
+	}
+	double t3 = now();
+	for (int i = 0; i < launched; i++) {
+		cth_free_result(&res[i]);
+	}
+	close(fifo);
+	unlink(FIFO_PATH);
+	if (launched == 0) {
+		printf("%8d  launch failed: %s\n", jobs, strerror(errno));
+		free(res);
+		free(latency);
+		free(release);
+		return;
+	}
+	qsort(latency, (size_t)launched, sizeof(double), cmp_double);
+	printf("%8d  %9.0f  %7.1f %7.1f %7.1f %7.1f  %8ld  %8ld  %8ld  %9ld  %8ld  %8.3f  %6.2f", jobs, launched / (t2 - t1), percentile(latency, launched, 0.5) * 1000, percentile(latency, launched, 0.9) * 1000, percentile(latency, launched, 0.99) * 1000,
+	       latency[launched - 1] * 1000, peak_fds - base_fds, peak_procs - base_procs, peak_rss - base_rss, peak_shmem - base_shmem, peak_slab - base_slab, sweep_time / (double)sweeps * 1000, t3 - t1);
+	if (launched < jobs) {
+		printf("  launch failed at %d: %s", launched, strerror(errno));
+	}
+	printf("\n");
+	free(res);
+	free(latency);
+	free(release);
+}
+int main(int argc, char **argv)
+{
+	// Each job holds some fds in the parent, so raise the soft limit.
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	printf("\nBenchmark: concurrent non-blocking jobs, each is 'dd' waiting for one byte from a FIFO\n");
+	printf("  launch/s: launch rate of cth_exec(), latency: from releasing all jobs to completion seen by cth_wait(),\n");
+	printf("  fds/procs/rss/shmem/slab: increase at peak, sweep: one cth_wait() pass over all jobs\n");
+	printf("  RLIMIT_NOFILE: %llu, pid_max limits the total processes\n\n", (unsigned long long)rl.rlim_cur);
+	printf("%8s  %9s  %7s %7s %7s %7s  %8s  %8s  %8s  %9s  %8s  %8s  %6s\n", "jobs", "launch/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "fds", "procs", "rss kB", "shmem kB", "slab kB", "sweep ms", "total s");
+	int defaults[] = { 100, 500, 1000, 2000 };
+	int count = argc > 1 ? argc - 1 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+	for (int i = 0; i < count; i++) {
+		int jobs = argc > 1 ? atoi(argv[i + 1]) : defaults[i];
+		if (jobs <= 0 || jobs > MAX_JOBS) {
+			printf("%8d  skipped, should be 1 to %d\n", jobs, MAX_JOBS);
+			continue;
+		}
+		bench(jobs);
+	}
+	return 0;
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#include <time.h>
+#define BENCH_SIZE (100 * 1024 * 1024)
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static char *gen_text(size_t size)
+{
+	// Lines of 1 to 120 bytes, with ',' separated fields.
+	char *buf = malloc(size + 1);
+	if (!buf) {
+		return NULL;
+	}
+	size_t i = 0;
+	while (i < size) {
+		size_t line_len = 1 + rand() % 120;
+		for (size_t j = 0; j < line_len && i < size; j++, i++) {
+			buf[i] = (rand() % 8 == 0) ? ',' : 'a' + rand() % 26;
+		}
+		if (i < size) {
+			buf[i++] = '\n';
+		}
+	}
+	buf[size - 1] = '\n';
+	buf[size] = 0;
+	return buf;
+}
+int main()
+{
+	printf("\nBenchmark: split 100MB of output into lines and fields\n");
+	char *text = gen_text(BENCH_SIZE);
+	char *copy = malloc(BENCH_SIZE + 1);
+	if (!text || !copy) {
+		printf("  Failed to allocate memory\n");
+		return 1;
+	}
+	// Naive strchr() loop.
+	double t1 = now();
+	size_t naive_lines = 0;
+	for (char *p = text, *nl; (nl = strchr(p, '\n')) != NULL; p = nl + 1) {
+		naive_lines++;
+	}
+	double t2 = now();
+	printf("  strchr() loop:      %zu lines, %.6f seconds\n", naive_lines, t2 - t1);
+	// Naive strtok() loop, on a copy as it modifies the buffer.
+	memcpy(copy, text, BENCH_SIZE + 1);
+	t1 = now();
+	size_t strtok_lines = 0;
+	for (char *line = strtok(copy, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+		strtok_lines++;
+	}
+	t2 = now();
+	printf("  strtok() loop:      %zu lines, %.6f seconds\n", strtok_lines, t2 - t1);
+	// cth_lines_index().
+	t1 = now();
+	struct cth_lines *lines = cth_lines_index(text, BENCH_SIZE);
+	t2 = now();
+	printf("  cth_lines_index():  %zu lines, %.6f seconds\n", lines ? lines->count : 0, t2 - t1);
+	// Fields, naive strtok_r() on each line.
+	memcpy(copy, text, BENCH_SIZE + 1);
+	t1 = now();
+	size_t naive_fields = 0;
+	char *save_line = NULL;
+	for (char *line = strtok_r(copy, "\n", &save_line); line != NULL; line = strtok_r(NULL, "\n", &save_line)) {
+		char *save_field = NULL;
+		for (char *field = strtok_r(line, ",", &save_field); field != NULL; field = strtok_r(NULL, ",", &save_field)) {
+			naive_fields++;
+		}
+	}
+	t2 = now();
+	printf("  strtok_r() fields:  %zu fields, %.6f seconds\n", naive_fields, t2 - t1);
+	// Fields, cth_fields_next() on each line.
+	// strtok_r() skips empty fields, cth_fields_next() does not, so only count non-empty ones.
+	t1 = now();
+	size_t cth_fields_count = 0;
+	for (size_t i = 0; lines && i < lines->count; i++) {
+		size_t len = 0;
+		const char *line = cth_line(lines, i, &len);
+		struct cth_fields fields;
+		cth_fields_init(&fields, line, len, ',');
+		const char *field = NULL;
+		size_t field_len = 0;
+		while (cth_fields_next(&fields, &field, &field_len)) {
+			if (field_len > 0) {
+				cth_fields_count++;
+			}
+		}
+	}
+	t2 = now();
+	printf("  cth_fields_next():  %zu fields, %.6f seconds\n", cth_fields_count, t2 - t1);
+	printf("  Counts match: %s\n", (lines && lines->count == naive_lines && naive_fields == cth_fields_count) ? "yes" : "no");
+	cth_free_lines(&lines);
+	free(copy);
+	free(text);
+	return 0;
+}
@@ -0,0 +1,370 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+// Usage: ./bench_replay [-s speed] [-m block|nonblock] [-c none|full|tail|fd] [-j jobs] [log]
+// Replays a workload logged by cth_record_start(): each command is re-issued with an input of the recorded size,
+// at the recorded pacing divided by speed (0, the default, issues them back to back), and is checked against
+// the recorded exit code and output sizes.
+// -m picks the spawn backend, blocking calls one by one, or non-blocking ones with up to -j (64) in flight.
+// -c picks the capture backend of commands that captured their output, the others never capture.
+// Without a log, a sample workload is recorded first, and replayed with every backend.
+#define SAMPLE_PATH "/tmp/cth_bench_replay.log"
+struct replay {
+	struct cth_record *recs;
+	size_t count;
+	// Largest input, the input buffer is shared by all the commands.
+	uint64_t max_input;
+};
+struct stats {
+	size_t failed;
+	size_t exit_mismatch;
+	size_t output_mismatch;
+	double *latency;
+	double lag_sum;
+	double lag_max;
+	double wall;
+};
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+static int cmp_start(const void *a, const void *b)
+{
+	const struct cth_record *x = a;
+	const struct cth_record *y = b;
+	return (x->start_us > y->start_us) - (x->start_us < y->start_us);
+}
+static double percentile(const double *sorted, size_t n, double p)
+{
+	size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+	return sorted[i];
+}
+static int load(const char *path, struct replay *rp)
+{
+	/*
+	 * Read the whole log, sorted by start time, the runners of non-blocking commands append out of order.
+	 */
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	size_t cap = 0;
+	struct cth_record rec;
+	int ret;
+	while ((ret = cth_record_next(fd, &rec)) == 1) {
+		if (rp->count == cap) {
+			cap = cap == 0 ? 256 : cap * 2;
+			struct cth_record *recs = realloc(rp->recs, cap * sizeof(*recs));
+			if (recs == NULL) {
+				cth_free_record(&rec);
+				ret = -1;
+				break;
+			}
+			rp->recs = recs;
+		}
+		if ((rec.flags & CTH_RECORD_INPUT) && rec.stdin_bytes > rp->max_input) {
+			rp->max_input = rec.stdin_bytes;
+		}
+		rp->recs[rp->count++] = rec;
+	}
+	if (ret < 0) {
+		printf("  stopped at record %zu: %s\n", rp->count, strerror(errno));
+	}
+	close(fd);
+	qsort(rp->recs, rp->count, sizeof(*rp->recs), cmp_start);
+	return 0;
+}
+static void check(const struct cth_record *rec, const struct cth_result *res, int capture, struct stats *st, size_t i, double latency)
+{
+	st->latency[i] = latency;
+	if (res->exit_code != rec->exit_code) {
+		st->exit_mismatch++;
+	}
+	if (capture >= 0 && (rec->flags & CTH_RECORD_OUTPUT) && (res->stdout_total != rec->stdout_bytes || res->stderr_total != rec->stderr_bytes)) {
+		st->output_mismatch++;
+	}
+}
+// Non-blocking commands in flight.
+struct window {
+	struct cth_result **running;
+	size_t *index;
+	double *launched;
+	size_t jobs;
+	size_t count;
+};
+static bool reap(const struct replay *rp, struct window *w, int capture, struct stats *st, int timeout_ms)
+{
+	/*
+	 * Collect one finished command, waiting up to timeout_ms, negative to wait forever.
+	 * Returns false if none finished.
+	 */
+	if (w->count == 0) {
+		return false;
+	}
+	int done = cth_wait_any(w->running, w->jobs, timeout_ms);
+	if (done < 0) {
+		return false;
+	}
+	check(&rp->recs[w->index[done]], w->running[done], capture, st, w->index[done], now() - w->launched[done]);
+	cth_free_result(&w->running[done]);
+	w->count--;
+	return true;
+}
+static void pace(const struct replay *rp, size_t i, double speed, double t0, struct window *w, int capture, struct stats *st)
+{
+	/*
+	 * Wait until the time of record i, scaled by speed, and account for how late we are.
+	 * Non-blocking commands are collected meanwhile, so that their latency is not inflated by the wait.
+	 */
+	if (speed > 0) {
+		double due = t0 + (double)(rp->recs[i].start_us - rp->recs[0].start_us) / 1e6 / speed;
+		double t;
+		while ((t = now()) < due) {
+			if (w == NULL || !reap(rp, w, capture, st, (int)((due - t) * 1000))) {
+				// Below 1 ms, or nothing in flight.
+				t = now();
+				if (t < due) {
+					usleep((useconds_t)((due - t) * 1e6));
+				}
+			}
+		}
+		double lag = t - due;
+		st->lag_sum += lag;
+		if (lag > st->lag_max) {
+			st->lag_max = lag;
+		}
+	}
+	if (w != NULL) {
+		while (reap(rp, w, capture, st, 0)) {
+		}
+		// Make room.
+		while (w->count == w->jobs && reap(rp, w, capture, st, -1)) {
+		}
+	}
+}
+static void replay(const struct replay *rp, double speed, bool block, int capture, size_t jobs, const char *input)
+{
+	/*
+	 * capture: CTH_CAPTURE_*, or -1 for no capture at all.
+	 */
+	struct stats st = { 0 };
+	st.latency = calloc(rp->count, sizeof(double));
+	struct window w = { 0 };
+	w.running = calloc(jobs, sizeof(struct cth_result *));
+	w.index = calloc(jobs, sizeof(size_t));
+	w.launched = calloc(jobs, sizeof(double));
+	w.jobs = jobs;
+	struct cth_exec_attr *attr = cth_new_attr();
+	if (st.latency == NULL || w.running == NULL || w.index == NULL || w.launched == NULL || attr == NULL) {
+		printf("  failed to set up\n");
+		free(st.latency);
+		free(w.running);
+		free(w.index);
+		free(w.launched);
+		cth_free_attr(&attr);
+		return;
+	}
+	attr->capture_mode = capture >= 0 ? capture : CTH_CAPTURE_FULL;
+	attr->tail_lines = 10;
+	double t0 = now();
+	for (size_t i = 0; i < rp->count; i++) {
+		const struct cth_record *rec = &rp->recs[i];
+		pace(rp, i, speed, t0, block ? NULL : &w, capture, &st);
+		char *in = (rec->flags & CTH_RECORD_INPUT) ? (char *)input + (rp->max_input - rec->stdin_bytes) : NULL;
+		bool get_output = capture >= 0 && (rec->flags & CTH_RECORD_OUTPUT);
+		if (block) {
+			double t = now();
+			struct cth_result *res = cth_exec_with_attr(rec->argv, in, true, get_output, attr);
+			if (res == NULL) {
+				st.failed++;
+				continue;
+			}
+			check(rec, res, capture, &st, i, now() - t);
+			cth_free_result(&res);
+			continue;
+		}
+		size_t slot = 0;
+		while (w.running[slot] != NULL) {
+			slot++;
+		}
+		w.launched[slot] = now();
+		w.running[slot] = cth_exec_with_attr(rec->argv, in, false, get_output, attr);
+		if (w.running[slot] == NULL) {
+			st.failed++;
+			continue;
+		}
+		w.index[slot] = i;
+		w.count++;
+	}
+	while (reap(rp, &w, capture, &st, -1)) {
+	}
+	st.wall = now() - t0;
+	qsort(st.latency, rp->count, sizeof(double), cmp_double);
+	static const char *const captures[] = { "full", "tail", "fd" };
+	printf("%-9s %-5s %6.1fx  %7zu  %8.0f  %7.2f %7.2f %7.2f  %7.2f %7.2f  %6zu %6zu %6zu  %7.3f\n", block ? "block" : "nonblock", capture >= 0 ? captures[capture] : "none", speed, rp->count, (double)rp->count / st.wall, percentile(st.latency, rp->count, 0.5) * 1000,
+	       percentile(st.latency, rp->count, 0.99) * 1000, st.latency[rp->count - 1] * 1000, speed > 0 ? st.lag_sum / (double)rp->count * 1000 : 0, st.lag_max * 1000, st.failed, st.exit_mismatch, st.output_mismatch, st.wall);
+	free(st.latency);
+	free(w.running);
+	free(w.index);
+	free(w.launched);
+	cth_free_attr(&attr);
+}
+static int record_sample(void)
+{
+	/*
+	 * A mix of short commands, with and without input and output, a few ms apart.
+	 */
+	unlink(SAMPLE_PATH);
+	if (cth_record_start(SAMPLE_PATH) < 0) {
+		return -1;
+	}
+	char *input = malloc(65537);
+	if (input == NULL) {
+		cth_record_stop();
+		return -1;
+	}
+	for (size_t i = 0; i < 65536; i++) {
+		input[i] = i % 64 == 63 ? '\n' : 'a';
+	}
+	input[65536] = '\0';
+	for (int i = 0; i < 60; i++) {
+		struct cth_result *res = NULL;
+		switch (i % 5) {
+		case 0:
+			res = cth_exec((char *[]){ "true", NULL }, NULL, true, false);
+			break;
+		case 1:
+			res = cth_exec((char *[]){ "cat", NULL }, input + 65536 - 4096, true, true);
+			break;
+		case 2:
+			res = cth_exec((char *[]){ "seq", "1000", NULL }, NULL, true, true);
+			break;
+		case 3:
+			res = cth_exec((char *[]){ "wc", "-l", NULL }, input, true, true);
+			break;
+		default:
+			res = cth_exec((char *[]){ "sh", "-c", "echo oops >&2; exit 1", NULL }, NULL, true, true);
+			break;
+		}
+		cth_free_result(&res);
+		usleep(2000);
+	}
+	cth_record_stop();
+	free(input);
+	return 0;
+}
+int main(int argc, char **argv)
+{
+	double speed = 0;
+	int mode = -1;
+	int capture = -2;
+	size_t jobs = 64;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:m:c:j:")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'm':
+			mode = strcmp(optarg, "block") == 0 ? 1 : strcmp(optarg, "nonblock") == 0 ? 0 : -1;
+			break;
+		case 'c':
+			capture = strcmp(optarg, "none") == 0 ? -1 : strcmp(optarg, "full") == 0 ? CTH_CAPTURE_FULL : strcmp(optarg, "tail") == 0 ? CTH_CAPTURE_TAIL : strcmp(optarg, "fd") == 0 ? CTH_CAPTURE_FD : -2;
+			break;
+		case 'j':
+			jobs = (size_t)atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s speed] [-m block|nonblock] [-c none|full|tail|fd] [-j jobs] [log]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (jobs == 0) {
+		jobs = 1;
+	}
+	const char *path = optind < argc ? argv[optind] : NULL;
+	if (path == NULL) {
+		printf("\nRecording a sample workload to %s\n", SAMPLE_PATH);
+		if (record_sample() < 0) {
+			printf("  failed: %s\n", strerror(errno));
+			return 1;
+		}
+		path = SAMPLE_PATH;
+	}
+	struct replay rp = { 0 };
+	if (load(path, &rp) < 0 || rp.count == 0) {
+		printf("No records in %s\n", path);
+		free(rp.recs);
+		return 1;
+	}
+	// Inputs are the tail of one buffer, NUL-terminated like any input of cth_exec().
+	char *input = malloc((size_t)rp.max_input + 1);
+	if (input == NULL) {
+		return 1;
+	}
+	for (uint64_t i = 0; i < rp.max_input; i++) {
+		input[i] = i % 64 == 63 ? '\n' : 'a';
+	}
+	input[rp.max_input] = '\0';
+	double span = (double)(rp.recs[rp.count - 1].start_us - rp.recs[0].start_us) / 1e6;
+	printf("\nBenchmark: replay of %zu commands recorded over %.3f s, %zu in flight at most for nonblock\n", rp.count, span, jobs);
+	printf("  latency: from launch to the result, lag: behind the recorded schedule, fail: not started, exit/out: differs from the record\n\n");
+	printf("%-9s %-5s %7s  %7s  %8s  %7s %7s %7s  %7s %7s  %6s %6s %6s  %7s\n", "spawn", "capt", "speed", "cmds", "cmds/s", "p50 ms", "p99 ms", "max ms", "lag ms", "lagmax", "fail", "exit", "out", "total s");
+	for (int m = 1; m >= 0; m--) {
+		if (mode >= 0 && m != mode) {
+			continue;
+		}
+		for (int c = -1; c <= CTH_CAPTURE_FD; c++) {
+			if (capture != -2 && c != capture) {
+				continue;
+			}
+			replay(&rp, speed, m == 1, c, jobs, input);
+		}
+	}
+	if (argc == 1) {
+		// The original pacing too, the lag shows the overhead of keeping up with it.
+		replay(&rp, 1, true, CTH_CAPTURE_FULL, jobs, input);
+		replay(&rp, 1, false, CTH_CAPTURE_FULL, jobs, input);
+	}
+	for (size_t i = 0; i < rp.count; i++) {
+		cth_free_record(&rp.recs[i]);
+	}
+	free(rp.recs);
+	free(input);
+	return 0;
+}
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#include <pthread.h>
+static struct cth_exec_attr *attr = NULL;
+static void show(const char *name, struct cth_result *res)
+{
+	if (res) {
+		printf("  %s: exit code = %d, cached = %d, stdout: %s", name, res->exit_code, res->cached, res->stdout_ret ? res->stdout_ret : "(null)\n");
+	} else {
+		printf("  %s: failed\n", name);
+	}
+}
+static void show_stats(void)
+{
+	uint64_t hits, misses, coalesced;
+	cth_cache_stats(attr->cache, &hits, &misses, &coalesced);
+	printf("  stats: hits = %llu, misses = %llu, coalesced = %llu\n", (unsigned long long)hits, (unsigned long long)misses, (unsigned long long)coalesced);
+}
+void t1()
+{
+	printf("\nTest 1: hit\n");
+	printf("  Command: uname -r, twice\n");
+	printf("  Expect: the second one is cached, same output\n");
+	for (int i = 0; i < 2; i++) {
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "uname", "-r", NULL }, NULL, true, true, attr);
+		show(i == 0 ? "first " : "second", res);
+		cth_free_result(&res);
+	}
+	show_stats();
+}
+void t2()
+{
+	printf("\nTest 2: input and selected env var are parts of the key\n");
+	printf("  Command: sh -c 'cat; echo $CTH_MODE'\n");
+	printf("  Expect: miss, miss, miss, hit\n");
+	cth_cache_add_env(attr->cache, "CTH_MODE");
+	setenv("CTH_MODE", "a", 1);
+	const char *inputs[] = { "x\n", "y\n", "x\n", "x\n" };
+	const char *modes[] = { "a", "a", "b", "b" };
+	for (int i = 0; i < 4; i++) {
+		setenv("CTH_MODE", modes[i], 1);
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "cat; echo $CTH_MODE", NULL }, (char *)inputs[i], true, true, attr);
+		if (res) {
+			printf("  cached = %d, stdout: %s", res->cached, res->stdout_ret);
+		}
+		cth_free_result(&res);
+	}
+	unsetenv("CTH_MODE");
+}
+void t3()
+{
+	printf("\nTest 3: the executable changes\n");
+	printf("  Command: /tmp/cth_cache_echo hello, then touch it\n");
+	printf("  Expect: miss, hit, miss\n");
+	system("cp /bin/echo /tmp/cth_cache_echo");
+	for (int i = 0; i < 3; i++) {
+		if (i == 2) {
+			struct timespec times[2] = { { 0, UTIME_NOW }, { 12345, 0 } };
+			utimensat(AT_FDCWD, "/tmp/cth_cache_echo", times, 0);
+		}
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "/tmp/cth_cache_echo", "hello", NULL }, NULL, true, true, attr);
+		if (res) {
+			printf("  cached = %d, stdout: %s", res->cached, res->stdout_ret);
+		}
+		cth_free_result(&res);
+	}
+	unlink("/tmp/cth_cache_echo");
+}
+void t4()
+{
+	printf("\nTest 4: TTL\n");
+	printf("  Command: date +%%N, 200ms apart, with a 100ms TTL\n");
+	printf("  Expect: miss, hit, miss after the sleep\n");
+	struct cth_cache *old = attr->cache;
+	attr->cache = cth_new_cache(100);
+	for (int i = 0; i < 3; i++) {
+		if (i == 2) {
+			usleep(200000);
+		}
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "date", "+%N", NULL }, NULL, true, true, attr);
+		if (res) {
+			printf("  cached = %d, stdout: %s", res->cached, res->stdout_ret);
+		}
+		cth_free_result(&res);
+	}
+	cth_free_cache(&attr->cache);
+	attr->cache = old;
+}
+static void *worker(void *arg)
+{
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "sleep 0.3; echo $$", NULL }, NULL, true, true, attr);
+	*(struct cth_result **)arg = res;
+	return NULL;
+}
+void t5()
+{
+	printf("\nTest 5: 8 identical requests at the same time are coalesced\n");
+	printf("  Command: sh -c 'sleep 0.3; echo $$'\n");
+	printf("  Expect: one run, all outputs match, about 0.3s\n");
+	cth_cache_invalidate(attr->cache);
+	uint64_t misses1, coalesced1, misses2, coalesced2;
+	cth_cache_stats(attr->cache, NULL, &misses1, &coalesced1);
+	pthread_t threads[8];
+	struct cth_result *res[8];
+	struct timespec ts1, ts2;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (int i = 0; i < 8; i++) {
+		pthread_create(&threads[i], NULL, worker, &res[i]);
+	}
+	for (int i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	cth_cache_stats(attr->cache, NULL, &misses2, &coalesced2);
+	int same = 0;
+	for (int i = 0; i < 8; i++) {
+		if (res[i] && res[0] && res[i]->stdout_ret && strcmp(res[i]->stdout_ret, res[0]->stdout_ret) == 0) {
+			same++;
+		}
+	}
+	printf("  Actual: runs = %llu, coalesced = %llu, %d/8 match, %.3f seconds\n", (unsigned long long)(misses2 - misses1), (unsigned long long)(coalesced2 - coalesced1), same, (ts2.tv_sec - ts1.tv_sec) + (ts2.tv_nsec - ts1.tv_nsec) / 1e9);
+	for (int i = 0; i < 8; i++) {
+		cth_free_result(&res[i]);
+	}
+}
+void t6()
+{
+	printf("\nTest 6: 10000 hits of 'uname -r'\n");
+	printf("  Expect: 9999 cached (the cache was invalidated in test 5), microseconds per call\n");
+	struct timespec ts1, ts2;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	int cached = 0;
+	for (int i = 0; i < 10000; i++) {
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "uname", "-r", NULL }, NULL, true, true, attr);
+		cached += res && res->cached;
+		cth_free_result(&res);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	printf("  Actual: %d cached, %.6f seconds\n", cached, (ts2.tv_sec - ts1.tv_sec) + (ts2.tv_nsec - ts1.tv_nsec) / 1e9);
+}
+void t7()
+{
+	printf("\nTest 7: binary output is kept as a whole\n");
+	printf("  Command: printf 'a\\0b\\0c'\n");
+	printf("  Expect: miss, hit, both 5 bytes, same\n");
+	struct cth_result *res[2];
+	for (int i = 0; i < 2; i++) {
+		res[i] = cth_exec_with_attr((char *[]){ "printf", "a\\0b\\0c", NULL }, NULL, true, true, attr);
+		if (res[i]) {
+			printf("  cached = %d, stdout_total = %llu\n", res[i]->cached, (unsigned long long)res[i]->stdout_total);
+		}
+	}
+	if (res[0] && res[1]) {
+		printf("  %s\n", memcmp(res[0]->stdout_ret, res[1]->stdout_ret, 6) == 0 ? "same" : "different");
+	}
+	cth_free_result(&res[0]);
+	cth_free_result(&res[1]);
+}
+void t8()
+{
+	printf("\nTest 8: working directory and nice are parts of the key\n");
+	printf("  Command: sh -c 'pwd; nice'\n");
+	printf("  Expect: miss /tmp 0, miss / 0, miss / 5, hit / 5\n");
+	const char *dirs[] = { "/tmp", "/", "/", "/" };
+	const int nices[] = { 0, 0, 5, 5 };
+	char old[4096];
+	if (getcwd(old, sizeof(old)) == NULL) {
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		if (chdir(dirs[i]) < 0) {
+			continue;
+		}
+		attr->nice = nices[i];
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "pwd; nice", NULL }, NULL, true, true, attr);
+		if (res) {
+			printf("  cached = %d, stdout: %s", res->cached, res->stdout_ret);
+		}
+		cth_free_result(&res);
+	}
+	attr->nice = 0;
+	if (chdir(old) < 0) {
+		printf("  chdir back failed\n");
+	}
+}
+void t9()
+{
+	printf("\nTest 9: perf counters bypass the cache\n");
+	printf("  Command: true with CTH_PERF_TASK_CLOCK, twice\n");
+	printf("  Expect: cached = 0, cached = 0, perf_stat set both times\n");
+	attr->perf_events = CTH_PERF_TASK_CLOCK;
+	for (int i = 0; i < 2; i++) {
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "true", NULL }, NULL, true, true, attr);
+		if (res) {
+			printf("  cached = %d, perf_stat = %s\n", res->cached, res->perf_stat != NULL ? "set" : "NULL");
+		}
+		cth_free_result(&res);
+	}
+	attr->perf_events = 0;
+}
+int main()
+{
+	attr = cth_new_attr();
+	attr->cache = cth_new_cache(0);
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	t6();
+	t7();
+	t8();
+	t9();
+	show_stats();
+	cth_free_cache(&attr->cache);
+	cth_free_attr(&attr);
+	return 0;
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+// Usage: ./cgroup [cgroup parent], defaults to the cgroup v2 mount, /sys/fs/cgroup, or /sys/fs/cgroup/unified on hybrid hosts.
+static const char *parent = NULL;
+static const char *find_cgroup2(void)
+{
+	// The mount point is the 5th field of mountinfo, the fs type is the one after " - ".
+	static char mount_point[4096];
+	char line[8192];
+	const char *found = NULL;
+	FILE *fp = fopen("/proc/self/mountinfo", "r");
+	if (fp == NULL) {
+		return NULL;
+	}
+	while (found == NULL && fgets(line, sizeof(line), fp) != NULL) {
+		char *sep = strstr(line, " - ");
+		if (sep == NULL || strncmp(sep + 3, "cgroup2 ", 8) != 0) {
+			continue;
+		}
+		if (sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) == 1) {
+			found = mount_point;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+static void show_stat(const struct cth_result *res)
+{
+	if (res->cgroup_stat == NULL) {
+		printf("  cgroup_stat: (null)\n");
+		return;
+	}
+	printf("  cgroup_stat: cpu_usage_usec=%llu user=%llu system=%llu memory_peak=%llu io_rbytes=%llu io_wbytes=%llu\n", (unsigned long long)res->cgroup_stat->cpu_usage_usec, (unsigned long long)res->cgroup_stat->cpu_user_usec, (unsigned long long)res->cgroup_stat->cpu_system_usec,
+	       (unsigned long long)res->cgroup_stat->memory_peak, (unsigned long long)res->cgroup_stat->io_rbytes, (unsigned long long)res->cgroup_stat->io_wbytes);
+}
+void t1()
+{
+	printf("\nTest 1: fresh cgroup, accounting of the whole process tree\n");
+	printf("  Command: sh -c 'i=0; while [ $i -lt 200000 ]; do i=$((i+1)); done & wait'\n");
+	printf("  Expect: exit code 0, cpu_usage_usec > 0\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->cgroup_parent = parent;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "i=0; while [ $i -lt 200000 ]; do i=$((i+1)); done & wait", NULL }, NULL, true, false, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		show_stat(res);
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: timeout kills the whole cgroup\n");
+	printf("  Command: sh -c 'sleep 10 & sleep 10; echo done'\n");
+	printf("  Expect: timed_out = 1, exit code = 137, no 'done', in about 200ms\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->cgroup_parent = parent;
+	attr->timeout_ms = 200;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "sleep 10 & sleep 10; echo done", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: timed_out = %d, exit code = %d, time_used_ms = %llu\n", res->timed_out, res->exit_code, (unsigned long long)res->time_used_ms);
+		printf("  stdout: %s\n", res->stdout_ret ? res->stdout_ret : "(null)");
+		show_stat(res);
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: timeout without cgroup, tail mode\n");
+	printf("  Command: sh -c 'echo start; exec sleep 10'\n");
+	printf("  Expect: timed_out = 1, exit code = 137, stdout='start'\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_TAIL;
+	attr->timeout_ms = 200;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "echo start; exec sleep 10", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: timed_out = %d, exit code = %d\n", res->timed_out, res->exit_code);
+		printf("  stdout: %s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: non-blocking, with cgroup and timeout\n");
+	printf("  Command: sh -c 'echo hello; sleep 10'\n");
+	printf("  Expect: cgroup_path set before exit, timed_out = 1, stdout='hello', cgroup removed\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->cgroup_parent = parent;
+	attr->timeout_ms = 300;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "echo hello; sleep 10", NULL }, NULL, false, true, attr);
+	if (res == NULL) {
+		printf("  Actual: cth_exec_with_attr failed\n");
+		cth_free_attr(&attr);
+		return;
+	}
+	printf("  Actual: cgroup_path = %s\n", res->cgroup_path ? res->cgroup_path : "(null)");
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	printf("  timed_out = %d, exit code = %d\n", res->timed_out, res->exit_code);
+	printf("  stdout: %s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+	show_stat(res);
+	struct stat st;
+	printf("  cgroup removed: %s\n", res->cgroup_path && stat(res->cgroup_path, &st) < 0 ? "yes" : "no");
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+static bool is_zombie(pid_t pid)
+{
+	// A killed process stays a zombie if its new parent (e.g. pid 1 of a container) does not reap it.
+	char path[64];
+	char state = 0;
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		return false;
+	}
+	if (fscanf(fp, "%*d (%*[^)]) %c", &state) != 1) {
+		state = 0;
+	}
+	fclose(fp);
+	return state == 'Z';
+}
+void t5()
+{
+	printf("\nTest 5: cth_free_result() kills a running non-blocking command\n");
+	printf("  Command: sleep 10\n");
+	printf("  Expect: the process is gone shortly after free\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->cgroup_parent = parent;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sleep", "10", NULL }, NULL, false, false, attr);
+	if (res == NULL) {
+		printf("  Actual: cth_exec_with_attr failed\n");
+		cth_free_attr(&attr);
+		return;
+	}
+	pid_t pid = res->pid;
+	cth_free_result(&res);
+	int alive = 1;
+	for (int i = 0; i < 1000 && alive; i++) {
+		usleep(1000);
+		alive = kill(pid, 0) == 0 && !is_zombie(pid);
+	}
+	printf("  Actual: %s\n", alive ? "still running" : "gone");
+	cth_free_attr(&attr);
+}
+int main(int argc, char **argv)
+{
+	parent = argc > 1 ? argv[1] : find_cgroup2();
+	if (parent == NULL) {
+		printf("\nNo cgroup v2 mount, only the tests without a cgroup are run\n");
+		t3();
+		return 0;
+	}
+	printf("\ncgroup parent: %s\n", parent);
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	return 0;
+}
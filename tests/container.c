@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#include <sys/mount.h>
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static pid_t start_container(const char *hostname)
+{
+	/*
+	 * Start a container init in new pid, uts, mount, ipc and net namespaces, with a private /tmp.
+	 * Returns its pid as we see it.
+	 */
+	int fds[2];
+	if (pipe(fds) < 0) {
+		return -1;
+	}
+	pid_t holder = fork();
+	if (holder == 0) {
+		if (unshare(CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | CLONE_NEWIPC | CLONE_NEWNET) < 0) {
+			_exit(1);
+		}
+		pid_t init = fork();
+		if (init == 0) {
+			sethostname(hostname, strlen(hostname));
+			mount("none", "/", NULL, MS_REC | MS_PRIVATE, NULL);
+			mount("tmpfs", "/tmp", "tmpfs", 0, NULL);
+			close(open("/tmp/cth-container-marker", O_CREAT | O_WRONLY, 0644));
+			write(fds[1], "", 1);
+			while (true) {
+				pause();
+			}
+		}
+		// Report the pid after init is ready.
+		char ready;
+		read(fds[0], &ready, 1);
+		write(fds[1], &init, sizeof(init));
+		_exit(0);
+	}
+	waitpid(holder, NULL, 0);
+	pid_t init = -1;
+	read(fds[0], &init, sizeof(init));
+	close(fds[0]);
+	close(fds[1]);
+	return init;
+}
+static void stop_container(pid_t init)
+{
+	kill(init, SIGKILL);
+	// Reaped by init of the sandbox, wait for it to be gone.
+	while (kill(init, 0) == 0) {
+		usleep(1000);
+	}
+}
+void t1(struct cth_exec_attr *attr)
+{
+	printf("\nTest 1: run in the container\n");
+	printf("  Command: sh -c 'hostname; echo $$; ls /tmp'\n");
+	printf("  Expect: cth-container, a small pid, cth-container-marker\n");
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "hostname; echo $$; ls /tmp", NULL }, NULL, true, true, attr);
+	printf("  Actual: exit code = %d, stdout:\n%s", res ? res->exit_code : -1, res && res->stdout_ret ? res->stdout_ret : "(null)\n");
+	cth_free_result(&res);
+	res = cth_exec_with_attr((char *[]){ "sh", "-c", "hostname; echo $$; ls /tmp", NULL }, NULL, false, true, attr);
+	while (res && cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	printf("  Actual (non-blocking): exit code = %d, stdout:\n%s", res ? res->exit_code : -1, res && res->stdout_ret ? res->stdout_ret : "(null)\n");
+	cth_free_result(&res);
+}
+void t2(pid_t init)
+{
+	printf("\nTest 2: cached fds\n");
+	printf("  Command: cth_container_open() twice\n");
+	printf("  Expect: same pointer\n");
+	const struct cth_container *c1 = cth_container_open(init);
+	const struct cth_container *c2 = cth_container_open(init);
+	printf("  Actual: same = %d\n", c1 != NULL && c1 == c2);
+}
+void t3(pid_t init, struct cth_exec_attr *attr)
+{
+	printf("\nTest 3: 200x 'true' in the container\n");
+	printf("  Command: setns() in the child vs. nsenter -t pid -a true\n");
+	printf("  Expect: one spawn is faster than the nsenter chain\n");
+	double start = now();
+	for (int i = 0; i < 200; i++) {
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "true", NULL }, NULL, true, false, attr);
+		cth_free_result(&res);
+	}
+	double setns_time = now() - start;
+	char pid[16];
+	sprintf(pid, "%d", init);
+	start = now();
+	for (int i = 0; i < 200; i++) {
+		struct cth_result *res = cth_exec((char *[]){ "nsenter", "-t", pid, "-a", "true", NULL }, NULL, true, false);
+		cth_free_result(&res);
+	}
+	printf("  Actual: setns %.3f seconds, nsenter %.3f seconds\n", setns_time, now() - start);
+}
+void t4(void)
+{
+	printf("\nTest 4: the host is not affected\n");
+	printf("  Command: ls /tmp/cth-container-marker on the host\n");
+	printf("  Expect: exit != 0\n");
+	struct cth_result *res = cth_exec((char *[]){ "ls", "/tmp/cth-container-marker", NULL }, NULL, true, true);
+	printf("  Actual: exit code = %d\n", res ? res->exit_code : -1);
+	cth_free_result(&res);
+}
+int main()
+{
+	if (getuid() != 0) {
+		printf("Needs root, skipped\n");
+		return 0;
+	}
+	pid_t init = start_container("cth-container");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->container = cth_container_open(init);
+	if (attr->container == NULL) {
+		printf("cth_container_open() failed\n");
+		return 1;
+	}
+	t1(attr);
+	t2(init);
+	t3(init, attr);
+	t4();
+	stop_container(init);
+	printf("\nTest 5: a restarted container is opened again\n");
+	printf("  Command: hostname\n");
+	printf("  Expect: cth-restarted\n");
+	init = start_container("cth-restarted");
+	attr->container = cth_container_open(init);
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "hostname", NULL }, NULL, true, true, attr);
+	printf("  Actual: %s", res && res->stdout_ret ? res->stdout_ret : "(null)\n");
+	cth_free_result(&res);
+	stop_container(init);
+	cth_container_forget(0);
+	cth_free_attr(&attr);
+	return 0;
+}
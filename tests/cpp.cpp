@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.hpp"
+#include <cstdio>
+// A minimal coroutine type for the test, the result is collected by the caller.
+struct task {
+	struct promise_type {
+		task get_return_object() noexcept
+		{
+			return {};
+		}
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+		void return_void() noexcept
+		{
+		}
+		void unhandled_exception() noexcept
+		{
+		}
+	};
+};
+static task run_async(cth::executor &ex, cth::command &cmd, std::atomic<int> &done, std::string &out)
+{
+	cth::result res = co_await cmd.async(ex);
+	out = res.out();
+	done.fetch_add(1);
+}
+void t1()
+{
+	printf("\nTest 1: cth::command::run()\n");
+	printf("  Command: sh -c 'cat; echo err >&2' with input 'hello'\n");
+	printf("  Expect: stdout='hello', stderr='err', 6 bytes\n");
+	cth::command cmd{ "sh", "-c", "cat; echo err >&2" };
+	cth::result res = cmd.input("hello\n").run();
+	if (!res) {
+		printf("  Actual: run() failed\n");
+		return;
+	}
+	printf("  Actual: exit code = %d, stdout: %.*s", res.exit_code(), static_cast<int>(res.out().size()), res.out().data());
+	printf("  stderr: %.*s", static_cast<int>(res.err().size()), res.err().data());
+	printf("  out_bytes: %zu\n", res.out_bytes().size());
+	// Move semantics, the result is freed only once.
+	cth::result moved = std::move(res);
+	printf("  moved: %d %d\n", static_cast<bool>(res), static_cast<bool>(moved));
+}
+void t2()
+{
+	printf("\nTest 2: env, timeout and spawn()\n");
+	printf("  Command: sh -c 'echo $CTH_FOO; sleep 10'\n");
+	printf("  Expect: stdout='bar', timed_out = 1\n");
+	cth::command cmd{ "sh", "-c", "echo $CTH_FOO; sleep 10" };
+	cth::result res = cmd.env("CTH_FOO", "bar").timeout(std::chrono::milliseconds(200)).spawn();
+	while (!res.ready()) {
+		usleep(1000);
+	}
+	printf("  Actual: timed_out = %d, stdout: %.*s", res.timed_out(), static_cast<int>(res.out().size()), res.out().data());
+}
+void t3()
+{
+	printf("\nTest 3: 32 co_await-ed commands on one executor\n");
+	printf("  Command: sh -c 'sleep 0.2; echo $0' N\n");
+	printf("  Expect: all done in well under 32 x 0.2s, outputs match\n");
+	std::vector<cth::command> cmds;
+	for (int i = 0; i < 32; i++) {
+		cth::command cmd{ "sh", "-c", "sleep 0.2; echo $0" };
+		cmd.arg(std::to_string(i));
+		cmds.push_back(std::move(cmd));
+	}
+	std::vector<std::string> outs(cmds.size());
+	std::atomic<int> done{ 0 };
+	struct timespec ts1, ts2;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	{
+		cth::executor ex;
+		for (std::size_t i = 0; i < cmds.size(); i++) {
+			run_async(ex, cmds[i], done, outs[i]);
+		}
+		while (done.load() < static_cast<int>(cmds.size())) {
+			usleep(1000);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	int mismatch = 0;
+	for (std::size_t i = 0; i < outs.size(); i++) {
+		if (outs[i] != std::to_string(i) + "\n") {
+			mismatch++;
+		}
+	}
+	printf("  Actual: %d done, %d mismatch, %.3f seconds\n", done.load(), mismatch, (ts2.tv_sec - ts1.tv_sec) + (ts2.tv_nsec - ts1.tv_nsec) / 1e9);
+}
+void t4()
+{
+	printf("\nTest 4: binary output, full and tail capture\n");
+	printf("  Command: printf 'a\\0b\\0c', then seq 1 1000 keeping 16 bytes\n");
+	printf("  Expect: 5 bytes, 16 bytes, tail '97'\n");
+	cth::command cmd{ "printf", "a\\0b\\0c" };
+	cth::result res = cmd.run();
+	printf("  Actual: %zu bytes", res.out_bytes().size());
+	cth::command seq{ "seq", "1", "1000" };
+	res = seq.tail(16).run();
+	printf(", %zu bytes, tail '%.2s'\n", res.out_bytes().size(), res.out().data());
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	return 0;
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+void t1()
+{
+	printf("\nTest 1: set and unset\n");
+	printf("  Command: sh -c 'echo $CTH_FOO ${HOME-unset}'\n");
+	printf("  Expect: stdout='bar unset', parent HOME unchanged\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->env = cth_new_env();
+	cth_env_set(attr->env, "CTH_FOO", "bar");
+	cth_env_unset(attr->env, "HOME");
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "echo $CTH_FOO ${HOME-unset}", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout: %s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	printf("  parent HOME: %s\n", getenv("HOME") ? "set" : "unset");
+	cth_free_env(&attr->env);
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: clear and replace, non-blocking\n");
+	printf("  Command: /usr/bin/env\n");
+	printf("  Expect: stdout='ONLY=1'\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->env = cth_new_env();
+	cth_env_clear(attr->env);
+	cth_env_set(attr->env, "ONLY", "0");
+	cth_env_set(attr->env, "ONLY", "1");
+	cth_env_compile(attr->env);
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "/usr/bin/env", NULL }, NULL, false, true, attr);
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	printf("  Actual: exit code = %d\n", res->exit_code);
+	printf("  stdout: %s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+	cth_free_result(&res);
+	cth_free_env(&attr->env);
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: 1000x 'true' with a compiled overlay over 200 variables\n");
+	printf("  Expect: all exit 0\n");
+	char key[32];
+	for (int i = 0; i < 200; i++) {
+		snprintf(key, sizeof(key), "CTH_BENCH_%d", i);
+		setenv(key, "some value", 1);
+	}
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->env = cth_new_env();
+	cth_env_set(attr->env, "CTH_FOO", "bar");
+	cth_env_compile(attr->env);
+	int failed = 0;
+	struct timespec ts1, ts2;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (int i = 0; i < 1000; i++) {
+		struct cth_result *res = cth_exec_with_attr((char *[]){ "true", NULL }, NULL, true, false, attr);
+		if (!CTH_EXEC_SUCCEED(res)) {
+			failed++;
+		}
+		cth_free_result(&res);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	printf("  Actual: %d failed, %.6f seconds\n", failed, (ts2.tv_sec - ts1.tv_sec) + (ts2.tv_nsec - ts1.tv_nsec) / 1e9);
+	cth_free_env(&attr->env);
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: no overlay after clearenv()\n");
+	printf("  Command: /usr/bin/env, then true without output\n");
+	printf("  Expect: exit code = 0, stdout='', exit code = 0\n");
+	clearenv();
+	struct cth_result *res = cth_exec((char *[]){ "/usr/bin/env", NULL }, NULL, true, true);
+	printf("  Actual: exit code = %d", res ? res->exit_code : -1);
+	printf(", stdout='%s'", res && res->stdout_ret ? res->stdout_ret : "(null)");
+	cth_free_result(&res);
+	res = cth_exec((char *[]){ "/bin/true", NULL }, NULL, true, false);
+	printf(", exit code = %d\n", res ? res->exit_code : -1);
+	cth_free_result(&res);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	return 0;
+}
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#define INPUT_SIZE (64 * 1024 * 1024)
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static int make_input(const char *path)
+{
+	/*
+	 * Write INPUT_SIZE bytes of pseudo random text into path, and open it for reading.
+	 */
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		return -1;
+	}
+	uint64_t x = 88172645463325252ULL;
+	for (size_t i = 0; i < INPUT_SIZE; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		fputc((x % 64) == 0 ? '\n' : 'a' + (int)(x % 26), f);
+	}
+	fclose(f);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+static void print_results(struct cth_result **res, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (res[i] == NULL) {
+			printf("  [%zu] failed to start\n", i);
+			continue;
+		}
+		printf("  [%zu] exit code = %d, timed_out = %d, stdout: %s", i, res[i]->exit_code, res[i]->timed_out, res[i]->stdout_ret && res[i]->stdout_ret[0] ? res[i]->stdout_ret : "(empty)\n");
+		cth_free_result(&res[i]);
+	}
+}
+void t1(int fd)
+{
+	printf("\nTest 1: 64MB file to sha256sum, wc -l and md5sum\n");
+	printf("  Expect: the same output as running them one by one, see Test 2\n");
+	char **argv_list[] = { (char *[]){ "sha256sum", NULL }, (char *[]){ "wc", "-l", NULL }, (char *[]){ "md5sum", NULL } };
+	struct cth_result *res[3];
+	lseek(fd, 0, SEEK_SET);
+	double start = now_s();
+	int ret = cth_exec_fanout(argv_list, 3, fd, true, NULL, res);
+	printf("  Actual: ret = %d, elapsed: %.3f s\n", ret, now_s() - start);
+	if (ret == 0) {
+		print_results(res, 3);
+	}
+}
+void t2(int fd)
+{
+	printf("\nTest 2: the same commands one by one with cth_exec_with_file_input()\n");
+	char **argv_list[] = { (char *[]){ "sha256sum", NULL }, (char *[]){ "wc", "-l", NULL }, (char *[]){ "md5sum", NULL } };
+	struct cth_result *res[3];
+	double start = now_s();
+	for (size_t i = 0; i < 3; i++) {
+		lseek(fd, 0, SEEK_SET);
+		res[i] = cth_exec_with_file_input(argv_list[i], fd, true, true, NULL, 0);
+	}
+	printf("  Actual: elapsed: %.3f s\n", now_s() - start);
+	print_results(res, 3);
+}
+void t3()
+{
+	printf("\nTest 3: pipe input, a consumer exits early\n");
+	printf("  Command: seq 1 1000000 | { head -c 5, wc -l, tail -n 1 }\n");
+	printf("  Expect: '1\\n2\\n3', 1000000, 1000000\n");
+	int fds[2];
+	if (pipe(fds) < 0) {
+		return;
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		execlp("seq", "seq", "1", "1000000", NULL);
+		_exit(1);
+	}
+	close(fds[1]);
+	char **argv_list[] = { (char *[]){ "head", "-c", "5", NULL }, (char *[]){ "wc", "-l", NULL }, (char *[]){ "tail", "-n", "1", NULL } };
+	struct cth_result *res[3];
+	int ret = cth_exec_fanout(argv_list, 3, fds[0], true, NULL, res);
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	printf("  Actual: ret = %d\n", ret);
+	if (ret == 0) {
+		print_results(res, 3);
+	}
+}
+void t4(int fd)
+{
+	printf("\nTest 4: a consumer that never reads holds the others back until timeout_ms\n");
+	printf("  Command: sleep 5, wc -c, timeout_ms=300\n");
+	printf("  Expect: both timed_out = 1, wc got EOF early\n");
+	char **argv_list[] = { (char *[]){ "sleep", "5", NULL }, (char *[]){ "wc", "-c", NULL } };
+	struct cth_result *res[2];
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->timeout_ms = 300;
+	lseek(fd, 0, SEEK_SET);
+	int ret = cth_exec_fanout(argv_list, 2, fd, true, attr, res);
+	printf("  Actual: ret = %d\n", ret);
+	if (ret == 0) {
+		print_results(res, 2);
+	}
+	cth_free_attr(&attr);
+}
+void t5()
+{
+	printf("\nTest 5: a command that does not exist\n");
+	printf("  Expect: [0] exit code = 114 or 127, [1] wc -c = 6\n");
+	int fds[2];
+	if (pipe(fds) < 0) {
+		return;
+	}
+	write(fds[1], "hello\n", 6);
+	close(fds[1]);
+	char **argv_list[] = { (char *[]){ "hbqvkcfdkbfukhje", NULL }, (char *[]){ "wc", "-c", NULL } };
+	struct cth_result *res[2];
+	int ret = cth_exec_fanout(argv_list, 2, fds[0], true, NULL, res);
+	close(fds[0]);
+	printf("  Actual: ret = %d\n", ret);
+	if (ret == 0) {
+		print_results(res, 2);
+	}
+}
+int main()
+{
+	int fd = make_input("/tmp/cth_fanout_input");
+	if (fd < 0) {
+		printf("Failed to create the input file\n");
+		return 1;
+	}
+	t1(fd);
+	t2(fd);
+	t3();
+	t4(fd);
+	t5();
+	close(fd);
+	unlink("/tmp/cth_fanout_input");
+	return 0;
+}
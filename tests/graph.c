@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static const char *state_name(int state)
+{
+	const char *names[] = { "pending", "succeeded", "failed", "skipped" };
+	return state >= 0 && state < 4 ? names[state] : "invalid";
+}
+static void show(struct cth_graph *graph, int count)
+{
+	for (int i = 0; i < count; i++) {
+		const struct cth_result *res = cth_graph_result(graph, i);
+		uint64_t start, end;
+		cth_graph_timing(graph, i, &start, &end);
+		printf("  node %d: %s, %llu-%llums, stdout: %s", i, state_name(cth_graph_state(graph, i)), (unsigned long long)start, (unsigned long long)end, res && res->stdout_ret && res->stdout_ret[0] ? res->stdout_ret : "(none)\n");
+	}
+}
+void t1()
+{
+	printf("\nTest 1: pipe outputs into a dependent\n");
+	printf("  Command: echo b, echo a -> sort\n");
+	printf("  Expect: run = 0, node 2 stdout='a\\nb\\n'\n");
+	struct cth_graph *graph = cth_new_graph();
+	int b = cth_graph_add(graph, (char *[]){ "echo", "b", NULL }, NULL, NULL);
+	int a = cth_graph_add(graph, (char *[]){ "echo", "a", NULL }, NULL, NULL);
+	int sort = cth_graph_add(graph, (char *[]){ "sort", NULL }, NULL, NULL);
+	cth_graph_pipe(graph, sort, b);
+	cth_graph_pipe(graph, sort, a);
+	printf("  Actual: run = %d\n", cth_graph_run(graph, 2, CTH_GRAPH_FAIL_FAST));
+	show(graph, 3);
+	cth_free_graph(&graph);
+}
+void t2()
+{
+	printf("\nTest 2: critical path\n");
+	printf("  Command: sleep 0.1 -> sleep 0.3, sleep 0.2 -> sleep 0.1, all -> true, 4 slots\n");
+	printf("  Expect: path 0 1 4, about 400ms\n");
+	struct cth_graph *graph = cth_new_graph();
+	int s1 = cth_graph_add(graph, (char *[]){ "sleep", "0.1", NULL }, NULL, NULL);
+	int s2 = cth_graph_add(graph, (char *[]){ "sleep", "0.3", NULL }, NULL, NULL);
+	int s3 = cth_graph_add(graph, (char *[]){ "sleep", "0.2", NULL }, NULL, NULL);
+	int s4 = cth_graph_add(graph, (char *[]){ "sleep", "0.1", NULL }, NULL, NULL);
+	int end = cth_graph_add(graph, (char *[]){ "true", NULL }, NULL, NULL);
+	cth_graph_depend(graph, s2, s1);
+	cth_graph_depend(graph, s4, s3);
+	cth_graph_depend(graph, end, s2);
+	cth_graph_depend(graph, end, s4);
+	cth_graph_run(graph, 4, CTH_GRAPH_FAIL_FAST);
+	int path[5];
+	size_t len;
+	uint64_t total = cth_graph_critical_path(graph, path, &len);
+	printf("  Actual: path");
+	for (size_t i = 0; i < len; i++) {
+		printf(" %d", path[i]);
+	}
+	printf(", %llums\n", (unsigned long long)total);
+	cth_free_graph(&graph);
+}
+void t3()
+{
+	printf("\nTest 3: fail fast\n");
+	printf("  Command: false, sleep 0.2 -> echo after, 1 slot\n");
+	printf("  Expect: run = 3, false failed, the rest skipped\n");
+	struct cth_graph *graph = cth_new_graph();
+	cth_graph_add(graph, (char *[]){ "false", NULL }, NULL, NULL);
+	int sleep = cth_graph_add(graph, (char *[]){ "sleep", "0.2", NULL }, NULL, NULL);
+	int after = cth_graph_add(graph, (char *[]){ "echo", "after", NULL }, NULL, NULL);
+	cth_graph_depend(graph, after, sleep);
+	printf("  Actual: run = %d\n", cth_graph_run(graph, 1, CTH_GRAPH_FAIL_FAST));
+	show(graph, 3);
+	cth_free_graph(&graph);
+}
+void t4()
+{
+	printf("\nTest 4: keep going\n");
+	printf("  Command: false -> echo skipped, echo independent\n");
+	printf("  Expect: run = 2, only the dependent of false skipped\n");
+	struct cth_graph *graph = cth_new_graph();
+	int fail = cth_graph_add(graph, (char *[]){ "false", NULL }, NULL, NULL);
+	int skipped = cth_graph_add(graph, (char *[]){ "echo", "skipped", NULL }, NULL, NULL);
+	cth_graph_add(graph, (char *[]){ "echo", "independent", NULL }, NULL, NULL);
+	cth_graph_depend(graph, skipped, fail);
+	printf("  Actual: run = %d\n", cth_graph_run(graph, 1, CTH_GRAPH_KEEP_GOING));
+	show(graph, 3);
+	cth_free_graph(&graph);
+}
+void t5()
+{
+	printf("\nTest 5: cycle\n");
+	printf("  Command: true <-> true\n");
+	printf("  Expect: run = -1\n");
+	struct cth_graph *graph = cth_new_graph();
+	int x = cth_graph_add(graph, (char *[]){ "true", NULL }, NULL, NULL);
+	int y = cth_graph_add(graph, (char *[]){ "true", NULL }, NULL, NULL);
+	cth_graph_depend(graph, x, y);
+	cth_graph_depend(graph, y, x);
+	printf("  Actual: run = %d\n", cth_graph_run(graph, 0, CTH_GRAPH_FAIL_FAST));
+	cth_free_graph(&graph);
+}
+void t6()
+{
+	printf("\nTest 6: 64 independent 'sleep 0.1' in 16 slots, then a chain of 100 'cat'\n");
+	printf("  Expect: about 0.4s for the first, 'x' out of the chain\n");
+	struct cth_graph *graph = cth_new_graph();
+	for (int i = 0; i < 64; i++) {
+		cth_graph_add(graph, (char *[]){ "sleep", "0.1", NULL }, NULL, NULL);
+	}
+	struct timespec ts1, ts2;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	int ret = cth_graph_run(graph, 16, CTH_GRAPH_FAIL_FAST);
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	printf("  Actual: run = %d, %.3f seconds\n", ret, (ts2.tv_sec - ts1.tv_sec) + (ts2.tv_nsec - ts1.tv_nsec) / 1e9);
+	cth_free_graph(&graph);
+	graph = cth_new_graph();
+	int prev = cth_graph_add(graph, (char *[]){ "cat", NULL }, "x\n", NULL);
+	for (int i = 1; i < 100; i++) {
+		int node = cth_graph_add(graph, (char *[]){ "cat", NULL }, NULL, NULL);
+		cth_graph_pipe(graph, node, prev);
+		prev = node;
+	}
+	ret = cth_graph_run(graph, 4, CTH_GRAPH_FAIL_FAST);
+	const struct cth_result *res = cth_graph_result(graph, prev);
+	printf("  Actual: run = %d, stdout: %s", ret, res && res->stdout_ret ? res->stdout_ret : "(none)\n");
+	cth_free_graph(&graph);
+}
+void t7()
+{
+	printf("\nTest 7: binary output is piped as a whole, 5000 workers\n");
+	printf("  Command: printf 'a\\0b', printf 'c\\0d' -> wc -c\n");
+	printf("  Expect: run = 0, stdout: 6\n");
+	struct cth_graph *graph = cth_new_graph();
+	int ab = cth_graph_add(graph, (char *[]){ "printf", "a\\0b", NULL }, NULL, NULL);
+	int cd = cth_graph_add(graph, (char *[]){ "printf", "c\\0d", NULL }, NULL, NULL);
+	int wc = cth_graph_add(graph, (char *[]){ "wc", "-c", NULL }, NULL, NULL);
+	cth_graph_pipe(graph, wc, ab);
+	cth_graph_pipe(graph, wc, cd);
+	int ret = cth_graph_run(graph, 5000, CTH_GRAPH_FAIL_FAST);
+	const struct cth_result *res = cth_graph_result(graph, wc);
+	printf("  Actual: run = %d, stdout: %s", ret, res && res->stdout_ret ? res->stdout_ret : "(none)\n");
+	cth_free_graph(&graph);
+}
+void t8()
+{
+	printf("\nTest 8: the kept tail of an upstream node is piped\n");
+	printf("  Command: seq 1 100000 keeping 16 bytes -> wc -c\n");
+	printf("  Expect: run = 0, stdout: 16\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_TAIL;
+	attr->tail_bytes = 16;
+	struct cth_graph *graph = cth_new_graph();
+	int seq = cth_graph_add(graph, (char *[]){ "seq", "1", "100000", NULL }, NULL, attr);
+	int wc = cth_graph_add(graph, (char *[]){ "wc", "-c", NULL }, NULL, NULL);
+	cth_graph_pipe(graph, wc, seq);
+	int ret = cth_graph_run(graph, 2, CTH_GRAPH_FAIL_FAST);
+	const struct cth_result *res = cth_graph_result(graph, wc);
+	printf("  Actual: run = %d, stdout: %s", ret, res && res->stdout_ret ? res->stdout_ret : "(none)\n");
+	cth_free_graph(&graph);
+	cth_free_attr(&attr);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	t6();
+	t7();
+	t8();
+	return 0;
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#define ALL_HASH (CTH_HASH_CRC32C | CTH_HASH_XXH64 | CTH_HASH_SHA256)
+static void print_digest(const char *name, const struct cth_digest *d)
+{
+	printf("  %s: len=%llu crc32c=%08x xxh64=%016llx sha256=", name, (unsigned long long)d->len, d->crc32c, (unsigned long long)d->xxh64);
+	for (int i = 0; i < 32; i++) {
+		printf("%02x", d->sha256[i]);
+	}
+	printf("\n");
+}
+static bool same_digest(const struct cth_digest *a, const struct cth_digest *b)
+{
+	return a->len == b->len && a->crc32c == b->crc32c && a->xxh64 == b->xxh64 && memcmp(a->sha256, b->sha256, 32) == 0;
+}
+void t1()
+{
+	printf("\nTest 1: known vectors\n");
+	printf("  Expect: crc32c('123456789')=e3069283, xxh64('')=ef46db3751d8e999, xxh64('abc')=44bc2cf5ad770999\n");
+	printf("          sha256('abc')=ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad\n");
+	struct cth_digest d;
+	cth_hash(ALL_HASH, "123456789", 9, &d);
+	printf("  Actual: crc32c('123456789')=%08x\n", d.crc32c);
+	cth_hash(ALL_HASH, "", 0, &d);
+	printf("  xxh64(''): %016llx\n", (unsigned long long)d.xxh64);
+	cth_hash(ALL_HASH, "abc", 3, &d);
+	print_digest("'abc'", &d);
+}
+void t2()
+{
+	printf("\nTest 2: hash stdin and stdout while pumping\n");
+	printf("  Command: sh -c 'cat; echo err >&2'\n");
+	printf("  Expect: stdin and stdout digests match cth_hash() of the input, stderr digest of 'err\\n'\n");
+	static char input[300000];
+	for (size_t i = 0; i < sizeof(input) - 1; i++) {
+		input[i] = (char)('a' + i % 26);
+	}
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->hash = ALL_HASH;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "cat; echo err >&2", NULL }, input, true, true, attr);
+	if (res && res->digest) {
+		struct cth_digest want;
+		cth_hash(ALL_HASH, input, strlen(input), &want);
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		print_digest("stdin", &res->digest[STDIN_FILENO]);
+		print_digest("stdout", &res->digest[STDOUT_FILENO]);
+		print_digest("stderr", &res->digest[STDERR_FILENO]);
+		printf("  stdin matches: %s, stdout matches: %s\n", same_digest(&res->digest[STDIN_FILENO], &want) ? "yes" : "no", same_digest(&res->digest[STDOUT_FILENO], &want) ? "yes" : "no");
+		cth_hash(ALL_HASH, "err\n", 4, &want);
+		printf("  stderr matches: %s\n", same_digest(&res->digest[STDERR_FILENO], &want) ? "yes" : "no");
+	} else {
+		printf("  Actual: no digest\n");
+	}
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: sha256 of 16MB output kept in fd, compared with sha256sum\n");
+	printf("  Command: sh -c 'head -c 16777216 /dev/urandom | tee /tmp/cth_hash_test'\n");
+	printf("  Expect: sha256 is the same as sha256sum /tmp/cth_hash_test, stdout_total=16777216\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->hash = CTH_HASH_SHA256 | CTH_HASH_CRC32C;
+	attr->capture_mode = CTH_CAPTURE_FD;
+	attr->max_output = CTH_OUTPUT_UNLIMITED;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "head -c 16777216 /dev/urandom | tee /tmp/cth_hash_test", NULL }, NULL, true, true, attr);
+	if (res && res->digest) {
+		printf("  Actual: exit code = %d, stdout_total: %llu, time: %llu ms\n", res->exit_code, (unsigned long long)res->stdout_total, (unsigned long long)res->time_used_ms);
+		print_digest("stdout", &res->digest[STDOUT_FILENO]);
+		cth_free_result(&res);
+		res = cth_exec((char *[]){ "sha256sum", "/tmp/cth_hash_test", NULL }, NULL, true, true);
+		printf("  sha256sum: %s", res && res->stdout_ret ? res->stdout_ret : "(null)\n");
+		unlink("/tmp/cth_hash_test");
+	} else {
+		printf("  Actual: no digest\n");
+	}
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: tail capture hashes the whole stream\n");
+	printf("  Command: seq 1 100000\n");
+	printf("  Expect: stdout='99999\\n100000\\n', digest matches cth_hash() of the full output\n");
+	struct cth_result *full = cth_exec((char *[]){ "seq", "1", "100000", NULL }, NULL, true, true);
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->hash = ALL_HASH;
+	attr->capture_mode = CTH_CAPTURE_TAIL;
+	attr->tail_lines = 2;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "seq", "1", "100000", NULL }, NULL, true, true, attr);
+	if (full && full->stdout_ret && res && res->digest) {
+		struct cth_digest want;
+		cth_hash(ALL_HASH, full->stdout_ret, strlen(full->stdout_ret), &want);
+		printf("  Actual: stdout:\n%s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+		printf("  matches: %s\n", same_digest(&res->digest[STDOUT_FILENO], &want) ? "yes" : "no");
+	} else {
+		printf("  Actual: no digest\n");
+	}
+	cth_free_result(&full);
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+void t5()
+{
+	printf("\nTest 5: non-blocking\n");
+	printf("  Command: seq 1 100000\n");
+	printf("  Expect: strlen(stdout)=588895, digest matches cth_hash() of stdout\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->hash = ALL_HASH;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "seq", "1", "100000", NULL }, NULL, false, true, attr);
+	if (res == NULL) {
+		printf("  Actual: cth_exec_with_attr failed\n");
+		cth_free_attr(&attr);
+		return;
+	}
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	if (res->digest && res->stdout_ret) {
+		struct cth_digest want;
+		cth_hash(ALL_HASH, res->stdout_ret, strlen(res->stdout_ret), &want);
+		printf("  Actual: strlen(stdout): %zu\n", strlen(res->stdout_ret));
+		printf("  matches: %s\n", same_digest(&res->digest[STDOUT_FILENO], &want) ? "yes" : "no");
+	} else {
+		printf("  Actual: no digest\n");
+	}
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	return 0;
+}
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static double run_sleeps(struct cth_exec_attr *attr, int count)
+{
+	/*
+	 * Start count non-blocking 'sleep 0.2', and wait for all of them.
+	 */
+	struct cth_result *res[16];
+	double start = now();
+	for (int i = 0; i < count; i++) {
+		res[i] = cth_exec_with_attr((char *[]){ "sleep", "0.2", NULL }, NULL, false, false, attr);
+	}
+	for (int i = 0; i < count; i++) {
+		while (cth_wait(&res[i]) < 0) {
+			usleep(1000);
+		}
+		cth_free_result(&res[i]);
+	}
+	return now() - start;
+}
+void t1()
+{
+	printf("\nTest 1: our own jobserver of 2 slots\n");
+	printf("  Command: 6x non-blocking 'sleep 0.2'\n");
+	printf("  Expect: 3 waves, about 0.6 seconds\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->jobserver = cth_new_jobserver(2);
+	printf("  Actual: %.3f seconds\n", run_sleeps(attr, 6));
+	cth_free_jobserver(&attr->jobserver);
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: the children get our jobserver\n");
+	printf("  Command: sh -c 'echo $MAKEFLAGS'\n");
+	printf("  Expect: ' -j4 --jobserver-auth=R,W'\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->jobserver = cth_new_jobserver(4);
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "echo \"'$MAKEFLAGS'\"", NULL }, NULL, true, true, attr);
+	printf("  Actual: %s", res && res->stdout_ret ? res->stdout_ret : "(null)\n");
+	cth_free_result(&res);
+	cth_free_jobserver(&attr->jobserver);
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: join the pipe jobserver of make from MAKEFLAGS\n");
+	printf("  Command: 4x non-blocking 'sleep 0.2', make -j2 gives one token plus the implicit one\n");
+	printf("  Expect: 2 waves, about 0.4 seconds, the token is given back\n");
+	int fds[2];
+	pipe(fds);
+	write(fds[1], "x", 1);
+	char flags[64];
+	sprintf(flags, " -j2 --jobserver-auth=%d,%d", fds[0], fds[1]);
+	setenv("MAKEFLAGS", flags, 1);
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->jobserver = cth_jobserver_from_env();
+	printf("  Actual: joined = %d, %.3f seconds", attr->jobserver != NULL, run_sleeps(attr, 4));
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	char token = 0;
+	printf(", token '%c'\n", read(fds[0], &token, 1) == 1 ? token : '-');
+	cth_free_jobserver(&attr->jobserver);
+	cth_free_attr(&attr);
+	close(fds[0]);
+	close(fds[1]);
+	unsetenv("MAKEFLAGS");
+}
+void t4()
+{
+	printf("\nTest 4: closed fds and no jobserver\n");
+	printf("  Command: MAKEFLAGS with closed fds, then without --jobserver-auth\n");
+	printf("  Expect: not joined, not joined\n");
+	setenv("MAKEFLAGS", " -j2 --jobserver-auth=1000,1001", 1);
+	struct cth_jobserver *js = cth_jobserver_from_env();
+	printf("  Actual: joined = %d", js != NULL);
+	cth_free_jobserver(&js);
+	setenv("MAKEFLAGS", " -k", 1);
+	js = cth_jobserver_from_env();
+	printf(", joined = %d\n", js != NULL);
+	cth_free_jobserver(&js);
+	unsetenv("MAKEFLAGS");
+}
+void t5()
+{
+	printf("\nTest 5: a graph of 4 slots under a jobserver of 1 slot\n");
+	printf("  Command: 4x 'sleep 0.1'\n");
+	printf("  Expect: one at a time, about 0.4 seconds\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->jobserver = cth_new_jobserver(1);
+	struct cth_graph *graph = cth_new_graph();
+	for (int i = 0; i < 4; i++) {
+		cth_graph_add(graph, (char *[]){ "sleep", "0.1", NULL }, NULL, attr);
+	}
+	double start = now();
+	int ret = cth_graph_run(graph, 4, CTH_GRAPH_FAIL_FAST);
+	printf("  Actual: run = %d, %.3f seconds\n", ret, now() - start);
+	cth_free_graph(&graph);
+	cth_free_jobserver(&attr->jobserver);
+	cth_free_attr(&attr);
+}
+void t6()
+{
+	printf("\nTest 6: make under our jobserver\n");
+	printf("  Command: make -f - with 4 targets of 'sleep 0.2', from a jobserver of 2 slots\n");
+	printf("  Expect: make joins it, about 0.4 seconds\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->jobserver = cth_new_jobserver(2);
+	double start = now();
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "make", "-s", "-f", "-", NULL }, "all: a b c d\na b c d:\n\t@sleep 0.2\n", true, true, attr);
+	printf("  Actual: exit code = %d, %.3f seconds\n", res ? res->exit_code : -1, now() - start);
+	cth_free_result(&res);
+	cth_free_jobserver(&attr->jobserver);
+	cth_free_attr(&attr);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	t6();
+	return 0;
+}
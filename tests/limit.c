@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static void show(struct cth_result *res)
+{
+	if (res) {
+		printf("  Actual: exit code = %d, term_signal = %d, limit_hit = %d\n", res->exit_code, res->term_signal, res->limit_hit);
+		if (res->stdout_ret && res->stdout_ret[0]) {
+			printf("  stdout: %s", res->stdout_ret);
+		}
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+}
+void t1()
+{
+	printf("\nTest 1: RLIMIT_CPU\n");
+	printf("  Command: sh -c 'while :; do :; done'\n");
+	printf("  Expect: term_signal = %d (SIGXCPU), limit_hit = %d (RLIMIT_CPU), in about 1s\n", SIGXCPU, RLIMIT_CPU);
+	struct cth_exec_attr *attr = cth_new_attr();
+	struct cth_rlimit limits[] = { { RLIMIT_CPU, { 1, 2 } } };
+	attr->rlimits = limits;
+	attr->rlimit_count = 1;
+	show(cth_exec_with_attr((char *[]){ "sh", "-c", "while :; do :; done", NULL }, NULL, true, false, attr));
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: RLIMIT_FSIZE, non-blocking\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	struct cth_rlimit limits[] = { { RLIMIT_FSIZE, { 1024, 1024 } } };
+	attr->rlimits = limits;
+	attr->rlimit_count = 1;
+	struct cth_result *res = NULL;
+	printf("  Command: head -c 65536 /dev/zero, stdout to a file\n");
+	printf("  Expect: term_signal = %d (SIGXFSZ), limit_hit = %d (RLIMIT_FSIZE)\n", SIGXFSZ, RLIMIT_FSIZE);
+	res = cth_exec_with_attr((char *[]){ "sh", "-c", "exec head -c 65536 /dev/zero > /tmp/cth_fsize_test", NULL }, NULL, false, false, attr);
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	show(res);
+	unlink("/tmp/cth_fsize_test");
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: RLIMIT_NOFILE and RLIMIT_NPROC\n");
+	printf("  Command: sh -c 'ulimit -n'\n");
+	printf("  Expect: stdout='16', limit_hit = -1\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	struct cth_rlimit limits[] = { { RLIMIT_NOFILE, { 16, 16 } }, { RLIMIT_NPROC, { 4096, 4096 } } };
+	attr->rlimits = limits;
+	attr->rlimit_count = 2;
+	show(cth_exec_with_attr((char *[]){ "sh", "-c", "ulimit -n", NULL }, NULL, true, true, attr));
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: killed by a signal, no limit\n");
+	printf("  Command: sh -c 'kill -TERM $$'\n");
+	printf("  Expect: exit code = %d, term_signal = %d, limit_hit = -1\n", 128 + SIGTERM, SIGTERM);
+	show(cth_exec((char *[]){ "sh", "-c", "kill -TERM $$", NULL }, NULL, true, false));
+}
+void t5()
+{
+	printf("\nTest 5: a crash under RLIMIT_AS far from the limit\n");
+	printf("  Command: sh -c 'kill -SEGV $$'\n");
+	printf("  Expect: term_signal = %d, limit_hit = -1\n", SIGSEGV);
+	struct cth_rlimit limits[] = { { RLIMIT_AS, { 1UL << 32, 1UL << 32 } } };
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->rlimits = limits;
+	attr->rlimit_count = 1;
+	show(cth_exec_with_attr((char *[]){ "sh", "-c", "kill -SEGV $$", NULL }, NULL, true, false, attr));
+	cth_free_attr(&attr);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	return 0;
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+void t1()
+{
+	printf("\nTest 1: dump before enabling\n");
+	printf("  Expect: -1\n");
+	printf("  Actual: %d\n", cth_metrics_dump(STDOUT_FILENO));
+}
+void t2()
+{
+	printf("\nTest 2: counters and histograms by argv[0]\n");
+	printf("  Commands: 3x true, false, sleep 5 with timeout_ms=100, seq 1 1000 non-blocking with output\n");
+	printf("  Expect: catsh_spawns_total{argv0=\"true\"} 3, catsh_failures_total{argv0=\"false\"} 1,\n");
+	printf("          catsh_timeouts_total{argv0=\"sleep\"} 1, catsh_output_bytes_sum{argv0=\"seq\"} 3893, in_flight all 0\n");
+	if (cth_metrics_enable(CTH_METRICS_BY_ARGV0) < 0) {
+		printf("  Actual: cth_metrics_enable failed\n");
+		return;
+	}
+	for (int i = 0; i < 3; i++) {
+		struct cth_result *res = cth_exec((char *[]){ "true", NULL }, NULL, true, false);
+		cth_free_result(&res);
+	}
+	struct cth_result *res = cth_exec((char *[]){ "false", NULL }, NULL, true, false);
+	cth_free_result(&res);
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->timeout_ms = 100;
+	res = cth_exec_with_attr((char *[]){ "sleep", "5", NULL }, NULL, true, false, attr);
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+	res = cth_exec((char *[]){ "seq", "1", "1000", NULL }, NULL, false, true);
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	cth_free_result(&res);
+	printf("  Actual:\n");
+	fflush(stdout);
+	cth_metrics_dump(STDOUT_FILENO);
+}
+int main()
+{
+	t1();
+	t2();
+	return 0;
+}
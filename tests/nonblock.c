@@ -136,9 +136,44 @@ void t3()
 	}
 	cth_free_result(&res);
 }
+void t4()
+{
+	// cth_wait_any() returns the jobs in the order they exit.
+	printf("Test 4: cth_wait_any() on 3 jobs, sleeping 0.3, 0.1 and 0.2 seconds\n");
+	printf("Expect: 1 2 0, then -1\n");
+	struct cth_result *res[3];
+	res[0] = cth_exec((char *[]){ "sleep", "0.3", NULL }, NULL, false, false);
+	res[1] = cth_exec((char *[]){ "sleep", "0.1", NULL }, NULL, false, false);
+	res[2] = cth_exec((char *[]){ "sleep", "0.2", NULL }, NULL, false, false);
+	printf("Actual:");
+	for (int i = 0; i < 4; i++) {
+		printf(" %d", cth_wait_any(res, 3, 1000));
+	}
+	printf("\nExit codes: %d %d %d\n", res[0]->exit_code, res[1]->exit_code, res[2]->exit_code);
+	for (int i = 0; i < 3; i++) {
+		cth_free_result(&res[i]);
+	}
+}
+void t5()
+{
+	// A runner killed before it reports the exit is noticed, instead of waiting forever.
+	printf("Test 5: cth_wait_any() after the runner of sleep 2 is killed\n");
+	printf("Expect: 0, exit code -1\n");
+	struct cth_result *res = cth_exec((char *[]){ "sleep", "2", NULL }, NULL, false, false);
+	if (res == NULL) {
+		printf("Actual: cth_exec() failed\n");
+		return;
+	}
+	kill(res->pid, SIGKILL);
+	printf("Actual: %d", cth_wait_any(&res, 1, -1));
+	printf(", exit code %d\n", res->exit_code);
+	cth_free_result(&res);
+}
 int main()
 {
 	t3();
 	t1();
 	t2();
+	t4();
+	t5();
 }
\ No newline at end of file
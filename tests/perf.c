@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static void print_perf(const struct cth_perf_stat *p)
+{
+	if (p == NULL) {
+		printf("  Actual: no counters\n");
+		return;
+	}
+	printf("  Actual: events 0x%x%s, task-clock %.2f ms", p->events, p->user_only ? " (user space only)" : "", (double)p->task_clock_ns / 1e6);
+	if (p->events & CTH_PERF_HARDWARE) {
+		printf(", cycles %llu, instructions %llu, IPC %.2f, cache-misses %llu, branch-misses %llu, running %.0f%%", (unsigned long long)p->cycles, (unsigned long long)p->instructions, p->cycles > 0 ? (double)p->instructions / (double)p->cycles : 0,
+		       (unsigned long long)p->cache_misses, (unsigned long long)p->branch_misses, p->time_enabled_ns > 0 ? (double)p->time_running_ns * 100 / (double)p->time_enabled_ns : 0);
+	}
+	printf("\n");
+}
+int main(void)
+{
+	int paranoid = -1;
+	FILE *fp = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "%d", &paranoid) != 1) {
+			paranoid = -1;
+		}
+		fclose(fp);
+	}
+	printf("\nperf_event_paranoid: %d, the hardware counters are missing without a PMU (e.g. in most VMs)\n", paranoid);
+	struct cth_exec_attr *attr = cth_new_attr();
+	char *busy[] = { "sh", "-c", "seq 300000 >/dev/null; true", NULL };
+	char *idle[] = { "sh", "-c", "true", NULL };
+	printf("\nTest 1: without perf_events\n");
+	printf("  Expect: no counters\n");
+	struct cth_result *res = cth_exec_with_attr(busy, NULL, true, false, attr);
+	print_perf(res->perf_stat);
+	cth_free_result(&res);
+	attr->perf_events = CTH_PERF_ALL;
+	printf("\nTest 2: sh -c 'true'\n");
+	printf("  Expect: exit 0, task-clock counted (events include 0x10) unless perf_event_paranoid is 3 or more\n");
+	res = cth_exec_with_attr(idle, NULL, true, false, attr);
+	printf("  exit %d\n", res->exit_code);
+	print_perf(res->perf_stat);
+	uint64_t idle_ns = res->perf_stat != NULL ? res->perf_stat->task_clock_ns : 0;
+	cth_free_result(&res);
+	printf("\nTest 3: sh -c 'seq 300000 >/dev/null; true', seq is a child of sh\n");
+	printf("  Expect: exit 0, the task-clock of seq is inherited, far more than sh -c 'true'\n");
+	res = cth_exec_with_attr(busy, NULL, true, true, attr);
+	printf("  exit %d\n", res->exit_code);
+	print_perf(res->perf_stat);
+	if (res->perf_stat != NULL) {
+		printf("  %.1fx of sh -c 'true'\n", idle_ns > 0 ? (double)res->perf_stat->task_clock_ns / (double)idle_ns : 0);
+	}
+	cth_free_result(&res);
+	printf("\nTest 4: the same, non-blocking\n");
+	printf("  Expect: exit 0, the counters come back through the runner\n");
+	res = cth_exec_with_attr(busy, NULL, false, false, attr);
+	while (res != NULL && cth_wait(&res) == -1) {
+		usleep(10000);
+	}
+	printf("  exit %d\n", res != NULL ? res->exit_code : -1);
+	print_perf(res != NULL ? res->perf_stat : NULL);
+	cth_free_result(&res);
+	printf("\nTest 5: cth_run(\"seq 300000 | wc -l\")\n");
+	printf("  Expect: stdout 300000, the counters of seq and wc added up\n");
+	res = cth_run("seq 300000 | wc -l", NULL, true, 0, attr);
+	printf("  stdout: %s", res != NULL && res->stdout_ret != NULL ? res->stdout_ret : "(null)\n");
+	print_perf(res != NULL ? res->perf_stat : NULL);
+	cth_free_result(&res);
+	printf("\nTest 6: command not found\n");
+	printf("  Expect: exit != 0, the failed exec is not counted\n");
+	res = cth_exec_with_attr((char *[]){ "hbqvkcfdkbfukhje", NULL }, NULL, true, false, attr);
+	printf("  exit %d\n", res->exit_code);
+	print_perf(res->perf_stat);
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+	return 0;
+}
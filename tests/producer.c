@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+// A cursor over generated lines, "line N\n" for N in [0, lines).
+struct cursor {
+	uint64_t next;
+	uint64_t lines;
+	// Fail with -1 at this line, 0 for never.
+	uint64_t fail_at;
+	uint64_t bytes;
+	size_t calls;
+	size_t max_cap;
+};
+static ssize_t produce(void *ctx, void *buf, size_t cap)
+{
+	struct cursor *c = ctx;
+	c->calls++;
+	if (cap > c->max_cap) {
+		c->max_cap = cap;
+	}
+	if (c->fail_at != 0 && c->next >= c->fail_at) {
+		return -1;
+	}
+	size_t len = 0;
+	char line[32];
+	while (c->next < c->lines) {
+		int n = snprintf(line, sizeof(line), "line %llu\n", (unsigned long long)c->next);
+		if (len + (size_t)n > cap) {
+			break;
+		}
+		memcpy((char *)buf + len, line, (size_t)n);
+		len += (size_t)n;
+		c->next++;
+		if (c->fail_at != 0 && c->next >= c->fail_at) {
+			break;
+		}
+	}
+	c->bytes += len;
+	return (ssize_t)len;
+}
+static void print_result(struct cth_result *res, struct cursor *c)
+{
+	if (res == NULL) {
+		printf("  Actual: failed\n");
+		return;
+	}
+	printf("  Actual: exit code = %d, stdout: %s", res->exit_code, res->stdout_ret != NULL ? res->stdout_ret : "(none)\n");
+	printf("  produced %llu lines, %llu bytes, in %zu calls, largest cap %zu\n", (unsigned long long)c->next, (unsigned long long)c->bytes, c->calls, c->max_cap);
+}
+void t1(void)
+{
+	printf("\nTest 1: 4M lines to wc -l, blocking\n");
+	printf("  Expect: exit 0, stdout='4000000', cap is the pipe size\n");
+	struct cursor c = { 0, 4000000, 0, 0, 0, 0 };
+	char *argv[] = { "wc", "-l", NULL };
+	struct cth_result *res = cth_exec_with_producer(argv, produce, &c, true, true, NULL);
+	print_result(res, &c);
+	cth_free_result(&res);
+}
+void t2(void)
+{
+	printf("\nTest 2: 4M lines to wc -l, non-blocking\n");
+	printf("  Expect: exit 0, stdout='4000000'\n");
+	struct cursor c = { 0, 4000000, 0, 0, 0, 0 };
+	char *argv[] = { "wc", "-l", NULL };
+	struct cth_result *res = cth_exec_with_producer(argv, produce, &c, false, true, NULL);
+	while (res != NULL && cth_wait(&res) == -1) {
+		usleep(10000);
+	}
+	print_result(res, &c);
+	cth_free_result(&res);
+}
+void t3(void)
+{
+	printf("\nTest 3: endless lines to head -n 2\n");
+	printf("  Expect: exit 0, stdout='line 0\\nline 1\\n', the producer stops\n");
+	struct cursor c = { 0, UINT64_MAX, 0, 0, 0, 0 };
+	char *argv[] = { "head", "-n", "2", NULL };
+	struct cth_result *res = cth_exec_with_producer(argv, produce, &c, true, true, NULL);
+	print_result(res, &c);
+	cth_free_result(&res);
+}
+void t4(void)
+{
+	printf("\nTest 4: the producer fails after 1000 lines\n");
+	printf("  Expect: exit 0, stdout='1000', the input ends there\n");
+	struct cursor c = { 0, UINT64_MAX, 1000, 0, 0, 0 };
+	char *argv[] = { "wc", "-l", NULL };
+	struct cth_result *res = cth_exec_with_producer(argv, produce, &c, true, true, NULL);
+	print_result(res, &c);
+	cth_free_result(&res);
+}
+void t5(void)
+{
+	printf("\nTest 5: endless lines, non-blocking, freed while running\n");
+	printf("  Expect: the producer is stopped, the command gets EOF\n");
+	struct cursor c = { 0, UINT64_MAX, 0, 0, 0, 0 };
+	char *argv[] = { "wc", "-l", NULL };
+	struct cth_result *res = cth_exec_with_producer(argv, produce, &c, false, false, NULL);
+	usleep(100000);
+	cth_free_result(&res);
+	usleep(100000);
+	uint64_t lines = c.next;
+	usleep(100000);
+	printf("  Actual: %s\n", lines == c.next ? "stopped" : "still producing");
+}
+int main(void)
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	return 0;
+}
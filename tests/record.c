@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static void print_record(const struct cth_record *rec)
+{
+	printf("   ");
+	for (char **arg = rec->argv; *arg != NULL; arg++) {
+		printf(" %s", *arg);
+	}
+	printf(": exit %d, stdin %llu, stdout %llu, stderr %llu, flags %u, wall %llu us\n", rec->exit_code, (unsigned long long)rec->stdin_bytes, (unsigned long long)rec->stdout_bytes, (unsigned long long)rec->stderr_bytes, rec->flags,
+	       (unsigned long long)rec->wall_us);
+}
+int main(void)
+{
+	const char *path = "/tmp/catsh_record.log";
+	unlink(path);
+	printf("\nTest 1: cth_record_start() twice\n");
+	printf("  Expect: 0 then -1\n");
+	int first = cth_record_start(path);
+	int second = cth_record_start(path);
+	printf("  Actual: %d then %d\n", first, second);
+	// Blocking with input and output, without stdio, non-blocking, and a fanout.
+	char *cat[] = { "cat", NULL };
+	struct cth_result *res = cth_exec(cat, "hello\n", true, true);
+	cth_free_result(&res);
+	char *sh[] = { "sh", "-c", "echo err >&2; exit 3", NULL };
+	res = cth_exec(sh, NULL, true, false);
+	cth_free_result(&res);
+	char *seq[] = { "seq", "100", NULL };
+	res = cth_exec(seq, NULL, false, true);
+	while (res != NULL && cth_wait(&res) == -1) {
+		usleep(10000);
+	}
+	cth_free_result(&res);
+	int fds[2];
+	pipe(fds);
+	write(fds[1], "a\nb\n", 4);
+	close(fds[1]);
+	char **const cmds[] = { (char *[]){ "wc", "-l", NULL }, (char *[]){ "cat", NULL } };
+	struct cth_result *out[2] = { NULL, NULL };
+	cth_exec_fanout(cmds, 2, fds[0], true, NULL, out);
+	close(fds[0]);
+	cth_free_result(&out[0]);
+	cth_free_result(&out[1]);
+	cth_record_stop();
+	// Not recorded.
+	res = cth_exec(cat, "ignored\n", true, true);
+	cth_free_result(&res);
+	printf("\nTest 2: read back the log\n");
+	printf("  Expect: 5 records in order: cat (stdin 6, stdout 6, flags 3), sh (exit 3, flags 0), seq (stdout 292, flags 1),\n");
+	printf("          then wc -l and cat of the fanout in any order (stdin 4, flags 3)\n");
+	printf("  Actual:\n");
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct cth_record rec;
+	int count = 0;
+	int ret;
+	while ((ret = cth_record_next(fd, &rec)) == 1) {
+		print_record(&rec);
+		cth_free_record(&rec);
+		count++;
+	}
+	printf("  %d records, last ret = %d\n", count, ret);
+	close(fd);
+	printf("\nTest 3: a torn record at the end\n");
+	printf("  Expect: 4 records, then -1 with EBADMSG\n");
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	off_t len = lseek(fd, 0, SEEK_END);
+	ftruncate(fd, len - 3);
+	lseek(fd, 0, SEEK_SET);
+	count = 0;
+	while ((ret = cth_record_next(fd, &rec)) == 1) {
+		cth_free_record(&rec);
+		count++;
+	}
+	printf("  Actual: %d records, then %d with %s\n", count, ret, ret < 0 && errno == EBADMSG ? "EBADMSG" : strerror(errno));
+	close(fd);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static void run(int n, const char *cmdline, char *input, int flags, const char *expect)
+{
+	printf("\nTest %d: %s\n", n, cmdline);
+	if (input != NULL) {
+		printf("  Input: '%s'\n", input);
+	}
+	printf("  Expect: %s\n", expect);
+	struct cth_result *res = cth_run(cmdline, input, true, flags, NULL);
+	if (res == NULL) {
+		printf("  Actual: NULL, %s\n", strerror(errno));
+		return;
+	}
+	printf("  Actual: exit code = %d, stdout='%s', stderr='%s'\n", res->exit_code, res->stdout_ret, res->stderr_ret);
+	cth_free_result(&res);
+}
+int main(void)
+{
+	run(1, "echo hello world | tr a-z A-Z", NULL, 0, "exit 0, stdout='HELLO WORLD\\n'");
+	run(2, "printf '%s|%s|%s\\n' \"a b\" 'c\"d' e\\ f", NULL, 0, "exit 0, stdout='a b|c\"d|e f\\n'");
+	run(3, "echo one > /tmp/catsh_run_out && echo two >> /tmp/catsh_run_out && cat < /tmp/catsh_run_out", NULL, 0, "exit 0, stdout='one\\ntwo\\n'");
+	run(4, "ls /nonexistent 2>&1 | wc -l", NULL, 0, "exit 0, stdout='1\\n', stderr=''");
+	run(5, "ls /nonexistent 2>/dev/null || echo fallback && echo chained", NULL, 0, "exit 0, stdout='fallback\\nchained\\n'");
+	run(6, "false && echo no", NULL, 0, "exit 1, stdout=''");
+	run(7, "FOO=bar BAZ='x y' env | grep -E '^(FOO|BAZ)=' | sort", NULL, 0, "exit 0, stdout='BAZ=x y\\nFOO=bar\\n'");
+	run(8, "sort | head -n 2", "c\nb\na\n", 0, "exit 0, stdout='a\\nb\\n'");
+	run(9, "echo $((1 + 2))", NULL, 0, "exit 0, stdout='3\\n', through sh");
+	run(10, "echo $((1 + 2))", NULL, CTH_RUN_NO_SHELL, "NULL, operation not supported");
+	run(11, "cat < /nonexistent", NULL, 0, "exit 1, stderr='catsh: cannot open /nonexistent\\n'");
+	run(12, "yes | head -n 1", NULL, 0, "exit 0, stdout='y\\n'");
+	unlink("/tmp/catsh_run_out");
+	printf("\nPerformance Test: 500x 'head -c 1 /dev/zero | cat > /dev/null'\n");
+	double start = now_s();
+	for (int i = 0; i < 500; i++) {
+		struct cth_result *res = cth_run("head -c 1 /dev/zero | cat > /dev/null", NULL, false, 0, NULL);
+		cth_free_result(&res);
+	}
+	double run_s = now_s() - start;
+	char *argv[] = { "sh", "-c", "head -c 1 /dev/zero | cat > /dev/null", NULL };
+	start = now_s();
+	for (int i = 0; i < 500; i++) {
+		struct cth_result *res = cth_exec(argv, NULL, true, false);
+		cth_free_result(&res);
+	}
+	double sh_s = now_s() - start;
+	printf("  cth_run(): %.3f s, cth_exec() of sh -c: %.3f s\n", run_s, sh_s);
+	return 0;
+}
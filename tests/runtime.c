@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+int main()
+{
+	printf("\nTest 1: runtime context\n");
+	printf("  Expect: cth_init() = 0, cached limits and features\n");
+	printf("  Actual: cth_init() = %d\n", cth_init());
+	const struct cth_runtime *rt = cth_get_runtime();
+	printf("  pipe_max_size: %zu\n", rt->pipe_max_size);
+	printf("  arg_max: %ld\n", rt->arg_max);
+	printf("  page_size: %ld\n", rt->page_size);
+	printf("  nofile: %llu/%llu\n", (unsigned long long)rt->nofile_cur, (unsigned long long)rt->nofile_max);
+	printf("  pidfd: %s, clone3: %s, io_uring: %s, close_range: %s\n", rt->has_pidfd ? "yes" : "no", rt->has_clone3 ? "yes" : "no", rt->has_io_uring ? "yes" : "no", rt->has_close_range ? "yes" : "no");
+	printf("  devnull_fd: %d\n", rt->devnull_fd);
+	printf("\nTest 2: 1000x 'true' with input and output\n");
+	printf("  Expect: all exit 0\n");
+	struct timespec ts1, ts2;
+	int failed = 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	for (int i = 0; i < 1000; i++) {
+		struct cth_result *res = cth_exec((char *[]){ "true", NULL }, "input", true, true);
+		if (!CTH_EXEC_SUCCEED(res)) {
+			failed++;
+		}
+		cth_free_result(&res);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts2);
+	printf("  Actual: %d failed, %.6f seconds\n", failed, (ts2.tv_sec - ts1.tv_sec) + (ts2.tv_nsec - ts1.tv_nsec) / 1e9);
+	return 0;
+}
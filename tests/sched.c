@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static void show(const char *name, struct cth_result *res)
+{
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  %s: %s", name, res->stdout_ret ? res->stdout_ret : "(null)\n");
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+}
+void t1()
+{
+	printf("\nTest 1: CPU affinity\n");
+	printf("  Command: grep Cpus_allowed_list /proc/self/status\n");
+	printf("  Expect: Cpus_allowed_list: 0\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	attr->cpu_affinity = &set;
+	show("stdout", cth_exec_with_attr((char *[]){ "grep", "Cpus_allowed_list", "/proc/self/status", NULL }, NULL, true, true, attr));
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: nice, ioprio and SCHED_IDLE, non-blocking\n");
+	printf("  Command: sh -c 'nice; ionice; chrt -p $$'\n");
+	printf("  Expect: 10, idle, SCHED_IDLE\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->nice = 10;
+	attr->ioprio_class = CTH_IOPRIO_IDLE;
+	attr->sched_policy = SCHED_IDLE;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "nice; ionice; chrt -p $$", NULL }, NULL, false, true, attr);
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	show("stdout", res);
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: SCHED_BATCH and best-effort level 7, file input\n");
+	printf("  Command: sh -c 'cat >/dev/null; ionice; chrt -p $$'\n");
+	printf("  Expect: best-effort: prio 7, SCHED_BATCH\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->ioprio_class = CTH_IOPRIO_BE;
+	attr->ioprio_level = 7;
+	attr->sched_policy = SCHED_BATCH;
+	int fd = open("/proc/self/status", O_RDONLY);
+	show("stdout", cth_exec_with_file_input_attr((char *[]){ "sh", "-c", "cat >/dev/null; ionice; chrt -p $$", NULL }, fd, true, true, NULL, 0, attr));
+	close(fd);
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: NUMA bind to node 0\n");
+	printf("  Command: grep Mems_allowed_list /proc/self/status\n");
+	printf("  Expect: exit code 0, or 114 (CTH_EXIT_FAILURE) if NUMA is not supported by the kernel\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->numa_policy = CTH_MPOL_BIND;
+	attr->numa_nodes = 1;
+	show("stdout", cth_exec_with_attr((char *[]){ "grep", "Mems_allowed_list", "/proc/self/status", NULL }, NULL, true, true, attr));
+	cth_free_attr(&attr);
+}
+void t5()
+{
+	printf("\nTest 5: invalid affinity fails the exec\n");
+	printf("  Command: true\n");
+	printf("  Expect: exit code 114 (CTH_EXIT_FAILURE)\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	attr->cpu_affinity = &set;
+	show("stdout", cth_exec_with_attr((char *[]){ "true", NULL }, NULL, true, false, attr));
+	cth_free_attr(&attr);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	return 0;
+}
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#define INPUT_SIZE (64 * 1024 * 1024)
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static int make_input(const char *path)
+{
+	/*
+	 * Write INPUT_SIZE bytes of pseudo random text into path, and open it for reading.
+	 */
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		return -1;
+	}
+	uint64_t x = 88172645463325252ULL;
+	for (size_t i = 0; i < INPUT_SIZE; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		fputc((x % 64) == 0 ? '\n' : 'a' + (int)(x % 26), f);
+	}
+	fclose(f);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+static int pipe_of(const char *data)
+{
+	/*
+	 * A pipe with data in it, the write end is closed.
+	 */
+	int fds[2];
+	if (pipe(fds) < 0) {
+		return -1;
+	}
+	write(fds[1], data, strlen(data));
+	close(fds[1]);
+	return fds[0];
+}
+void t1(int fd)
+{
+	printf("\nTest 1: 64MB file to tr a-z A-Z, sharded and in one run\n");
+	printf("  Expect: the same output\n");
+	char *argv[] = { "tr", "a-z", "A-Z", NULL };
+	lseek(fd, 0, SEEK_SET);
+	double start = now_s();
+	struct cth_result *one = cth_exec_with_file_input(argv, fd, true, true, NULL, 0);
+	double one_s = now_s() - start;
+	lseek(fd, 0, SEEK_SET);
+	start = now_s();
+	struct cth_result *sharded = cth_exec_sharded(argv, fd, 0, 0, '\n', true, NULL, 0, NULL);
+	double sharded_s = now_s() - start;
+	if (one == NULL || sharded == NULL) {
+		printf("  Actual: failed\n");
+	} else {
+		bool same = one->stdout_total == sharded->stdout_total && memcmp(one->stdout_ret, sharded->stdout_ret, one->stdout_total) == 0;
+		printf("  Actual: exit code = %d, %llu bytes, same = %d\n", sharded->exit_code, (unsigned long long)sharded->stdout_total, same);
+		printf("  one run: %.3f s, sharded: %.3f s\n", one_s, sharded_s);
+	}
+	cth_free_result(&one);
+	cth_free_result(&sharded);
+}
+void t2(int fd)
+{
+	printf("\nTest 2: 64MB file to wc -l in 16MB chunks\n");
+	printf("  Expect: one count per chunk, the sum is the line count of the file\n");
+	char *argv[] = { "wc", "-l", NULL };
+	lseek(fd, 0, SEEK_SET);
+	struct cth_result *res = cth_exec_sharded(argv, fd, 4, 16 * 1024 * 1024, '\n', true, NULL, 0, NULL);
+	lseek(fd, 0, SEEK_SET);
+	struct cth_result *one = cth_exec_with_file_input(argv, fd, true, true, NULL, 0);
+	if (res == NULL || one == NULL) {
+		printf("  Actual: failed\n");
+	} else {
+		long sum = 0;
+		int chunks = 0;
+		for (char *p = res->stdout_ret; *p != '\0'; p = strchr(p, '\n') + 1) {
+			sum += strtol(p, NULL, 10);
+			chunks++;
+		}
+		printf("  Actual: %d chunks, sum = %ld, wc -l = %ld\n", chunks, sum, strtol(one->stdout_ret, NULL, 10));
+	}
+	cth_free_result(&res);
+	cth_free_result(&one);
+}
+void t3(void)
+{
+	printf("\nTest 3: pipe input 'one,two,three,four', delimiter ',', 1 byte chunks\n");
+	printf("  Command: sh -c 'cat; echo'\n");
+	printf("  Expect: stdout='one,\\ntwo,\\nthree,\\nfour\\n'\n");
+	char *argv[] = { "sh", "-c", "cat; echo", NULL };
+	int fd = pipe_of("one,two,three,four");
+	struct cth_result *res = cth_exec_sharded(argv, fd, 2, 1, ',', true, NULL, 0, NULL);
+	close(fd);
+	if (res == NULL) {
+		printf("  Actual: failed\n");
+		return;
+	}
+	printf("  Actual: exit code = %d, stdout:\n%s", res->exit_code, res->stdout_ret);
+	cth_free_result(&res);
+}
+void t4(void)
+{
+	printf("\nTest 4: records 1 to 6, the commands for 2 and 4 fail\n");
+	printf("  Expect: exit code = 2, the first failure in input order\n");
+	char *argv[] = { "sh", "-c", "read x; [ $x = 2 ] || [ $x = 4 ] && exit $x; exit 0", NULL };
+	int fd = pipe_of("1\n2\n3\n4\n5\n6\n");
+	struct cth_result *res = cth_exec_sharded(argv, fd, 3, 1, '\n', false, NULL, 0, NULL);
+	close(fd);
+	if (res == NULL) {
+		printf("  Actual: failed\n");
+		return;
+	}
+	printf("  Actual: exit code = %d\n", res->exit_code);
+	cth_free_result(&res);
+}
+void t5(void)
+{
+	printf("\nTest 5: empty input\n");
+	printf("  Expect: exit code = 0, stdout=''\n");
+	char *argv[] = { "cat", NULL };
+	int fd = pipe_of("");
+	struct cth_result *res = cth_exec_sharded(argv, fd, 0, 0, '\n', true, NULL, 0, NULL);
+	close(fd);
+	if (res == NULL) {
+		printf("  Actual: failed\n");
+		return;
+	}
+	printf("  Actual: exit code = %d, stdout='%s'\n", res->exit_code, res->stdout_ret);
+	cth_free_result(&res);
+}
+int main(void)
+{
+	const char *path = "/tmp/catsh_shard_input";
+	int fd = make_input(path);
+	if (fd < 0) {
+		perror("make_input");
+		return 1;
+	}
+	t1(fd);
+	t2(fd);
+	t3();
+	t4();
+	t5();
+	close(fd);
+	unlink(path);
+	return 0;
+}
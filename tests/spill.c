@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static void print_fd_target(int fd)
+{
+	char path[64];
+	char target[PATH_MAX] = { 0 };
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	if (readlink(path, target, sizeof(target) - 1) < 0) {
+		strcpy(target, "(none)");
+	}
+	printf("  fd target: %s\n", target);
+}
+void t1()
+{
+	printf("\nTest 1: 256MB output, unlimited, kept in fd\n");
+	printf("  Command: head -c 268435456 /dev/zero\n");
+	printf("  Expect: stdout_total=268435456, mapped 268435456 zero bytes\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_FD;
+	attr->max_output = CTH_OUTPUT_UNLIMITED;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "head", "-c", "268435456", "/dev/zero", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout_total: %llu, stdout_ret: %s\n", (unsigned long long)res->stdout_total, res->stdout_ret ? "set" : "(null)");
+		size_t len = 0;
+		char *map = cth_map_output(res, false, &len);
+		size_t nonzero = 0;
+		for (size_t i = 0; map != NULL && i < len; i++) {
+			nonzero += map[i] != 0;
+		}
+		printf("  mapped: %zu bytes, %zu non-zero\n", len, nonzero);
+		if (map != NULL) {
+			munmap(map, len);
+		}
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: small cap\n");
+	printf("  Command: sh -c 'for i in $(seq 1 500); do echo $i; done'\n");
+	printf("  Expect: exit != 0, stdout_total=1000, strlen(stdout)=1000\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->max_output = 1000;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "for i in $(seq 1 500); do echo $i; done", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout_total: %llu, strlen(stdout): %zu\n", (unsigned long long)res->stdout_total, res->stdout_ret ? strlen(res->stdout_ret) : 0);
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: spill to /tmp, capped, kept in fd\n");
+	printf("  Command: seq 1 100000\n");
+	printf("  Expect: exit 0, stdout_total=588895, mapped 100000 bytes, fd target in /tmp\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_FD;
+	attr->max_output = 100000;
+	attr->spill_dir = "/tmp";
+	attr->spill_threshold = 4096;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "seq", "1", "100000", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout_total: %llu\n", (unsigned long long)res->stdout_total);
+		print_fd_target(res->stdout_fd);
+		size_t len = 0;
+		char *map = cth_map_output(res, false, &len);
+		printf("  mapped: %zu bytes, starts with '%.6s'\n", len, map != NULL ? map : "");
+		if (map != NULL) {
+			munmap(map, len);
+		}
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: spill to /tmp, read back to heap\n");
+	printf("  Command: sh -c 'seq 1 100000; echo err >&2'\n");
+	printf("  Expect: exit 0, stdout_total=588895, strlen(stdout)=588895, stderr='err\\n'\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->spill_dir = "/tmp";
+	attr->spill_threshold = 1024;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "seq 1 100000; echo err >&2", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout_total: %llu, strlen(stdout): %zu\n", (unsigned long long)res->stdout_total, res->stdout_ret ? strlen(res->stdout_ret) : 0);
+		printf("  stderr: %s", res->stderr_ret ? res->stderr_ret : "(null)\n");
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t5()
+{
+	printf("\nTest 5: non-blocking, spill to /tmp, kept in fd\n");
+	printf("  Command: seq 1 100000\n");
+	printf("  Expect: exit 0, stdout_total=588895, mapped 588895 bytes, fd target in /tmp\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_FD;
+	attr->spill_dir = "/tmp";
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "seq", "1", "100000", NULL }, NULL, false, true, attr);
+	if (res == NULL) {
+		printf("  Actual: cth_exec_with_attr failed\n");
+		cth_free_attr(&attr);
+		return;
+	}
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	printf("  Actual: exit code = %d\n", res->exit_code);
+	printf("  stdout_total: %llu\n", (unsigned long long)res->stdout_total);
+	print_fd_target(res->stdout_fd);
+	size_t len = 0;
+	char *map = cth_map_output(res, false, &len);
+	printf("  mapped: %zu bytes\n", len);
+	if (map != NULL) {
+		munmap(map, len);
+	}
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	t5();
+	return 0;
+}
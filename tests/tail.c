@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+void t1()
+{
+	printf("\nTest 1: tail bytes\n");
+	printf("  Command: seq 1 100000\n");
+	printf("  Expect: stdout='99999\\n100000\\n', stdout_total=588895\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_TAIL;
+	attr->tail_bytes = 13;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "seq", "1", "100000", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout: %s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+		printf("  stdout_total: %llu\n", (unsigned long long)res->stdout_total);
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t2()
+{
+	printf("\nTest 2: tail lines\n");
+	printf("  Command: sh -c 'seq 1 1000; seq 1 5 >&2'\n");
+	printf("  Expect: stdout='998\\n999\\n1000\\n', stderr='3\\n4\\n5\\n'\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_TAIL;
+	attr->tail_lines = 3;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "sh", "-c", "seq 1 1000; seq 1 5 >&2", NULL }, NULL, true, true, attr);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout:\n%s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+		printf("  stderr:\n%s", res->stderr_ret ? res->stderr_ret : "(null)\n");
+		printf("  stdout_total: %llu, stderr_total: %llu\n", (unsigned long long)res->stdout_total, (unsigned long long)res->stderr_total);
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec_with_attr failed\n");
+	}
+	cth_free_attr(&attr);
+}
+void t3()
+{
+	printf("\nTest 3: tail lines, non-blocking, with input\n");
+	printf("  Command: cat\n");
+	printf("  Expect: stdout='c\\nd\\n', stdout_total=8\n");
+	struct cth_exec_attr *attr = cth_new_attr();
+	attr->capture_mode = CTH_CAPTURE_TAIL;
+	attr->tail_lines = 2;
+	struct cth_result *res = cth_exec_with_attr((char *[]){ "cat", NULL }, "a\nb\nc\nd\n", false, true, attr);
+	while (cth_wait(&res) < 0) {
+		usleep(1000);
+	}
+	printf("  Actual: exit code = %d\n", res->exit_code);
+	printf("  stdout:\n%s", res->stdout_ret ? res->stdout_ret : "(null)\n");
+	printf("  stdout_total: %llu\n", (unsigned long long)res->stdout_total);
+	cth_free_result(&res);
+	cth_free_attr(&attr);
+}
+void t4()
+{
+	printf("\nTest 4: full capture reports output size\n");
+	printf("  Command: seq 1 100000\n");
+	printf("  Expect: stdout_total=588895, strlen(stdout)=588895\n");
+	struct cth_result *res = cth_exec((char *[]){ "seq", "1", "100000", NULL }, NULL, true, true);
+	if (res) {
+		printf("  Actual: exit code = %d\n", res->exit_code);
+		printf("  stdout_total: %llu, strlen(stdout): %zu\n", (unsigned long long)res->stdout_total, res->stdout_ret ? strlen(res->stdout_ret) : 0);
+		cth_free_result(&res);
+	} else {
+		printf("  Actual: cth_exec failed\n");
+	}
+}
+int main()
+{
+	t1();
+	t2();
+	t3();
+	t4();
+	return 0;
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+static size_t count(const char *text, const char *needle)
+{
+	size_t n = 0;
+	for (const char *p = strstr(text, needle); p != NULL; p = strstr(p + 1, needle)) {
+		n++;
+	}
+	return n;
+}
+int main(void)
+{
+	printf("\nTest 1: cth_trace_dump() before cth_trace_enable()\n");
+	printf("  Expect: -1\n");
+	printf("  Actual: %d\n", cth_trace_dump(STDOUT_FILENO));
+	cth_trace_enable(0);
+	// Blocking, with input and output.
+	char *cat[] = { "cat", NULL };
+	struct cth_result *res = cth_exec(cat, "hello\n", true, true);
+	cth_free_result(&res);
+	// 4 non-blocking commands in parallel, traced by their runners.
+	char *sleep_argv[] = { "sleep", "0.1", NULL };
+	struct cth_result *jobs[4];
+	for (int i = 0; i < 4; i++) {
+		jobs[i] = cth_exec(sleep_argv, NULL, false, false);
+	}
+	for (int i = 0; i < 4; i++) {
+		while (jobs[i] != NULL && cth_wait(&jobs[i]) == -1) {
+			usleep(10000);
+		}
+		cth_free_result(&jobs[i]);
+	}
+	// A pipeline, and a command without stdio.
+	res = cth_run("seq 1000 | wc -l", NULL, true, 0, NULL);
+	cth_free_result(&res);
+	char *true_argv[] = { "true", NULL };
+	res = cth_exec(true_argv, NULL, true, false);
+	cth_free_result(&res);
+	const char *path = "/tmp/catsh_trace.json";
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	int ret = cth_trace_dump(fd);
+	off_t len = lseek(fd, 0, SEEK_END);
+	char *text = calloc(1, (size_t)len + 1);
+	pread(fd, text, (size_t)len, 0);
+	close(fd);
+	printf("\nTest 2: trace of cat with input, 4x sleep in parallel, seq | wc -l, and true\n");
+	printf("  Expect: ret = 0, 8 commands, 8 spawn, running and reaped, stdin and drain only for cat, the pipeline is wired directly\n");
+	printf("  Actual: ret = %d, %zu commands, spawn %zu, stdin %zu, running %zu, drain %zu, reaped %zu\n", ret, count(text, "\"thread_name\""), count(text, "\"name\":\"spawn\""), count(text, "\"name\":\"stdin\""), count(text, "\"name\":\"running\""), count(text, "\"name\":\"drain\""), count(text, "\"name\":\"reaped\""));
+	char *first = strstr(text, "\"name\":\"stdin\"");
+	char *end = first != NULL ? strchr(first, '\n') : NULL;
+	if (end != NULL) {
+		*end = '\0';
+		printf("  %s\n", first - 1);
+	}
+	printf("  Written to %s, open it in https://ui.perfetto.dev\n", path);
+	free(text);
+	return 0;
+}
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+/*
+ *
+ * This file is part of catsh, with ABSOLUTELY NO WARRANTY.
+ *
+ * MIT License
+ *
+ * Copyright (c) 2025 Moe-hacker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+#include "../src/include/catsh.h"
+#include <pthread.h>
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+static int subcommand(int argc, char **argv)
+{
+	/*
+	 * The subcommands run by cth_fork_rexec_self().
+	 */
+	if (argc < 2) {
+		// No arguments at all.
+		return 100;
+	}
+	if (strcmp(argv[1], "exit") == 0 && argc > 2) {
+		return atoi(argv[2]);
+	}
+	if (strcmp(argv[1], "echo") == 0) {
+		for (int i = 2; i < argc; i++) {
+			printf("%s%s", argv[i], i + 1 < argc ? " " : "\n");
+		}
+		return 0;
+	}
+	if (strcmp(argv[1], "pwd") == 0) {
+		char cwd[PATH_MAX];
+		printf("%s\n", getcwd(cwd, sizeof(cwd)));
+		return 0;
+	}
+	return 127;
+}
+static double rexec_many(int count)
+{
+	double start = now();
+	for (int i = 0; i < count; i++) {
+		cth_fork_rexec_self((char *[]){ "exit", "0", NULL });
+	}
+	return (now() - start) / count;
+}
+static void *worker(void *arg)
+{
+	char code[16];
+	sprintf(code, "%d", (int)(intptr_t)arg);
+	intptr_t ret = cth_fork_rexec_self((char *[]){ "exit", code, NULL });
+	return (void *)ret;
+}
+int main(int argc, char **argv)
+{
+	// Pretend a slow startup, e.g. loading the config.
+	usleep(20000);
+	if (cth_zygote_serve(&argc, &argv) || argc > 1) {
+		return subcommand(argc, argv);
+	}
+	printf("\nTest 1: fork and exec without zygote\n");
+	printf("  Command: exit 7, and 20x exit 0\n");
+	printf("  Expect: 7, 20ms+ per call\n");
+	fflush(stdout);
+	printf("  Actual: %d, %.3f ms per call\n", cth_fork_rexec_self((char *[]){ "exit", "7", NULL }), rexec_many(20) * 1000);
+	printf("\nTest 2: with zygote\n");
+	printf("  Command: exit 7, and 200x exit 0\n");
+	printf("  Expect: started, 7, much less than 20ms per call\n");
+	printf("  Actual: start = %d", cth_zygote_start());
+	fflush(stdout);
+	printf(", %d, %.3f ms per call\n", cth_fork_rexec_self((char *[]){ "exit", "7", NULL }), rexec_many(200) * 1000);
+	printf("\nTest 3: stdio and cwd of the caller\n");
+	printf("  Command: echo hello zygote, pwd in /tmp\n");
+	printf("  Expect: hello zygote, /tmp\n");
+	printf("  Actual:\n");
+	fflush(stdout);
+	cth_fork_rexec_self((char *[]){ "echo", "hello", "zygote", NULL });
+	char cwd[PATH_MAX];
+	getcwd(cwd, sizeof(cwd));
+	chdir("/tmp");
+	cth_fork_rexec_self((char *[]){ "pwd", NULL });
+	chdir(cwd);
+	printf("\nTest 4: 8 concurrent requests\n");
+	printf("  Command: exit i from 8 threads\n");
+	printf("  Expect: 0 1 2 3 4 5 6 7\n");
+	pthread_t threads[8];
+	for (intptr_t i = 0; i < 8; i++) {
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	}
+	printf("  Actual:");
+	for (int i = 0; i < 8; i++) {
+		void *ret;
+		pthread_join(threads[i], &ret);
+		printf(" %d", (int)(intptr_t)ret);
+	}
+	printf("\n");
+	printf("\nTest 5: no arguments, and one empty argument\n");
+	printf("  Command: (nothing), \"\"\n");
+	printf("  Expect: 100 127\n");
+	fflush(stdout);
+	printf("  Actual: %d", cth_fork_rexec_self((char *[]){ NULL }));
+	printf(" %d\n", cth_fork_rexec_self((char *[]){ "", NULL }));
+	printf("\nTest 6: stop\n");
+	printf("  Command: exit 3 after cth_zygote_stop()\n");
+	printf("  Expect: 3, through fork and exec again\n");
+	cth_zygote_stop();
+	fflush(stdout);
+	printf("  Actual: %d\n", cth_fork_rexec_self((char *[]){ "exit", "3", NULL }));
+	return 0;
+}